@@ -0,0 +1,213 @@
+/*
+  	AWSClock.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <time.h>
+
+#include "AWSClock.h"
+
+RTC_DATA_ATTR bool	clock_was_synced = false;	// NOSONAR
+
+namespace {
+
+	// SNTP only accepts a plain function as callback
+	AWSClock	*ntp_clock = nullptr;
+
+	int64_t timeval_to_us( const struct timeval &tv )
+	{
+		return static_cast<int64_t>( tv.tv_sec ) * 1000000LL + tv.tv_usec;
+	}
+}
+
+clock_stats_t AWSClock::get_stats( void )
+{
+	clock_stats_t s;
+
+	taskENTER_CRITICAL( &stats_mux );
+	s = stats;
+	taskEXIT_CRITICAL( &stats_mux );
+	return s;
+}
+
+uint64_t AWSClock::get_sync_age_us( void )
+{
+	uint64_t last = get_stats().last_sync_us;
+
+	return last ? monotonic_us() - last : UINT64_MAX;
+}
+
+bool AWSClock::initialise( const char *tzname, const char *server, bool _debug_mode )
+{
+	debug_mode = _debug_mode;
+	ntp_server = server;
+	ntp_clock = this;
+
+	// The RTC timer keeps running through deep sleep, so a time set before sleeping is still good
+	if ( clock_was_synced )
+		stats.source = clock_source_t::RTC;
+
+	sntp_set_time_sync_notification_cb( ntp_sync_callback );
+	sntp_set_sync_mode( SNTP_SYNC_MODE_SMOOTH );
+	sntp_set_sync_interval( NTP_POLL_INTERVAL );
+
+	// Does not wait for an answer, SNTP runs in the background from now on
+	configTzTime( tzname, ntp_server );
+	ntp_running = true;
+
+	if ( debug_mode )
+		Serial.printf( "[CLOCK     ] [DEBUG] SNTP started with %s, polling every %ds.\n", ntp_server, NTP_POLL_INTERVAL / 1000 );
+
+	return true;
+}
+
+bool AWSClock::is_synced( void )
+{
+	return ( stats.source != clock_source_t::NONE );
+}
+
+// Falls back to SNTP when the GPS has not delivered a sample for a while
+void AWSClock::maintain( void )
+{
+	if ( ntp_running || ( stats.source != clock_source_t::GPS ))
+		return;
+
+	if ( get_sync_age_us() > GPS_TIMEOUT ) {
+
+		Serial.printf( "[CLOCK     ] [INFO ] GPS time lost, falling back to NTP.\n" );
+		start_ntp();
+	}
+}
+
+uint64_t AWSClock::monotonic_us( void )
+{
+	return static_cast<uint64_t>( esp_timer_get_time() );
+}
+
+// Called by the SNTP task, the time is already being slewed by the time we get here
+void AWSClock::ntp_sync_callback( struct timeval *tv )
+{
+	struct timeval now;
+
+	if ( !ntp_clock )
+		return;
+
+	gettimeofday( &now, nullptr );
+	ntp_clock->record_offset( clock_source_t::NTP, timeval_to_us( *tv ) - timeval_to_us( now ));
+
+	if ( ntp_clock->debug_mode ) {
+
+		clock_stats_t s = ntp_clock->get_stats();
+		Serial.printf( "[CLOCK     ] [DEBUG] NTP sync: offset=%lldus jitter=%.0fus\n", s.last_offset_us, s.jitter_us );
+	}
+}
+
+void AWSClock::record_offset( clock_source_t source, int64_t offset_us )
+{
+	struct timeval now;
+
+	gettimeofday( &now, nullptr );
+	taskENTER_CRITICAL( &stats_mux );
+
+	if ( stats.source == source ) {
+
+		float delta = static_cast<float>( offset_us - stats.last_offset_us );
+		stats.jitter_us = sqrtf( ( 1.F - JITTER_WEIGHT ) * stats.jitter_us * stats.jitter_us + JITTER_WEIGHT * delta * delta );
+	}
+
+	stats.source = source;
+	stats.last_offset_us = offset_us;
+	stats.last_sync_us = monotonic_us();
+	if ( source == clock_source_t::NTP ) {
+
+		stats.ntp_syncs++;
+		stats.last_ntp_time = now;
+
+	} else
+		stats.gps_samples++;
+
+	taskEXIT_CRITICAL( &stats_mux );
+
+	clock_was_synced = true;
+}
+
+// Solar panel wake up without network: the time kept by the RTC timer through deep sleep is all we have
+void AWSClock::restore( const char *tzname, bool _debug_mode )
+{
+	debug_mode = _debug_mode;
+
+	setenv( "TZ", tzname, 1 );
+	tzset();
+
+	if ( clock_was_synced )
+		stats.source = clock_source_t::RTC;
+}
+
+// rx_us is the monotonic time at which the GPS message started to arrive
+void AWSClock::set_gps_time( const struct timeval &gps_time, uint64_t rx_us )
+{
+	struct timeval	now;
+	struct timeval	delta;
+	int64_t			offset_us;
+
+	gettimeofday( &now, nullptr );
+	offset_us = timeval_to_us( gps_time ) - ( timeval_to_us( now ) - static_cast<int64_t>( monotonic_us() - rx_us ));
+
+	if ( ntp_running ) {
+
+		stop_ntp();
+		Serial.printf( "[CLOCK     ] [INFO ] Using GPS time, NTP stopped.\n" );
+	}
+
+	record_offset( clock_source_t::GPS, offset_us );
+
+	if ( llabs( offset_us ) < GPS_SLEW_THRESHOLD )
+		return;
+
+	if ( llabs( offset_us ) > MAX_SLEW ) {
+
+		int64_t target = timeval_to_us( now ) + offset_us;
+
+		now.tv_sec = target / 1000000LL;
+		now.tv_usec = target % 1000000LL;
+		settimeofday( &now, nullptr );
+
+		taskENTER_CRITICAL( &stats_mux );
+		stats.gps_steps++;
+		taskEXIT_CRITICAL( &stats_mux );
+		return;
+	}
+
+	delta.tv_sec = offset_us / 1000000LL;
+	delta.tv_usec = offset_us % 1000000LL;
+	adjtime( &delta, nullptr );
+}
+
+void AWSClock::start_ntp( void )
+{
+	sntp_init();
+	ntp_running = true;
+}
+
+void AWSClock::stop_ntp( void )
+{
+	sntp_stop();
+	ntp_running = false;
+}
@@ -0,0 +1,85 @@
+/*
+  	AWSClock.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _AWSClock_H
+#define _AWSClock_H
+
+#include <sys/time.h>
+
+enum struct clock_source_t : uint8_t {
+
+	NONE,
+	RTC,		// Synchronised before deep sleep, kept by the RTC timer since
+	NTP,
+	GPS
+};
+
+struct clock_stats_t {
+
+	clock_source_t	source;
+	uint32_t		ntp_syncs;
+	uint32_t		gps_samples;
+	uint32_t		gps_steps;
+	int64_t			last_offset_us;		// Reference minus system time, before correction
+	float			jitter_us;			// RMS of successive offset differences
+	uint64_t		last_sync_us;		// Monotonic time of the last correction
+	struct timeval	last_ntp_time;
+};
+
+// Owns the system time: SNTP polls in the background and slews the clock, a GPS with a fix
+// takes over as the better reference and SNTP is stopped until the GPS goes quiet.
+// Nothing in here ever waits for a time source.
+class AWSClock {
+
+	public:
+
+								AWSClock( void ) = default;
+		clock_stats_t			get_stats( void );
+		uint64_t				get_sync_age_us( void );
+		bool					initialise( const char *, const char *, bool );
+		bool					is_synced( void );
+		void					maintain( void );
+		void					restore( const char *, bool );
+		void					set_gps_time( const struct timeval &, uint64_t );
+
+		static uint64_t			monotonic_us( void );
+
+	private:
+
+		static constexpr uint32_t	NTP_POLL_INTERVAL		= 15 * 60 * 1000;	// ms
+		static constexpr uint64_t	GPS_TIMEOUT				= 120000000;		// us without a GPS sample before falling back to NTP
+		static constexpr int64_t	GPS_SLEW_THRESHOLD		= 5000;				// us, smaller offsets are reception noise
+		static constexpr int64_t	MAX_SLEW				= 500000;			// us, larger offsets are stepped
+		static constexpr float		JITTER_WEIGHT			= 0.125F;
+
+		bool					debug_mode				= false;
+		bool					ntp_running				= false;
+		const char				*ntp_server				= nullptr;
+		portMUX_TYPE			stats_mux				= portMUX_INITIALIZER_UNLOCKED;
+		clock_stats_t			stats					= {};
+
+		void					record_offset( clock_source_t, int64_t );
+		void					start_ntp( void );
+		void					stop_ntp( void );
+
+		static void				ntp_sync_callback( struct timeval * );
+};
+
+#endif
@@ -23,81 +23,374 @@
 #include "AWSGPS.h"
 
 const unsigned long	GPS_SPEED = 9600;
+const uint32_t		GPS_CHAR_US = 10000000UL / GPS_SPEED;		// 8N1
+const uint32_t		GPS_POLL_INTERVAL = 5000;		// ms
+const uint32_t		GPS_DRAIN_INTERVAL = 100;		// ms, the bridge buffers ~200ms worth of data at GPS_SPEED
+
+// NMEA sentences sent by default by u-blox receivers, TinyGPS++ only needs GGA and RMC
+const std::array<uint8_t,6>	UBX_NMEA_GGA_GLL_GSA_GSV_RMC_VTG = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05 };
+
+namespace {
+
+	inline uint16_t ubx_u2( const uint8_t *p )
+	{
+		return p[0] | ( p[1] << 8 );
+	}
+
+	inline uint32_t ubx_u4( const uint8_t *p )
+	{
+		return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( static_cast<uint32_t>( p[3] ) << 24 );
+	}
+
+	// The bridge keeps the low 32 bits of the monotonic clock, bytes are never that old
+	inline uint64_t bridge_rx_us( uint64_t now, uint32_t rx_us )
+	{
+		return now - static_cast<uint32_t>( static_cast<uint32_t>( now ) - rx_us );
+	}
+
+	// UTC calendar date to epoch, does not depend on the TZ setting unlike mktime()
+	time_t utc_to_time_t( int year, unsigned month, unsigned day, unsigned hour, unsigned minute, unsigned second )
+	{
+		year -= ( month <= 2 );
+		const int		era = ( year >= 0 ? year : year - 399 ) / 400;
+		const unsigned	yoe = static_cast<unsigned>( year - era * 400 );
+		const unsigned	doy = ( 153 * ( month + ( month > 2 ? -3 : 9 )) + 2 ) / 5 + day - 1;
+		const unsigned	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+		return static_cast<time_t>( era * 146097 + static_cast<int>( doe ) - 719468 ) * 86400 + hour * 3600 + minute * 60 + second;
+	}
+}
 
 AWSGPS::AWSGPS( void )
 {
 	set_name( "GPS Receiver" );
 	set_description( "" );
-	set_driver_version( "1.0" );
+	set_driver_version( "1.1" );
 }
 
-void AWSGPS::read_GPS( void )
+// Asks for UBX-NAV-PVT and silences NMEA. Receivers that do not know NAV-PVT (u-blox 6 and older)
+// are left with GGA and RMC only, for TinyGPS++.
+void AWSGPS::configure_ublox( void )
+{
+	ubx_mode = set_message_rate( UBX_CLASS_NAV, UBX_NAV_PVT, 1 );
+
+	if ( ubx_ack == ubx_ack_t::NONE ) {
+
+		Serial.printf( "[GPS       ] [ERROR] Receiver does not answer UBX commands, keeping its default configuration.\n" );
+		return;
+	}
+
+	for ( uint8_t id : UBX_NMEA_GGA_GLL_GSA_GSV_RMC_VTG ) {
+
+		if ( !ubx_mode && (( id == 0x00 ) || ( id == 0x04 )))
+			continue;
+		set_message_rate( UBX_CLASS_NMEA, id, 0 );
+	}
+
+	Serial.printf( "[GPS       ] [INFO ] Receiver %s UBX-NAV-PVT.\n", ubx_mode ? "sends" : "does not support" );
+}
+
+// Interrupt driven bridge: bytes are pushed by its receive task as they arrive, so we parse all of them
+// instead of sampling one second out of five. Never waits, the job is scheduled often enough.
+void AWSGPS::drain_GPS_from_bridge( void )
+{
+	std::array<uint8_t,SC16IS750_FIFO_SIZE>	buf;
+	std::array<uint32_t,SC16IS750_FIFO_SIZE>	rx_us;
+	uint8_t									n;
+	uint64_t								now;
+
+	while (( n = sc16is750->read_bytes( buf.data(), buf.size(), rx_us.data() ))) {
+
+		now = AWSClock::monotonic_us();
+		for ( uint8_t i = 0; i < n; i++ )
+			feed_byte( buf[ i ], bridge_rx_us( now, rx_us[ i ] ));
+	}
+
+	if (( millis() - last_update ) >= GPS_POLL_INTERVAL ) {
+
+		update_data();
+		last_update = millis();
+	}
+}
+
+// NMEA and UBX are interleaved on the same port, NMEA is plain ASCII so UBX_SYNC_1 can only start a UBX frame.
+// rx_us is the monotonic time at which the byte was received, that of the first sync byte dates the whole frame
+void AWSGPS::feed_byte( uint8_t c, uint64_t rx_us )
+{
+	switch( ubx_state ) {
+
+		case ubx_parser_state_t::IDLE:
+			if ( c == UBX_SYNC_1 ) {
+
+				ubx_state = ubx_parser_state_t::SYNC_2;
+				ubx_frame_us = rx_us;
+
+			} else
+				gps.encode( c );
+			break;
+
+		case ubx_parser_state_t::SYNC_2:
+			ubx_state = ( c == UBX_SYNC_2 ) ? ubx_parser_state_t::CLASS : ubx_parser_state_t::IDLE;
+			ubx_ck_a = ubx_ck_b = 0;
+			break;
+
+		case ubx_parser_state_t::CLASS:
+			ubx_class = c;
+			ubx_ck_a += c;
+			ubx_ck_b += ubx_ck_a;
+			ubx_state = ubx_parser_state_t::ID;
+			break;
+
+		case ubx_parser_state_t::ID:
+			ubx_id = c;
+			ubx_ck_a += c;
+			ubx_ck_b += ubx_ck_a;
+			ubx_state = ubx_parser_state_t::LENGTH_1;
+			break;
+
+		case ubx_parser_state_t::LENGTH_1:
+			ubx_length = c;
+			ubx_ck_a += c;
+			ubx_ck_b += ubx_ck_a;
+			ubx_state = ubx_parser_state_t::LENGTH_2;
+			break;
+
+		case ubx_parser_state_t::LENGTH_2:
+			ubx_length |= ( c << 8 );
+			ubx_ck_a += c;
+			ubx_ck_b += ubx_ck_a;
+			ubx_index = 0;
+			if ( ubx_length > ubx_payload.size() )
+				ubx_state = ubx_parser_state_t::IDLE;
+			else
+				ubx_state = ubx_length ? ubx_parser_state_t::PAYLOAD : ubx_parser_state_t::CK_A;
+			break;
+
+		case ubx_parser_state_t::PAYLOAD:
+			ubx_payload[ ubx_index++ ] = c;
+			ubx_ck_a += c;
+			ubx_ck_b += ubx_ck_a;
+			if ( ubx_index == ubx_length )
+				ubx_state = ubx_parser_state_t::CK_A;
+			break;
+
+		case ubx_parser_state_t::CK_A:
+			ubx_state = ( c == ubx_ck_a ) ? ubx_parser_state_t::CK_B : ubx_parser_state_t::IDLE;
+			break;
+
+		case ubx_parser_state_t::CK_B:
+			if ( c == ubx_ck_b )
+				handle_ubx_frame();
+			ubx_state = ubx_parser_state_t::IDLE;
+			break;
+	}
+}
+
+// Fields are decoded in place from the payload buffer, see u-blox M8 protocol specification, UBX-NAV-PVT
+void AWSGPS::handle_nav_pvt( const uint8_t *pvt )
+{
+	const uint8_t	valid = pvt[11];
+	const int32_t	nano = static_cast<int32_t>( ubx_u4( pvt + 16 ));
+	const uint8_t	fix_type = pvt[20];
+	const uint8_t	flags = pvt[21];
+
+	gps_data->fix = ( flags & 0x01 ) && ( fix_type >= 2 ) && ( fix_type <= 4 );
+
+	if ( gps_data->fix ) {
+
+		gps_data->longitude = static_cast<int32_t>( ubx_u4( pvt + 24 )) * 1e-7F;
+		gps_data->latitude = static_cast<int32_t>( ubx_u4( pvt + 28 )) * 1e-7F;
+		gps_data->altitude = static_cast<int32_t>( ubx_u4( pvt + 36 )) / 1000.F;
+
+	} else {
+
+		gps_data->longitude = 0.F;
+		gps_data->latitude = 0.F;
+		gps_data->altitude = 0.F;
+	}
+
+	// validDate + validTime
+	if (( valid & 0x03 ) != 0x03 )
+		return;
+
+	gps_data->time.tv_sec = utc_to_time_t( ubx_u2( pvt + 4 ), pvt[6], pvt[7], pvt[8], pvt[9], pvt[10] );
+	gps_data->time.tv_usec = nano / 1000;
+	if ( gps_data->time.tv_usec < 0 ) {
+
+		gps_data->time.tv_sec--;
+		gps_data->time.tv_usec += 1000000;
+	}
+
+	if ( aws_clock && gps_data->fix )
+		aws_clock->set_gps_time( gps_data->time, ubx_frame_us );
+}
+
+void AWSGPS::handle_ubx_frame( void )
+{
+	switch( ubx_class ) {
+
+		case UBX_CLASS_NAV:
+			if (( ubx_id == UBX_NAV_PVT ) && ( ubx_length == UBX_NAV_PVT_LENGTH ))
+				handle_nav_pvt( ubx_payload.data() );
+			break;
+
+		// A late answer to an earlier command must not be taken for the answer to the current one
+		case UBX_CLASS_ACK:
+			if (( ubx_length == 2 ) && ( ubx_payload[0] == ubx_ack_class ) && ( ubx_payload[1] == ubx_ack_id ))
+				ubx_ack = ( ubx_id == UBX_ACK_ACK ) ? ubx_ack_t::ACK : ubx_ack_t::NAK;
+			break;
+
+		default:
+			break;
+	}
+}
+
+void AWSGPS::poll_GPS( uint32_t duration_ms )
 {
 	unsigned long _start = millis();
 
-	if ( sc16is750 ) {
+	do {
 
-		do {
-			while( sc16is750->available() )
+		if ( sc16is750 ) {
+
+			uint8_t		b;
+			uint32_t	rx_us;
+
+			while( sc16is750->read_bytes( &b, 1, &rx_us ))
+				feed_byte( b, bridge_rx_us( AWSClock::monotonic_us(), rx_us ));
+
+		} else {
+
+			while( gps_serial->available() )
 				// flawfinder: ignore
-				gps.encode( sc16is750->read() );
-			delay( 5 );
-		} while( ( millis() - _start ) < 1000 );
+				feed_byte( gps_serial->read(), serial_rx_us() );
+		}
 
-	} else {
+		if ( ubx_ack != ubx_ack_t::NONE )
+			return;
+
+		delay( 5 );
+
+	} while( ( millis() - _start ) < duration_ms );
+}
+
+// Time at which the byte just read from the UART was received: the ones still waiting came after it
+uint64_t AWSGPS::serial_rx_us( void )
+{
+	return AWSClock::monotonic_us() - gps_serial->available() * GPS_CHAR_US;
+}
+
+void AWSGPS::send_ubx( uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t len )
+{
+	std::array<uint8_t,6>	header = { UBX_SYNC_1, UBX_SYNC_2, msg_class, msg_id, static_cast<uint8_t>( len & 0xff ), static_cast<uint8_t>( len >> 8 ) };
+	uint8_t					ck_a = 0;
+	uint8_t					ck_b = 0;
+
+	for ( uint8_t i = 2; i < header.size(); i++ ) {
+
+		ck_a += header[ i ];
+		ck_b += ck_a;
+	}
+	for ( uint16_t i = 0; i < len; i++ ) {
+
+		ck_a += payload[ i ];
+		ck_b += ck_a;
+	}
+
+	for ( const auto &b : header )
+		sc16is750 ? sc16is750->write( b ) : gps_serial->write( b );
+	for ( uint16_t i = 0; i < len; i++ )
+		sc16is750 ? sc16is750->write( payload[ i ] ) : gps_serial->write( payload[ i ] );
+	sc16is750 ? sc16is750->write( ck_a ) : gps_serial->write( ck_a );
+	sc16is750 ? sc16is750->write( ck_b ) : gps_serial->write( ck_b );
+}
+
+// UBX-CFG-MSG on the current port, true if the receiver acknowledged
+bool AWSGPS::set_message_rate( uint8_t msg_class, uint8_t msg_id, uint8_t rate )
+{
+	std::array<uint8_t,3> payload = { msg_class, msg_id, rate };
+
+	ubx_ack = ubx_ack_t::NONE;
+	ubx_ack_class = UBX_CLASS_CFG;
+	ubx_ack_id = UBX_CFG_MSG;
+	send_ubx( UBX_CLASS_CFG, UBX_CFG_MSG, payload.data(), payload.size() );
+	poll_GPS( 1000 );
+
+	return ( ubx_ack == ubx_ack_t::ACK );
+}
+
+void AWSGPS::read_GPS( void )
+{
+	unsigned long _start = millis();
+
+	if ( sc16is750 )
+
+		read_GPS_from_bridge();
+
+	else {
 
 		do {
 			while( gps_serial->available() )
 				// flawfinder: ignore
-				gps.encode( gps_serial->read() );
+				feed_byte( gps_serial->read(), serial_rx_us() );
 			delay( 5 );
 		} while( ( millis() - _start ) < 1000 );
 	}
 }
 
-void AWSGPS::feed( void *dummy )	// NOSONAR
+// The I2C mutex is only held while the bridge's RX FIFO is drained in bursts, NMEA parsing is done outside of it.
+// At 9600bps the 64 bytes FIFO fills in ~67ms, so draining every 20ms loses nothing.
+void AWSGPS::read_GPS_from_bridge( void )
 {
-	while( true ) {
+	std::array<uint8_t,SC16IS750_FIFO_SIZE>	buf;
+	std::array<uint32_t,SC16IS750_FIFO_SIZE>	rx_us;
+	uint8_t									n;
+	uint64_t								now;
+	unsigned long							_start = millis();
+	uint32_t								t0;
+	uint32_t								hold;
+	sc16is750_stats_t						stats = sc16is750->get_stats();
 
-		if ( sc16is750 ) {
+	i2c_hold_us = 0;
 
-			if ( xSemaphoreTake( i2c_mutex, 500 / portTICK_PERIOD_MS ) == pdTRUE ) {
+	do {
 
-				read_GPS();
-				xSemaphoreGive( i2c_mutex );
+		if ( xSemaphoreTake( i2c_mutex, 500 / portTICK_PERIOD_MS ) != pdTRUE )
+			return;
 
-			} else
-				delay( 5000 );
+		t0 = micros();
+		n = sc16is750->read_bytes( buf.data(), buf.size(), rx_us.data() );
+		hold = micros() - t0;
+		xSemaphoreGive( i2c_mutex );
 
-		} else
-			read_GPS();
+		i2c_hold_us += hold;
+		if ( hold > i2c_hold_max_us )
+			i2c_hold_max_us = hold;
 
-		update_data();
-		delay( 5000 );
-	}
-}
+		now = AWSClock::monotonic_us();
+		for ( uint8_t i = 0; i < n; i++ )
+			feed_byte( buf[ i ], bridge_rx_us( now, rx_us[ i ] ));
 
-void AWSGPS::get_ublox_model( void )
-{
-    std::array<byte,10> ubx_nav_svinfo = { 0xB5, 0x62, 0x06, 0x30, 0x01, 0x00, 0x37, 0xE1, 0x74, 0x55 };
+		delay( 20 );
 
-	for( const auto &b : ubx_nav_svinfo )
-		gps_serial->write( b );
+	} while( ( millis() - _start ) < 1000 );
 
-	delay( 1000 );
+	if ( get_debug_mode() ) {
 
-	for( int i = 0; i < 10; i++)
-		while( gps_serial->available() ) {
-			char c = gps_serial->read();
-//			Serial.printf( "%c(%02x)", c, c );
-		}
-	return;
+		sc16is750_stats_t now = sc16is750->get_stats();
+		uint32_t bytes = now.bytes - stats.bytes;
+		uint32_t transactions = now.transactions - stats.transactions;
+
+		Serial.printf( "[GPS       ] [DEBUG] Read %d bytes in %d I2C transactions (%.1f bytes/transaction), i2c_mutex held %dus (max %dus), %d bytes overflowed.\n",
+			bytes, transactions, transactions ? static_cast<float>( bytes ) / transactions : 0.F, i2c_hold_us, i2c_hold_max_us, now.overflows - stats.overflows );
+	}
 }
 
 void AWSGPS::update_data( void )
 {
-	struct tm gpstime = {0};
-	time_t now;
+	// Already done by handle_nav_pvt()
+	if ( ubx_mode )
+		return;
 
 	gps_data->fix = gps.location.isValid();
 
@@ -106,27 +399,20 @@ void AWSGPS::update_data( void )
 		gps_data->longitude = gps.location.lng();
 		gps_data->latitude = gps.location.lat();
 		gps_data->altitude = gps.altitude.meters();
-		gpstime.tm_year = 	gps.date.year() - 1900;
-		gpstime.tm_mon = gps.date.month() - 1;
-		gpstime.tm_mday = gps.date.day();
-		gpstime.tm_hour = gps.time.hour();
-		gpstime.tm_min = gps.time.minute();
-		gpstime.tm_sec = gps.time.second();
-		gpstime.tm_isdst = -1;
-		now = mktime( &gpstime );
-		gps_data->time.tv_sec = now;
-		if ( update_rtc )
-			settimeofday( &gps_data->time, 0 );
 
 	} else {
 
 		gps_data->longitude = 0.F;
 		gps_data->latitude = 0.F;
 		gps_data->altitude = 0.F;
-		now = mktime( &gpstime );
-		gps_data->time.tv_sec = now;
-
 	}
+
+	gps_data->time.tv_sec = utc_to_time_t( gps.date.year(), gps.date.month(), gps.date.day(), gps.time.hour(), gps.time.minute(), gps.time.second() );
+	gps_data->time.tv_usec = gps.time.centisecond() * 10000;
+
+	// The sentence may have been parsed a while ago, tell the clock when it was received
+	if ( aws_clock && gps_data->fix && gps.time.isValid() && gps.date.isValid() )
+		aws_clock->set_gps_time( gps_data->time, AWSClock::monotonic_us() - static_cast<uint64_t>( gps.time.age() ) * 1000 );
 }
 
 bool AWSGPS::initialise( gps_data_t *_gps_data, I2C_SC16IS750 *_sc16is750, SemaphoreHandle_t _i2c_mutex )
@@ -143,8 +429,12 @@ bool AWSGPS::initialise( gps_data_t *_gps_data, I2C_SC16IS750 *_sc16is750, Semap
 		xSemaphoreGive( i2c_mutex );
 		return false;
 	}
-	get_ublox_model();
+	configure_ublox();
 	xSemaphoreGive( i2c_mutex );
+
+	if ( sc16is750->enable_interrupts( GPIO_SC16IS750_IRQ, i2c_mutex ))
+		Serial.printf( "[GPS       ] [INFO ] I2C UART in interrupt mode.\n" );
+
 	return true;
 }
 
@@ -155,33 +445,35 @@ bool AWSGPS::initialise( gps_data_t *_gps_data )
 	gps_serial = new HardwareSerial(2);
 	gps_serial->begin( GPS_SPEED, SERIAL_8N1, GPS_RX, GPS_TX );
 	if ( gps_serial->availableForWrite() ) {
-		get_ublox_model();
+		configure_ublox();
 		return true;
 	}
 	return false;
 }
 
-void AWSGPS::pilot_rtc( bool _update_rtc )
+void AWSGPS::pilot_rtc( AWSClock *_aws_clock )
 {
-	update_rtc = _update_rtc;
+	aws_clock = _aws_clock;
 }
 
 void AWSGPS::resume( void )
 {
-	if ( gps_task_handle != NULL )
-		vTaskResume( gps_task_handle );
+	if ( scheduler )
+		scheduler->set_enabled( job, true );
 }
 
-bool AWSGPS::start( void )
+bool AWSGPS::start( Scheduler *_scheduler )
 {
-	std::function<void(void *)> _feed = std::bind( &AWSGPS::feed, this, std::placeholders::_1 );
-	if ( xTaskCreatePinnedToCore(
-		[](void *param) {	// NOSONAR
-            std::function<void(void*)>* feed_proxy = static_cast<std::function<void(void*)>*>( param );
-            (*feed_proxy)( NULL );
-		}, "GPS Feed Task", 2000, &_feed, 4, &gps_task_handle, 1 ) != pdPASS ) {
+	scheduler = _scheduler;
 
-		Serial.printf( "[GPS       ] [ERROR] Could not start task [GPSFeed]\n" );
+	if ( sc16is750 && sc16is750->get_interrupt_mode() )
+		job = scheduler->add_job( "gps", GPS_DRAIN_INTERVAL, 0, GPS_DRAIN_INTERVAL, job_priority_t::URGENT, job_pool_t::SHORT, [this]() { drain_GPS_from_bridge(); } );
+	else
+		job = scheduler->add_job( "gps", GPS_POLL_INTERVAL, 0, GPS_POLL_INTERVAL, job_priority_t::NORMAL, job_pool_t::BLOCKING, [this]() { read_GPS(); update_data(); } );
+
+	if ( job == SCHEDULER_NO_JOB ) {
+
+		Serial.printf( "[GPS       ] [ERROR] Could not schedule GPS polling.\n" );
 		return false;
 	}
 
@@ -190,14 +482,11 @@ bool AWSGPS::start( void )
 
 void AWSGPS::suspend( void )
 {
-	if ( gps_task_handle != NULL )
-		vTaskSuspend( gps_task_handle );
+	if ( scheduler )
+		scheduler->set_enabled( job, false );
 }
 
 void AWSGPS::stop( void )
 {
-	if ( gps_task_handle != NULL )
-		vTaskDelete( gps_task_handle );
-
-	gps_task_handle = NULL;
+	suspend();
 }
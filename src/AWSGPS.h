@@ -25,6 +25,41 @@
 #include <TinyGPSPlus.h>
 #include "device.h"
 #include "SC16IS750.h"
+#include "AWSClock.h"
+#include "scheduler.h"
+
+constexpr uint8_t	UBX_SYNC_1			= 0xB5;
+constexpr uint8_t	UBX_SYNC_2			= 0x62;
+constexpr uint8_t	UBX_CLASS_NAV		= 0x01;
+constexpr uint8_t	UBX_CLASS_ACK		= 0x05;
+constexpr uint8_t	UBX_CLASS_CFG		= 0x06;
+constexpr uint8_t	UBX_CLASS_NMEA		= 0xF0;
+constexpr uint8_t	UBX_NAV_PVT			= 0x07;
+constexpr uint8_t	UBX_ACK_NAK			= 0x00;
+constexpr uint8_t	UBX_ACK_ACK			= 0x01;
+constexpr uint8_t	UBX_CFG_MSG			= 0x01;
+constexpr uint16_t	UBX_NAV_PVT_LENGTH	= 92;
+constexpr uint16_t	UBX_MAX_PAYLOAD		= 100;
+
+enum struct ubx_parser_state_t : uint8_t {
+
+	IDLE,
+	SYNC_2,
+	CLASS,
+	ID,
+	LENGTH_1,
+	LENGTH_2,
+	PAYLOAD,
+	CK_A,
+	CK_B
+};
+
+enum struct ubx_ack_t : uint8_t {
+
+	NONE,
+	ACK,
+	NAK
+};
 
 struct gps_data_t {
 
@@ -40,18 +75,44 @@ class AWSGPS : public Device
 {
 	private:
 
-		TaskHandle_t		gps_task_handle;
 		TinyGPSPlus			gps;
 		I2C_SC16IS750		*sc16is750		= nullptr;
 		SemaphoreHandle_t	i2c_mutex		= nullptr;
 		HardwareSerial		*gps_serial		= nullptr;
 		gps_data_t			*gps_data		= nullptr;
-		bool				update_rtc		= false;
+		AWSClock			*aws_clock		= nullptr;
+		uint32_t			i2c_hold_max_us	= 0;
+		uint32_t			i2c_hold_us		= 0;
+		job_id_t			job				= SCHEDULER_NO_JOB;
+		unsigned long		last_update		= 0;
+		Scheduler			*scheduler		= nullptr;
+		bool				ubx_mode		= false;
+
+		std::array<uint8_t,UBX_MAX_PAYLOAD>	ubx_payload;
+		volatile ubx_ack_t	ubx_ack			= ubx_ack_t::NONE;
+		uint8_t				ubx_ack_class	= 0;		// Of the command waiting for its acknowledgement
+		uint8_t				ubx_ack_id		= 0;
+		uint8_t				ubx_ck_a		= 0;
+		uint8_t				ubx_ck_b		= 0;
+		uint8_t				ubx_class		= 0;
+		uint8_t				ubx_id			= 0;
+		uint16_t			ubx_index		= 0;
+		uint64_t			ubx_frame_us	= 0;
+		uint16_t			ubx_length		= 0;
+		ubx_parser_state_t	ubx_state		= ubx_parser_state_t::IDLE;
 	
 		void update_data( void );
-		void feed( void * );
+		void drain_GPS_from_bridge( void );
 		void read_GPS( void );
-		void get_ublox_model( void );
+		void read_GPS_from_bridge( void );
+		void configure_ublox( void );
+		void feed_byte( uint8_t, uint64_t );
+		void handle_nav_pvt( const uint8_t * );
+		void handle_ubx_frame( void );
+		void poll_GPS( uint32_t );
+		void send_ubx( uint8_t, uint8_t, const uint8_t *, uint16_t );
+		uint64_t serial_rx_us( void );
+		bool set_message_rate( uint8_t, uint8_t, uint8_t );
 
 	public:
 
@@ -59,8 +120,8 @@ class AWSGPS : public Device
 		bool		initialise( gps_data_t * );
 		bool		initialise( gps_data_t *, I2C_SC16IS750 *, SemaphoreHandle_t );
 		void		resume( void );
-		void		pilot_rtc( bool );
-		bool		start( void );
+		void		pilot_rtc( AWSClock * );
+		bool		start( Scheduler * );
 		void		stop( void );
 		void		suspend( void );
 };
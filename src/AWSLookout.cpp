@@ -27,194 +27,74 @@
 #include "dome.h"
 #include "config_manager.h"
 #include "sensor_manager.h"
+#include "AWSClock.h"
 #include "AWSLookout.h"
 #include "AstroWeatherStation.h"
 
 extern AstroWeatherStation	station;
 
-template <typename T>
-bool AWSLookout::check_safe_rule( const char *name, lookout_rule_t<T> &rule, T value, time_t value_ts, time_t now, lookout_rule_t<T> &unsafe_rule )
-{
-	if ( !rule.active ) {
-
-		unsafe_rule.ts = 0;
-		return ( rule.satisfied = true );
-	}
-
-	if ( value > rule.max )
-		return ( rule.satisfied = false );
-
-	if ( !rule.ts )
-		rule.ts = value_ts;
-
-	if (( now - rule.ts ) >= rule.delay ) {
-
-		if ( std::is_same<T, float>::value )
-			Serial.printf( "[LOOKOUT   ] [INFO ] Safe rule '%s' satisfied: %f <= %f\n", name, value, rule.max );
-		else if ( std::is_same<T, uint8_t>::value )
-			Serial.printf( "[LOOKOUT   ] [INFO ] Safe rule '%s' satisfied: %d <= %d\n", name, value, rule.max );
-
-		unsafe_rule.ts = 0;
-		return ( rule.satisfied = true );
-
-	}
-
-	if ( std::is_same<T, float>::value )
-		Serial.printf( "[LOOKOUT   ] [INFO ] Safe rule '%s' pending delay: %f >= %f (%ds < %ds).\n", name, value, rule.max, now - rule.ts, rule.delay );
-	else if ( std::is_same<T, uint8_t>::value )
-		Serial.printf( "[LOOKOUT   ] [INFO ] Safe rule '%s' pending delay: %d >= %d (%ds < %ds).\n", name, value, rule.max, now - rule.ts, rule.delay );
-
-	return ( rule.satisfied = false );
-}
-
-template <typename T>
-bool AWSLookout::check_unsafe_rule( const char *name, lookout_rule_t<T> &rule, bool sensor_available, T value, time_t value_ts, time_t now, lookout_rule_t<T> &safe_rule )
-{
-	if ( !rule.active )
-		return ( rule.satisfied = false );
-
-	if ( !sensor_available && rule.check_available ) {
-
-		Serial.printf( "[LOOKOUT   ] [INFO ] Unsafe rule '%s' satisfied: sensor not available\n", name );
-		safe_rule.ts = 0;
-		return ( rule.satisfied = true );
+namespace {
+
+	// Sensor behind each input of the rules
+	aws_device_t channel_device( lookout_channel_t channel )
+	{
+		switch( channel ) {
+
+			case lookout_channel_t::WIND_SPEED:
+				return aws_device_t::ANEMOMETER_SENSOR;
+			case lookout_channel_t::CLOUD_COVERAGE:
+				return aws_device_t::MLX_SENSOR;
+			case lookout_channel_t::RAIN_INTENSITY:
+				return aws_device_t::RAIN_SENSOR;
+			case lookout_channel_t::RH:
+			case lookout_channel_t::DEW_SPREAD:
+				return aws_device_t::BME_SENSOR;
+			case lookout_channel_t::MSAS:
+				return aws_device_t::TSL_SENSOR;
+			default:
+				return aws_device_t::NO_SENSOR;
+		}
 	}
 
-	if ( value < rule.max )
-		return ( rule.satisfied = false );
-
-	if ( !rule.ts )
-		rule.ts = value_ts;
-
-	if (( now - rule.ts ) >= rule.delay ) {
-
-		if ( std::is_same<T, float>::value )
-			Serial.printf( "[LOOKOUT   ] [INFO ] Unsafe rule '%s' satisfied: %f >= %f\n", name, value, rule.max );
-		else if ( std::is_same<T, uint8_t>::value )
-			Serial.printf( "[LOOKOUT   ] [INFO ] Unsafe rule '%s' satisfied: %d >= %d\n", name, value, rule.max );
-
-		safe_rule.ts = 0;
-		return ( rule.satisfied = true );
-
+	void set_input( lookout_inputs_t &inputs, lookout_channel_t channel, float value, bool available )
+	{
+		inputs[ static_cast<uint8_t>( channel ) ] = { value, available };
 	}
-
-	if ( std::is_same<T, float>::value )
-		Serial.printf( "[LOOKOUT   ] [INFO ] Unsafe rule '%s' pending delay: %f >= %f (%ds < %ds).\n", name, value, rule.max, now - rule.ts, rule.delay );
-	else if ( std::is_same<T, uint8_t>::value )
-		Serial.printf( "[LOOKOUT   ] [INFO ] Unsafe rule '%s' pending delay: %d >= %d (%ds < %ds).\n", name, value, rule.max, now - rule.ts, rule.delay );
-
-	return ( rule.satisfied = false );
 }
 
-void AWSLookout::check_rules( void )
+void AWSLookout::check_rules( uint32_t events )
 {
-	aws_device_t		available_sensors	= sensor_manager->get_available_sensors();
-	bool				b;
-	time_t				now					= station.get_timestamp();
 	etl::string<150>	str;
-	bool				tmp_is_safe			= true;
-	bool				tmp_is_unsafe		= false;
-
-	if ( rain_event ) {
+	bool				rain				= rain_event;
+	bool				safe;
+	bool				unsafe;
 
+	rain_event = false;
+	if ( rain )
 		Serial.printf( "[LOOKOUT   ] [INFO ] Rain event\n" );
-		if ( unsafe_rain_event.active ) {
 
-			unsafe_rain_event.ts = sensor_manager->get_sensor_data()->timestamp;
-			unsafe_rain_event.satisfied = true;
-			Serial.printf( "[LOOKOUT   ] [INFO ] Rain monitor is active, closing dome shutter.\n");
-			tmp_is_unsafe |= true;
+	// Only the rules whose input changed are evaluated again
+	rules.update( read_inputs( rain ), AWSClock::monotonic_us() / 1000000 );
 
-		}
-		rain_event = false;
-
-	} else {
-
-		unsafe_rain_event.satisfied = false;
-
-		tmp_is_unsafe |= ( b = AWSLookout::check_unsafe_rule<float>( "Wind speed #1",
-																		unsafe_wind_speed_1,
-																		sensor_manager->sensor_is_available( aws_device_t::ANEMOMETER_SENSOR ),
-																		sensor_manager->get_sensor_data()->weather.wind_speed,
-																		sensor_manager->get_sensor_data()->timestamp,
-																		now,
-																		safe_wind_speed ));
-		tmp_is_unsafe |= ( b = AWSLookout::check_unsafe_rule<float>( "Wind speed #2",
-																		unsafe_wind_speed_2,
-																		sensor_manager->sensor_is_available( aws_device_t::ANEMOMETER_SENSOR ),
-																		sensor_manager->get_sensor_data()->weather.wind_speed,
-																		sensor_manager->get_sensor_data()->timestamp,
-																		now,
-																		safe_wind_speed ));
-		tmp_is_unsafe |= ( b = AWSLookout::check_unsafe_rule<uint8_t>( "Cloud coverage #1",
-																		unsafe_cloud_coverage_1,
-																		sensor_manager->sensor_is_available( aws_device_t::MLX_SENSOR ),
-																		sensor_manager->get_sensor_data()->weather.cloud_coverage,
-																		sensor_manager->get_sensor_data()->timestamp,
-																		now,
-																		safe_cloud_coverage_1 ));
-		if ( b )
-			safe_cloud_coverage_2.ts = 0;
-
-		tmp_is_unsafe |= ( b = AWSLookout::check_unsafe_rule<uint8_t>( "Cloud coverage #2",
-																		unsafe_cloud_coverage_2,
-																		sensor_manager->sensor_is_available( aws_device_t::MLX_SENSOR ),
-																		sensor_manager->get_sensor_data()->weather.cloud_coverage,
-																		sensor_manager->get_sensor_data()->timestamp,
-																		now,
-																		safe_cloud_coverage_1 ));
-		if ( b )
-			safe_cloud_coverage_2.ts = 0;
-
-		tmp_is_unsafe |= ( b = AWSLookout::check_unsafe_rule<uint8_t>( "Rain intensity",
-																		unsafe_rain_intensity,
-																		sensor_manager->sensor_is_available( aws_device_t::RAIN_SENSOR ),
-																		sensor_manager->get_sensor_data()->weather.rain_intensity,
-																		sensor_manager->get_sensor_data()->timestamp,
-																		now,
-																		safe_rain_intensity ));
-
-		tmp_is_safe &= ( b = AWSLookout::check_safe_rule<float>( "Wind speed",
-																	safe_wind_speed,
-																	sensor_manager->get_sensor_data()->weather.wind_speed,
-																	sensor_manager->get_sensor_data()->timestamp,
-																	now,
-																	unsafe_wind_speed_1 ));
-		if ( b )
-			unsafe_wind_speed_2.ts = 0;
-
-		tmp_is_safe &= ( b = AWSLookout::check_safe_rule<uint8_t>( "Cloud coverage #1",
-																	safe_cloud_coverage_1,
-																	sensor_manager->get_sensor_data()->weather.cloud_coverage,
-																	sensor_manager->get_sensor_data()->timestamp,
-																	now,
-																	unsafe_cloud_coverage_1 ));
-		if ( b )
-			unsafe_cloud_coverage_2.ts = 0;
-
-		tmp_is_safe &= ( b = AWSLookout::check_safe_rule<uint8_t>( "Cloud coverage #2",
-																	safe_cloud_coverage_2,
-																	sensor_manager->get_sensor_data()->weather.cloud_coverage,
-																	sensor_manager->get_sensor_data()->timestamp,
-																	now,
-																	unsafe_cloud_coverage_1 ));
-		if ( b )
-			unsafe_cloud_coverage_2.ts = 0;
-
-		tmp_is_safe &= ( b = AWSLookout::check_safe_rule<uint8_t>( "Rain intensity",
-																	safe_rain_intensity,
-																	sensor_manager->get_sensor_data()->weather.rain_intensity,
-																	sensor_manager->get_sensor_data()->timestamp,
-																	now,
-																	unsafe_rain_intensity ));
+	decision_us = static_cast<uint32_t>( AWSClock::monotonic_us() );
+	latency.decisions++;
+	if ( events & SENSOR_SNAPSHOT_NOTIFICATION ) {
+
+		latency.last_sensor_to_decision_us = decision_us - sensor_manager->get_snapshot_us();
+		latency.max_sensor_to_decision_us = std::max( latency.max_sensor_to_decision_us, latency.last_sensor_to_decision_us );
 	}
+	if ( events & ( LOOKOUT_RAIN_NOTIFICATION | LOOKOUT_DOME_NOTIFICATION ))
+		latency.max_event_to_decision_us = std::max( latency.max_event_to_decision_us, decision_us - event_us );
+
+	safe = rules.is_safe();
+	unsafe = rules.is_unsafe();
 
-	if ( decide_is_safe( tmp_is_unsafe, tmp_is_safe ))
+	if ( decide_is_safe( unsafe, safe ))
 		return;
 
-	snprintf( str.data(), str.capacity(), "[LOOKOUT   ] [INFO ] Safe conditions are <%s> AND unsafe conditions are <%s>: conditions are <UNDECIDED>, rules must be fixed!\n", tmp_is_safe?"SATISFIED":"NOT SATISFIED", tmp_is_unsafe?"SATISFIED":"NOT SATISFIED" );
+	snprintf( str.data(), str.capacity(), "[LOOKOUT   ] [INFO ] Safe conditions are <%s> AND unsafe conditions are <%s>: conditions are <UNDECIDED>, rules must be fixed!\n", safe?"SATISFIED":"NOT SATISFIED", unsafe?"SATISFIED":"NOT SATISFIED" );
 	Serial.printf( "%s", str.data() );
-	station.send_alarm( "[LOOKOUT] Configuration is not consistent", str.data() );
+	station.queue_alarm( "[LOOKOUT] Configuration is not consistent", str.data() );
 }
 
 bool AWSLookout::decide_is_safe( bool unsafe, bool safe )
@@ -222,7 +102,7 @@ bool AWSLookout::decide_is_safe( bool unsafe, bool safe )
 	if ( is_safe && !unsafe ) {
 
 		Serial.printf( "[LOOKOUT   ] [INFO ] Previous conditions were <SAFE> AND unsafe conditions are <NOT SATISFIED>: conditions are <SAFE>\n" );
-		dome->open_shutter();
+		drive_shutter( true );
 		return true;
 
 	}
@@ -230,49 +110,61 @@ bool AWSLookout::decide_is_safe( bool unsafe, bool safe )
 	if ( !safe || unsafe ) {
 
 		if ( is_safe )
-			station.send_alarm( "[LOOKOUT] Flipped from SAFE to UNSAFE", "[LOOKOUT] Flipped from SAFE to UNSAFE" );
+			station.queue_alarm( "[LOOKOUT] Flipped from SAFE to UNSAFE", "[LOOKOUT] Flipped from SAFE to UNSAFE" );
 		is_safe = false;
 		Serial.printf( "[LOOKOUT   ] [INFO ] Safe conditions are <NOT SATISFIED> OR unsafe conditions are <SATISFIED>: conditions are <UNSAFE>\n" );
-		dome->close_shutter();
+		drive_shutter( false );
 		return true;
 	}
 
 	if ( !unsafe && safe ) {
 
 		if ( !is_safe )
-			station.send_alarm( "[LOOKOUT] Flipped from UNSAFE to SAFE", "[LOOKOUT] Flipped from UNSAFE to SAFE" );
+			station.queue_alarm( "[LOOKOUT] Flipped from UNSAFE to SAFE", "[LOOKOUT] Flipped from UNSAFE to SAFE" );
 		is_safe = true;
 		Serial.printf( "[LOOKOUT   ] [INFO ] Safe conditions are <SATISFIED> AND unsafe conditions are <NOT SATISFIED>: conditions are <SAFE>\n" );
-		dome->open_shutter();
+		drive_shutter( true );
 		return true;
 	}
 
 	return false;
 }
 
+void AWSLookout::drive_shutter( bool open )
+{
+	if ( open )
+		dome->open_shutter();
+	else
+		dome->close_shutter();
+
+	latency.max_decision_to_relay_us = std::max( latency.max_decision_to_relay_us, static_cast<uint32_t>( AWSClock::monotonic_us() ) - decision_us );
+}
+
+lookout_latency_t AWSLookout::get_latency( void )
+{
+	return latency;
+}
+
 etl::string_view AWSLookout::get_rules_state( void )
 {
 	JsonDocument	rules_state_json;
 	int				i;
 
-	rules_state_json["unsafe_rain_event"] = unsafe_rain_event.satisfied;
-	rules_state_json["unsafe_wind_speed_1"] = unsafe_wind_speed_1.satisfied;
-	rules_state_json["unsafe_wind_speed_2"] = unsafe_wind_speed_2.satisfied;
-	rules_state_json["unsafe_cloud_coverage_1"] = unsafe_cloud_coverage_1.satisfied;
-	rules_state_json["unsafe_cloud_coverage_2"] = unsafe_cloud_coverage_2.satisfied;
-	rules_state_json["unsafe_rain_intensity"] = unsafe_rain_intensity.satisfied;
+	for ( const lookout_rule_definition_t &definition : LOOKOUT_RULE_DEFINITIONS )
+		rules_state_json[ definition.name ] = rules.is_satisfied( definition );
 
-	rules_state_json["safe_wind_speed"] = safe_wind_speed.satisfied;
-	rules_state_json["safe_cloud_coverage_1"] = safe_cloud_coverage_1.satisfied;
-	rules_state_json["safe_cloud_coverage_2"] = safe_cloud_coverage_2.satisfied;
-	rules_state_json["safe_rain_intensity"] = safe_rain_intensity.satisfied;
+	rules_state_json["latency"]["decisions"] = latency.decisions;
+	rules_state_json["latency"]["last_sensor_to_decision_us"] = latency.last_sensor_to_decision_us;
+	rules_state_json["latency"]["max_sensor_to_decision_us"] = latency.max_sensor_to_decision_us;
+	rules_state_json["latency"]["max_event_to_decision_us"] = latency.max_event_to_decision_us;
+	rules_state_json["latency"]["max_decision_to_relay_us"] = latency.max_decision_to_relay_us;
 
 	if ( (i = measureJson( rules_state_json )) > rules_state_data.capacity() ) {
 
 		etl::string<64> tmp;
 		Serial.printf( "[LOOKOUT   ] [BUG  ] rules_state_data json is too small (%d > %d). Please report to support!\n", i, rules_state_data.capacity() );
 		snprintf( tmp.data(), tmp.capacity(), "rules_state_data json is too small (%d > %d)", i, rules_state_data.capacity() );
-		station.send_alarm( "[STATION] LOOKOUT BUG", tmp.data() );
+		station.queue_alarm( "[STATION] LOOKOUT BUG", tmp.data() );
 		return etl::string_view( "" );
 
 	}
@@ -283,107 +175,81 @@ etl::string_view AWSLookout::get_rules_state( void )
 	return etl::string_view( rules_state_data );
 }
 
-void AWSLookout::loop( void * )	// NOSONAR
+// event_us is the monotonic time (low 32 bits) of the interrupt behind the event
+void AWSLookout::notify( uint32_t event, uint32_t _event_us )
 {
-	while( true ) {
+	event_us = _event_us;
+	post( event );
+}
 
-		if ( initialised )
-			check_rules();
-		delay( 1000 );
+// The decision is taken again as soon as the short worker is free
+void AWSLookout::post( uint32_t event )
+{
+	pending_events |= event;
+	if ( initialised && active )
+		scheduler->run_now( job );
+}
 
-	}
+lookout_inputs_t AWSLookout::read_inputs( bool rain )
+{
+	sensor_data_t		*data = sensor_manager->get_sensor_data();
+	lookout_inputs_t	inputs;
+
+	set_input( inputs, lookout_channel_t::RAIN_EVENT, rain ? 1.F : 0.F, true );
+	set_input( inputs, lookout_channel_t::WIND_SPEED, data->weather.wind_speed, sensor_manager->sensor_is_available( aws_device_t::ANEMOMETER_SENSOR ));
+	set_input( inputs, lookout_channel_t::CLOUD_COVERAGE, data->weather.cloud_coverage, sensor_manager->sensor_is_available( aws_device_t::MLX_SENSOR ));
+	set_input( inputs, lookout_channel_t::RAIN_INTENSITY, data->weather.rain_intensity, sensor_manager->sensor_is_available( aws_device_t::RAIN_SENSOR ));
+	set_input( inputs, lookout_channel_t::RH, data->weather.rh, sensor_manager->sensor_is_available( aws_device_t::BME_SENSOR ));
+	set_input( inputs, lookout_channel_t::DEW_SPREAD, data->weather.temperature - data->weather.dew_point, sensor_manager->sensor_is_available( aws_device_t::BME_SENSOR ));
+	set_input( inputs, lookout_channel_t::MSAS, data->sqm.msas, sensor_manager->sensor_is_available( aws_device_t::TSL_SENSOR ));
+	return inputs;
+}
+
+// Rules on a sensor the station does not have are left out
+lookout_rule_settings_t AWSLookout::read_rule_settings( AWSConfig *config, const lookout_rule_definition_t &definition )
+{
+	lookout_rule_settings_t settings = definition.defaults;
+
+	if ( definition.keys & LOOKOUT_KEY_ACTIVE )
+		settings.active = config->get_parameter<bool>( LookoutRules::config_key( definition, "_active" ).c_str() );
+	if ( definition.keys & LOOKOUT_KEY_MAX )
+		settings.max = config->get_parameter<float>( LookoutRules::config_key( definition, "_max" ).c_str() );
+	if ( definition.keys & LOOKOUT_KEY_DELAY )
+		settings.delay = config->get_parameter<int>( LookoutRules::config_key( definition, "_delay" ).c_str() );
+	if ( definition.keys & LOOKOUT_KEY_MISSING )
+		settings.satisfied_if_missing = config->get_parameter<bool>( LookoutRules::config_key( definition, "_missing" ).c_str() );
+	if ( definition.keys & LOOKOUT_KEY_HYSTERESIS )
+		settings.hysteresis = config->get_parameter<float>( LookoutRules::config_key( definition, "_hysteresis" ).c_str() );
+
+	settings.active &= config->get_has_device( channel_device( definition.channel ));
+	return settings;
 }
 
-void AWSLookout::initialise( AWSConfig *_config, AWSSensorManager *_mngr, Dome *_dome, bool _debug_mode )
+void AWSLookout::initialise( AWSConfig *_config, AWSSensorManager *_mngr, Dome *_dome, Scheduler *_scheduler, bool _debug_mode )
 {
 	debug_mode = _debug_mode;
 	dome = _dome;
+	scheduler = _scheduler;
 	sensor_manager = _mngr;
 
 	Serial.printf( "[LOOKOUT   ] [INFO ] Initialising.\n" );
 
-	initialise_rules( _config );
+	rules.compile( [_config]( const lookout_rule_definition_t &definition ) { return read_rule_settings( _config, definition ); }, debug_mode );
 
-	std::function<void(void *)> _loop = std::bind( &AWSLookout::loop, this, std::placeholders::_1 );
-	if ( xTaskCreatePinnedToCore(
-		[](void *param) {	// NOSONAR
-			std::function<void(void*)>* lookout_task_proxy = static_cast<std::function<void(void*)>*>( param );	// NOSONAR
-			(*lookout_task_proxy)( NULL );
-		}, "AWSLookout Task", 10000, &_loop, 5, &lookout_task_handle, 1 ) != pdPASS ) {
+	job = scheduler->add_job( "lookout", IDLE_TIMEOUT_MS, IDLE_TIMEOUT_MS, DELAY_TICK_MS, job_priority_t::URGENT, job_pool_t::SHORT, [this]() { run(); } );
+	if ( job == SCHEDULER_NO_JOB ) {
 
-		Serial.printf( "[LOOKOUT   ] [ERROR] Could not start task [LookoutTask]\n" );
+		Serial.printf( "[LOOKOUT   ] [ERROR] Could not schedule the lookout.\n" );
 		return;
 	}
 
+	sensor_manager->set_snapshot_listener( [this]() { post( SENSOR_SNAPSHOT_NOTIFICATION ); } );
+
 	initialised = true;
 	active = true;
 	Serial.printf( "[LOOKOUT   ] [INFO ] Initialised.\n" );
 }
 
-void AWSLookout::initialise_rules( AWSConfig *_config )
-{
-	unsafe_rain_event.active = true;
-	unsafe_rain_event.max = 1;
-	unsafe_rain_event.delay = 0;
-	unsafe_rain_event.check_available = true;
-	unsafe_rain_event.ts = 0;
-	unsafe_rain_event.satisfied = false;
-
-	unsafe_wind_speed_1.active = _config->get_parameter<bool>( "unsafe_wind_speed_1_active" ) && _config->get_has_device( aws_device_t::ANEMOMETER_SENSOR );
-	unsafe_wind_speed_1.max = _config->get_parameter<float>( "unsafe_wind_speed_1_max" );
-	unsafe_wind_speed_1.delay = _config->get_parameter<int>( "unsafe_wind_speed_1_delay" );
-	unsafe_wind_speed_1.check_available = _config->get_parameter<int>( "unsafe_wind_speed_1_missing" );
-	unsafe_wind_speed_1.ts = 0;
-
-	unsafe_wind_speed_2.active = _config->get_parameter<bool>( "unsafe_wind_speed_2_active" ) && _config->get_has_device( aws_device_t::ANEMOMETER_SENSOR );
-	unsafe_wind_speed_2.max =  _config->get_parameter<float>( "unsafe_wind_speed_2_max" );
-	unsafe_wind_speed_2.delay =  _config->get_parameter<int>( "unsafe_wind_speed_2_delay" );
-	unsafe_wind_speed_2.check_available = _config->get_parameter<int>( "unsafe_wind_speed_2_missing" );
-	unsafe_wind_speed_2.ts = 0;
-
-	unsafe_cloud_coverage_1.active = _config->get_parameter<bool>( "unsafe_cloud_coverage_1_active" ) && _config->get_has_device( aws_device_t::MLX_SENSOR );
-	unsafe_cloud_coverage_1.max = _config->get_parameter<int>( "unsafe_cloud_coverage_1_max" );
-	unsafe_cloud_coverage_1.delay = _config->get_parameter<int>( "unsafe_cloud_coverage_1_delay" );
-	unsafe_cloud_coverage_1.check_available = _config->get_parameter<int>( "unsafe_cloud_coverage_1_missing" );
-	unsafe_cloud_coverage_1.ts = 0;
-
-	unsafe_cloud_coverage_2.active = _config->get_parameter<bool>( "unsafe_cloud_coverage_2_active" ) && _config->get_has_device( aws_device_t::MLX_SENSOR );
-	unsafe_cloud_coverage_2.max = _config->get_parameter<int>( "unsafe_cloud_coverage_2_max" );
-	unsafe_cloud_coverage_2.delay = _config->get_parameter<int>( "unsafe_cloud_coverage_2_delay" );
-	unsafe_cloud_coverage_2.check_available = _config->get_parameter<int>( "unsafe_cloud_coverage_2_missing" );
-	unsafe_cloud_coverage_2.ts = 0;
-
-	unsafe_rain_intensity.active = _config->get_parameter<bool>( "unsafe_rain_intensity_active" ) && _config->get_has_device( aws_device_t::RAIN_SENSOR );
-	unsafe_rain_intensity.max = _config->get_parameter<int>( "unsafe_rain_intensity_max" );
-	unsafe_rain_intensity.delay = 0;
-	unsafe_rain_intensity.check_available = _config->get_parameter<int>( "unsafe_rain_intensity_missing" );
-	unsafe_rain_intensity.ts = 0;
-
-	safe_wind_speed.active = _config->get_parameter<bool>( "safe_wind_speed_active" ) && _config->get_has_device( aws_device_t::ANEMOMETER_SENSOR );
-	safe_wind_speed.max = _config->get_parameter<float>( "safe_wind_speed_max" );
-	safe_wind_speed.delay = _config->get_parameter<int>( "safe_wind_speed_delay" );
-	safe_wind_speed.check_available = false;
-	safe_wind_speed.ts = 0;
-
-	safe_cloud_coverage_1.active = _config->get_parameter<bool>( "safe_cloud_coverage_1_active" ) && _config->get_has_device( aws_device_t::MLX_SENSOR );
-	safe_cloud_coverage_1.max = _config->get_parameter<int>( "safe_cloud_coverage_1_max" );
-	safe_cloud_coverage_1.delay = _config->get_parameter<int>( "safe_cloud_coverage_1_delay" );
-	safe_cloud_coverage_1.check_available = false;
-	safe_cloud_coverage_1.ts = 0;
-
-	safe_cloud_coverage_2.active = _config->get_parameter<bool>( "safe_cloud_coverage_2_active" ) && _config->get_has_device( aws_device_t::MLX_SENSOR );
-	safe_cloud_coverage_2.max = _config->get_parameter<int>( "safe_cloud_coverage_2_max" );
-	safe_cloud_coverage_2.delay = _config->get_parameter<int>( "safe_cloud_coverage_2_delay" );
-	safe_cloud_coverage_2.check_available = false;
-	safe_cloud_coverage_2.ts = 0;
-
-	safe_rain_intensity.active = _config->get_parameter<bool>( "safe_rain_intensity_active" ) && _config->get_has_device( aws_device_t::RAIN_SENSOR );
-	safe_rain_intensity.max = _config->get_parameter<int>( "safe_rain_intensity_max" );
-	safe_rain_intensity.delay = _config->get_parameter<int>( "safe_rain_intensity_delay" );
-	safe_rain_intensity.check_available = false;
-	safe_rain_intensity.ts = 0;
-}
-
 bool AWSLookout::is_active( void )
 {
 	return active;
@@ -397,23 +263,37 @@ bool AWSLookout::issafe( void )
 bool AWSLookout::resume( void )
 {
 	if ( initialised ) {
-		vTaskResume( lookout_task_handle );
+		scheduler->set_enabled( job, true );
 		active = true;
+		scheduler->run_now( job );
 		return true;
 	}
 	return false;
 }
 
-void AWSLookout::set_rain_event()
+// Runs on each event, and otherwise every DELAY_TICK_MS while a rule waits for its delay to expire
+void AWSLookout::run( void )
+{
+	check_rules( pending_events.exchange( 0 ));
+	scheduler->set_period( job, rules.is_waiting() ? DELAY_TICK_MS : IDLE_TIMEOUT_MS );
+}
+
+void AWSLookout::set_dome_event( uint32_t _event_us )
+{
+	notify( LOOKOUT_DOME_NOTIFICATION, _event_us );
+}
+
+void AWSLookout::set_rain_event( uint32_t _event_us )
 {
 	rain_event = true;
+	notify( LOOKOUT_RAIN_NOTIFICATION, _event_us );
 }
 
 bool AWSLookout::suspend( void )
 {
 	active = false;
 	if ( initialised ) {
-		vTaskSuspend( lookout_task_handle );
+		scheduler->set_enabled( job, false );
 		return true;
 	}
 	return false;
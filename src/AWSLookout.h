@@ -21,58 +21,65 @@
 #ifndef _AWSLookout_H
 #define _AWSLookout_H
 
-template <typename T>
-struct lookout_rule_t {
-	bool	active;
-	bool	check_available;
-	T 		max;
-	int 	delay;
-	time_t	ts;
-	bool	satisfied;
+#include <atomic>
+#include "lookout_rules.h"
+#include "scheduler.h"
+
+// Notification bits, SENSOR_SNAPSHOT_NOTIFICATION comes from the sensor manager
+const uint32_t	LOOKOUT_RAIN_NOTIFICATION	= 0x02;
+const uint32_t	LOOKOUT_DOME_NOTIFICATION	= 0x04;
+
+struct lookout_latency_t {
+
+	uint32_t	decisions;
+	uint32_t	last_sensor_to_decision_us;
+	uint32_t	max_sensor_to_decision_us;		// From the start of the sensor reads
+	uint32_t	max_event_to_decision_us;		// From the rain or dome interrupt
+	uint32_t	max_decision_to_relay_us;		// Until the dome relay is driven
 };
 
 class AWSLookout
 {
 	private:
 
-		TaskHandle_t			lookout_task_handle;
+		static constexpr uint32_t	DELAY_TICK_MS			= 1000;		// While a rule waits for its delay to expire
+		static constexpr uint32_t	IDLE_TIMEOUT_MS			= 10000;	// Re-asserts the decision if the sensors go quiet
+
 		bool					active					= false;
 		bool 					debug_mode				= false;
 		Dome					*dome					= nullptr;
 		bool					initialised				= false;
 		bool					is_safe					= true;
-		etl::string<248>		rules_state_data;
-		bool					rain_event				= false;
+		job_id_t				job						= SCHEDULER_NO_JOB;
+		std::atomic<uint32_t>	pending_events			= 0;
+		etl::string<768>		rules_state_data;
+		uint32_t				decision_us				= 0;
+		volatile uint32_t		event_us				= 0;
+		lookout_latency_t		latency					= {};
+		volatile bool			rain_event				= false;
+		LookoutRules			rules;
+		Scheduler				*scheduler				= nullptr;
 		AWSSensorManager		*sensor_manager			= nullptr;
-		AWSConfig				*config					= nullptr;
-		lookout_rule_t<uint8_t>	unsafe_rain_event;
-		lookout_rule_t<float>	unsafe_wind_speed_1;
-		lookout_rule_t<float>	unsafe_wind_speed_2;
-		lookout_rule_t<uint8_t>	unsafe_cloud_coverage_1;
-		lookout_rule_t<uint8_t>	unsafe_cloud_coverage_2;
-		lookout_rule_t<uint8_t>	unsafe_rain_intensity;
-		lookout_rule_t<float>	safe_wind_speed;
-		lookout_rule_t<uint8_t>	safe_cloud_coverage_1;
-		lookout_rule_t<uint8_t>	safe_cloud_coverage_2;
-		lookout_rule_t<uint8_t>	safe_rain_intensity;
-
-		void check_rules( void );
-		template <typename T>
-		bool check_unsafe_rule( const char *, lookout_rule_t<T> &, bool, T, time_t, time_t, lookout_rule_t<T> & );
-		template <typename T>
-		bool check_safe_rule( const char *, lookout_rule_t<T> &, T, time_t, time_t, lookout_rule_t<T> & );
+
+		void check_rules( uint32_t );
 		bool decide_is_safe( bool, bool );
-		void initialise_rules( AWSConfig * );
+		void drive_shutter( bool );
+		void notify( uint32_t, uint32_t );
+		void post( uint32_t );
+		lookout_inputs_t read_inputs( bool );
+		static lookout_rule_settings_t read_rule_settings( AWSConfig *, const lookout_rule_definition_t & );
+		void run( void );
 
 	public:
 
 							AWSLookout( void ) = default;
+		lookout_latency_t	get_latency( void );
 		etl::string_view	get_rules_state( void );
-		void				initialise( AWSConfig *, AWSSensorManager *, Dome *, bool _debug_mode );
+		void				initialise( AWSConfig *, AWSSensorManager *, Dome *, Scheduler *, bool _debug_mode );
 		bool				is_active( void );
 		bool				issafe( void );
-		void				loop( void * );
-		void				set_rain_event( void );
+		void				set_dome_event( uint32_t );
+		void				set_rain_event( uint32_t );
 		bool				suspend( void );
 		bool				resume( void );
 };
@@ -24,6 +24,7 @@
 #include <WiFi.h>
 #include <WiFiClient.h>
 #include <HTTPClient.h>
+#include <rom/crc.h>
 #include "Embedded_Template_Library.h"
 #include "etl/string.h"
 
@@ -35,6 +36,9 @@
 
 extern AstroWeatherStation station;
 
+RTC_DATA_ATTR wifi_cache_t			wifi_cache = {};			// NOSONAR
+RTC_DATA_ATTR wifi_connect_stats_t	wifi_connect_stats = {};	// NOSONAR
+
 AWSNetwork::AWSNetwork( void )
 {
 	ssl_eth_client = nullptr;
@@ -55,14 +59,52 @@ IPAddress AWSNetwork::cidr_to_mask( byte cidr )
 	return IPAddress( subnet );
 }
 
+// Straight to the access point of the last connection, without scanning, and with the last DHCP lease while it is
+// fresh enough. Anything going wrong invalidates the cache and leaves it to the full connection.
+bool AWSNetwork::connect_to_cached_ap( const char *ssid, const char *password, bool fixed_ip )
+{
+	bool	reuse_lease;
+
+	if ( !wifi_cache.valid || ( wifi_cache.ssid_crc != crc32_le( 0, reinterpret_cast<const uint8_t *>( ssid ), strlen( ssid ))))
+		return false;
+
+	reuse_lease = !fixed_ip && wifi_cache.lease_ts && (( time( nullptr ) - wifi_cache.lease_ts ) < LEASE_REUSE_MAX );
+
+	if ( debug_mode )
+		Serial.printf( "[NETWORK   ] [DEBUG] Connecting to cached AP, channel %d%s.\n", wifi_cache.channel, reuse_lease ? ", reusing DHCP lease" : "" );
+
+	if ( reuse_lease )
+		WiFi.config( IPAddress( wifi_cache.ip ), IPAddress( wifi_cache.gw ), IPAddress( wifi_cache.subnet ), IPAddress( wifi_cache.dns ));
+
+	WiFi.begin( ssid, password, wifi_cache.channel, wifi_cache.bssid.data() );
+	wifi_connect_stats.fast_attempts++;
+
+	if ( wait_for_wifi( FAST_CONNECT_TIMEOUT, false )) {
+
+		set_wifi_sta_parameters();
+		if ( !reuse_lease )
+			save_wifi_cache( ssid, !fixed_ip );
+		Serial.printf( "[NETWORK   ] [INFO ] Connected to SSID [%s] on channel %d. Using IP [%s]\n", ssid, wifi_cache.channel, WiFi.localIP().toString().c_str() );
+		return true;
+	}
+
+	Serial.printf( "[NETWORK   ] [INFO ] Cached AP did not answer, falling back to full connection.\n" );
+	wifi_cache.valid = false;
+	WiFi.disconnect();
+	if ( reuse_lease )
+		WiFi.config( INADDR_NONE, INADDR_NONE, INADDR_NONE );
+	return false;
+}
+
 bool AWSNetwork::connect_to_wifi()
 {
-	uint8_t		remaining_attempts	= 10;
 	char		*ip = nullptr;
 	char		*cidr = nullptr;
 	const char	*ssid		= config->get_parameter<const char *>( "wifi_sta_ssid" );
 	const char	*password	= config->get_parameter<const char *>( "wifi_sta_password" );
 	char		*dummy;
+	bool		fixed_ip	= ( static_cast<aws_ip_mode>(config->get_parameter<int>( "wifi_sta_ip_mode" )) == aws_ip_mode::fixed );
+	uint32_t	start		= millis();
 
 	if (( WiFi.status () == WL_CONNECTED ) && !strcmp( ssid, WiFi.SSID().c_str() )) {
 
@@ -71,9 +113,7 @@ bool AWSNetwork::connect_to_wifi()
 		return true;
 	}
 
-	Serial.printf( "[NETWORK   ] [INFO ] Attempting to connect to SSID [%s] ", ssid );
-
-	if ( static_cast<aws_ip_mode>(config->get_parameter<int>( "wifi_sta_ip_mode" )) == aws_ip_mode::fixed ) {
+	if ( fixed_ip ) {
 
 		if ( etl::string_view( config->get_parameter<const char *>( "wifi_sta_ip" )).size() ) {
 
@@ -92,32 +132,35 @@ bool AWSNetwork::connect_to_wifi()
 		WiFi.config( wifi_sta_ip, wifi_sta_gw, wifi_sta_subnet, wifi_sta_dns );
 
 	}
-	WiFi.begin( ssid , password );
 
-	while (( WiFi.status() != WL_CONNECTED ) && ( --remaining_attempts > 0 )) {	// NOSONAR
+	if ( connect_to_cached_ap( ssid, password, fixed_ip )) {
 
-    Serial.print( "." );
-		delay( 1000 );
+		update_connect_stats( true, millis() - start );
+		return true;
 	}
 
-	if ( WiFi.status () == WL_CONNECTED ) {
+	Serial.printf( "[NETWORK   ] [INFO ] Attempting to connect to SSID [%s] ", ssid );
+	WiFi.begin( ssid , password );
+
+	if ( wait_for_wifi( FULL_CONNECT_TIMEOUT, true )) {
 
-		wifi_sta_ip = WiFi.localIP();
-		wifi_sta_subnet = WiFi.subnetMask();
-		wifi_sta_gw = WiFi.gatewayIP();
-		wifi_sta_dns = WiFi.dnsIP();
-		config->set_parameter( "run_wifi_sta_ip", wifi_sta_ip.toString().c_str() );
-		config->set_parameter( "run_wifi_sta_subnet", wifi_sta_subnet.toString().c_str() );
-		config->set_parameter( "run_wifi_sta_gw", wifi_sta_gw.toString().c_str() );
+		set_wifi_sta_parameters();
+		save_wifi_cache( ssid, !fixed_ip );
+		update_connect_stats( false, millis() - start );
 		Serial.printf( " OK. Using IP [%s]\n", WiFi.localIP().toString().c_str() );
 		return true;
 	}
 
 	Serial.printf( "NOK.\n" );
-
+	wifi_connect_stats.failures++;
 	return false;
 }
 
+wifi_connect_stats_t AWSNetwork::get_connect_stats( void )
+{
+	return wifi_connect_stats;
+}
+
 IPAddress AWSNetwork::get_gw( aws_iface iface )
 {
 	switch( iface ) {
@@ -397,6 +440,31 @@ bool AWSNetwork::post_content( const char *endpoint, size_t endpoint_len, const
 	return wifi_post_content( remote_server, final_endpoint, jsonString );
 }
 
+// The lease timestamp only moves when the address comes from a DHCP exchange, not from the cache
+void AWSNetwork::save_wifi_cache( const char *ssid, bool dhcp )
+{
+	memcpy( wifi_cache.bssid.data(), WiFi.BSSID(), wifi_cache.bssid.size() );
+	wifi_cache.channel = WiFi.channel();
+	wifi_cache.ip = static_cast<uint32_t>( wifi_sta_ip );
+	wifi_cache.gw = static_cast<uint32_t>( wifi_sta_gw );
+	wifi_cache.subnet = static_cast<uint32_t>( wifi_sta_subnet );
+	wifi_cache.dns = static_cast<uint32_t>( wifi_sta_dns );
+	wifi_cache.lease_ts = dhcp ? time( nullptr ) : 0;
+	wifi_cache.ssid_crc = crc32_le( 0, reinterpret_cast<const uint8_t *>( ssid ), strlen( ssid ));
+	wifi_cache.valid = true;
+}
+
+void AWSNetwork::set_wifi_sta_parameters( void )
+{
+	wifi_sta_ip = WiFi.localIP();
+	wifi_sta_subnet = WiFi.subnetMask();
+	wifi_sta_gw = WiFi.gatewayIP();
+	wifi_sta_dns = WiFi.dnsIP();
+	config->set_parameter( "run_wifi_sta_ip", wifi_sta_ip.toString().c_str() );
+	config->set_parameter( "run_wifi_sta_subnet", wifi_sta_subnet.toString().c_str() );
+	config->set_parameter( "run_wifi_sta_gw", wifi_sta_gw.toString().c_str() );
+}
+
 bool AWSNetwork::start_hotspot( void )
 {
 	const char	*ssid		= config->get_parameter<const char *>( "wifi_ap_ssid" );
@@ -432,6 +500,38 @@ bool AWSNetwork::start_hotspot( void )
 	return false;
 }
 
+void AWSNetwork::update_connect_stats( bool fast, uint32_t ms )
+{
+	wifi_connect_stats.last_connect_ms = ms;
+
+	if ( fast ) {
+
+		wifi_connect_stats.fast_connects++;
+		wifi_connect_stats.mean_fast_ms = wifi_connect_stats.mean_fast_ms ? ( 7 * wifi_connect_stats.mean_fast_ms + ms ) / 8 : ms;
+
+	} else {
+
+		wifi_connect_stats.full_connects++;
+		wifi_connect_stats.mean_full_ms = wifi_connect_stats.mean_full_ms ? ( 7 * wifi_connect_stats.mean_full_ms + ms ) / 8 : ms;
+	}
+
+	if ( debug_mode )
+		Serial.printf( "[NETWORK   ] [DEBUG] WiFi connected in %dms. Fast connections: %d/%d (mean %dms), full connections: %d (mean %dms), failures: %d.\n",
+			ms, wifi_connect_stats.fast_connects, wifi_connect_stats.fast_attempts, wifi_connect_stats.mean_fast_ms, wifi_connect_stats.full_connects,
+			wifi_connect_stats.mean_full_ms, wifi_connect_stats.failures );
+}
+
+bool AWSNetwork::wait_for_wifi( uint32_t timeout_ms, bool show_progress )
+{
+	for ( uint32_t elapsed = 0; ( WiFi.status() != WL_CONNECTED ) && ( elapsed < timeout_ms ); elapsed += WIFI_POLL_INTERVAL ) {
+
+		if ( show_progress && !( elapsed % 1000 ))
+			Serial.print( "." );
+		delay( WIFI_POLL_INTERVAL );
+	}
+	return ( WiFi.status() == WL_CONNECTED );
+}
+
 void AWSNetwork::webhook( const char *json_msg )
 {
 	// Placeholder for #155
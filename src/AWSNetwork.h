@@ -23,10 +23,40 @@
 
 #include <ESPping.h>
 
+// Kept in RTC memory to skip the scan and, while the lease is fresh, the DHCP exchange on the next connection
+struct wifi_cache_t {
+
+	bool					valid;
+	uint32_t				ssid_crc;
+	std::array<uint8_t,6>	bssid;
+	int32_t					channel;
+	uint32_t				ip;
+	uint32_t				gw;
+	uint32_t				subnet;
+	uint32_t				dns;
+	time_t					lease_ts;		// 0 with a fixed IP
+};
+
+struct wifi_connect_stats_t {
+
+	uint32_t	fast_attempts;
+	uint32_t	fast_connects;
+	uint32_t	full_connects;
+	uint32_t	failures;
+	uint32_t	last_connect_ms;
+	uint32_t	mean_fast_ms;
+	uint32_t	mean_full_ms;
+};
+
 class AWSNetwork {
 
 	private:
 
+		static constexpr uint32_t	FAST_CONNECT_TIMEOUT	= 3000;		// in ms
+		static constexpr uint32_t	FULL_CONNECT_TIMEOUT	= 10000;	// in ms
+		static constexpr time_t		LEASE_REUSE_MAX			= 3600;		// in s, well below usual DHCP lease times
+		static constexpr uint32_t	WIFI_POLL_INTERVAL		= 50;		// in ms
+
 		AWSConfig			*config;
 		aws_iface			current_pref_iface;
 		aws_wifi_mode		current_wifi_mode;
@@ -47,7 +77,12 @@ class AWSNetwork {
 		IPAddress			wifi_sta_ip;
 		IPAddress			wifi_sta_subnet;
 
+		bool connect_to_cached_ap( const char *, const char *, bool );
 		bool eth_post_content( const char *, etl::string<128> &, const char * );
+		void save_wifi_cache( const char *, bool );
+		void set_wifi_sta_parameters( void );
+		void update_connect_stats( bool, uint32_t );
+		bool wait_for_wifi( uint32_t, bool );
 		bool wifi_post_content( const char *, etl::string<128> &, const char * );
 
 	public:
@@ -55,6 +90,7 @@ class AWSNetwork {
 					AWSNetwork( void );
 		IPAddress	cidr_to_mask( byte cidr );
 		bool 		connect_to_wifi( void );
+		wifi_connect_stats_t	get_connect_stats( void );
 		IPAddress	get_ip( aws_iface );
 		IPAddress	get_gw( aws_iface );
 		IPAddress 	get_subnet( aws_iface );
@@ -17,12 +17,16 @@
 	with this program. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <esp_heap_caps.h>
+#include <esp_ota_ops.h>
 #include <esp_task_wdt.h>
 #include <AsyncUDP_ESP32_W5500.hpp>
 #include <ESPAsyncWebServer.h>
 #include <HTTPClient.h>
-#include <Update.h>
+#include <Preferences.h>
 #include <WiFi.h>
+#include <mbedtls/sha256.h>
+#include <rom/crc.h>
 
 #include "Embedded_Template_Library.h"
 #include "etl/string.h"
@@ -34,38 +38,48 @@
 extern bool	ota_update_ongoing;			// NOSONAR
 extern AstroWeatherStation	station;
 
+constexpr uint8_t	OTA_MAX_RESUMES		= 5;
+constexpr size_t	OTA_PROGRESS_STEP	= 64 * 1024;		// Between two NVS writes of the resume point
+constexpr uint16_t	OTA_STREAM_TIMEOUT	= 10000;			// in ms
+
 ota_status_t AWSOTA::check_for_update( const char *url, const char *root_ca, etl::string<26> &current_version, ota_action_t action = ota_action_t::CHECK_ONLY) {
 
 	ota_status_t ota_status;
 
-	if ( !download_json( url, root_ca )) {
-
-		ota_status = ota_status_t::HTTP_FAILED;
-		goto exit;
-	}
-
 	if (!aws_board_id.size() || !aws_config.size() || !aws_device_id.size()) {
 
 		ota_status = ota_status_t::CONFIG_ERROR;
 		goto exit;
 	}
 
-	for (auto ota_config : json_ota_config["Configurations"].as<JsonArray>()) {
-
-		if (is_profile_match(ota_config, current_version)) {
+	if ( !download_json( url, root_ca, current_version )) {
 
-			ota_status = handle_action(ota_config, root_ca, action);
-			break;
-		}
-    }
+		ota_status = ( http_status == 200 ) ? ota_status_t::JSON_PROBLEM : ota_status_t::HTTP_FAILED;
+		goto exit;
+	}
 
-	ota_status = ota_status_t::NO_UPDATE_PROFILE_FOUND;
+	if ( json_ota_config.isNull() )
+		ota_status = ota_status_t::NO_UPDATE_PROFILE_FOUND;
+	else
+		ota_status = handle_action( json_ota_config.as<JsonObject>(), root_ca, current_version, action );
 
 exit:
 	Serial.printf( "[OTA       ] [INFO ] Firmware OTA update result: (%d) %s.\n", ota_status, OTA_message( ota_status ));
 	return ota_status;
 }
 
+void AWSOTA::clear_progress( void )
+{
+	Preferences nvs;
+
+	if ( nvs.begin( "ota", false )) {
+
+		nvs.clear();
+		nvs.end();
+	}
+	download.saved = 0;
+}
+
 bool AWSOTA::is_profile_match( const JsonObject &ota_config, const etl::string<26> &current_version )
 {
 	etl::string<32> board;
@@ -91,8 +105,21 @@ bool AWSOTA::is_profile_match( const JsonObject &ota_config, const etl::string<2
            ( !version.size() || (version > current_version) );
 }
 
-ota_status_t AWSOTA::handle_action( const JsonObject &ota_config, const char *root_ca, ota_action_t action )
+// Deltas are only published for a few recent builds, each of them as a base
+JsonObject AWSOTA::find_delta( const JsonObject &ota_config, const etl::string<26> &current_version )
+{
+	for ( JsonObject delta : ota_config["Deltas"].as<JsonArray>() )
+		if ( delta["Base"].is<const char *>() && ( current_version == delta["Base"].as<const char *>() ))
+			return delta;
+
+	return JsonObject();
+}
+
+// A patch against the running build is tried first, the full image is the fallback
+ota_status_t AWSOTA::handle_action( const JsonObject &ota_config, const char *root_ca, const etl::string<26> &current_version, ota_action_t action )
 {
+	JsonObject	delta = find_delta( ota_config, current_version );
+
 	if ( action == ota_action_t::CHECK_ONLY )
 		return ota_status_t::UPDATE_AVAILABLE;
 
@@ -102,99 +129,222 @@ ota_status_t AWSOTA::handle_action( const JsonObject &ota_config, const char *ro
 		save_firmware_sha256(ota_config["SHA256"].as<const char *>());
 	}
 
-	if ( !do_ota_update( ota_config["URL"], root_ca, action ))
+	if ( !delta.isNull() ) {
+
+		if ( do_ota_update( delta, ota_config["SHA256"].as<const char *>(), root_ca, true, action ))
+			return ota_status_t::UPDATE_OK;
+		Serial.printf( "[OTA       ] [INFO ] Delta update failed, downloading the full image.\n" );
+	}
+
+	if ( !do_ota_update( ota_config, ota_config["SHA256"].as<const char *>(), root_ca, false, action ))
 		return ota_status_t::OTA_UPDATE_FAIL;
 
 	return ota_status_t::UPDATE_OK;
 }
 
-bool AWSOTA::do_ota_update( const char *url, const char *root_ca, ota_action_t action )
+// Interrupted downloads resume with a Range request where they stopped, compressed images are inflated on the fly.
+// 'image' is the manifest entry of the full image or of a delta, with its URL, SHA256 and Encoding, whichever it is
+// the result must match 'sha256', the one of the full (uncompressed) image.
+bool AWSOTA::do_ota_update( const JsonObject &image, const char *sha256, const char *root_ca, bool delta, ota_action_t action )
 {
-	HTTPClient	http;
-	
-	if ( !http.begin( url, root_ca )) {
+	std::unique_ptr<uint8_t[]>	buffer( new ( std::nothrow ) uint8_t[ buffer_size ] );
+	HTTPClient					http;
+	bool						done = false;
+	uint8_t						attempts = 0;
+	const char					*url = image["URL"];
 
-		status_code = ota_status_t::HTTP_FAILED;
-		return false;
+	if ( !url || !buffer || !start_download( image["SHA256"].is<const char *>() ? image["SHA256"].as<const char *>() : url, image["Encoding"] == "gzip", delta )) {
 
+		Serial.printf( "[OTA       ] [ERROR] Could not prepare firmware download.\n" );
+		status_code = ota_status_t::OTA_UPDATE_FAIL;
+		return false;
 	}
 
-	http_status = http.GET();
+	while ( !done && !download.failed && ( attempts++ <= OTA_MAX_RESUMES )) {
 
-	if ( http_status != 200 ) {
+		if ( attempts > 1 )
+			Serial.printf( "[OTA       ] [INFO ] Resuming firmware download at %d/%d bytes.\n", download.received, download.total );
+
+		if ( open_download( http, url, root_ca ))
+			done = receive_download( http, buffer.get() );
 
 		http.end();
+		esp_task_wdt_reset();
+	}
+
+	inflator.reset();
+	dictionary.reset();
+
+	if ( !done ) {
+
+		save_progress();
+		status_code = download.failed ? ota_status_t::WRITE_ERROR : ota_status_t::HTTP_FAILED;
 		return false;
 	}
 
-	int total_length = http.getSize();
+	Serial.printf( "[OTA       ] [INFO ] Firmware %s: %d bytes received, %d bytes written.\n", delta ? "patched" : "downloaded", download.received, download.written );
 
-	if ( !Update.begin( UPDATE_SIZE_UNKNOWN )) {
+	// Whatever the outcome, there is nothing left to resume
+	bool verified = verify_image( sha256, buffer.get() );
+	clear_progress();
+	if ( !verified ) {
+
+		status_code = ota_status_t::WRITE_ERROR;
+		return false;
+	}
+
+	// Also checks the image before making it bootable
+	if ( esp_ota_set_boot_partition( download.partition ) != ESP_OK ) {
 
-		http.end();
 		status_code = ota_status_t::OTA_UPDATE_FAIL;
 		return false;
 	}
 
-	std::array<uint8_t,1280>	buffer;
+	esp_task_wdt_reset();
+	delay( 1000 );
+	if ( action == ota_action_t::UPDATE_ONLY ) {
+
+		status_code = ota_status_t::UPDATE_OK;
+		return true;
+	}
+	ESP.restart();
+	return true;
+}
+
+// Decoded bytes of the download: either the image itself or a patch of the running one
+bool AWSOTA::consume( const uint8_t *data, size_t len )
+{
+	return download.delta ? patch_image( data, len ) : write_image( data, len );
+}
 
-	WiFiClient *stream = http.getStreamPtr();
+// The manifest is parsed straight from the stream, one profile at a time, and only the first one which applies to this
+// station is kept, without the fields the station does not use. json_ota_config is left empty when none applies.
+bool AWSOTA::download_json( const char *url, const char *root_ca, const etl::string<26> &current_version )
+{
+	HTTPClient		http;
+	JsonDocument	filter;
+	size_t			free_heap;
+	size_t			lowest_heap;
+	bool			more;
 
-	int offset = 0;
-	while ( http.connected() && offset < total_length ) {
+	json_ota_config.clear();
+	deserialisation_status = DeserializationError::Ok;
 
-		size_t	bytes_available = stream->available();
-		if ( bytes_available > 0 ) {
+	if ( !http.begin( url, root_ca )) {
 
-			size_t bytes_to_read = min( bytes_available, buffer.max_size() );
-			size_t bytes_read = stream->readBytes( buffer.data(), bytes_to_read );
-			esp_task_wdt_reset();
-			size_t bytes_written = Update.write( buffer.data(), bytes_read );
-			if ( bytes_read != bytes_written )
-				break;
-			offset += bytes_written;
-			if ( progress_callback != nullptr )
-				progress_callback( offset, total_length );
-		}
-		esp_task_wdt_reset();
+		status_code = ota_status_t::HTTP_FAILED;
+		return false;
 	}
 
-	esp_task_wdt_reset();
+	http.useHTTP10( true );		// No chunked transfer encoding in the way of the parser
+	if ( ( http_status = http.GET()) != 200 ) {
+
+		http.end();
+		return false;
+	}
+
+	for ( const char *key : { "Board", "Config", "Device", "Encoding", "SHA256", "URL", "Version" } )
+		filter[ key ] = true;
+	for ( const char *key : { "Base", "Encoding", "SHA256", "URL" } )
+		filter["Deltas"][0][ key ] = true;
+
+	free_heap = heap_caps_get_free_size( MALLOC_CAP_8BIT );
+	WiFiClient &stream = http.getStream();
+	more = stream.find( "\"Configurations\"" ) && stream.find( "[" );
+
+	while ( more ) {
+
+		while ( isspace( stream.peek() ))
+			stream.read();
+		if ( stream.peek() == ']' )
+			break;
+
+		if ( ( deserialisation_status = deserializeJson( json_ota_config, stream, DeserializationOption::Filter( filter ))) != DeserializationError::Ok )
+			break;
+
+		if ( is_profile_match( json_ota_config.as<JsonObject>(), current_version ))
+			break;
+
+		json_ota_config.clear();
+		more = stream.findUntil( ",", "]" );
+	}
+
+	// The low mark is since boot: the peak of the parse is exact when it went lower, an upper bound otherwise
+	lowest_heap = heap_caps_get_minimum_free_size( MALLOC_CAP_8BIT );
+	Serial.printf( "[OTA       ] [INFO ] Manifest parsed with %d bytes of heap held, %d at most while parsing (lowest free heap %d bytes).\n",
+		static_cast<int>( free_heap - heap_caps_get_free_size( MALLOC_CAP_8BIT )), static_cast<int>( free_heap - lowest_heap ), static_cast<int>( lowest_heap ));
 	http.end();
-	esp_task_wdt_reset();
 
-	if ( offset == total_length ) {
+	if ( deserialisation_status != DeserializationError::Ok ) {
 
-		Update.end( true );
-		esp_task_wdt_reset();
-		delay( 1000 );
-		if ( action == ota_action_t::UPDATE_ONLY ) {
+		Serial.printf( "[OTA       ] [ERROR] Invalid manifest (%s).\n", deserialisation_status.c_str() );
+		json_ota_config.clear();
+		return false;
+	}
+	return true;
+}
 
-			status_code = ota_status_t::UPDATE_OK;
-			return true;
+// Wrapping dictionary mode: the output goes through the 32KB dictionary, which is flushed to flash as it fills up
+bool AWSOTA::inflate( const uint8_t *data, size_t len )
+{
+	size_t			in_bytes;
+	size_t			out_bytes;
+	tinfl_status	status;
+
+	if ( download.gzip_header && !skip_gzip_header( data, len ))
+		return false;
+
+	while ( !download.inflated ) {
+
+		in_bytes = len;
+		out_bytes = TINFL_LZ_DICT_SIZE - download.dictionary_offset;
+		status = tinfl_decompress( inflator.get(), data, &in_bytes, dictionary.get(), dictionary.get() + download.dictionary_offset, &out_bytes,
+			( download.received < download.total ) ? TINFL_FLAG_HAS_MORE_INPUT : 0 );
+		data += in_bytes;
+		len -= in_bytes;
+
+		if ( out_bytes && !consume( dictionary.get() + download.dictionary_offset, out_bytes ))
+			return false;
+		download.dictionary_offset = ( download.dictionary_offset + out_bytes ) & ( TINFL_LZ_DICT_SIZE - 1 );
+
+		if ( status < TINFL_STATUS_DONE ) {
+
+			Serial.printf( "[OTA       ] [ERROR] Corrupted compressed firmware (%d).\n", status );
+			download.failed = true;
+			return false;
 		}
-		ESP.restart();
+
+		// The gzip trailer is left out, the image carries its own checksum
+		download.inflated = ( status == TINFL_STATUS_DONE );
+		if ( status == TINFL_STATUS_NEEDS_MORE_INPUT )
+			break;
 	}
-	
-	status_code = ota_status_t::WRITE_ERROR;
-	return false;
+	return true;
 }
 
-bool AWSOTA::download_json( const char *url, const char *root_ca )
+// Only uncompressed images can resume after a reboot, the inflator state does not survive it
+void AWSOTA::load_progress( void )
 {
-	HTTPClient	http;
+	Preferences nvs;
+	size_t		offset = 0;
+	size_t		total = 0;
 
-	if ( !http.begin( url, root_ca )) {
+	if ( !nvs.begin( "ota", true ))
+		return;
 
-		status_code = ota_status_t::HTTP_FAILED;
-		return false;
+	if (( nvs.getUInt( "image", 0 ) == download.image_id ) && ( nvs.getUInt( "partition", 0 ) == download.partition->address )) {
+
+		offset = nvs.getUInt( "offset", 0 );
+		total = nvs.getUInt( "total", 0 );
 	}
-	
-	if ( ( http_status = http.GET()) == 200 )
-		deserialisation_status = deserializeJson( json_ota_config, http.getString() );
+	nvs.end();
 
-	http.end();
-	return (( http_status == 200 ) && ( deserialisation_status == DeserializationError::Ok ));
+	if ( offset && ( offset < total )) {
+
+		Serial.printf( "[OTA       ] [INFO ] Resuming interrupted firmware download at %d/%d bytes.\n", offset, total );
+		download.received = download.written = download.erased = download.saved = offset;
+		download.total = total;
+	}
 }
 
 const char *AWSOTA::OTA_message( ota_status_t code )
@@ -235,6 +385,184 @@ const char *AWSOTA::OTA_message( ota_status_t code )
 	return "Unhandled OTA status code";
 }
 
+// A partial answer must start where the download stopped and be part of the same file
+bool AWSOTA::open_download( HTTPClient &http, const char *url, const char *root_ca )
+{
+	const char		*headers[] = { "Content-Range" };
+	etl::string<32>	range;
+	unsigned int	first;
+	unsigned int	last;
+	unsigned int	total;
+
+	if ( !http.begin( url, root_ca ))
+		return false;
+
+	http.setTimeout( OTA_STREAM_TIMEOUT );
+	if ( download.received ) {
+
+		snprintf( range.data(), range.capacity(), "bytes=%d-", download.received );
+		http.addHeader( "Range", range.data() );
+	}
+
+	http.collectHeaders( headers, 1 );
+	http_status = http.GET();
+
+	if ( download.received && ( http_status == 206 )) {
+
+		if (( sscanf( http.header( "Content-Range" ).c_str(), "bytes %u-%u/%u", &first, &last, &total ) == 3 ) && ( first == download.received ) && ( total == download.total ))
+			return true;
+
+		Serial.printf( "[OTA       ] [INFO ] Partial content does not match the interrupted download, restarting from scratch.\n" );
+		reset_download();
+		clear_progress();
+		return false;
+	}
+
+	if ( http_status != 200 )
+		return false;
+
+	if ( download.received ) {
+
+		Serial.printf( "[OTA       ] [INFO ] Server does not support resuming downloads, restarting from scratch.\n" );
+		reset_download();
+	}
+
+	if ( http.getSize() <= 0 ) {
+
+		Serial.printf( "[OTA       ] [ERROR] Firmware size is unknown.\n" );
+		download.failed = true;
+		return false;
+	}
+
+	download.total = http.getSize();
+	return true;
+}
+
+bool AWSOTA::patch_image( const uint8_t *data, size_t len )
+{
+	std::array<uint8_t,256>	base_chunk;
+	size_t					n;
+	size_t					expected;
+
+	while ( true ) {
+
+		if (( patch.state == delta_state_t::DIFF ) && !patch.diff_left )
+			patch.state = delta_state_t::EXTRA;
+
+		if (( patch.state == delta_state_t::EXTRA ) && !patch.extra_left ) {
+
+			patch.base_pos += patch.seek;
+			patch.state = delta_state_t::CONTROL;
+		}
+
+		if ( !len || ( download.written == patch.new_size && patch.state == delta_state_t::CONTROL ))
+			return true;
+
+		switch ( patch.state ) {
+
+			case delta_state_t::HEADER:
+			case delta_state_t::CONTROL:
+				expected = ( patch.state == delta_state_t::HEADER ) ? OTA_DELTA_HEADER_SIZE : OTA_DELTA_CONTROL_SIZE;
+				n = std::min( len, expected - patch.buffered );
+				memcpy( patch.buffer.data() + patch.buffered, data, n );
+				patch.buffered += n;
+				if ( patch.buffered < expected )
+					break;
+
+				patch.buffered = 0;
+				if ( patch.state == delta_state_t::HEADER ) {
+
+					if ( !start_patch() )
+						return false;
+					patch.state = delta_state_t::CONTROL;
+					break;
+				}
+
+				memcpy( &patch.diff_left, patch.buffer.data(), 4 );
+				memcpy( &patch.extra_left, patch.buffer.data() + 4, 4 );
+				memcpy( &patch.seek, patch.buffer.data() + 8, 4 );
+				patch.state = delta_state_t::DIFF;
+				break;
+
+			case delta_state_t::DIFF:
+				n = std::min( { len, static_cast<size_t>( patch.diff_left ), base_chunk.size() } );
+				if (( patch.base_pos < 0 ) || ( patch.base_pos + n > patch.base_size ) || ( esp_partition_read( patch.base, patch.base_pos, base_chunk.data(), n ) != ESP_OK )) {
+
+					Serial.printf( "[OTA       ] [ERROR] Firmware patch reads outside of the running image.\n" );
+					download.failed = true;
+					return false;
+				}
+				for ( size_t i = 0; i < n; i++ )
+					base_chunk[ i ] += data[ i ];
+				if ( !write_image( base_chunk.data(), n ))
+					return false;
+				patch.base_pos += n;
+				patch.diff_left -= n;
+				break;
+
+			case delta_state_t::EXTRA:
+				n = std::min( len, static_cast<size_t>( patch.extra_left ));
+				if ( !write_image( data, n ))
+					return false;
+				patch.extra_left -= n;
+				break;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+// Returns true when the whole image is in the partition, false when the transfer stopped before
+bool AWSOTA::receive_download( HTTPClient &http, uint8_t *buffer )
+{
+	WiFiClient	*stream = http.getStreamPtr();
+	size_t		bytes_read;
+
+	while ( download.received < download.total ) {
+
+		bytes_read = stream->readBytes( buffer, std::min( buffer_size, download.total - download.received ));
+		esp_task_wdt_reset();
+		if ( !bytes_read )
+			return false;
+
+		download.received += bytes_read;
+		if ( download.compressed ? !inflate( buffer, bytes_read ) : !consume( buffer, bytes_read ))
+			return false;
+
+		if (( download.written - download.saved ) >= OTA_PROGRESS_STEP )
+			save_progress();
+
+		if ( progress_callback != nullptr )
+			progress_callback( download.received, download.total );
+	}
+
+	if ( download.compressed && !download.inflated ) {
+
+		Serial.printf( "[OTA       ] [ERROR] Truncated compressed firmware.\n" );
+		download.failed = true;
+		return false;
+	}
+
+	if ( download.delta && ( download.written != patch.new_size )) {
+
+		Serial.printf( "[OTA       ] [ERROR] Truncated firmware patch (%d/%d bytes).\n", download.written, patch.new_size );
+		download.failed = true;
+		return false;
+	}
+	return true;
+}
+
+void AWSOTA::reset_download( void )
+{
+	download.received = download.written = download.erased = download.dictionary_offset = 0;
+	download.gzip_header = download.compressed;
+	download.inflated = false;
+	if ( inflator )
+		tinfl_init( inflator.get() );
+	patch.state = delta_state_t::HEADER;
+	patch.buffered = 0;
+}
+
 void AWSOTA::save_firmware_sha256( const char *sha256 )
 {
 	Preferences nvs;
@@ -256,6 +584,23 @@ void AWSOTA::save_firmware_sha256( const char *sha256 )
 	station.send_alarm( "[Station] OTA NVS", "Could not save firmware SHA256 on NVS" );
 }
 
+// Sector aligned, anything written past that point is erased again when resuming
+void AWSOTA::save_progress( void )
+{
+	Preferences nvs;
+	size_t		offset = download.written & ~( SPI_FLASH_SEC_SIZE - 1 );
+
+	if ( download.compressed || download.delta || ( offset == download.saved ) || !nvs.begin( "ota", false ))
+		return;
+
+	nvs.putUInt( "image", download.image_id );
+	nvs.putUInt( "partition", download.partition->address );
+	nvs.putUInt( "offset", offset );
+	nvs.putUInt( "total", download.total );
+	nvs.end();
+	download.saved = offset;
+}
+
 void AWSOTA::set_aws_board_id( etl::string<24> &board )
 {
 	aws_board_id = etl::string_view( board.data() );
@@ -275,3 +620,185 @@ void AWSOTA::set_aws_device_id( etl::string<18> &device )
 {
 	aws_device_id = etl::string_view( device.data() );
 }
+
+void AWSOTA::set_buffer_size( size_t size )
+{
+	buffer_size = std::clamp( size, OTA_MIN_BUFFER_SIZE, OTA_MAX_BUFFER_SIZE );
+}
+
+// The header must fit in the first chunk, which is always the case with the usual FNAME only
+bool AWSOTA::skip_gzip_header( const uint8_t *&data, size_t &len )
+{
+	size_t	header_len = 10;
+
+	if (( len < header_len ) || ( data[0] != 0x1f ) || ( data[1] != 0x8b ) || ( data[2] != 8 )) {
+
+		Serial.printf( "[OTA       ] [ERROR] Firmware is not gzip compressed.\n" );
+		download.failed = true;
+		return false;
+	}
+
+	if ( data[3] & 0x04 )													// FEXTRA
+		header_len += 2 + (( len >= 12 ) ? ( data[10] | ( data[11] << 8 )) : len );
+	for ( uint8_t flag : { 0x08, 0x10 } )									// FNAME, FCOMMENT
+		if ( data[3] & flag ) {
+
+			while (( header_len < len ) && data[ header_len ] )
+				header_len++;
+			header_len++;
+		}
+	if ( data[3] & 0x02 )													// FHCRC
+		header_len += 2;
+
+	if ( header_len > len ) {
+
+		Serial.printf( "[OTA       ] [ERROR] gzip header is too large.\n" );
+		download.failed = true;
+		return false;
+	}
+
+	data += header_len;
+	len -= header_len;
+	download.gzip_header = false;
+	return true;
+}
+
+bool AWSOTA::start_download( const char *image_id, bool compressed, bool delta )
+{
+	download = {};
+	patch = {};
+	if ( !( download.partition = esp_ota_get_next_update_partition( nullptr ))) {
+
+		Serial.printf( "[OTA       ] [ERROR] No OTA partition.\n" );
+		return false;
+	}
+
+	download.image_id = crc32_le( 0, reinterpret_cast<const uint8_t *>( image_id ), strlen( image_id ));
+	download.compressed = download.gzip_header = compressed;
+	download.delta = delta;
+
+	if ( delta && !( patch.base = esp_ota_get_running_partition() ))
+		return false;
+
+	if ( !compressed && !delta ) {
+
+		load_progress();
+		return true;
+	}
+
+	// The partition is about to be overwritten, an older resume point would not hold any more
+	clear_progress();
+	if ( !compressed )
+		return true;
+
+	inflator.reset( new ( std::nothrow ) tinfl_decompressor );
+	dictionary.reset( new ( std::nothrow ) uint8_t[ TINFL_LZ_DICT_SIZE ] );
+	if ( !inflator || !dictionary )
+		return false;
+
+	tinfl_init( inflator.get() );
+	return true;
+}
+
+// The patch must have been made against the very image which is running
+bool AWSOTA::start_patch( void )
+{
+	std::array<uint8_t,32>	sha_256;
+
+	if ( memcmp( patch.buffer.data(), OTA_DELTA_MAGIC, 8 )) {
+
+		Serial.printf( "[OTA       ] [ERROR] Not a firmware patch.\n" );
+		download.failed = true;
+		return false;
+	}
+
+	memcpy( &patch.base_size, patch.buffer.data() + 8, 4 );
+	memcpy( &patch.new_size, patch.buffer.data() + 12, 4 );
+	esp_partition_get_sha256( patch.base, sha_256.data() );
+
+	if (( patch.base_size > patch.base->size ) || memcmp( patch.buffer.data() + 16, sha_256.data(), sha_256.size() )) {
+
+		Serial.printf( "[OTA       ] [ERROR] Firmware patch does not apply to the running image.\n" );
+		download.failed = true;
+		return false;
+	}
+
+	if ( patch.new_size > download.partition->size ) {
+
+		Serial.printf( "[OTA       ] [ERROR] Patched firmware does not fit in the OTA partition.\n" );
+		download.failed = true;
+		return false;
+	}
+	return true;
+}
+
+// The image is read back from the partition, whether it was downloaded, inflated or patched
+bool AWSOTA::verify_image( const char *sha256, uint8_t *buffer )
+{
+	mbedtls_sha256_context	context;
+	std::array<uint8_t,32>	digest;
+	etl::string<64>			digest_hex;
+	size_t					len;
+	bool					ok = true;
+
+	if ( !sha256 || ( strlen( sha256 ) != digest_hex.capacity() )) {
+
+		Serial.printf( "[OTA       ] [WARN ] No SHA256 for the firmware in the manifest, cannot verify it.\n" );
+		return true;
+	}
+
+	mbedtls_sha256_init( &context );
+	mbedtls_sha256_starts( &context, 0 );
+	for ( size_t offset = 0; ok && ( offset < download.written ); offset += len ) {
+
+		len = std::min( buffer_size, download.written - offset );
+		if (( ok = ( esp_partition_read( download.partition, offset, buffer, len ) == ESP_OK )))
+			mbedtls_sha256_update( &context, buffer, len );
+		esp_task_wdt_reset();
+	}
+	mbedtls_sha256_finish( &context, digest.data() );
+	mbedtls_sha256_free( &context );
+
+	for ( uint8_t b : digest ) {
+
+		std::array<char,3> h;
+		snprintf( h.data(), h.size(), "%02x", b );
+		digest_hex += h.data();
+	}
+
+	if ( !ok || strcasecmp( digest_hex.data(), sha256 )) {
+
+		Serial.printf( "[OTA       ] [ERROR] Firmware in the OTA partition does not match the manifest SHA256.\n" );
+		return false;
+	}
+	return true;
+}
+
+// Sectors are erased just ahead of the data
+bool AWSOTA::write_image( const uint8_t *data, size_t len )
+{
+	if ( download.written + len > download.partition->size ) {
+
+		Serial.printf( "[OTA       ] [ERROR] Firmware does not fit in the OTA partition.\n" );
+		download.failed = true;
+		return false;
+	}
+
+	while ( download.erased < download.written + len ) {
+
+		if ( esp_partition_erase_range( download.partition, download.erased, SPI_FLASH_SEC_SIZE ) != ESP_OK ) {
+
+			download.failed = true;
+			return false;
+		}
+		download.erased += SPI_FLASH_SEC_SIZE;
+	}
+
+	if ( esp_partition_write( download.partition, download.written, data, len ) != ESP_OK ) {
+
+		download.failed = true;
+		return false;
+	}
+	download.written += len;
+	return true;
+}
@@ -22,6 +22,11 @@
 #define _AWSOTA_h
 
 #include <ArduinoJson.h>
+#include <esp_partition.h>
+#include <rom/miniz.h>
+#include <memory>
+
+class HTTPClient;
 
 enum struct ota_action_t: int {
 
@@ -44,6 +49,55 @@ enum struct ota_status_t : int {
 	UNKNOWN = 6
 };
 
+constexpr size_t	OTA_DEFAULT_BUFFER_SIZE	= 4096;
+constexpr size_t	OTA_MIN_BUFFER_SIZE		= 1024;
+constexpr size_t	OTA_MAX_BUFFER_SIZE		= 16384;
+
+constexpr char		OTA_DELTA_MAGIC[]		= "AWSDELTA";
+constexpr size_t	OTA_DELTA_HEADER_SIZE	= 48;
+constexpr size_t	OTA_DELTA_CONTROL_SIZE	= 12;
+
+enum struct delta_state_t : uint8_t {
+
+	HEADER,
+	CONTROL,
+	DIFF,
+	EXTRA
+};
+
+// Streaming patch of the running image into the OTA partition, the format is described in tools/ota_delta.py
+struct ota_patch_t {
+
+	delta_state_t			state;
+	std::array<uint8_t,OTA_DELTA_HEADER_SIZE>	buffer;		// Header or control block being assembled
+	size_t					buffered;
+	const esp_partition_t	*base;
+	uint32_t				base_size;
+	uint32_t				new_size;
+	int64_t					base_pos;
+	uint32_t				diff_left;
+	uint32_t				extra_left;
+	int32_t					seek;
+};
+
+// One firmware download, which may span several HTTP requests (and reboots for plain images)
+struct ota_download_t {
+
+	const esp_partition_t	*partition;
+	uint32_t				image_id;			// CRC of the SHA256 announced in the manifest, or of the URL
+	bool					compressed;			// gzip
+	bool					delta;				// Patch of the running image
+	bool					gzip_header;		// Still to be skipped
+	bool					inflated;			// End of the deflate stream reached
+	bool					failed;				// Not worth resuming
+	size_t					received;			// From the URL, next Range request starts from there
+	size_t					total;				// Size of the whole download
+	size_t					written;			// Into the partition
+	size_t					erased;
+	size_t					saved;				// Last resume point saved to NVS
+	size_t					dictionary_offset;
+};
+
 class AWSOTA {
 
 	public:
@@ -53,6 +107,7 @@ class AWSOTA {
 		void			set_aws_board_id( etl::string<24> & );
 		void			set_aws_config( etl::string<32> & );
 		void			set_aws_device_id( etl::string<18> & );
+		void			set_buffer_size( size_t );
 		void			set_progress_callback( std::function<void(int, int)> );
 
 	private:
@@ -60,18 +115,38 @@ class AWSOTA {
 		etl::string_view				aws_board_id;
 		etl::string_view				aws_config;
 		etl::string_view				aws_device_id;
+		size_t							buffer_size				= OTA_DEFAULT_BUFFER_SIZE;
+		std::unique_ptr<uint8_t[]>		dictionary;
+		ota_download_t					download;
+		ota_patch_t						patch;
 		DeserializationError			deserialisation_status;
 		int								http_status;
+		std::unique_ptr<tinfl_decompressor>	inflator;
 		JsonDocument					json_ota_config;
 	    std::function<void (int, int)>	progress_callback		= nullptr;
 		ota_status_t					status_code				= ota_status_t::UNKNOWN;
 
-		bool	do_ota_update( const char *, const char *, ota_action_t );
-		bool	download_json( const char *, const char * );
-		ota_status_t	handle_action( const JsonObject &, const char *, ota_action_t );
+		void	clear_progress( void );
+		bool	consume( const uint8_t *, size_t );
+		bool	do_ota_update( const JsonObject &, const char *, const char *, bool, ota_action_t );
+		bool	download_json( const char *, const char *, const etl::string<26> & );
+		JsonObject		find_delta( const JsonObject &, const etl::string<26> & );
+		ota_status_t	handle_action( const JsonObject &, const char *, const etl::string<26> &, ota_action_t );
+		bool			inflate( const uint8_t *, size_t );
 		bool			is_profile_match( const JsonObject &, const etl::string<26> & );
+		void			load_progress( void );
 		const char		*OTA_message( ota_status_t );
+		bool	open_download( HTTPClient &, const char *, const char * );
+		bool	patch_image( const uint8_t *, size_t );
+		bool	receive_download( HTTPClient &, uint8_t * );
+		void	reset_download( void );
 		void	save_firmware_sha256( const char * );
+		void	save_progress( void );
+		bool	skip_gzip_header( const uint8_t *&, size_t & );
+		bool	start_download( const char *, bool, bool );
+		bool	start_patch( void );
+		bool	verify_image( const char *, uint8_t * );
+		bool	write_image( const uint8_t *, size_t );
 
 };
 
@@ -17,6 +17,7 @@
 	with this program. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <esp_heap_caps.h>
 #include <esp_task_wdt.h>
 #include <ArduinoJson.h>
 #include <Ethernet.h>
@@ -24,167 +25,434 @@
 #include <ESPAsyncWebServer.h>
 #include <HTTPClient.h>
 #include <LittleFS.h>
+#include <Preferences.h>
+#include <mbedtls/sha256.h>
 #include "Embedded_Template_Library.h"
 #include "etl/string.h"
 
 #include "AWSUpdater.h"
 
-int AWSUpdater::download_file( const char *root_ca, const char *server, const char *path, const char *package, const char *filename, const char *hash )
+// The manifest is only downloaded again when it changed since the last successful check with the same firmware,
+// then parsed straight from the stream, one package at a time, until the first applicable one
+bool AWSUpdater::check_for_new_files( const char *current_version, const char *root_ca, const char *server, const char *path )
 {
-	etl::string<128>	end_point;
-	File				file;
-	HTTPClient 			http;
-	uint8_t				http_code;
-	etl::string<64>		local_filename;
+	int									http_code;
+	HTTPClient 							http;
+	ArduinoJson::DeserializationError 	ret = DeserializationError::Ok;
+	JsonDocument						filter;
+	JsonDocument						package;
+	etl::string<128>					end_point;
+	size_t								free_heap;
+	size_t								lowest_heap;
+	bool								found = false;
+	bool								more;
+	Preferences							nvs;
+	etl::string<64>						etag;
+	etl::string<32>						last_modified;
+	etl::string<32>						version;
+	const char							*headers[] = { "ETag", "Last-Modified" };
 
 	end_point = "https://";
 	end_point += server;
 	end_point += "/";
 	end_point += path;
 	end_point += "/";
-	end_point += package;
-	end_point += filename;
+	end_point += "ota_file_packages.json";
 
-	local_filename = filename;
-	local_filename += ".tmp";
+	Serial.printf( "[UPDATER   ] [INFO ] Checking availability of file package update.\n" );
 
-	if ( LittleFS.exists( local_filename.data() ))
-		LittleFS.remove( local_filename.data() );
+	if (!LittleFS.begin()) {
 
-	Serial.printf( "[UPDATER   ] [INFO ] Downloading file [%s] from update package [%s].\n", filename, package );
+    	Serial.printf( "[UPDATER   ] [ERROR] Cannot access flash storage, aborting!\n" );
+		return false;
+	}
+
+	finish_pending_swap();
 
 	if ( !http.begin( end_point.data(), root_ca )) {
 
-       	Serial.printf( "[UPDATER   ] [ERROR] Cannot connect to file packager server, aborting.\n" );
+       	Serial.printf( "[UPDATER   ] [ERROR] Cannot connect to file package server, aborting.\n" );
 		return false;
 
 	}
 
 	http.setFollowRedirects( HTTPC_FORCE_FOLLOW_REDIRECTS );
-	esp_task_wdt_reset();
+	http.useHTTP10( true );		// No chunked transfer encoding in the way of the parser
+	http.collectHeaders( headers, 2 );
+
+	if ( nvs.begin( "updater", true )) {
+
+		if ( nvs.getString( "version", version.data(), version.capacity() ) && !strcmp( version.data(), current_version )) {
+
+			if ( nvs.getString( "etag", etag.data(), etag.capacity() ) && *etag.data() )
+				http.addHeader( "If-None-Match", etag.data() );
+			if ( nvs.getString( "modified", last_modified.data(), last_modified.capacity() ) && *last_modified.data() )
+				http.addHeader( "If-Modified-Since", last_modified.data() );
+		}
+		nvs.end();
+	}
+
 	http_code = http.GET();
-	esp_task_wdt_reset();
-	if ( http_code != 200 ) {
+	if ( http_code == 304 ) {
 
-       	Serial.printf( "[UPDATER   ] [ERROR] Cannot download file from server (error code: %d), aborting.\n", http_code );
+		Serial.printf( "[UPDATER   ] [INFO ] File package manifest has not changed.\n" );
 		http.end();
-		return false;
+		return true;
 	}
 
-	if ( http.getSize() >= fs_free_space() ) {
+	if ( http_code != 200 ) {
 
-		Serial.printf( "[UPDATER   ] [ERROR] No space left to save file, aborting.\n" );
+       	Serial.printf( "[UPDATER   ] [ERROR] Could not retrive file package manifest (error code: %d), aborting.\n", http_code );
 		http.end();
 		return false;
+
 	}
 
-	esp_task_wdt_reset();
-	file = LittleFS.open( local_filename.data(), FILE_WRITE );
-	if ( file ) {
+	etag = http.header( "ETag" ).c_str();
+	last_modified = http.header( "Last-Modified" ).c_str();
 
-		int sz = http.writeToStream( &file );
-		http.end();
-		file.close();
-		file = LittleFS.open( local_filename.data(), FILE_READ );
-		int sz2 = file.size();
-		file.close();
-		if ( sz == sz2 ) {
-
-			LittleFS.remove( filename );
-			LittleFS.rename( local_filename.data(), filename );
-			Serial.printf( "[UPDATER   ] [INFO ] New version of file [%s] has been installed.\n", filename );
-			return true;
+	filter["min_version"] = true;
+	filter["id"] = true;
+	filter["files"] = true;
+
+	free_heap = heap_caps_get_free_size( MALLOC_CAP_8BIT );
+	WiFiClient &stream = http.getStream();
+	more = stream.find( "\"packages\"" ) && stream.find( "[" );
+
+	while ( more ) {
+
+		while ( isspace( stream.peek() ))
+			stream.read();
+		if ( stream.peek() == ']' )
+			break;
 
+		if ( ( ret = deserializeJson( package, stream, DeserializationOption::Filter( filter ))) != DeserializationError::Ok )
+			break;
+
+		if ( package["min_version"].is<const char *>() && ( strcmp( current_version, package["min_version"].as<const char *>() ) < 0 )) {
+
+			found = true;
+			break;
 		}
-		Serial.printf( "[UPDATER   ] [ERROR] New version of file [%s] could not be installed.\n", filename );
-		LittleFS.remove( local_filename.data() );
+		more = stream.findUntil( ",", "]" );
+	}
+
+	// Same figures as AWSOTA::download_json(), the low mark is since boot
+	lowest_heap = heap_caps_get_minimum_free_size( MALLOC_CAP_8BIT );
+	Serial.printf( "[UPDATER   ] [INFO ] Manifest parsed with %d bytes of heap held, %d at most while parsing (lowest free heap %d bytes).\n",
+		static_cast<int>( free_heap - heap_caps_get_free_size( MALLOC_CAP_8BIT )), static_cast<int>( free_heap - lowest_heap ), static_cast<int>( lowest_heap ));
+	http.end();
+
+	if ( ret != DeserializationError::Ok ) {
+
+		Serial.printf( "[UPDATER   ] [ERROR] Problem with manifest file (error: %s), aborting!\n", ret.c_str() );
 		return false;
 
 	}
 
-	esp_task_wdt_reset();
-	Serial.printf( "[UPDATER   ] [ERROR] Cannot create new version of file [%s].\n", filename );
-	esp_task_wdt_reset();
-	http.end();
-	return false;
+	if ( found ) {
+
+		Serial.printf( "[UPDATER   ] [INFO ] Found applicable file package [%s]\n", package["id"].as<const char *>() );
+		if ( !download_package( root_ca, server, path, package["id"], package["files"] ))
+			return false;
+
+	} else
+
+		Serial.printf( "[UPDATER   ] [INFO ] No applicable file package found.\n" );
+
+	// Only remembered once the files match the manifest, so that a failed update is tried again
+	if ( nvs.begin( "updater", false )) {
+
+		nvs.putString( "version", current_version );
+		nvs.putString( "etag", etag.data() );
+		nvs.putString( "modified", last_modified.data() );
+		nvs.end();
+	}
+	return true;
 }
 
-bool AWSUpdater::check_for_new_files( const char *current_version, const char *root_ca, const char *server, const char *path )
+// The new version goes to a temporary file, hashed on its way to flash
+bool AWSUpdater::download_file( const char *root_ca, const char *server, const char *path, const char *package, const char *filename, const char *hash )
 {
-	uint8_t								http_code;
-	HTTPClient 							http;
-	ArduinoJson::DeserializationError 	ret;
-	JsonDocument						json;
-	etl::string<128>					end_point;
+	std::array<uint8_t,1024>	buffer;
+	std::array<uint8_t,32>		digest;
+	etl::string<128>			end_point;
+	File						file;
+	HTTPClient 					http;
+	int							http_code;
+	updater_filename_t			local_filename;
+	mbedtls_sha256_context		sha256;
+	etl::string<64>				sha256_hex;
+	int							remaining;
+	size_t						bytes_read;
 
 	end_point = "https://";
 	end_point += server;
 	end_point += "/";
 	end_point += path;
 	end_point += "/";
-	end_point += "ota_file_packages.json";
+	end_point += package;
+	end_point += filename;
 
-	Serial.printf( "[UPDATER   ] [INFO ] Checking availability of file package update.\n" );
+	local_filename = filename;
+	local_filename += ".tmp";
+
+	if ( LittleFS.exists( local_filename.data() ))
+		LittleFS.remove( local_filename.data() );
+
+	Serial.printf( "[UPDATER   ] [INFO ] Downloading file [%s] from update package [%s].\n", filename, package );
 
 	if ( !http.begin( end_point.data(), root_ca )) {
 
-       	Serial.printf( "[UPDATER   ] [ERROR] Cannot connect to file package server, aborting.\n" );
+       	Serial.printf( "[UPDATER   ] [ERROR] Cannot connect to file packager server, aborting.\n" );
 		return false;
 
 	}
 
 	http.setFollowRedirects( HTTPC_FORCE_FOLLOW_REDIRECTS );
+	http.useHTTP10( true );
+	esp_task_wdt_reset();
 	http_code = http.GET();
+	esp_task_wdt_reset();
 	if ( http_code != 200 ) {
 
-       	Serial.printf( "[UPDATER   ] [ERROR] Could not retrive file package manifest (error code: %d), aborting.\n", http_code );
+       	Serial.printf( "[UPDATER   ] [ERROR] Cannot download file from server (error code: %d), aborting.\n", http_code );
 		http.end();
 		return false;
+	}
+
+	if ( ( remaining = http.getSize() ) >= static_cast<int>( fs_free_space() )) {
 
+		Serial.printf( "[UPDATER   ] [ERROR] No space left to save file, aborting.\n" );
+		http.end();
+		return false;
 	}
 
-	if ( ( ret = deserializeJson( json, http.getString() )) != DeserializationError::Ok ) {
+	esp_task_wdt_reset();
+	if ( !( file = LittleFS.open( local_filename.data(), FILE_WRITE ))) {
 
-		Serial.printf( "[UPDATER   ] [ERROR] Problem with manifest file (error: %d), aborting!\n", ret );
+		Serial.printf( "[UPDATER   ] [ERROR] Cannot create new version of file [%s].\n", filename );
 		http.end();
 		return false;
+	}
+
+	mbedtls_sha256_init( &sha256 );
+	mbedtls_sha256_starts( &sha256, 0 );
+	WiFiClient *stream = http.getStreamPtr();
+
+	// Without Content-Length the file ends with the connection
+	while (( remaining > 0 ) || (( remaining < 0 ) && http.connected() )) {
+
+		bytes_read = stream->readBytes( buffer.data(), ( remaining > 0 ) ? std::min<size_t>( remaining, buffer.size() ) : buffer.size() );
+		esp_task_wdt_reset();
+		if ( !bytes_read )
+			break;
+		if ( file.write( buffer.data(), bytes_read ) != bytes_read ) {
 
+			remaining = 1;
+			break;
+		}
+		mbedtls_sha256_update( &sha256, buffer.data(), bytes_read );
+		if ( remaining > 0 )
+			remaining -= bytes_read;
 	}
 
+	mbedtls_sha256_finish( &sha256, digest.data() );
+	mbedtls_sha256_free( &sha256 );
 	http.end();
+	file.close();
 
-	if (!LittleFS.begin()) {
+	for ( uint8_t b : digest ) {
 
-    	Serial.printf( "[UPDATER   ] [ERROR] Cannot access flash storage, aborting!\n" );
+		etl::string<3> h;
+		snprintf( h.data(), 3, "%02x", b );
+		sha256_hex += h.data();
+	}
+
+	if ( strlen( hash ) != sha256_hex.size() )
+		Serial.printf( "[UPDATER   ] [WARN ] No SHA256 for file [%s] in the manifest, cannot verify it.\n", filename );
+
+	if (( remaining > 0 ) || (( strlen( hash ) == sha256_hex.size() ) && strcasecmp( sha256_hex.data(), hash ))) {
+
+		Serial.printf( "[UPDATER   ] [ERROR] New version of file [%s] is incomplete or corrupted.\n", filename );
+		LittleFS.remove( local_filename.data() );
 		return false;
 	}
 
-	JsonArray packages = json["packages"];
-	for( JsonObject package : packages ) {
+	return true;
+}
 
-		const char *mv = package["min_version"];
-		if ( strcmp( current_version, mv ) < 0 ) {
+// Only the files whose hash changed are downloaded, and none of them is installed unless all of them made it
+bool AWSUpdater::download_package( const char *root_ca, const char *server, const char *path, const char *id, JsonArray files )
+{
+	etl::vector<updater_filename_t,UPDATER_MAX_FILES>	changed;
+	File												pending;
+	updater_filename_t									tmp_filename;
+	bool												ok = true;
 
-			Serial.printf( "[UPDATER   ] [INFO ] Found applicable file package [%s]\n", package["id"] );
-			download_package( root_ca, server, path, package["id"], package["files"] );
-			return true;
+	for( JsonObject file_item : files )
+		for( JsonPair file : file_item ) {
+
+			if ( is_up_to_date( file.key().c_str(), file.value().as<const char *>() ))
+				continue;
+
+			if ( changed.full() || !download_file( root_ca, server, path, id, file.key().c_str(), file.value().as<const char *>() )) {
 
+				ok = false;
+				break;
+			}
+			changed.emplace_back( file.key().c_str() );
 		}
+
+	if ( !ok ) {
+
+		for ( const auto &filename : changed ) {
+
+			tmp_filename = filename;
+			tmp_filename += ".tmp";
+			LittleFS.remove( tmp_filename.data() );
+		}
+		Serial.printf( "[UPDATER   ] [ERROR] File package [%s] could not be downloaded, keeping the current files.\n", id );
+		return false;
 	}
 
-	Serial.printf( "[UPDATER   ] [INFO ] No applicable file package found.\n" );
+	if ( debug_mode )
+		Serial.printf( "[UPDATER   ] [DEBUG] %d file(s) of package [%s] changed.\n", changed.size(), id );
+
+	write_index( files );
+
+	// Once the pending list is renamed into place, the swap completes even if interrupted
+	tmp_filename = PENDING_FILE;
+	tmp_filename += ".tmp";
+	pending = LittleFS.open( tmp_filename.data(), FILE_WRITE );
+	for ( const auto &filename : changed )
+		pending.printf( "%s\n", filename.data() );
+	pending.close();
+	LittleFS.rename( tmp_filename.data(), PENDING_FILE );
+
+	finish_pending_swap();
 	return true;
 }
 
-void AWSUpdater::download_package( const char *root_ca, const char *server, const char *path, const char *id, JsonArray files )
+bool AWSUpdater::file_sha256( const char *filename, etl::string<64> &sha256_hex )
 {
-	for( JsonObject file_item : files )
-		for( JsonPair file : file_item )
-			download_file( root_ca, server, path, id, file.key().c_str(), file.value().as<const char *>() );
+	std::array<uint8_t,512>	buffer;
+	std::array<uint8_t,32>	digest;
+	mbedtls_sha256_context	sha256;
+	size_t					bytes_read;
+	File					file = LittleFS.open( filename, FILE_READ );
+
+	if ( !file )
+		return false;
+
+	mbedtls_sha256_init( &sha256 );
+	mbedtls_sha256_starts( &sha256, 0 );
+	while (( bytes_read = file.read( buffer.data(), buffer.size() )) > 0 )
+		mbedtls_sha256_update( &sha256, buffer.data(), bytes_read );
+	mbedtls_sha256_finish( &sha256, digest.data() );
+	mbedtls_sha256_free( &sha256 );
+	file.close();
+
+	sha256_hex.clear();
+	for ( uint8_t b : digest ) {
 
+		etl::string<3> h;
+		snprintf( h.data(), 3, "%02x", b );
+		sha256_hex += h.data();
+	}
+	return true;
+}
+
+// Rolls a package installation forward, the pending list is only written once every new file is in place
+void AWSUpdater::finish_pending_swap( void )
+{
+	updater_filename_t	filename;
+	updater_filename_t	tmp_filename;
+	File				pending;
+	int					i;
+
+	if ( !LittleFS.exists( PENDING_FILE ))
+		return;
+
+	pending = LittleFS.open( PENDING_FILE, FILE_READ );
+	while ( pending.available() ) {
+
+		if ( !( i = pending.readBytesUntil( '\n', filename.data(), filename.capacity() )))
+			continue;
+		filename.uninitialized_resize( i );
+		tmp_filename = filename;
+		tmp_filename += ".tmp";
+
+		if ( LittleFS.exists( tmp_filename.data() )) {
+
+			LittleFS.remove( filename.data() );
+			LittleFS.rename( tmp_filename.data(), filename.data() );
+			Serial.printf( "[UPDATER   ] [INFO ] New version of file [%s] has been installed.\n", filename.data() );
+		}
+	}
+	pending.close();
+
+	tmp_filename = INDEX_FILE;
+	tmp_filename += ".tmp";
+	if ( LittleFS.exists( tmp_filename.data() )) {
+
+		LittleFS.remove( INDEX_FILE );
+		LittleFS.rename( tmp_filename.data(), INDEX_FILE );
+	}
+	LittleFS.remove( PENDING_FILE );
 }
 
 uint32_t AWSUpdater::fs_free_space( void )
 {
 	return LittleFS.totalBytes() - LittleFS.usedBytes();
 }
+
+bool AWSUpdater::get_indexed_hash( const char *filename, etl::string<64> &hash )
+{
+	std::array<char,140>	line;
+	File					index = LittleFS.open( INDEX_FILE, FILE_READ );
+	int						i;
+
+	if ( !index )
+		return false;
+
+	while ( index.available() ) {
+
+		if ( !( i = index.readBytesUntil( '\n', line.data(), line.size() - 1 )))
+			continue;
+		line[ i ] = '\0';
+		if (( i > 65 ) && ( line[ 64 ] == ' ' ) && !strcmp( line.data() + 65, filename )) {
+
+			hash.assign( line.data(), 64 );
+			index.close();
+			return true;
+		}
+	}
+	index.close();
+	return false;
+}
+
+// Files installed before the index existed are hashed once, the index then takes over
+bool AWSUpdater::is_up_to_date( const char *filename, const char *hash )
+{
+	etl::string<64>	current_hash;
+
+	if ( !get_indexed_hash( filename, current_hash ) && !( LittleFS.exists( filename ) && file_sha256( filename, current_hash )))
+		return false;
+
+	return !strcasecmp( current_hash.data(), hash );
+}
+
+// Written aside, it replaces the current index along with the files
+void AWSUpdater::write_index( JsonArray files )
+{
+	updater_filename_t	tmp_filename = INDEX_FILE;
+	File				index;
+
+	tmp_filename += ".tmp";
+	index = LittleFS.open( tmp_filename.data(), FILE_WRITE );
+	for( JsonObject file_item : files )
+		for( JsonPair file : file_item )
+			index.printf( "%s %s\n", file.value().as<const char *>(), file.key().c_str() );
+	index.close();
+}
@@ -21,15 +21,31 @@
 #ifndef _AWSUpdater_h
 #define	_AWSUpdater_h
 
+#include "Embedded_Template_Library.h"
+#include "etl/string.h"
+#include "etl/vector.h"
+
+constexpr uint8_t	UPDATER_MAX_FILES	= 16;
+
+using updater_filename_t = etl::string<64>;
+
 class AWSUpdater {
 
 	private:
 
 		bool	debug_mode		= true;
 
-		int			download_file( const char *, const char *, const char *, const char *, const char *, const char * );
-		void		download_package( const char *, const char *, const char *, const char *, JsonArray );
+		static constexpr const char	*INDEX_FILE		= "/files.idx";		// "<sha256> <filename>" lines of the installed files
+		static constexpr const char	*PENDING_FILE	= "/update.pending";	// Files whose new version is ready to be swapped in
+
+		bool		download_file( const char *, const char *, const char *, const char *, const char *, const char * );
+		bool		download_package( const char *, const char *, const char *, const char *, JsonArray );
+		bool		file_sha256( const char *, etl::string<64> & );
+		void		finish_pending_swap( void );
 		uint32_t	fs_free_space( void );
+		bool		get_indexed_hash( const char *, etl::string<64> & );
+		bool		is_up_to_date( const char *, const char * );
+		void		write_index( JsonArray );
 
 	public:
 
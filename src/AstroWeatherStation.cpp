@@ -50,6 +50,7 @@
 #include "alpaca_server.h"
 #include "AWSUpdater.h"
 #include "AWSNetwork.h"
+#include "AWSClock.h"
 #include "AstroWeatherStation.h"
 
 extern void IRAM_ATTR		_handle_rain_event( void );
@@ -58,16 +59,42 @@ extern SemaphoreHandle_t	sensors_read_mutex;
 const std::array<etl::string<10>, 3> PWR_MODE_STR = { "SolarPanel", "12VDC", "PoE" };
 
 const bool				FORMAT_LITTLEFS_IF_FAILED = true;
+const uint32_t			ALARM_DEADLINE			= 10000;	// ms, to send the queued alarms
 const unsigned long		CONFIG_MODE_GUARD		= 5000000;	// 5 seconds
 const unsigned long		FACTORY_RESET_GUARD		= 15000000;	// 15 seconds
+const uint32_t			HEALTH_CHECK_INTERVAL	= 5000;		// ms
+const uint32_t			HISTORY_DEADLINE		= 5000;		// ms, from the sensor snapshot it records
+const uint32_t			HISTORY_QUERY_DEADLINE	= 1000;		// ms, to make the next /history chunk ready
+const uint32_t			OTA_CHECK_INTERVAL		= 30 * 60 * 1000;
+const uint32_t			RAIN_GUARD_INTERVAL		= 500;
+const uint32_t			SCHEDULER_REPORT_INTERVAL	= 10 * 60 * 1000;
+const uint32_t			FULL_WAKE_PERIOD		= 24 * 60 * 60;		// s, solar stations fully boot at least this often
+
+const led_pattern_t		LED_OFF			= { 1, {{ { 0, 0, 0 } }} };
+const led_pattern_t		LED_ON			= { 1, {{ { 255, 0, 0 } }} };
+const led_pattern_t		LED_HALF		= { 1, {{ { 127, 0, 0 } }} };
+const led_pattern_t		LED_BLINK_FAST	= { 2, {{ { 255, 0, 500 }, { 0, 0, 500 } }} };
+const led_pattern_t		LED_BLINK_SLOW	= { 2, {{ { 255, 0, 1000 }, { 0, 0, 1000 } }} };
+
+// Green and blue LED patterns, in station_status_t order
+const std::array<std::pair<const led_pattern_t *,const led_pattern_t *>,7> STATUS_LED_PATTERNS = {{
+	{ &LED_HALF, &LED_OFF },			// READY
+	{ &LED_OFF, &LED_OFF },				// BOOTING
+	{ &LED_ON, &LED_ON },				// CONFIG_ERROR
+	{ &LED_OFF, &LED_BLINK_FAST },		// NETWORK_INIT
+	{ &LED_OFF, &LED_BLINK_SLOW },		// NETWORK_ERROR
+	{ &LED_BLINK_SLOW, &LED_OFF },		// SENSOR_INIT_ERROR
+	{ &LED_BLINK_FAST, &LED_OFF }		// OTA_UPGRADE
+}};
 
 RTC_DATA_ATTR time_t 	rain_event_timestamp = 0;		// NOSONAR
 RTC_DATA_ATTR time_t 	boot_timestamp = 0;				// NOSONAR
-RTC_DATA_ATTR time_t 	last_ntp_time = 0;				// NOSONAR
-RTC_DATA_ATTR uint16_t	ntp_time_misses = 0;			// NOSONAR
 RTC_DATA_ATTR bool		catch_rain_event = false;		// NOSONAR
 RTC_DATA_ATTR uint16_t 	low_battery_event_count = 0;	// NOSONAR
 RTC_NOINIT_ATTR bool	ota_update_ongoing = false;		// NOSONAR
+RTC_DATA_ATTR uint16_t	fast_wakes_left = 0;			// NOSONAR
+RTC_DATA_ATTR uint16_t	wakes_since_push = 0;			// NOSONAR
+RTC_DATA_ATTR wake_stats_t	wake_stats = {};			// NOSONAR
 
 aws_operation_info_t operator&( aws_operation_info_t a, aws_operation_info_t b )
 {
@@ -128,6 +155,7 @@ void AstroWeatherStation::check_ota_updates( bool force_update = false )
 	ota.set_aws_device_id( ota_setup.device );
 	ota.set_aws_config( ota_setup.config );
 	ota.set_progress_callback( OTA_callback );
+	ota.set_buffer_size( config.get_parameter<int>( "ota_buffer_size" ));
 	ota_setup.last_update_ts = get_timestamp();
 
 	ota_retcode = ota.check_for_update( config.get_parameter<const char *>( "ota_url" ), config.get_root_ca().data(), ota_setup.version, force_update ? ota_action_t::UPDATE_AND_BOOT : ota_action_t::CHECK_ONLY );
@@ -281,6 +309,38 @@ void AstroWeatherStation::display_banner()
 	Serial.printf( "#############################################################################################\n" );
 }
 
+// Dispatches the events queued by the interrupt handlers
+void AstroWeatherStation::event_task( void *dummy )	// NOSONAR
+{
+	aws_event_record_t	record;
+	uint32_t			overflows = 0;
+
+	while ( true ) {
+
+		ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+
+		while ( events.pop( record )) {
+
+			event_stats_t &stats = event_stats[ static_cast<uint8_t>( record.event ) ];
+
+			stats.count++;
+			stats.last_latency_us = static_cast<uint32_t>( AWSClock::monotonic_us() ) - record.timestamp_us;
+			stats.max_latency_us = std::max( stats.max_latency_us, stats.last_latency_us );
+
+			handle_event( record.event, record.timestamp_us );
+
+			if (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG )
+				Serial.printf( "[STATION   ] [DEBUG] Event %d handled after %dus (max %dus, count %d).\n", static_cast<uint8_t>( record.event ), stats.last_latency_us, stats.max_latency_us, stats.count );
+		}
+
+		if ( events.get_overflows() != overflows ) {
+
+			overflows = events.get_overflows();
+			Serial.printf( "[STATION   ] [ERROR] Event queue overflow, %d events lost so far.\n", overflows );
+		}
+	}
+}
+
 void AstroWeatherStation::try_enter_config_mode( aws_boot_mode_t boot_mode )
 {
 	if ( boot_mode != aws_boot_mode_t::MAINTENANCE )
@@ -320,6 +380,11 @@ etl::string_view AstroWeatherStation::get_anemometer_sensorname( void )
 	return etl::string_view( "N/A" );
 }
 
+event_stats_t AstroWeatherStation::get_event_stats( aws_event_t event )
+{
+	return event_stats[ static_cast<uint8_t>( event ) ];
+}
+
 uint16_t AstroWeatherStation::get_config_port( void )
 {
 	return config.get_parameter<int>( "config_port" );
@@ -330,16 +395,26 @@ Dome *AstroWeatherStation::get_dome( void )
 	return &station_devices.dome;
 }
 
+SensorHistory *AstroWeatherStation::get_history( void )
+{
+	return &history;
+}
+
 etl::string_view AstroWeatherStation::get_json_sensor_data( size_t *len )
+{
+	return get_json_sensor_data( sensor_manager.get_sensor_data(), station_data.health.battery_level, len );
+}
+
+// Station data is the current one, the sensor data and battery level may come from an earlier wake up
+etl::string_view AstroWeatherStation::get_json_sensor_data( const sensor_data_t *sensor_data, float battery_level, size_t *len )
 {
 	JsonDocument	json_data;
-	sensor_data_t	*sensor_data = sensor_manager.get_sensor_data();
 	int				l;
 
 	esp_task_wdt_reset();
 
 	json_data["available_sensors"] = static_cast<unsigned long>( sensor_data->available_sensors );
-	json_data["battery_level"] = station_data.health.battery_level;
+	json_data["battery_level"] = battery_level;
 	json_data["timestamp"] = sensor_data->timestamp;
 	json_data["rain_event"] = sensor_data->weather.rain_event;
 	json_data["temperature"] = sensor_data->weather.temperature;
@@ -367,6 +442,7 @@ etl::string_view AstroWeatherStation::get_json_sensor_data( size_t *len )
 	json_data["full_luminosity"] = sensor_data->sqm.full_luminosity;
 	json_data["lux"] = sensor_data->sun.lux;
 	json_data["irradiance"] = sensor_data->sun.irradiance;
+	station_data.ntp_time = aws_clock.get_stats().last_ntp_time;
 	json_data["ntp_time_sec"] = station_data.ntp_time.tv_sec;
 	json_data["ntp_time_usec"] = station_data.ntp_time.tv_usec;
 	json_data["gps_fix"] = station_data.gps.fix;
@@ -388,6 +464,11 @@ etl::string_view AstroWeatherStation::get_json_sensor_data( size_t *len )
 	json_data["shutter_open"] = station_data.dome_data.open_sensor;
 	json_data["shutter_close"] = station_data.dome_data.close_command;
 	json_data["lookout_active"] = lookout.is_active();
+	json_data["wake_ms"] = wake_stats.last_wake_ms;
+	json_data["fast_wake_ms"] = wake_stats.mean_fast_wake_ms;
+	json_data["wifi_ms"] = network.get_connect_stats().last_connect_ms;
+	json_data["wifi_fast_ms"] = network.get_connect_stats().mean_fast_ms;
+	json_data["wifi_full_ms"] = network.get_connect_stats().mean_full_ms;
 
 	esp_task_wdt_reset();
 
@@ -460,7 +541,7 @@ time_t AstroWeatherStation::get_timestamp( void )
 {
 	time_t now = 0;
 
-	if ( (( operation_info & aws_operation_info_t::NTP_SYNCED ) == aws_operation_info_t::NTP_SYNCED ) || ( config.get_has_device( aws_device_t::GPS_SENSOR ) && station_data.gps.fix ))
+	if ( aws_clock.is_synced() )
 		time( &now );
 
 	return now;
@@ -484,12 +565,14 @@ etl::string_view AstroWeatherStation::get_wind_vane_sensorname( void )
 	return etl::string_view( "N/A" );
 }
 
-void AstroWeatherStation::handle_event( aws_event_t event )
+// timestamp_us is the monotonic time (low 32 bits) at which the event occurred
+void AstroWeatherStation::handle_event( aws_event_t event, uint32_t timestamp_us )
 {
 	switch( event ) {
 
 		case aws_event_t::DOME_SHUTTER_OPEN_CHANGE:
-			station_devices.dome.shutter_open_change();
+			station_devices.dome.shutter_open_change( timestamp_us );
+			lookout.set_dome_event( timestamp_us );
 			break;
 
 		case aws_event_t::RAIN:
@@ -497,15 +580,17 @@ void AstroWeatherStation::handle_event( aws_event_t event )
 
 				sensor_manager.read_rain_sensor();
 				send_rain_event_alarm( sensor_manager.rain_intensity_str() );
+				send_buffered_readings();
 
 			} else
-				lookout.set_rain_event();
+				lookout.set_rain_event( timestamp_us );
 
 			sensor_manager.set_rain_event();
 			break;
 
 		case aws_event_t::DOME_SHUTTER_CLOSED_CHANGE:
-			station_devices.dome.shutter_closed_change();
+			station_devices.dome.shutter_closed_change( timestamp_us );
+			lookout.set_dome_event( timestamp_us );
 			break;
 
 		default:
@@ -528,24 +613,18 @@ bool AstroWeatherStation::has_device( aws_device_t device )
 bool AstroWeatherStation::initialise( void )
 {
 	aws_boot_mode_t			boot_mode	= determine_boot_mode();
-	std::array<uint8_t,6>	mac;
 	byte					offset		= 0;
 	std::array<uint8_t,32>	sha_256;
 
-	pinMode( GPIO_LED_GREEN, OUTPUT );
-	pinMode( GPIO_LED_BLUE, OUTPUT );
+	green_led.initialise( GPIO_LED_GREEN, LEDC_CHANNEL_0 );
+	blue_led.initialise( GPIO_LED_BLUE, LEDC_CHANNEL_1 );
 
-	std::function<void(void *)> _led_task = std::bind( &AstroWeatherStation::led_task, this, std::placeholders::_1 );
-	if ( xTaskCreatePinnedToCore(
-		[](void *param) {	// NOSONAR
-			std::function<void(void*)>* led_task_proxy = static_cast<std::function<void(void*)>*>( param );	// NOSONAR
-			(*led_task_proxy)( NULL );
-		}, "AWSLedTask", 2000, &_led_task, 10, &aws_led_task_handle, 1 ) != pdPASS ) {
+	set_led_status( station_status_t::BOOTING );
 
-		Serial.printf( "[STATION   ] [ERROR] Could not start background task [LEDTask]\n" );
-	}
+	if (( boot_mode == aws_boot_mode_t::NORMAL ) && ( esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER ) && fast_wakes_left && config.load_from_rtc( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ) ))
+		return initialise_fast_wake();
 
-	set_led_status( station_status_t::BOOTING );
+	wake_stats.full_wakes++;
 
     esp_partition_get_sha256( esp_ota_get_running_partition(), sha_256.data() );
 	for ( uint8_t _byte : sha_256 ) {
@@ -577,19 +656,14 @@ bool AstroWeatherStation::initialise( void )
 	sensor_manager.set_debug_mode( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ) );
 
 
-	ota_setup.board = "AWS_";
-	ota_setup.board += ESP.getChipModel();
-
-	esp_read_mac( mac.data(), ESP_MAC_WIFI_STA );
-	snprintf( ota_setup.device.data(), ota_setup.device.capacity(), "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5] );
+	initialise_ota_setup();
 
-	ota_setup.config = PWR_MODE_STR[ static_cast<int>( config.get_pwr_mode()) ];
-	ota_setup.config += "_";
-	ota_setup.config += config.get_pcb_version().data();
+	if ( solar_panel ) {
 
-	ota_setup.version = REV;
-	ota_setup.version += ".";
-	ota_setup.version += BUILD_ID;
+		config.save_to_rtc();
+		fast_wakes_left = FULL_WAKE_PERIOD / ( US_SLEEP / 1000000 );
+		wakes_since_push = 0;
+	}
 
 	read_battery_level();
 
@@ -618,6 +692,17 @@ bool AstroWeatherStation::initialise( void )
 
 	}
 
+	scheduler.initialise( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
+
+	// Registered early so that the configuration server can trigger it
+	ota_job = scheduler.add_job( "ota", OTA_CHECK_INTERVAL, OTA_CHECK_INTERVAL, OTA_CHECK_INTERVAL, job_priority_t::BACKGROUND, job_pool_t::BLOCKING, [this]() { check_ota_updates( true ); } );
+	scheduler.set_enabled( ota_job, config.get_parameter<bool>( "automatic_updates" ) && !solar_panel );
+
+	// Before the dome and the lookout, which queue their alarms
+	alarms_mutex = xSemaphoreCreateMutex();
+	alarm_job = scheduler.add_job( "alarms", ALARM_DEADLINE, ALARM_DEADLINE, ALARM_DEADLINE, job_priority_t::NORMAL, job_pool_t::BLOCKING, [this]() { send_queued_alarms(); } );
+	scheduler.set_enabled( alarm_job, false );
+
 	if ( solar_panel ) {
 
 		setCpuFrequencyMhz( 80 );
@@ -639,22 +724,33 @@ bool AstroWeatherStation::initialise( void )
 
 	display_banner();
 
+	// Must be running before the dome and rain sensor interrupts are attached
+	std::function<void(void *)> _event_task = std::bind( &AstroWeatherStation::event_task, this, std::placeholders::_1 );
+	if ( xTaskCreatePinnedToCore(
+		[](void *param) {	// NOSONAR
+			std::function<void(void*)>* event_task_proxy = static_cast<std::function<void(void*)>*>( param );	// NOSONAR
+			(*event_task_proxy)( NULL );
+		}, "AWSEventTask", 4000, &_event_task, configMAX_PRIORITIES - 1, &aws_event_task_handle, 1 ) != pdPASS ) {
+
+		Serial.printf( "[STATION   ] [ERROR] Could not start task [EventTask]\n" );
+		aws_event_task_handle = nullptr;
+	}
+
 	// Do not enable earlier as some HW configs rely on SC16IS750 to pilot the dome.
 	initialise_dome();
 
-	if ( solar_panel )
-		sync_time( true );
+	aws_clock.initialise( config.get_parameter<const char *>( "tzname" ), "pool.ntp.org", (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
 
 	if (( operation_info & aws_operation_info_t::RAIN ) == aws_operation_info_t::RAIN ) {
 
-		sensor_manager.initialise( &station_devices.sc16is750, &config, (( operation_info & aws_operation_info_t::RAIN )== aws_operation_info_t::RAIN ) );
-		handle_event( aws_event_t::RAIN );
+		sensor_manager.initialise( &station_devices.sc16is750, &config, &scheduler, (( operation_info & aws_operation_info_t::RAIN )== aws_operation_info_t::RAIN ) );
+		handle_event( aws_event_t::RAIN, static_cast<uint32_t>( AWSClock::monotonic_us() ));
 		return true;
 	}
 
 	initialise_GPS();
 
-	if ( !sensor_manager.initialise( &station_devices.sc16is750, &config, false )) {
+	if ( !sensor_manager.initialise( &station_devices.sc16is750, &config, &scheduler, false )) {
 
 		set_led_status( station_status_t::SENSOR_INIT_ERROR );
 		return false;
@@ -673,18 +769,13 @@ bool AstroWeatherStation::initialise( void )
 	}
 
 	if ( config.get_parameter<bool>( "lookout_enabled" ))
-		lookout.initialise( &config, &sensor_manager, &station_devices.dome, (( operation_info & aws_operation_info_t::DEBUG )== aws_operation_info_t::DEBUG ) );
+		lookout.initialise( &config, &sensor_manager, &station_devices.dome, &scheduler, (( operation_info & aws_operation_info_t::DEBUG )== aws_operation_info_t::DEBUG ) );
 	else
 		if ( config.get_has_device( aws_device_t::DOME_DEVICE ))
 			station_devices.dome.close_shutter();	// Issue #144
 
-	std::function<void(void *)> _periodic_tasks = std::bind( &AstroWeatherStation::periodic_tasks, this, std::placeholders::_1 );
-	if ( xTaskCreatePinnedToCore(
-		[](void *param) {	// NOSONAR
-			std::function<void(void*)>* periodic_tasks_proxy = static_cast<std::function<void(void*)>*>( param );	// NOSONAR
-			(*periodic_tasks_proxy)( NULL );
-		}, "AWSCoreTask", 6000, &_periodic_tasks, 5, &aws_periodic_task_handle, 1 ) != pdPASS )
-		Serial.printf( "[STATION   ] [ERROR] Could not start task [CoreTask]\n" );
+	history.initialise( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
+	start_periodic_jobs();
 
 	operation_info |= aws_operation_info_t::READY;
 	set_led_status( station_status_t::READY );
@@ -696,12 +787,47 @@ void AstroWeatherStation::initialise_dome( void )
 	if ( config.get_has_device( aws_device_t::DOME_DEVICE ) ) {
 
 		if ( config.get_has_device( aws_device_t::SC16IS750_DEVICE ) )
-			station_devices.dome.initialise( &station_devices.sc16is750, sensor_manager.get_i2c_mutex(), &station_data.dome_data, (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
+			station_devices.dome.initialise( &station_devices.sc16is750, sensor_manager.get_i2c_mutex(), &station_data.dome_data, &scheduler, (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
 		else
-			station_devices.dome.initialise( &station_data.dome_data, (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
+			station_devices.dome.initialise( &station_data.dome_data, &scheduler, (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
 	}
 }
 
+// Solar panel timer wake up: no filesystem, no probing of missing sensors, and the network only when data is due
+bool AstroWeatherStation::initialise_fast_wake( void )
+{
+	bool		debug_mode = (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG );
+	// Records in between stay in RTC memory, which must hold all of them
+	uint32_t	wakes_per_push = std::clamp<uint32_t>(( 1000000ULL * config.get_parameter<int>( "push_freq" )) / US_SLEEP, 1, READING_BUFFER_SIZE + 1 );
+
+	fast_wake = true;
+	fast_wakes_left--;
+	wake_stats.fast_wakes++;
+	solar_panel = true;
+	station_data.reset_reason = esp_reset_reason();
+
+	sensor_manager.set_solar_panel( true );
+	sensor_manager.set_debug_mode( debug_mode );
+	sensor_manager.set_fast_wake( true );
+
+	initialise_ota_setup();
+	read_battery_level();
+	aws_clock.restore( config.get_parameter<const char *>( "tzname" ), debug_mode );
+
+	push_cycle = false;
+	if ( ++wakes_since_push >= wakes_per_push )
+		start_push_cycle();
+
+	if ( !sensor_manager.initialise( &station_devices.sc16is750, &config, &scheduler, false )) {
+
+		set_led_status( station_status_t::SENSOR_INIT_ERROR );
+		return false;
+	}
+
+	Serial.printf( "[STATION   ] [INFO ] Fast wake up, %s data.\n", push_cycle ? "pushing" : "storing" );
+	return true;
+}
+
 void AstroWeatherStation::initialise_GPS( void )
 {
 	if ( !config.get_has_device( aws_device_t::GPS_SENSOR ) )
@@ -715,8 +841,27 @@ void AstroWeatherStation::initialise_GPS( void )
 			Serial.printf( "[STATION   ] [ERROR] GPS initialisation failed.\n" );
 			return;
 	}
-	station_devices.gps.start();
-	station_devices.gps.pilot_rtc( true );
+	station_devices.gps.start( &scheduler );
+	station_devices.gps.pilot_rtc( &aws_clock );
+}
+
+void AstroWeatherStation::initialise_ota_setup( void )
+{
+	std::array<uint8_t,6>	mac;
+
+	ota_setup.board = "AWS_";
+	ota_setup.board += ESP.getChipModel();
+
+	esp_read_mac( mac.data(), ESP_MAC_WIFI_STA );
+	snprintf( ota_setup.device.data(), ota_setup.device.capacity(), "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5] );
+
+	ota_setup.config = PWR_MODE_STR[ static_cast<int>( config.get_pwr_mode()) ];
+	ota_setup.config += "_";
+	ota_setup.config += config.get_pcb_version().data();
+
+	ota_setup.version = REV;
+	ota_setup.version += ".";
+	ota_setup.version += BUILD_ID;
 }
 
 void AstroWeatherStation::initialise_sensors( void )
@@ -726,7 +871,12 @@ void AstroWeatherStation::initialise_sensors( void )
 
 bool AstroWeatherStation::is_ntp_synced( void )
 {
-	return (( operation_info & aws_operation_info_t::NTP_SYNCED ) == aws_operation_info_t::NTP_SYNCED );
+	return aws_clock.is_synced();
+}
+
+bool AstroWeatherStation::is_push_cycle( void )
+{
+	return push_cycle;
 }
 
 bool AstroWeatherStation::is_rain_event( void )
@@ -755,75 +905,6 @@ bool AstroWeatherStation::is_sensor_initialised( aws_device_t sensor_id )
 	return (( sensor_manager.get_available_sensors() & sensor_id ) == sensor_id );
 }
 
-void AstroWeatherStation::led_task( void *dummy )	// NOSONAR
-{
-	while( true ) {
-
-		switch( led_status ) {
-
-			case station_status_t::BOOTING:
-
-				analogWrite( GPIO_LED_GREEN, 0 );
-				analogWrite( GPIO_LED_BLUE, 0 );
-				delay( 100 );
-				break;
-
-			case station_status_t::READY:
-
-				analogWrite( GPIO_LED_GREEN, 127 );
-				analogWrite( GPIO_LED_BLUE, 0 );
-				delay( 1000 );
-				break;
-
-			case station_status_t::CONFIG_ERROR:
-
-				analogWrite( GPIO_LED_GREEN, 255 );
-				analogWrite( GPIO_LED_BLUE, 255 );
-				delay( 1000 );
-				break;
-
-			case station_status_t::NETWORK_INIT:
-
-				analogWrite( GPIO_LED_BLUE, 255 );
-				analogWrite( GPIO_LED_GREEN, 0 );
-				delay( 500 );
-				analogWrite( GPIO_LED_BLUE, 0 );
-				delay( 500 );
-				break;
-
-			case station_status_t::NETWORK_ERROR:
-
-				analogWrite( GPIO_LED_BLUE, 255 );
-				analogWrite( GPIO_LED_GREEN, 0 );
-				delay( 1000 );
-				analogWrite( GPIO_LED_BLUE, 0 );
-				delay( 1000 );
-				break;
-
-			case station_status_t::SENSOR_INIT_ERROR:
-
-				analogWrite( GPIO_LED_GREEN, 255 );
-				analogWrite( GPIO_LED_BLUE, 0 );
-				delay( 1000 );
-				analogWrite( GPIO_LED_GREEN, 0 );
-				delay( 1000 );
-				break;
-
-			case station_status_t::OTA_UPGRADE:
-
-				analogWrite( GPIO_LED_GREEN, 255 );
-				analogWrite( GPIO_LED_BLUE, 0 );
-				delay( 500 );
-				analogWrite( GPIO_LED_GREEN, 0 );
-				delay( 500 );
-				break;
-
-			default:
-				delay( 100 );
-
-		}
-	}
-}
 bool AstroWeatherStation::on_solar_panel( void )
 {
 	return solar_panel;
@@ -887,49 +968,6 @@ const char *AstroWeatherStation::OTA_message( ota_status_t code )
 	return "Unhandled OTA status code";
 }
 
-void AstroWeatherStation::periodic_tasks( void *dummy )	// NOSONAR
-{
-	unsigned long	sync_time_millis			= 0;
-	unsigned long	sync_time_timer				= 5000;
-	unsigned long	ota_millis					= 0;
-	unsigned long	ota_timer					= 30 * 60 * 1000;
-	unsigned long	data_push_millis			= 0;
-	int				data_push_timer				= config.get_parameter<int>( "push_freq" );
-	uint16_t		rain_event_guard_time		= config.get_parameter<int>( "rain_event_guard_time" );
-	bool			auto_ota_updates			= config.get_parameter<bool>( "automatic_updates" );
-
-	if ( !config.get_parameter<bool>( "data_push" ))
-		data_push_timer = 0;
-
-	while ( true ) {
-
-		if (( millis() - sync_time_millis ) > sync_time_timer ) {
-
-			station_data.health.current_heap_size =	xPortGetFreeHeapSize();
-			station_data.health.largest_free_heap_block = heap_caps_get_largest_free_block( MALLOC_CAP_8BIT );
-			sync_time( false );
-			sync_time_millis = millis();
-		}
-
-		if ( (( operation_info & aws_operation_info_t::FORCE_OTA_UPDATE ) == aws_operation_info_t::FORCE_OTA_UPDATE ) || ( auto_ota_updates && (( millis() - ota_millis ) > ota_timer ))) {
-
-			operation_info &= ~aws_operation_info_t::FORCE_OTA_UPDATE;
-			check_ota_updates( true );
-			ota_millis = millis();
-		}
-
-		check_rain_event_guard_time( rain_event_guard_time );
-
-		if ( data_push_timer && (( millis() - data_push_millis ) > 1000*data_push_timer )) {
-
-			send_data();
-			data_push_millis = millis();
-		}
-
-		delay( 500 );
-	}
-}
-
 bool AstroWeatherStation::poll_sensors( void )
 {
 	if ( config.get_has_device( aws_device_t::GPS_SENSOR ) )
@@ -1128,6 +1166,41 @@ int AstroWeatherStation::reformat_ca_root_line( std::array<char,97> &string, int
 }
 
 
+// Called by the interrupt handlers, the event is handled later by the event task
+// For the jobs which must not wait on the network, the alarm is sent by the blocking worker
+void AstroWeatherStation::queue_alarm( const char *subject, const char *message )
+{
+	if ( alarm_job == SCHEDULER_NO_JOB ) {
+
+		send_alarm( subject, message );
+		return;
+	}
+
+	xSemaphoreTake( alarms_mutex, portMAX_DELAY );
+	if ( alarms.full() ) {
+
+		xSemaphoreGive( alarms_mutex );
+		Serial.printf( "[STATION   ] [ERROR] Too many alarms waiting, dropping [%s]\n", subject );
+		return;
+	}
+	alarms.push( { etl::string<48>( subject ), etl::string<160>( message ) } );
+	xSemaphoreGive( alarms_mutex );
+
+	scheduler.run_now( alarm_job );
+}
+
+void IRAM_ATTR AstroWeatherStation::queue_event( aws_event_t event )
+{
+	BaseType_t woken = pdFALSE;
+
+	if ( !events.push( event ) || !aws_event_task_handle )
+		return;
+
+	vTaskNotifyGiveFromISR( aws_event_task_handle, &woken );
+	if ( woken )
+		portYIELD_FROM_ISR();
+}
+
 bool AstroWeatherStation::rain_sensor_available( void )
 {
 	return sensor_manager.rain_sensor_available();
@@ -1135,8 +1208,17 @@ bool AstroWeatherStation::rain_sensor_available( void )
 
 void AstroWeatherStation::read_sensors( void )
 {
+	bool	low_battery_alarm = (( station_data.health.battery_level <= BAT_LEVEL_MIN ) && ( low_battery_event_count >= LOW_BATTERY_COUNT_MIN ) && ( low_battery_event_count <= LOW_BATTERY_COUNT_MAX ));
+
 	sensor_manager.read_sensors();
 
+	// Rain and alarms do not wait for the next push
+	if ( fast_wake && !push_cycle && ( low_battery_alarm || sensor_manager.get_sensor_data()->weather.rain_event )) {
+
+		Serial.printf( "[STATION   ] [INFO ] Urgent data, pushing %d buffered records now.\n", readings.count() );
+		start_push_cycle();
+	}
+
 	if ( station_data.health.battery_level <= BAT_LEVEL_MIN ) {
 
 		etl::string<64> string;
@@ -1157,6 +1239,22 @@ void AstroWeatherStation::reboot( void )
 	ESP.restart();
 }
 
+// Called just before going to deep sleep, the duration does not include the boot loader
+void AstroWeatherStation::record_wake_duration( void )
+{
+	uint32_t ms = millis();
+
+	wake_stats.last_wake_ms = ms;
+	if ( fast_wake ) {
+
+		wake_stats.max_fast_wake_ms = std::max( wake_stats.max_fast_wake_ms, ms );
+		wake_stats.mean_fast_wake_ms = wake_stats.mean_fast_wake_ms ? ( 7 * wake_stats.mean_fast_wake_ms + ms ) / 8 : ms;
+	}
+
+	Serial.printf( "[STATION   ] [INFO ] Awake for %dms (%s wake up). Fast wake ups: %d, mean %dms, max %dms. Full wake ups: %d.\n", ms, fast_wake ? "fast" : "full",
+		wake_stats.fast_wakes, wake_stats.mean_fast_wake_ms, wake_stats.max_fast_wake_ms, wake_stats.full_wakes );
+}
+
 void AstroWeatherStation::report_unavailable_sensors( void )
 {
 	std::array<std::string, 7>	sensor_name			= { "MLX96014 ", "TSL2591 ", "BME280 ", "WIND VANE ", "ANEMOMETER ", "RAIN_SENSOR ", "GPS " };
@@ -1208,6 +1306,26 @@ void AstroWeatherStation::send_alarm( const char *subject, const char *message )
 	network.webhook( jsonString );
 }
 
+void AstroWeatherStation::send_queued_alarms( void )
+{
+	pending_alarm_t alarm;
+
+	while ( true ) {
+
+		xSemaphoreTake( alarms_mutex, portMAX_DELAY );
+		if ( alarms.empty() ) {
+
+			xSemaphoreGive( alarms_mutex );
+			return;
+		}
+		alarm = alarms.front();
+		alarms.pop();
+		xSemaphoreGive( alarms_mutex );
+
+		send_alarm( alarm.subject.data(), alarm.message.data() );
+	}
+}
+
 void AstroWeatherStation::send_backlog_data( void )
 {
 	etl::string<1024> line;
@@ -1282,6 +1400,30 @@ void AstroWeatherStation::send_backlog_data( void )
 	}
 }
 
+// Oldest first, stops at the first failure so that the remaining records keep their order
+bool AstroWeatherStation::send_buffered_readings( void )
+{
+	size_t	len;
+
+	// Records join the history as they leave RTC memory, so that they are added once and in order
+	history.initialise( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ));
+
+	while ( readings.count() ) {
+
+		history.add( readings.front().sensor_data );
+		get_json_sensor_data( &readings.front().sensor_data, readings.front().battery_level, &len );
+		esp_task_wdt_reset();
+
+		if ( !network.post_content( "newData.php", strlen( "newData.php" ), json_sensor_data.data() )) {
+
+			Serial.printf( "[STATION   ] [ERROR] Could not push buffered data, %d records left.\n", readings.count() );
+			return false;
+		}
+		readings.pop();
+	}
+	return true;
+}
+
 void AstroWeatherStation::send_data( void )
 {
 	size_t	len;
@@ -1298,6 +1440,16 @@ void AstroWeatherStation::send_data( void )
 		}
 	}
 
+	if ( solar_panel && !send_buffered_readings() ) {
+
+		// No point in trying the current record, it joins the others until the next push
+		store_data();
+		return;
+	}
+
+	if ( solar_panel )
+		history.add( *sensor_manager.get_sensor_data() );
+
 	get_json_sensor_data( &len );
 
 	esp_task_wdt_reset();
@@ -1307,6 +1459,8 @@ void AstroWeatherStation::send_data( void )
 
 	if ( network.post_content( "newData.php", strlen( "newData.php" ), json_sensor_data.data() ))
 		send_backlog_data();
+	else if ( solar_panel )
+		store_data();
 	else
 		store_unsent_data( json_sensor_data, len );
 
@@ -1325,6 +1479,8 @@ void AstroWeatherStation::send_rain_event_alarm( const char *str )
 void AstroWeatherStation::set_led_status( station_status_t x )
 {
 	led_status = x;
+	green_led.play( STATUS_LED_PATTERNS[ static_cast<uint8_t>( x ) ].first );
+	blue_led.play( STATUS_LED_PATTERNS[ static_cast<uint8_t>( x ) ].second );
 	if (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG )
 		Serial.printf( "[STATION   ] [DEBUG] LED STATUS=%d\n",static_cast<int>(x) );
 }
@@ -1354,6 +1510,66 @@ bool AstroWeatherStation::start_config_server( void )
 	return true;
 }
 
+// What used to be the core task's polling loop, each at its own pace
+void AstroWeatherStation::start_periodic_jobs( void )
+{
+	uint16_t	rain_event_guard_time = config.get_parameter<int>( "rain_event_guard_time" );
+	uint32_t	push_ms = 1000 * config.get_parameter<int>( "push_freq" );
+	job_id_t	history_job;
+
+	scheduler.add_job( "health", HEALTH_CHECK_INTERVAL, 0, HEALTH_CHECK_INTERVAL, job_priority_t::NORMAL, job_pool_t::SHORT, [this]() {
+
+		station_data.health.current_heap_size = xPortGetFreeHeapSize();
+		station_data.health.largest_free_heap_block = heap_caps_get_largest_free_block( MALLOC_CAP_8BIT );
+		aws_clock.maintain();
+	});
+
+	scheduler.add_job( "rain_guard", RAIN_GUARD_INTERVAL, 0, RAIN_GUARD_INTERVAL, job_priority_t::URGENT, job_pool_t::SHORT, [this,rain_event_guard_time]() { check_rain_event_guard_time( rain_event_guard_time ); } );
+
+	// One raw record per sensor snapshot: the job never runs on its own, the sensor manager triggers it
+	history_job = scheduler.add_job( "history", HISTORY_DEADLINE, HISTORY_DEADLINE, HISTORY_DEADLINE, job_priority_t::BACKGROUND, job_pool_t::SHORT, [this]() {
+
+		sensor_data_t	sensor_data;
+
+		if ( xSemaphoreTake( sensors_read_mutex, 2000 / portTICK_PERIOD_MS ) != pdTRUE )
+			return;
+		sensor_data = *sensor_manager.get_sensor_data();
+		xSemaphoreGive( sensors_read_mutex );
+		history.add( sensor_data );
+	});
+	scheduler.set_enabled( history_job, false );
+	sensor_manager.set_snapshot_job( history_job );
+
+	// Reads the history for the configuration server, triggered by each chunk it sends
+	history_query_job = scheduler.add_job( "history_query", HISTORY_QUERY_DEADLINE, HISTORY_QUERY_DEADLINE, HISTORY_QUERY_DEADLINE, job_priority_t::BACKGROUND, job_pool_t::SHORT, [this]() { server.fill_history_query(); } );
+	scheduler.set_enabled( history_query_job, false );
+
+	if ( config.get_parameter<bool>( "data_push" ) && push_ms )
+		scheduler.add_job( "data_push", push_ms, push_ms, push_ms, job_priority_t::BACKGROUND, job_pool_t::BLOCKING, [this]() { send_data(); } );
+
+	if (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG )
+		scheduler.add_job( "report", SCHEDULER_REPORT_INTERVAL, SCHEDULER_REPORT_INTERVAL, SCHEDULER_REPORT_INTERVAL, job_priority_t::BACKGROUND, job_pool_t::SHORT, [this]() { scheduler.print_stats(); } );
+}
+
+// Network for the rest of this wake up, returns false when it stays unavailable
+bool AstroWeatherStation::start_push_cycle( void )
+{
+	bool	debug_mode = (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG );
+
+	set_led_status( station_status_t::NETWORK_INIT );
+
+	if ( !network.initialise( &config, debug_mode )) {
+
+		Serial.printf( "[STATION   ] [ERROR] Network unavailable, data will be sent at next push.\n" );
+		return false;
+	}
+
+	aws_clock.initialise( config.get_parameter<const char *>( "tzname" ), "pool.ntp.org", debug_mode );
+	wakes_since_push = 0;
+	push_cycle = true;
+	return true;
+}
+
 bool AstroWeatherStation::startup_sanity_check( void )
 {
 	switch ( static_cast<aws_iface>( config.get_parameter<int>( "pref_iface" ) )) {
@@ -1371,6 +1587,22 @@ bool AstroWeatherStation::startup_sanity_check( void )
 	return false;
 }
 
+// Wake ups without network keep their record in RTC memory, only the overflow goes to the backlog file
+void AstroWeatherStation::store_data( void )
+{
+	rtc_reading_t	evicted;
+	size_t			len;
+
+	if ( !readings.push( *sensor_manager.get_sensor_data(), station_data.health.battery_level, evicted ))
+		return;
+
+	get_json_sensor_data( &evicted.sensor_data, evicted.battery_level, &len );
+	store_unsent_data( json_sensor_data, len );
+}
+
+// The backlog is not compressed with SeriesCodec like the sensor history: its lines are the JSON documents posted
+// as they are, with station fields the history channels do not hold, and send_backlog_data() drops them one at a time
+// from the front, which a delta encoded stream cannot do without re-encoding what is left.
 bool AstroWeatherStation::store_unsent_data( etl::string_view data, size_t len )
 {
 	bool ok;
@@ -1405,66 +1637,14 @@ bool AstroWeatherStation::suspend_lookout( void )
 	return lookout.suspend();
 }
 
-bool AstroWeatherStation::sync_time( bool verbose )
+void AstroWeatherStation::trigger_history_query( void )
 {
-	const char	*ntp_server = "pool.ntp.org";
-	uint8_t		ntp_retries = 5;
-   	struct 		tm timeinfo;
-	bool		b;
-	
-	if ( config.get_has_device( aws_device_t::GPS_SENSOR ) && station_data.gps.fix ) {
-
-		time( &sensor_manager.get_sensor_data()->timestamp );
- 		return true;
-	}
-
-	if ( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ) && verbose )
-		Serial.printf( "[STATION   ] [DEBUG] Connecting to NTP server " );
-
-	configTzTime( config.get_parameter<const char *>( "tzname" ), ntp_server );
-
-	if ( ( b = getLocalTime( &timeinfo )))
-		operation_info |= aws_operation_info_t::NTP_SYNCED;
-
-	while ( !b && ( --ntp_retries > 0 ) ) {	// NOSONAR
-
-		if ( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ) && verbose )
-			Serial.printf( "." );
-		delay( 1000 );
-		configTzTime( config.get_parameter<const char *>( "tzname" ), ntp_server );
-		if ( ( b = getLocalTime( &timeinfo )))
-			operation_info |= aws_operation_info_t::NTP_SYNCED;
-	}
-
-	if ( (( operation_info & aws_operation_info_t::DEBUG ) == aws_operation_info_t::DEBUG ) && verbose ) {
-
-		Serial.printf( "\n[STATION   ] [DEBUG] %sNTP Synchronised. ", (( operation_info & aws_operation_info_t::NTP_SYNCED ) == aws_operation_info_t::NTP_SYNCED ) ? "" : "NOT " );
-		Serial.print( "Time and date: " );
-		Serial.print( &timeinfo, "%Y-%m-%d %H:%M:%S\n" );
-		Serial.printf( "\n" );
-	}
-
-	if (( operation_info & aws_operation_info_t::NTP_SYNCED ) == aws_operation_info_t::NTP_SYNCED ) {
-
-		time( &sensor_manager.get_sensor_data()->timestamp );
-		station_data.ntp_time.tv_sec = sensor_manager.get_sensor_data()->timestamp;
-		if ( ntp_time_misses )
-			ntp_time_misses = 0;
-		last_ntp_time = sensor_manager.get_sensor_data()->timestamp;
-
-	} else {
-
-		// Not proud of this but it should be sufficient if the number of times we miss ntp sync is not too big
-		ntp_time_misses++;
-		sensor_manager.get_sensor_data()->timestamp =  last_ntp_time + ( US_SLEEP / 1000000 ) * ntp_time_misses;
-
-	}
-	return (( operation_info & aws_operation_info_t::NTP_SYNCED ) == aws_operation_info_t::NTP_SYNCED );
+	scheduler.run_now( history_query_job );
 }
 
 void AstroWeatherStation::trigger_ota_update( void )
 {
-	operation_info |= aws_operation_info_t::FORCE_OTA_UPDATE;
+	scheduler.run_now( ota_job );
 }
 
 bool AstroWeatherStation::update_config( JsonVariant &proposed_config )
@@ -29,6 +29,13 @@
 #include "AWSLookout.h"
 #include "alpaca_server.h"
 #include "AWSNetwork.h"
+#include "AWSClock.h"
+#include "event_queue.h"
+#include "reading_buffer.h"
+#include "sensor_history.h"
+#include "status_led.h"
+#include "scheduler.h"
+#include "etl/queue.h"
 
 const byte LOW_BATTERY_COUNT_MIN = 5;
 const byte LOW_BATTERY_COUNT_MAX = 10;
@@ -56,15 +63,6 @@ enum struct aws_ip_info : uint8_t
 };
 using aws_ip_info_t = aws_ip_info;
 
-enum struct aws_events : uint8_t
-{
-	RAIN,
-	DOME_SHUTTER_CLOSED_CHANGE,
-	DOME_SHUTTER_OPEN_CHANGE
-
-};
-using aws_event_t = aws_events;
-
 enum struct boot_mode : uint8_t
 {
 	NORMAL,
@@ -106,32 +104,60 @@ struct station_devices_t {
 
 enum class aws_operation_info_t : unsigned int {
 	NONE				= 0x0000,
-	FORCE_OTA_UPDATE	= 0x0001,
-	NTP_SYNCED			= 0x0002,
 	RAIN				= 0x0004,
 	REQ_DOME_OPEN		= 0x0008,
 	DEBUG				= 0x4000,
 	READY				= 0x8000
 };
 
+struct wake_stats_t {
+
+	uint32_t	full_wakes;
+	uint32_t	fast_wakes;
+	uint32_t	last_wake_ms;		// Reported with the next record
+	uint32_t	mean_fast_wake_ms;
+	uint32_t	max_fast_wake_ms;
+};
+
+// Alarm left to the blocking worker by a job which must not wait on the network
+struct pending_alarm_t {
+
+	etl::string<48>		subject;
+	etl::string<160>	message;
+};
+
 void OTA_callback( int, int );
 
 class AstroWeatherStation {
 
 	private:
 
+		job_id_t					alarm_job					= SCHEDULER_NO_JOB;
+		etl::queue<pending_alarm_t,4>	alarms;
+		SemaphoreHandle_t			alarms_mutex				= nullptr;
 		alpaca_server				alpaca;
-		TaskHandle_t				aws_led_task_handle;
-		TaskHandle_t				aws_periodic_task_handle;
+		TaskHandle_t				aws_event_task_handle		= nullptr;
+		AWSClock					aws_clock;
+		StatusLED					blue_led;
 		AWSConfig					config;
 		aws_operation_info_t		operation_info				= aws_operation_info_t::NONE;
-		etl::string<1116>			json_sensor_data;
+		EventQueue					events;
+		std::array<event_stats_t,static_cast<size_t>( aws_event_t::COUNT )>	event_stats	= {};
+		bool						fast_wake					= false;
+		StatusLED					green_led;
+		SensorHistory				history;
+		job_id_t					history_query_job			= SCHEDULER_NO_JOB;
+		etl::string<1536>			json_sensor_data;
 		station_status_t			led_status					= station_status_t::BOOTING;
 		etl::string<128>			location;
 		AWSLookout					lookout;
 		AWSNetwork					network;
 		AWSOTA						ota;
+		job_id_t					ota_job						= SCHEDULER_NO_JOB;
 		ota_setup_t					ota_setup;
+		bool						push_cycle					= true;
+		ReadingBuffer				readings;
+		Scheduler					scheduler;
 		AWSSensorManager 			sensor_manager;
 		AWSWebServer 				server;
 		bool						solar_panel;
@@ -143,14 +169,16 @@ class AstroWeatherStation {
 		void			compute_uptime( void );
 		aws_boot_mode_t	determine_boot_mode( void );
 		void			display_banner( void );
+		void			event_task( void * );
 		void			check_factory_reset( aws_boot_mode_t );
 		template<typename... Args>
 		etl::string<96>	format_helper( const char *, Args... );
+		etl::string_view	get_json_sensor_data( const sensor_data_t *, float, size_t * );
 		void 			initialise_dome( void );
+		bool			initialise_fast_wake( void );
 		void			initialise_GPS( void );
-		void			led_task( void * );
+		void			initialise_ota_setup( void );
 		const char		*OTA_message( ota_status_t );
-		void			periodic_tasks( void * );
 		template<typename... Args>
 		void			print_config_string( const char *, Args... );
 		void			print_runtime_config( void );
@@ -158,10 +186,14 @@ class AstroWeatherStation {
 		void			read_GPS( void );
 		int				reformat_ca_root_line( std::array<char,97> &, int, int, int, const char * );
 		void			send_backlog_data( void );
+		bool			send_buffered_readings( void );
+		void			send_queued_alarms( void );
 		void			send_rain_event_alarm( const char * );
 		void			set_led_status( station_status );
 		void			start_alpaca_server( void );
 		bool			start_config_server( void );
+		void			start_periodic_jobs( void );
+		bool			start_push_cycle( void );
 		bool			startup_sanity_check( void );
 		bool			store_unsent_data( etl::string_view, size_t );
 		void			try_enter_config_mode( aws_boot_mode_t );
@@ -172,7 +204,9 @@ class AstroWeatherStation {
 		void				check_ota_updates( bool );
 		void				close_dome_shutter( void );
 		etl::string_view	get_anemometer_sensorname( void );
+		event_stats_t		get_event_stats( aws_event_t );
 		Dome				*get_dome( void );
+		SensorHistory		*get_history( void );
 		sensor_data_t		*get_sensor_data( void );
 		station_data_t		*get_station_data( void );
 		uint16_t			get_config_port( void );
@@ -187,10 +221,11 @@ class AstroWeatherStation {
 		etl::string_view	get_unique_build_id( void );
 		uint32_t			get_uptime( void );
 		etl::string_view	get_wind_vane_sensorname( void );
-		void				handle_event( aws_event_t );
+		void				handle_event( aws_event_t, uint32_t );
 		bool				has_device( aws_device_t );
 		bool				initialise( void );
 		void				initialise_sensors( void );
+		bool				is_push_cycle( void );
 		bool				is_rain_event( void );
 		bool				is_ready( void );
 		bool				is_sensor_initialised( aws_device_t );
@@ -199,15 +234,19 @@ class AstroWeatherStation {
 		bool				on_solar_panel();
 		void				open_dome_shutter( void );
 		bool				poll_sensors( void );
+		void				queue_alarm( const char *, const char * );
+		void IRAM_ATTR		queue_event( aws_event_t );
 		bool				rain_sensor_available( void );
 		void				reboot( void );
+		void				record_wake_duration( void );
 		void				read_sensors( void );
 		void				report_unavailable_sensors( void );
 		bool				resume_lookout( void );
 		void				send_alarm( const char *, const char * );
 		void				send_data( void );
+		void				store_data( void );
 		bool				suspend_lookout( void );
-		bool				sync_time( bool );
+		void				trigger_history_query( void );
 		void				trigger_ota_update( void );
 		bool				update_config( JsonVariant & );
 };
@@ -58,13 +58,20 @@ void setup()
 		if ( !station.is_rain_event() ) {
 
 			station.read_sensors();
-			station.send_data();
-			if ( station.get_station_data()->health.battery_level > 50 )
-				station.check_ota_updates( true );
+
+			if ( station.is_push_cycle() ) {
+
+				station.send_data();
+				if ( station.get_station_data()->health.battery_level > 50 )
+					station.check_ota_updates( true );
+
+			} else
+
+				station.store_data();
 
 		} else
 		
-			station.handle_event( aws_event_t::RAIN );
+			station.handle_event( aws_event_t::RAIN, static_cast<uint32_t>( AWSClock::monotonic_us() ));
 
 		esp_sleep_enable_timer_wakeup( US_SLEEP );
 
@@ -79,6 +86,7 @@ void setup()
 
 				Serial.printf( "[CORE      ] [INFO ] Not monitoring rain sensor.\n" );
 		}
+		station.record_wake_duration();
 		Serial.printf( "[CORE      ] [INFO ] Entering sleep mode.\n" );
 		esp_deep_sleep_start();
 	}
@@ -102,15 +110,15 @@ void loop()
 
 void IRAM_ATTR _handle_dome_shutter_open_change( void )
 {
-	station.handle_event( aws_event_t::DOME_SHUTTER_OPEN_CHANGE );
+	station.queue_event( aws_event_t::DOME_SHUTTER_OPEN_CHANGE );
 }
 
 void IRAM_ATTR _handle_dome_shutter_closed_change( void )
 {
-	station.handle_event( aws_event_t::DOME_SHUTTER_CLOSED_CHANGE );
+	station.queue_event( aws_event_t::DOME_SHUTTER_CLOSED_CHANGE );
 }
 
 void IRAM_ATTR _handle_rain_event( void )
 {
-	station.handle_event( aws_event_t::RAIN );
+	station.queue_event( aws_event_t::RAIN );
 }
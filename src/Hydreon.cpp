@@ -44,21 +44,68 @@ const std::array<uint16_t,7>	Hydreon::BPS 		= { 1200, 2400, 4800, 9600, 19200, 3
 
 extern AstroWeatherStation	station;
 
-Hydreon::Hydreon( void ) : rg9_read_mutex( xSemaphoreCreateMutex() )
+Hydreon::Hydreon( void ) : rg9_answer_ready( xSemaphoreCreateBinary() )
 {
 	set_name( "Hydreon RG-9" );
 	set_description( "The Hydreon RG-9 Solid State Rain Sensor is a rainfall sensing device." );
-	set_driver_version( "1.0" );
+	set_driver_version( "1.1" );
 	str.clear();
 }
 
+// Fed from the UART receive callback, or from any other byte source
+void Hydreon::feed( uint8_t c )
+{
+	rg9_answer_t answer = parser.feed( c );
+
+	switch( answer ) {
+
+		case rg9_answer_t::NONE:
+			return;
+
+		case rg9_answer_t::RAIN:
+			intensity = parser.get_intensity();
+			last_report_ms = millis();
+			break;
+
+		case rg9_answer_t::RESET:
+			status = parser.get_status();
+			if ( get_initialised() ) {
+
+				// The sensor restarts in polling mode and would otherwise never report again
+				Serial.printf( "[HYDREON   ] [INFO ] Rain sensor was reset because of '%s', switching it back to continuous mode\n", reset_cause() );
+				set_continuous_mode();
+			}
+			break;
+
+		case rg9_answer_t::OTHER:
+			if ( get_debug_mode() )
+				Serial.printf( "[HYDREON   ] [DEBUG] Rain sensor says [%s]\n", parser.get_line() );
+			break;
+
+		default:
+			break;
+	}
+
+	str.assign( parser.get_line() );
+	last_answer = answer;
+	if ( answer != rg9_answer_t::OTHER )
+		xSemaphoreGive( rg9_answer_ready );
+}
+
+void Hydreon::on_receive( void )
+{
+	while ( sensor->available() > 0 )
+		feed( static_cast<uint8_t>( sensor->read() ));
+}
+
 void Hydreon::probe( uint16_t baudrate )
 {
 	status = RAIN_SENSOR_FAIL;
 
-	sensor.begin( baudrate, SERIAL_8N1, rx_pin, tx_pin );
-	sensor.println();
-	sensor.println();
+	sensor->begin( baudrate, SERIAL_8N1, rx_pin, tx_pin );
+	sensor->onReceive( std::bind( &Hydreon::on_receive, this ));
+	sensor->println();
+	sensor->println();
 
 	if ( get_debug_mode() ) {
 
@@ -66,28 +113,55 @@ void Hydreon::probe( uint16_t baudrate )
 		Serial.flush();
 	}
 
-	sensor.println( "B" );
-	read_string();
+	xSemaphoreTake( rg9_answer_ready, 0 );
+	sensor->println( "B" );
+	rg9_answer_t answer = wait_for_answer( RG9_ANSWER_TIMEOUT );
 
 	if ( get_debug_mode() )
-		Serial.printf( "%s] ", str.data() );
+		Serial.printf( "%s] ", ( answer == rg9_answer_t::NONE ) ? "" : str.data() );
 
-	if ( !strncmp( str.data(), "Baud ", 5 )) {
+	switch( answer ) {
 
-		Serial.printf( "%s[HYDREON   ] [INFO ] Found rain sensor @ %d bps\n", get_debug_mode()?"\n":"", baudrate );
-		status = RAIN_SENSOR_OK;
-		rain_sensor_baud = baudrate;
+		case rg9_answer_t::BAUD:
+		case rg9_answer_t::RAIN:
+			Serial.printf( "%s[HYDREON   ] [INFO ] Found rain sensor @ %d bps\n", get_debug_mode()?"\n":"", baudrate );
+			status = RAIN_SENSOR_OK;
+			rain_sensor_baud = baudrate;
+			break;
 
-	} else if ( !strncmp( str.data(), "Reset " , 6 )) {
+		case rg9_answer_t::RESET:
+			Serial.printf( "%s[HYDREON   ] [INFO ] Found rain sensor @ %dbps after it was reset because of '%s'\n", get_debug_mode()?"\n":"", baudrate, reset_cause() );
+			rain_sensor_baud = baudrate;
+			break;
 
-		status = str[6];
-		Serial.printf( "%s[HYDREON   ] [INFO ] Found rain sensor @ %dbps after it was reset because of '%s'\n[INFO ] Rain sensor boot message:\n", get_debug_mode()?"\n":"", baudrate, reset_cause() );
+		default:
+			break;
+	}
 
-		while ( read_string() )
-			Serial.printf( "%s", str.data() );
+	if ( status != RAIN_SENSOR_FAIL )
+		set_continuous_mode();
+}
 
-		rain_sensor_baud = baudrate;
-	}
+void Hydreon::request_rain_intensity( void )
+{
+	xSemaphoreTake( rg9_answer_ready, 0 );
+	sensor->println( "R" );
+}
+
+// Continuous mode: the sensor sends "R x" by itself whenever the intensity changes. Asks for the current
+// intensity too, as the cached one may be stale after a reset.
+void Hydreon::set_continuous_mode( void )
+{
+	sensor->println( "C" );
+	sensor->println( "R" );
+}
+
+rg9_answer_t Hydreon::wait_for_answer( uint16_t timeout_ms )
+{
+	if ( xSemaphoreTake( rg9_answer_ready, timeout_ms / portTICK_PERIOD_MS ) != pdTRUE )
+		return rg9_answer_t::NONE;
+
+	return last_answer;
 }
 
 bool Hydreon::initialise( void )
@@ -141,7 +215,7 @@ bool Hydreon::initialise( void )
 bool Hydreon::initialise( HardwareSerial &bus, bool b )
 {
 	set_debug_mode( b );
-	sensor = bus;
+	sensor = &bus;
 	return initialise();
 }
 
@@ -153,12 +227,16 @@ byte Hydreon::get_rain_intensity( void )
 		return -1;
 	}
 
-	sensor.println( "R" );
-	read_string();
-	intensity = static_cast<byte>( str[2] - '0' );
+	// Served from the last report, only block when we never got one (e.g. right after boot or wake up)
+	if ( !last_report_ms ) {
+
+		request_rain_intensity();
+		if ( wait_for_answer( RG9_ANSWER_TIMEOUT ) != rg9_answer_t::RAIN )
+			Serial.printf( "[HYDREON   ] [ERROR] No answer from rain sensor.\n" );
+
+	} else if (( millis() - last_report_ms ) > RG9_REPORT_MAX_AGE )
 
-	if ( intensity > 7 )	// Most probably during initialisation phase
-		intensity = 0;
+		request_rain_intensity();	// Refresh in the background, answer will be handled by the parser
 
 	if ( get_debug_mode() )
 		Serial.printf( "[HYDREON   ] [DEBUG] Rain sensor status string = [%s] intensity=[%d]\n", str.data(), intensity );
@@ -189,37 +267,9 @@ float Hydreon::get_rain_rate( void )
 	return Hydreon::RAIN_RATES[ intensity ];
 }
 
-byte Hydreon::read_string( void )
-{
-	str.clear();
-	delay( 500 );
-
-	if ( sensor.available() > 0 ) {
-
-		uint8_t i = sensor.readBytes( str.data(), str.capacity() );
-		if ( i >= 2 )
-			str[ i-2 ] = 0;	// trim trailing \n
-
-		return i-1;
-	}
-
-	return 0;
-}
-
 const char *Hydreon::reset_cause()
 {
-	switch ( status ) {
-
-		case 'N': return "Normal power up";
-		case 'M': return "MCLR";
-		case 'W': return "Watchdog timer reset";
-		case 'O': return "Start overflow";
-		case 'U': return "Start underflow";
-		case 'B': return "Low voltage";
-		case 'D': return "Other";
-		default: return "Unknown";
-
-	}
+	return RG9Parser::reset_cause( status );
 }
 
 void Hydreon::try_baudrates( void )
@@ -234,7 +284,7 @@ void Hydreon::try_baudrates( void )
 			esp_task_wdt_reset();
 			probe( BPS[j] );
 			if ( status == RAIN_SENSOR_FAIL )
-				sensor.end();
+				sensor->end();
 			else
 				return;
 		}
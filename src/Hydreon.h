@@ -24,6 +24,7 @@
 #include <Arduino.h>
 #include <HardwareSerial.h>
 #include "gpio_config.h"
+#include "rg9_parser.h"
 
 class Hydreon : public Device {
 
@@ -32,26 +33,35 @@ class Hydreon : public Device {
 		static constexpr byte				HYDREON_PROBE_RETRIES	= 3;
 		static constexpr byte				RAIN_SENSOR_OK			= 0;
 		static constexpr byte 				RAIN_SENSOR_FAIL		= 127;
+		static constexpr uint16_t			RG9_ANSWER_TIMEOUT		= 500;		// ms
+		static constexpr uint32_t			RG9_REPORT_MAX_AGE		= 60000;	// ms, continuous mode only reports changes
 		static const std::array<float,8>	RAIN_RATES;
 		static const std::array<uint16_t,7> BPS;
 
-		uint8_t				intensity;
-		uint8_t				reset_pin	= GPIO_RAIN_SENSOR_MCLR;
-		SemaphoreHandle_t 	rg9_read_mutex;
-		uint8_t				rx_pin		= GPIO_RAIN_SENSOR_RX;
-		uint8_t				tx_pin		= GPIO_RAIN_SENSOR_TX;
-		HardwareSerial		sensor		= HardwareSerial(1);
+		volatile uint8_t	intensity		= 0;
+		volatile uint32_t	last_report_ms	= 0;
+		volatile rg9_answer_t	last_answer	= rg9_answer_t::NONE;
+		RG9Parser			parser;
+		uint8_t				reset_pin		= GPIO_RAIN_SENSOR_MCLR;
+		SemaphoreHandle_t 	rg9_answer_ready;
+		uint8_t				rx_pin			= GPIO_RAIN_SENSOR_RX;
+		uint8_t				tx_pin			= GPIO_RAIN_SENSOR_TX;
+		HardwareSerial		*sensor			= nullptr;
 		etl::string<128>	str;
-		char				status;
+		volatile char		status;
 
 		bool			initialise( void );
+		void			on_receive( void );
 		void			probe( uint16_t );
-		byte			read_string( void );
+		void			request_rain_intensity( void );
+		void			set_continuous_mode( void );
 		void			try_baudrates( void );
+		rg9_answer_t	wait_for_answer( uint16_t );
 
 	public:
 
 					Hydreon( void );
+		void		feed( uint8_t );
 		bool 		initialise( HardwareSerial &, bool );
 		byte		get_rain_intensity( void  );
 		const char	*get_rain_intensity_str( void );
@@ -5,6 +5,9 @@
 
 	Revisions
 		1.0.0	: Barebone version, polled mode operation, made to work with the AstroWeatherStation's GPS
+		1.1.0	: Burst reads of the RX FIFO into a local ring buffer
+		1.2.0	: Interrupt driven receive path and GPIO change interrupts
+		1.3.0	: Receive time of each byte
 
    	This program is free software: you can redistribute it and/or modify it
 	under the terms of the GNU General Public License as published by the
@@ -31,11 +34,164 @@
 
 #include <Arduino.h>
 #include <Wire.h>
+#include <esp_timer.h>
 #include "SC16IS750.h"
 
 int I2C_SC16IS750::available( void )
 {
-    return available_data_in_FIFO();
+	if ( !rx_count && !interrupt_mode )
+		read_FIFO();
+
+	return rx_count;
+}
+
+// The callback is run from the receive task, without holding the I2C mutex. Once interrupts are enabled,
+// the registers are shared with that task and the other users of the bus, so the mutex is taken here.
+bool I2C_SC16IS750::attach_GPIO_interrupt( uint8_t pin, std::function<void(uint8_t,bool)> callback )
+{
+	bool ok;
+
+	if ( pin > 7 )
+		return false;
+
+	if ( i2c_mutex )
+		while ( xSemaphoreTake( i2c_mutex, 500 / portTICK_PERIOD_MS ) != pdTRUE );
+
+	GPIO_callbacks[ pin ] = callback;
+	io_state = get_IO_state();
+	ok = setup_GPIO_interrupt( pin, true );
+
+	if ( i2c_mutex )
+		xSemaphoreGive( i2c_mutex );
+	return ok;
+}
+
+// Uses the bridge's IRQ output (active low, open drain) so that the FIFO is only drained when there is
+// something to read: RHR interrupt fires when RX_TRIGGER_LEVEL bytes are waiting or after 4 characters
+// of silence with data below that level.
+bool I2C_SC16IS750::enable_interrupts( int8_t irq_pin, SemaphoreHandle_t _i2c_mutex )
+{
+	if ( irq_pin < 0 )
+		return false;
+
+	i2c_mutex = _i2c_mutex;
+	rx_ready = xSemaphoreCreateBinary();
+
+	std::function<void(void *)> _rx_task = std::bind( &I2C_SC16IS750::rx_task, this, std::placeholders::_1 );
+	if ( xTaskCreatePinnedToCore(
+		[](void *param) {	// NOSONAR
+			std::function<void(void*)>* rx_task_proxy = static_cast<std::function<void(void*)>*>( param );	// NOSONAR
+			(*rx_task_proxy)( NULL );
+		}, "SC16IS750Rx", 3000, &_rx_task, 6, &rx_task_handle, 1 ) != pdPASS ) {
+
+		Serial.printf( "[GPIOEXT   ] [ERROR] Could not start task [SC16IS750Rx]\n" );
+		return false;
+	}
+
+	while ( xSemaphoreTake( i2c_mutex, 500 / portTICK_PERIOD_MS ) != pdTRUE );
+	write_register( SC16IS750_TLR, TLR_RX_TRIGGER_LEVEL( SC16IS750_RX_TRIGGER_LEVEL ));
+	write_register( SC16IS750_IER, read_register( SC16IS750_IER ) | IER_RHR_INT_ENABLE | IER_RX_INT_ENABLE );
+	io_state = get_IO_state();
+	interrupt_mode = true;
+	xSemaphoreGive( i2c_mutex );
+
+	pinMode( irq_pin, INPUT_PULLUP );
+	attachInterruptArg( irq_pin, I2C_SC16IS750::IRQ_handler, this, FALLING );
+
+	xTaskNotifyGive( rx_task_handle );	// In case the line was already asserted
+	return true;
+}
+
+bool I2C_SC16IS750::get_interrupt_mode( void )
+{
+	return interrupt_mode;
+}
+
+// Serves every pending interrupt source, must be called with the I2C mutex held
+void I2C_SC16IS750::handle_interrupts( void )
+{
+	uint8_t	iir;
+	uint8_t	changed = 0;
+	uint8_t	new_state;
+
+	while ( !(( iir = static_cast<uint8_t>( read_register( SC16IS750_IIR ))) & IIR_NO_INTERRUPT )) {
+
+		switch( iir & IIR_SOURCE_MASK ) {
+
+			case IIR_RHR:
+			case IIR_RX_TIMEOUT:
+				// The time out is raised after 4 characters of silence
+				if ( !read_FIFO(( iir & IIR_SOURCE_MASK ) == IIR_RX_TIMEOUT ? 4 : 0 ))
+					return;
+				xSemaphoreGive( rx_ready );
+				break;
+
+			case IIR_RX_LINE_STATUS:
+				if ( read_register( SC16IS750_LSR ) & LSR_OVERRUN_ERROR )
+					stats.overflows++;
+				break;
+
+			case IIR_INPUT_PIN_CHANGE:
+				new_state = get_IO_state();		// Reading IOSTATE clears the interrupt
+				changed |= new_state ^ io_state;
+				io_state = new_state;
+				break;
+
+			case IIR_MODEM_STATUS:
+				read_register( SC16IS750_MSR );
+				break;
+
+			default:
+				return;
+		}
+	}
+
+	if ( !changed )
+		return;
+
+	xSemaphoreGive( i2c_mutex );
+	for ( uint8_t pin = 0; pin < 8; pin++ )
+		if (( changed & ( 1 << pin )) && GPIO_callbacks[ pin ] )
+			GPIO_callbacks[ pin ]( pin, ( io_state & ( 1 << pin )) != 0 );
+	while ( xSemaphoreTake( i2c_mutex, 500 / portTICK_PERIOD_MS ) != pdTRUE );
+}
+
+void IRAM_ATTR I2C_SC16IS750::IRQ_handler( void *arg )
+{
+	BaseType_t	woken = pdFALSE;
+	I2C_SC16IS750 *bridge = static_cast<I2C_SC16IS750 *>( arg );
+
+	vTaskNotifyGiveFromISR( bridge->rx_task_handle, &woken );
+	if ( woken )
+		portYIELD_FROM_ISR();
+}
+
+void I2C_SC16IS750::rx_task( void *dummy )	// NOSONAR
+{
+	while ( true ) {
+
+		// Times out once in a while to catch an edge that would have been missed
+		if ( ulTaskNotifyTake( pdTRUE, 1000 / portTICK_PERIOD_MS ))
+			stats.interrupts++;
+
+		if ( !interrupt_mode || ( xSemaphoreTake( i2c_mutex, 500 / portTICK_PERIOD_MS ) != pdTRUE ))
+			continue;
+
+		handle_interrupts();
+		xSemaphoreGive( i2c_mutex );
+	}
+}
+
+bool I2C_SC16IS750::wait_for_data( uint32_t timeout_ms )
+{
+	if ( rx_count )
+		return true;
+
+	if ( !interrupt_mode )
+		return ( available() > 0 );
+
+	xSemaphoreTake( rx_ready, timeout_ms / portTICK_PERIOD_MS );
+	return ( rx_count > 0 );
 }
 
 void I2C_SC16IS750::set_address( uint8_t a )
@@ -66,6 +222,7 @@ bool I2C_SC16IS750::begin( uint32_t baudrate )
 	enable_TX_RX();
     set_line( 8, 0, 1 );
 	set_baudrate( baudrate );
+	char_us = 10000000UL / baudrate;		// 8N1
     return true;
 }
 
@@ -121,9 +278,104 @@ bool I2C_SC16IS750::test( void )
 }
 
 // flawfinder: ignore
-int8_t I2C_SC16IS750::read( void )
+int I2C_SC16IS750::read( void )
+{
+	uint8_t b;
+
+	return read_bytes( &b, 1 ) ? b : -1;
+}
+
+// Returns up to `len` bytes, refilling the local buffer from the RX FIFO only when it is empty.
+// In interrupt mode the buffer is filled by the receive task and no I2C transaction is made here.
+// When given, `rx_us` gets the time at which each byte was received, see read_FIFO().
+uint8_t I2C_SC16IS750::read_bytes( uint8_t *buf, uint8_t len, uint32_t *rx_us )
+{
+	uint8_t n = 0;
+
+	while ( n < len ) {
+
+		if ( !rx_count && ( interrupt_mode || !read_FIFO() ))
+			break;
+
+		n += take_rx( buf + n, len - n, rx_us ? rx_us + n : nullptr );
+	}
+	return n;
+}
+
+uint8_t I2C_SC16IS750::take_rx( uint8_t *buf, uint8_t len, uint32_t *rx_us )
 {
-	return read_byte();
+	uint8_t n = 0;
+
+	portENTER_CRITICAL( &rx_mux );
+	while (( n < len ) && rx_count ) {
+
+		if ( rx_us )
+			rx_us[ n ] = rx_time[ rx_tail ];
+		buf[ n++ ] = rx_buffer[ rx_tail ];
+		rx_tail = ( rx_tail + 1 ) % SC16IS750_RX_BUFFER_SIZE;
+		rx_count--;
+	}
+	portEXIT_CRITICAL( &rx_mux );
+	return n;
+}
+
+// Reads RXLVL once then pulls everything the FIFO holds in a single I2C burst.
+// RHR is not auto-incremented, consecutive reads return consecutive FIFO bytes.
+// The last byte in the FIFO is taken as received when RXLVL is read, or `idle_chars` characters earlier
+// when the line is known to have been silent since, and the ones before it one character apart.
+uint8_t I2C_SC16IS750::read_FIFO( uint8_t idle_chars )
+{
+	std::array<uint8_t,SC16IS750_FIFO_SIZE>	burst;
+	uint8_t	level = static_cast<uint8_t>( read_register( SC16IS750_RXLVL ));
+	uint32_t last_us = static_cast<uint32_t>( esp_timer_get_time() ) - idle_chars * char_us;
+	uint8_t	room = SC16IS750_RX_BUFFER_SIZE - rx_count;
+	uint8_t	fifo_level;
+	uint8_t	n;
+
+	stats.transactions++;
+
+	if ( level > SC16IS750_FIFO_SIZE )
+		level = SC16IS750_FIFO_SIZE;
+
+	if ( !level )
+		return 0;
+	fifo_level = level;
+
+	if ( level > room ) {
+
+		stats.overflows += level - room;
+		level = room;
+		if ( !level )
+			return 0;
+	}
+
+	Wire.beginTransmission( address );
+	Wire.write( ( SC16IS750_RHR << SC16IS750_REG_ADDR_SHIFT ));
+	end_transmission( false );
+	n = Wire.requestFrom( address, level );
+	stats.transactions++;
+
+	for ( uint8_t i = 0; i < n; i++ )
+		// flawfinder: ignore
+		burst[ i ] = Wire.read();
+
+	portENTER_CRITICAL( &rx_mux );
+	for ( uint8_t i = 0; i < n; i++ ) {
+
+		rx_buffer[ rx_head ] = burst[ i ];
+		rx_time[ rx_head ] = last_us - ( fifo_level - 1 - i ) * char_us;
+		rx_head = ( rx_head + 1 ) % SC16IS750_RX_BUFFER_SIZE;
+	}
+	rx_count += n;
+	portEXIT_CRITICAL( &rx_mux );
+	stats.bursts++;
+	stats.bytes += n;
+	return n;
+}
+
+sc16is750_stats_t I2C_SC16IS750::get_stats( void )
+{
+	return stats;
 }
 
 uint8_t I2C_SC16IS750::write( uint8_t b )
@@ -181,18 +433,19 @@ void I2C_SC16IS750::set_baudrate( uint32_t baudrate )
 
 void I2C_SC16IS750::flush()
 {
+	portENTER_CRITICAL( &rx_mux );
+	rx_count = rx_head = rx_tail = 0;
+	portEXIT_CRITICAL( &rx_mux );
     FIFO_reset( true, true );
     FIFO_enable( false );
 }
 
 int I2C_SC16IS750:: peek()
 {
-	if ( has_peek )
-		return peek_byte;
+	if ( !rx_count && ( interrupt_mode || !read_FIFO() ))
+		return -1;
 
-	peek_byte = read_byte();
-	has_peek = ( peek_byte >= 0 );
-	return peek_byte;
+	return rx_buffer[ rx_tail ];
 }
 
 void I2C_SC16IS750::set_line( uint8_t word_length, uint8_t parity_type, uint8_t stop_bits )
@@ -244,15 +497,11 @@ void I2C_SC16IS750::set_line( uint8_t word_length, uint8_t parity_type, uint8_t
     write_register( SC16IS750_LCR, tmp );
 }
 
-int8_t I2C_SC16IS750::read_register( uint8_t register_address )
+bool I2C_SC16IS750::end_transmission( bool stop )
 {
-    uint8_t n;
-
-	Wire.beginTransmission( address );
-	Wire.write( ( register_address << SC16IS750_REG_ADDR_SHIFT ));	// Product sheet, table 33. Register address byte: use bits 3-6 and bits 2&1 must be 0, bit 0 is not used.
-	switch( Wire.endTransmission( 0 )) {
+	switch( Wire.endTransmission( stop )) {
 		case 0:
-			break;
+			return true;
 		case 1:
 			Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 transmission failed: data to long to fit in buffer\n" );
 			break;
@@ -269,6 +518,16 @@ int8_t I2C_SC16IS750::read_register( uint8_t register_address )
 			Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 transmission failed: timeout\n" );
 			break;
 	}
+	return false;
+}
+
+int8_t I2C_SC16IS750::read_register( uint8_t register_address )
+{
+    uint8_t n;
+
+	Wire.beginTransmission( address );
+	Wire.write( ( register_address << SC16IS750_REG_ADDR_SHIFT ));	// Product sheet, table 33. Register address byte: use bits 3-6 and bits 2&1 must be 0, bit 0 is not used.
+	end_transmission( false );
 	if ( ( n = Wire.requestFrom( address, 1 )) != 1 )
 		Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 received %d bytes instead of 1 while addressing register 0x%02x\n", n, register_address );
 	// flawfinder: ignore
@@ -280,27 +539,7 @@ bool I2C_SC16IS750::write_register (uint8_t register_address, uint8_t value )
 	Wire.beginTransmission( address );
 	Wire.write( ( register_address << SC16IS750_REG_ADDR_SHIFT ));	// Product sheet, table 33. Register address byte: use bits 3-6 and bits 2&1 must be 0, bit 0 is not used.
 	Wire.write( value );
-	switch ( Wire.endTransmission( 1 )) {
-		case 0:
-			return true;
-			break;
-		case 1:
-			Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 transmission failed: data to long to fit in buffer\n" );
-			break;
-		case 2:
-			Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 transmission failed: NACK on transmit of address\n" );
-			break;
-		case 3:
-			Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 transmission failed: NACK on transmit of data\n" );
-			break;
-		case 4:
-			Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 transmission failed: other error\n" );
-			break;
-		case 5:
-			Serial.printf( "[GPIOEXT   ] [ERROR] SC16IS750 transmission failed: timeout\n" );
-			break;
-	}
-    return false;
+	return end_transmission( true );
 }
 
 void I2C_SC16IS750::FIFO_enable( bool enable_fifo )
@@ -22,6 +22,8 @@
 #define	_SC16IS750_H_
 
 #include <Arduino.h>
+#include <array>
+#include <functional>
 
 const uint8_t			DEFAULT_SC16IS750_ADDR				= 0x90;
 
@@ -136,6 +138,20 @@ const uint8_t			DEFAULT_SC16IS750_ADDR				= 0x90;
 
 // IIR register bits
 #define	IIR_NO_INTERRUPT			(1 << 0)
+#define	IIR_SOURCE_MASK				(0x3E)
+
+// IIR interrupt sources, once masked
+#define	IIR_MODEM_STATUS			(0x00)
+#define	IIR_THR						(0x02)
+#define	IIR_RHR						(0x04)
+#define	IIR_RX_LINE_STATUS			(0x06)
+#define	IIR_RX_TIMEOUT				(0x0C)
+#define	IIR_XOFF					(0x10)
+#define	IIR_CTS_RTS					(0x20)
+#define	IIR_INPUT_PIN_CHANGE		(0x30)
+
+// TLR register, RX trigger level in 4 bytes steps (takes precedence over FCR when not 0)
+#define	TLR_RX_TRIGGER_LEVEL( x )	(((( x ) / 4 ) & 0x0F ) << 4 )
 
 // EFR register bits
 #define	EFR_ENHANCED_FUNC_ENABLE	(1 << 4)
@@ -156,18 +172,39 @@ const uint8_t			DEFAULT_SC16IS750_ADDR				= 0x90;
 #define	FORCE_1_PARITY		( 3 )
 #define	FORCE_0_PARITY		( 4 )
 
+#define	SC16IS750_FIFO_SIZE			( 64 )
+#define	SC16IS750_RX_BUFFER_SIZE	( 128 )
+#define	SC16IS750_RX_TRIGGER_LEVEL	( 32 )
+
+struct sc16is750_stats_t {
+
+	uint32_t	transactions;		// I2C transactions spent on the receive path
+	uint32_t	bursts;				// RX FIFO burst reads
+	uint32_t	bytes;				// Bytes received
+	uint32_t	overflows;			// Bytes left in the FIFO because the local buffer was full
+	uint32_t	interrupts;			// IRQ line assertions served
+};
+
 class I2C_SC16IS750
 {
 	public:
 				explicit I2C_SC16IS750( void ) = default;
+		bool	attach_GPIO_interrupt( uint8_t, std::function<void(uint8_t,bool)> );
 		bool	begin( uint32_t );
+		bool	enable_interrupts( int8_t, SemaphoreHandle_t );
+		bool	get_interrupt_mode( void );
+		bool	wait_for_data( uint32_t );
 		// flawfinder: ignore
-		int8_t	read( void );
+		int		read( void );
+		uint8_t	read_bytes( uint8_t *, uint8_t, uint32_t * = nullptr );
+		uint8_t	read_FIFO( uint8_t = 0 );
 		uint8_t	write( uint8_t );
 		int		available( void );
 		int		peek( void );
 		void	flush( void );
 
+		sc16is750_stats_t	get_stats( void );
+
 		bool	digitalRead( uint8_t );
 		bool	digitalWrite( uint8_t, bool );
 		bool	pinMode( uint8_t, bool );
@@ -177,12 +214,32 @@ class I2C_SC16IS750
 	private:
 
 		uint8_t address		= ( DEFAULT_SC16IS750_ADDR >> 1 );
-		bool	has_peek	= false;
-		int		peek_byte	= -1;
+
+		uint32_t			char_us		= 0;		// Time of one character on the line
+		std::array<uint8_t,SC16IS750_RX_BUFFER_SIZE>	rx_buffer;
+		std::array<uint32_t,SC16IS750_RX_BUFFER_SIZE>	rx_time;	// Low 32 bits of esp_timer_get_time() when each byte was received
+		uint8_t				rx_count	= 0;
+		uint8_t				rx_head		= 0;
+		uint8_t				rx_tail		= 0;
+		sc16is750_stats_t	stats		= {};
+
+		std::array<std::function<void(uint8_t,bool)>,8>	GPIO_callbacks;
+		SemaphoreHandle_t	i2c_mutex		= nullptr;
+		bool				interrupt_mode	= false;
+		uint8_t				io_state		= 0;
+		portMUX_TYPE		rx_mux			= portMUX_INITIALIZER_UNLOCKED;
+		SemaphoreHandle_t	rx_ready		= nullptr;
+		TaskHandle_t		rx_task_handle	= nullptr;
+
+		static void IRAM_ATTR	IRQ_handler( void * );
+		void	handle_interrupts( void );
+		void	rx_task( void * );
+		uint8_t	take_rx( uint8_t *, uint8_t, uint32_t * );
 
 		void	FIFO_enable( bool );
 		uint8_t get_IO_state( void );
 		void	set_baudrate( uint32_t );
+		bool	end_transmission( bool );
 		int8_t	read_register( uint8_t );
 		bool	write_register( uint8_t, uint8_t );
 		void	set_line( uint8_t, uint8_t, uint8_t );
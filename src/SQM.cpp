@@ -4,6 +4,7 @@
   	(c) 2023-2024 F.Lesage
 
 	1.0.0 - Initial version, derived from AWS 2.0
+	1.1.0 - Predictive auto-ranging, integrations stop at a target SNR
 
 	This program is free software: you can redistribute it and/or modify it
 	under the terms of the GNU General Public License as published by the
@@ -23,11 +24,32 @@
 #include <Arduino.h>
 #include <esp_task_wdt.h>
 
-#include "common.h"
-#include "device.h"
 #include "SQM.h"
-#include "Hydreon.h"
-#include "sensor_manager.h"
+
+namespace {
+
+	const std::array<uint16_t,4>	GAIN_FACTOR			= { 1, 25, 428, 9876 };
+	const std::array<uint16_t,6>	INTEGRATION_TIME	= { 100, 200, 300, 400, 500, 600 };
+
+	// ADC saturation level, from the datasheet
+	inline uint16_t max_count( tsl2591IntegrationTime_t t )
+	{
+		return ( t == TSL2591_INTEGRATIONTIME_100MS ) ? 36863 : 65535;
+	}
+
+	inline uint32_t sensitivity( tsl2591Gain_t g, tsl2591IntegrationTime_t t )
+	{
+		return static_cast<uint32_t>( GAIN_FACTOR[ g >> 4 ] ) * INTEGRATION_TIME[ t ];
+	}
+
+	// Photon noise on both channels, visible is their difference
+	inline float snr( uint32_t full, uint32_t ir )
+	{
+		if ( full <= ir )
+			return 0.F;
+		return static_cast<float>( full - ir ) / sqrtf( static_cast<float>( full + ir ));
+	}
+}
 
 void SQM::initialise( Adafruit_TSL2591 *_tsl, sqm_data_t *data, float calibration_offset, bool _debug_mode )
 {
@@ -35,6 +57,7 @@ void SQM::initialise( Adafruit_TSL2591 *_tsl, sqm_data_t *data, float calibratio
 	sqm_data = data;
 	msas_calibration_offset = calibration_offset;
 	debug_mode = _debug_mode;
+	set_range( TSL2591_GAIN_LOW, TSL2591_INTEGRATIONTIME_100MS );
 }
 
 void SQM::set_msas_calibration_offset( float _msas_calibration_offset )
@@ -63,196 +86,169 @@ float SQM::ch1_temperature_factor( float temp )
 	return 1.05118F - 0.0023342F*pow( temp, 0.958056F );
 }
 
-void SQM::change_gain( uint8_t upDown, tsl2591Gain_t *gain_idx )
+bool SQM::compute_msas_nelm( float full_luminosity, float ir_luminosity, uint8_t integrations )
 {
-	tsl2591Gain_t	g = static_cast<tsl2591Gain_t>( *gain_idx + 16*upDown );
-
-	if ( g < TSL2591_GAIN_LOW )
-		g = TSL2591_GAIN_LOW;
-	else if ( g > TSL2591_GAIN_MAX )
-		g = TSL2591_GAIN_MAX;
+	float visible_luminosity = full_luminosity - ir_luminosity;
 
-	if ( g != *gain_idx ) {
+	// On some occasions this can happen, leading to high values of "visible" although it is dark, giving erroneous msas
+	if ( visible_luminosity <= 0.F ) {
 
-		tsl->setGain( g );
-		*gain_idx = g;
+		if ( debug_mode )
+			Serial.printf( "[SQM       ] [DEBUG] Inconsistent reading (Infrared=%.1f Full=%.1f), keeping previous values.\n", ir_luminosity, full_luminosity );
+		return false;
 	}
-}
-
-void SQM::change_integration_time( uint8_t upDown, tsl2591IntegrationTime_t *int_time_idx )
-{
-	tsl2591IntegrationTime_t	t = static_cast<tsl2591IntegrationTime_t>( *int_time_idx + 2*upDown );
 
-	if ( t < TSL2591_INTEGRATIONTIME_100MS )
-		t = TSL2591_INTEGRATIONTIME_100MS;
-	else if ( t > TSL2591_INTEGRATIONTIME_600MS )
-		t = TSL2591_INTEGRATIONTIME_600MS;
+	// Comes from Adafruit TSL2591 driver
+	float cpl = static_cast<float>( sensitivity( gain, int_time )) / 408.F;
+	float lux = ( visible_luminosity * ( 1.F - ( ir_luminosity / full_luminosity ))) / cpl;
 
-	if ( t != *int_time_idx ) {
+	// About the MSAS formula, quoting http://unihedron.com/projects/darksky/magconv.php:
+	// This formula was derived from conversations on the Yahoo-groups darksky-list
+	// Topic: [DSLF]  Conversion from mg/arcsec^2 to cd/m^2
+	// Date range: Fri, 1 Jul 2005 17:36:41 +0900 to Fri, 15 Jul 2005 08:17:52 -0400
 
-		tsl->setTiming( t );
-		*int_time_idx = t;
-	}
-}
+	// I added a calibration offset to match readings from my SQM-LE
+	sqm_data->msas = ( log10( lux / 108000.F ) / -0.4F ) + msas_calibration_offset;
+	if ( sqm_data->msas < 0 )
+		sqm_data->msas = 0;
+	sqm_data->nelm = 7.93F - 5.F * log10( pow( 10, ( 4.316F - ( sqm_data->msas / 5.F ))) + 1.F );
 
-void SQM::read( float ambient_temp )
-{
-	tsl->setGain( TSL2591_GAIN_LOW );
-	tsl->setTiming( TSL2591_INTEGRATIONTIME_100MS );
+	sqm_data->integration_time = INTEGRATION_TIME[ int_time ];
+	sqm_data->gain = GAIN_FACTOR[ gain >> 4 ];
+	sqm_data->full_luminosity = static_cast<uint16_t>( full_luminosity );
+	sqm_data->ir_luminosity = static_cast<uint16_t>( ir_luminosity );
+	if ( debug_mode )
+		Serial.printf( "[SQM       ] [DEBUG] GAIN=[0x%02hhx/%ux] TIME=[0x%02hhx/%ums] Iterations=[%d] Visible=[%.1f] Infrared=[%.1f] MPSAS=[%f] NELM=[%2.2f]\n", gain, GAIN_FACTOR[ gain >> 4 ], int_time, INTEGRATION_TIME[ int_time ], integrations, visible_luminosity, ir_luminosity, sqm_data->msas, sqm_data->nelm );
 
-	while ( !get_msas_nelm( ambient_temp ));
+	return true;
 }
 
-bool SQM::decrease_gain( tsl2591Gain_t *gain_idx )
+// One integration, temperature compensated. Returns false when either channel saturated.
+bool SQM::integrate( float ambient_temp, uint32_t *full_luminosity, uint32_t *ir_luminosity )
 {
-	if ( *gain_idx != TSL2591_GAIN_LOW ) {
+	uint32_t	both_channels = tsl->getFullLuminosity();
+	uint16_t	ir = static_cast<uint16_t>( both_channels >> 16 );
+	uint16_t	full = static_cast<uint16_t>( both_channels & 0xFFFF );
 
-		if ( debug_mode )
-			Serial.printf( "[SQM       ] [DEBUG] Decreasing gain.\n" );
-		change_gain( DOWN, gain_idx );
-		return false;
+	*ir_luminosity = static_cast<uint32_t>( static_cast<float>( ir ) * ch1_temperature_factor( ambient_temp ));
+	*full_luminosity = static_cast<uint32_t>( static_cast<float>( full ) * ch0_temperature_factor( ambient_temp ));
 
-	}
-	return true;
-}
-
-bool SQM::decrease_integration_time( tsl2591IntegrationTime_t *int_time_idx )
-{
-	if ( *int_time_idx != TSL2591_INTEGRATIONTIME_100MS ) {
+	if ( debug_mode )
+		Serial.printf( "[SQM       ] [DEBUG] gain=0x%02x (%dx) time=0x%02x (%dms)/ temp=%2.2f° / Infrared=%05d Full=%05d\n", gain, GAIN_FACTOR[ gain >> 4 ], int_time, INTEGRATION_TIME[ int_time ], ambient_temp, ir, full );
 
-		if ( debug_mode )
-			Serial.printf( "[SQM       ] [DEBUG] Decreasing integration time.\n" );
-		change_integration_time( DOWN, int_time_idx );
-		return true;
-	}
-	return false;	
+	return (( full < max_count( int_time )) && ( ir < max_count( int_time )));
 }
 
-bool SQM::increase_gain( tsl2591Gain_t *gain_idx )
+// Picks the shortest integration, then the lowest gain, predicted to reach TARGET_SNR in one go while keeping
+// the count below TARGET_FILL. If the sky is too dark for that, the most sensitive pair that fits, preferring
+// longer integrations over more gain as they add less noise.
+void SQM::predict_range( uint32_t full_luminosity, uint32_t ir_luminosity, tsl2591Gain_t *best_gain, tsl2591IntegrationTime_t *best_time )
 {
-	if ( *gain_idx != TSL2591_GAIN_MAX ) {
+	*best_gain = TSL2591_GAIN_MAX;
+	*best_time = TSL2591_INTEGRATIONTIME_600MS;
 
-		if ( debug_mode )
-			Serial.printf( "[SQM       ] [DEBUG] Increasing gain.\n" );
-		change_gain( UP, gain_idx );
-		return true;
-	}
-	return false;
-}
+	if ( full_luminosity <= ir_luminosity )
+		return;
 
-bool SQM::increase_integration_time( tsl2591IntegrationTime_t *int_time_idx )
-{
-	if ( *int_time_idx != TSL2591_INTEGRATIONTIME_600MS ) {
+	float rate = static_cast<float>( full_luminosity ) / static_cast<float>( sensitivity( gain, int_time ));
+	float visible_ratio = static_cast<float>( full_luminosity - ir_luminosity ) / static_cast<float>( full_luminosity );
+	float needed = TARGET_SNR * TARGET_SNR * ( 2.F - visible_ratio ) / ( visible_ratio * visible_ratio );
 
-		if ( debug_mode )
-			Serial.printf( "[SQM       ] [DEBUG] Increasing integration time.\n" );
-		change_integration_time( UP, int_time_idx );
-		return true;
-	}
-	return false;
-}
+	*best_gain = TSL2591_GAIN_LOW;
+	*best_time = TSL2591_INTEGRATIONTIME_100MS;
 
-bool SQM::get_msas_nelm( float ambient_temp )
-{
-	uint32_t	both_channels;
-	uint16_t	ir_luminosity;
-	uint16_t	full_luminosity;
-	uint16_t	visible_luminosity;
-	uint8_t		iterations = 1;
+	for ( uint8_t t = 0; t < INTEGRATION_TIME.size(); t++ )
+		for ( uint8_t g = 0; g < GAIN_FACTOR.size(); g++ ) {
 
-	tsl2591Gain_t				gain_idx;
-	tsl2591IntegrationTime_t	int_time_idx;
+			auto	_gain = static_cast<tsl2591Gain_t>( g << 4 );
+			auto	_time = static_cast<tsl2591IntegrationTime_t>( t );
+			float	predicted = rate * static_cast<float>( sensitivity( _gain, _time ));
 
-	const std::array<uint16_t,4>	gain_factor			= { 1, 25, 428, 9876 };
-	const std::array<uint16_t,6>	integration_time	= { 100, 200, 300, 400, 500, 600 };
+			if ( predicted > TARGET_FILL * max_count( _time ))
+				continue;
 
-	esp_task_wdt_reset();
+			if ( predicted >= needed ) {
 
-	gain_idx = tsl->getGain();
-	int_time_idx = tsl->getTiming();
-	both_channels = tsl->getFullLuminosity();
-	ir_luminosity = static_cast<uint16_t>( both_channels >> 16 );
-	full_luminosity = static_cast<uint16_t>( both_channels & 0xFFFF );
-	ir_luminosity = static_cast<uint16_t>( static_cast<float>(ir_luminosity) * ch1_temperature_factor( ambient_temp ) );
-	full_luminosity = static_cast<uint16_t>( static_cast<float>(full_luminosity) * ch0_temperature_factor( ambient_temp ) );
-	visible_luminosity = full_luminosity - ir_luminosity;
-
-	// On some occasions this can happen, leading to high values of "visible" although it is dark (as the variable is unsigned), giving erroneous msas
-	if ( full_luminosity < ir_luminosity )
-		return false;
+				*best_gain = _gain;
+				*best_time = _time;
+				return;
+			}
 
-	if ( debug_mode )
-		Serial.printf( "[SQM       ] [DEBUG] gain=0x%02x (%dx) time=0x%02x (%dms)/ temp=%2.2f° / Infrared=%05d Full=%05d Visible=%05d\n", gain_idx, gain_factor[ gain_idx >> 4 ], int_time_idx, integration_time[ int_time_idx ], ambient_temp, ir_luminosity, full_luminosity, visible_luminosity );
+			if ( sensitivity( _gain, _time ) > sensitivity( *best_gain, *best_time )) {
 
-	// Auto gain and integration time, increase time before gain to avoid increasing noise if we can help it, decrease gain first for the same reason
-	// Then retry by returning false
-	if ( visible_luminosity < 128 ) {
+				*best_gain = _gain;
+				*best_time = _time;
+			}
+		}
+}
 
-		if ( increase_integration_time( &int_time_idx ))
-			return false;
+void SQM::read( float ambient_temp )
+{
+	uint32_t					full;
+	uint32_t					ir;
+	uint32_t					total_full;
+	uint32_t					total_ir;
+	uint8_t						integrations = 1;
+	bool						saturated;
+	tsl2591Gain_t				next_gain;
+	tsl2591IntegrationTime_t	next_time;
 
-		if ( increase_gain( &gain_idx ))
-			return false;
+	esp_task_wdt_reset();
 
-		iterations = read_with_extended_integration_time( ambient_temp, &ir_luminosity, &full_luminosity, &visible_luminosity );
-		if ( full_luminosity < ir_luminosity )
-			return false;
+	// The previous reading's range is usually right, otherwise jump straight to the predicted one
+	for ( uint8_t step = 0; ; step++ ) {
 
-	}
+		saturated = !integrate( ambient_temp, &full, &ir );
+		if ( saturated ) {
 
-	if (( full_luminosity == 0xFFFF ) || ( ir_luminosity == 0xFFFF )) {
+			// Rate is unknown, predict again from the bottom of the range
+			if (( step == MAX_RANGING_STEPS ) || (( gain == TSL2591_GAIN_LOW ) && ( int_time == TSL2591_INTEGRATIONTIME_100MS )))
+				break;
+			set_range( TSL2591_GAIN_LOW, TSL2591_INTEGRATIONTIME_100MS );
+			continue;
+		}
 
-		if ( decrease_gain( &gain_idx ))
-			return false;
+		predict_range( full, ir, &next_gain, &next_time );
+		if (( step == MAX_RANGING_STEPS ) || (( next_gain == gain ) && ( next_time == int_time )))
+			break;
 
-		if ( decrease_integration_time( &int_time_idx ))
-			return false;
+		// Keep a usable reading unless the prediction is much more sensitive
+		if (( full <= HIGH_FILL * max_count( int_time )) && (( snr( full, ir ) >= TARGET_SNR ) || ( sensitivity( next_gain, next_time ) < 2 * sensitivity( gain, int_time ))))
+			break;
 
+		set_range( next_gain, next_time );
 	}
 
-	// Comes from Adafruit TSL2591 driver
-	float cpl = static_cast<float>( gain_factor[ gain_idx >> 4 ] ) * static_cast<float>( integration_time[ int_time_idx ] ) / 408.F;
-	float lux = ( static_cast<float>(visible_luminosity) * ( 1.F-( static_cast<float>(ir_luminosity)/static_cast<float>(full_luminosity))) ) / cpl;
+	// Accumulate until the visible signal is precise enough
+	total_full = full;
+	total_ir = ir;
+	while ( !saturated && ( snr( total_full, total_ir ) < TARGET_SNR ) && ( integrations < MAX_INTEGRATIONS )) {
 
-	// About the MSAS formula, quoting http://unihedron.com/projects/darksky/magconv.php:
-	// This formula was derived from conversations on the Yahoo-groups darksky-list
-	// Topic: [DSLF]  Conversion from mg/arcsec^2 to cd/m^2
-	// Date range: Fri, 1 Jul 2005 17:36:41 +0900 to Fri, 15 Jul 2005 08:17:52 -0400
+		esp_task_wdt_reset();
+		integrate( ambient_temp, &full, &ir );
+		total_full += full;
+		total_ir += ir;
+		integrations++;
+	}
 
-	// I added a calibration offset to match readings from my SQM-LE
-	sqm_data->msas = ( log10( lux / 108000.F ) / -0.4F ) + msas_calibration_offset;
-	if ( sqm_data->msas < 0 )
-		sqm_data->msas = 0;
-	sqm_data->nelm = 7.93F - 5.F * log10( pow( 10, ( 4.316F - ( sqm_data->msas / 5.F ))) + 1.F );
+	compute_msas_nelm( static_cast<float>( total_full ) / integrations, static_cast<float>( total_ir ) / integrations, integrations );
 
-	sqm_data->integration_time = integration_time[ int_time_idx ];
-	sqm_data->gain = gain_factor[ gain_idx >> 4 ];
-	sqm_data->full_luminosity = full_luminosity;
-	sqm_data->ir_luminosity = ir_luminosity;
-	if ( debug_mode )
-		Serial.printf( "[SQM       ] [DEBUG] GAIN=[0x%02hhx/%ux] TIME=[0x%02hhx/%ums] Iterations=[%d] Visible=[%05d] Infrared=[%05d] MPSAS=[%f] NELM=[%2.2f]\n", gain_idx, gain_factor[ gain_idx >> 4 ], int_time_idx, integration_time[ int_time_idx ], iterations, visible_luminosity, ir_luminosity, sqm_data->msas, sqm_data->nelm );
+	// Start the next reading from where this one says it should
+	if ( !saturated ) {
 
-	return true;
+		predict_range( total_full / integrations, total_ir / integrations, &next_gain, &next_time );
+		if (( next_gain != gain ) || ( next_time != int_time ))
+			set_range( next_gain, next_time );
+	}
 }
 
-uint8_t SQM::read_with_extended_integration_time( float ambient_temp, uint16_t *cumulated_ir, uint16_t *cumulated_full, uint16_t *cumulated_visible )
+void SQM::set_range( tsl2591Gain_t _gain, tsl2591IntegrationTime_t _int_time )
 {
-	uint8_t		iterations = 1;
-
-	while (( *cumulated_visible < 128 ) && ( iterations <= 32 )) {
-
-		iterations++;
-		uint32_t both_channels = tsl->getFullLuminosity();
-		uint16_t _ir_luminosity = both_channels >> 16;
-		uint16_t _full_luminosity = both_channels & 0xFFFF;
-		_ir_luminosity = static_cast<uint16_t>( static_cast<float>(_ir_luminosity) * ch1_temperature_factor( ambient_temp ));
-		_full_luminosity = static_cast<uint16_t>( static_cast<float>(_full_luminosity) * ch0_temperature_factor( ambient_temp ));
-		*cumulated_full += _full_luminosity;
-		*cumulated_ir += _ir_luminosity;
-		*cumulated_visible = *cumulated_full - *cumulated_ir;
-
-		delay( 50 );
-	}
+	if ( debug_mode )
+		Serial.printf( "[SQM       ] [DEBUG] Range set to %dx / %dms.\n", GAIN_FACTOR[ _gain >> 4 ], INTEGRATION_TIME[ _int_time ] );
 
-	return iterations;
+	tsl->setGain( _gain );
+	tsl->setTiming( _int_time );
+	gain = _gain;
+	int_time = _int_time;
 }
@@ -21,11 +21,20 @@
 #ifndef _SQM_H
 #define _SQM_H
 
-#define	DOWN	( -1 )
-#define	UP		( 1 )
-
 #include "Adafruit_TSL2591.h"
 
+struct sqm_data_t {
+
+	float		msas;
+	float		nelm;
+	uint16_t	gain;
+	uint16_t	integration_time;
+	uint16_t	ir_luminosity;
+	uint16_t	vis_luminosity;
+	uint16_t	full_luminosity;
+
+};
+
 class SQM {
 
 	public:
@@ -37,21 +46,25 @@ class SQM {
 		
 	private:
 
-		bool				debug_mode				= false;
-		float				msas_calibration_offset	= 0.F;
-		sqm_data_t			*sqm_data				= nullptr;
-		Adafruit_TSL2591	*tsl;
+		static constexpr float		TARGET_SNR				= 8.F;		// ~0.14 mag, as the 128 visible counts the fixed stepping stopped at
+		static constexpr float		TARGET_FILL				= 0.5F;		// Of the ADC range, leaves room for the sky to brighten
+		static constexpr float		HIGH_FILL				= 0.8F;
+		static constexpr uint8_t	MAX_INTEGRATIONS		= 32;
+		static constexpr uint8_t	MAX_RANGING_STEPS		= 3;
+
+		bool						debug_mode				= false;
+		tsl2591Gain_t				gain					= TSL2591_GAIN_LOW;
+		tsl2591IntegrationTime_t	int_time				= TSL2591_INTEGRATIONTIME_100MS;
+		float						msas_calibration_offset	= 0.F;
+		sqm_data_t					*sqm_data				= nullptr;
+		Adafruit_TSL2591			*tsl;
 		
 		float ch0_temperature_factor( float );
 		float ch1_temperature_factor( float );
-		void change_gain( uint8_t, tsl2591Gain_t * );
-		void change_integration_time( uint8_t, tsl2591IntegrationTime_t * );
-		bool decrease_gain( tsl2591Gain_t * );
-		bool decrease_integration_time( tsl2591IntegrationTime_t * );
-		bool increase_gain( tsl2591Gain_t * );
-		bool increase_integration_time( tsl2591IntegrationTime_t * );
-		bool get_msas_nelm(  float );
-		uint8_t read_with_extended_integration_time( float, uint16_t *, uint16_t *, uint16_t * );
+		bool compute_msas_nelm( float, float, uint8_t );
+		bool integrate( float, uint32_t *, uint32_t * );
+		void predict_range( uint32_t, uint32_t, tsl2591Gain_t *, tsl2591IntegrationTime_t * );
+		void set_range( tsl2591Gain_t, tsl2591IntegrationTime_t );
 		
 };
 
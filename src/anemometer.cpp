@@ -17,7 +17,6 @@
 	with this program. If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include <SoftwareSerial.h>
 #include <vector>
 
 #include "defaults.h"
@@ -30,7 +29,7 @@ const std::array<std::string, 3>	Anemometer::ANEMOMETER_DESCRIPTION	= { "Mechani
 const std::array<uint64_t,3>		Anemometer::ANEMOMETER_CMD			= { 0x010300000001840a, 0x010300000001840a, 0x010300000002c40b };
 const std::array<uint16_t,3>		Anemometer::ANEMOMETER_SPEED		= { 4800, 9600, 4800 };
 
-bool Anemometer::initialise( SoftwareSerial *bus, uint32_t interval, byte _model, bool _debug_mode )
+bool Anemometer::initialise( ModbusMaster *bus, uint32_t interval, byte _model, bool _debug_mode )
 {
 	model = _model;
 	set_debug_mode( _debug_mode );
@@ -40,9 +39,9 @@ bool Anemometer::initialise( SoftwareSerial *bus, uint32_t interval, byte _model
 
 	set_name( ANEMOMETER_DESCRIPTION[ model ].c_str() );
 	set_description( ANEMOMETER_DESCRIPTION[ model ].c_str() );
-	set_driver_version( "1.0" );
+	set_driver_version( "1.1" );
 
-	return RS485Device::initialise( "ANEMOMETER", bus, GPIO_WIND_SENSOR_RX, GPIO_WIND_SENSOR_TX, GPIO_WIND_SENSOR_CTRL, ANEMOMETER_CMD[ model ], ANEMOMETER_SPEED[ model ] );
+	return RS485Device::initialise( "ANEMOMETER", bus, ANEMOMETER_CMD[ model ], ANEMOMETER_SPEED[ model ] );
 }
 
 float Anemometer::get_wind_speed( bool verbose )
@@ -50,9 +49,9 @@ float Anemometer::get_wind_speed( bool verbose )
 	if ( interrogate( verbose ) ) {
 
 		if ( model == 2 )
-			wind_speed = static_cast<float>(get_answer()[4]) / 100.F;
+			wind_speed = static_cast<float>( get_register( 0 )) / 100.F;
 		else
-			wind_speed = static_cast<float>(get_answer()[4]) / 10.F;
+			wind_speed = static_cast<float>( get_register( 0 )) / 10.F;
 
 		if ( get_debug_mode() && verbose )
 			Serial.printf( "\n[ANEMOMETER] [DEBUG] Wind speed: %02.2f m/s\n", wind_speed );
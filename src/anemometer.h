@@ -21,7 +21,6 @@
 #ifndef _anemometer_H
 #define	_anemometer_H
 
-#include <SoftwareSerial.h>
 #include <vector>
 
 #include "rs485_device.h"
@@ -36,7 +35,7 @@ class Anemometer : public RS485Device {
 		static const std::array<uint16_t,3>		ANEMOMETER_SPEED;
 
 				Anemometer( void ) = default;
-		bool			initialise( SoftwareSerial *, uint32_t, byte, bool );
+		bool			initialise( ModbusMaster *, uint32_t, byte, bool );
 		float			get_wind_gust( void );
 		float			get_wind_speed( bool );
 
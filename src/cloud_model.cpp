@@ -0,0 +1,94 @@
+/*
+  	cloud_model.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+
+#include "cloud_model.h"
+
+namespace {
+
+	// As in common.h, which is not included so that the models build on the host
+	inline float sign( float x )
+	{
+		return static_cast<float>(( 0.F < x ) - ( x < 0.F ));
+	}
+}
+
+uint8_t CloudModel::classify( float sky_temperature ) const
+{
+	if ( sky_temperature < cloudy_threshold )
+		return static_cast<uint8_t>( cloud_coverage::CLEAR );
+
+	if ( sky_temperature < overcast_threshold )
+		return static_cast<uint8_t>( cloud_coverage::CLOUDY );
+
+	return static_cast<uint8_t>( cloud_coverage::OVERCAST );
+}
+
+cloud_model_result_t CloudModel::evaluate( float ambient_temperature, float raw_sky_temperature ) const
+{
+	cloud_model_result_t result;
+
+	result.sky_temperature = correct( ambient_temperature, raw_sky_temperature );
+	result.cloud_coverage = classify( result.sky_temperature );
+	return result;
+}
+
+// For calibration over recorded readings
+void CloudModel::evaluate( const cloud_model_sample_t *samples, cloud_model_result_t *results, size_t count ) const
+{
+	for ( size_t i = 0; i < count; i++ )
+		results[ i ] = evaluate( samples[ i ].ambient_temperature, samples[ i ].raw_sky_temperature );
+}
+
+void CloudModel::set_thresholds( float cloudy, float overcast )
+{
+	cloudy_threshold = cloudy;
+	overcast_threshold = overcast;
+}
+
+float AWSCloudModel::correct( float ambient_temperature, float raw_sky_temperature ) const
+{
+	return raw_sky_temperature - ambient_temperature;
+}
+
+float AAGCloudModel::correct( float ambient_temperature, float raw_sky_temperature ) const
+{
+	float delta = ambient_temperature - k2;
+	float t67;
+
+	if ( fabsf( delta ) < 1.F )
+		t67 = -k6_sign * fabsf( delta );
+	else
+		t67 = k6 * sign( delta ) * ( log10f( fabsf( delta )) + k7 );
+
+	return raw_sky_temperature - ( k1 * delta * k3 * expf( k45 * ambient_temperature ) + t67 );
+}
+
+// Integer divisions, see the header
+void AAGCloudModel::set_coefficients( const std::array<int,7> &k )
+{
+	k1 = static_cast<float>( k[0] / 100 );
+	k2 = static_cast<float>( k[1] / 10 );
+	k3 = static_cast<float>( k[2] / 100 );
+	k45 = static_cast<float>( k[3] / 1000 ) * static_cast<float>( k[4] / 100 );
+	k6 = static_cast<float>( k[5] / 10 );
+	k6_sign = sign( static_cast<float>( k[5] ));
+	k7 = static_cast<float>( k[6] / 100 );
+}
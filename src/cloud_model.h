@@ -0,0 +1,98 @@
+/*
+  	cloud_model.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _cloud_model_H
+#define	_cloud_model_H
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+
+enum struct cloud_coverage : uint8_t {
+
+	CLEAR,
+	CLOUDY,
+	OVERCAST
+
+};
+
+struct cloud_model_sample_t {
+
+	float	ambient_temperature;
+	float	raw_sky_temperature;
+};
+
+struct cloud_model_result_t {
+
+	float	sky_temperature;
+	uint8_t	cloud_coverage;
+};
+
+// Turns a raw MLX90614 reading into a corrected sky temperature and a cloud coverage class.
+// Models are set up once from the configuration, evaluating them is cheap.
+class CloudModel {
+
+	public:
+
+		virtual					~CloudModel( void ) = default;
+		uint8_t					classify( float ) const;
+		virtual float			correct( float, float ) const = 0;
+		cloud_model_result_t	evaluate( float, float ) const;
+		void					evaluate( const cloud_model_sample_t *, cloud_model_result_t *, size_t ) const;
+		void					set_thresholds( float, float );
+
+	private:
+
+		float					cloudy_threshold		= 0.F;
+		float					overcast_threshold		= 0.F;
+};
+
+// Sky minus ambient temperature
+class AWSCloudModel : public CloudModel {
+
+	public:
+
+								AWSCloudModel( void ) = default;
+		float					correct( float, float ) const override;
+};
+
+// AAG CloudWatcher model, coefficients are given as integers scaled like in the AAG documentation. Gives the same
+// results as the inline formula it replaced, integer divisions of the coefficients included, so that configured
+// thresholds keep their meaning. See tools/cloud_model_test.cpp.
+class AAGCloudModel : public CloudModel {
+
+	public:
+
+								AAGCloudModel( void ) = default;
+		float					correct( float, float ) const override;
+		void					set_coefficients( const std::array<int,7> & );
+
+	private:
+
+		float					k1						= 0.F;
+		float					k2						= 0.F;
+		float					k3						= 0.F;
+		float					k45						= 0.F;	// exp(k4*Ta)^k5 == exp(k4*k5*Ta)
+		float					k6						= 0.F;
+		float					k6_sign					= 0.F;
+		float					k7						= 0.F;
+};
+
+#endif
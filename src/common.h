@@ -28,6 +28,7 @@
 
 #include "build_id.h"
 #include "AWSGPS.h"
+#include "SQM.h"
 
 // Force DEBUG output even if not activated by external button
 const byte DEBUG_MODE = 1;
@@ -72,7 +73,8 @@ enum struct dome_shutter_status_type : byte
 	Open,
 	Closed,
 	Opening,
-	Closing
+	Closing,
+	Error		// Motion timed out or both sensors are active
 };
 using dome_shutter_status_t = dome_shutter_status_type;
 
@@ -87,18 +89,6 @@ struct health_data_t {
 
 };
 
-struct sqm_data_t {
-
-	float		msas;
-	float		nelm;
-	uint16_t	gain;
-	uint16_t	integration_time;
-	uint16_t	ir_luminosity;
-	uint16_t	vis_luminosity;
-	uint16_t	full_luminosity;
-
-};
-
 struct weather_data_t {
 
 	float	temperature;
@@ -21,6 +21,7 @@
 #include <ESPAsyncWebServer.h>
 #include <FS.h>
 #include <LittleFS.h>
+#include <rom/crc.h>
 
 #include "defaults.h"
 #include "common.h"
@@ -35,6 +36,12 @@ extern const std::array<std::string, 3> ANEMOMETER_MODEL;
 
 RTC_DATA_ATTR char _can_rollback = 0;	// NOSONAR
 
+// Parsed configuration kept across deep sleep, only the length is reset on power up
+RTC_NOINIT_ATTR std::array<uint8_t,RTC_CONFIG_SIZE>	rtc_config;			// NOSONAR
+RTC_DATA_ATTR uint16_t		rtc_config_len = 0;						// NOSONAR
+RTC_DATA_ATTR uint32_t		rtc_config_crc = 0;						// NOSONAR
+RTC_DATA_ATTR aws_device_t	rtc_config_devices = aws_device_t::NO_SENSOR;	// NOSONAR
+
 bool AWSConfig::can_rollback( void )
 {
 	return _can_rollback;
@@ -84,6 +91,16 @@ aws_pwr_src	AWSConfig::get_pwr_mode( void )
 
 etl::string_view AWSConfig::get_root_ca( void )
 {
+	// Not read when the configuration comes from RTC memory. Never formats the filesystem from here: if it
+	// does not mount, the default CA is used until the next full boot sorts it out.
+	if ( root_ca.empty() ) {
+
+		if ( LittleFS.begin( false ))
+			read_root_ca();
+		else
+			root_ca.assign( DEFAULT_ROOT_CA );
+	}
+
 	return etl::string_view( root_ca );
 }
 
@@ -146,6 +163,30 @@ bool AWSConfig::load( bool _debug_mode  )
 	return read_config();
 }
 
+// Skips the filesystem after a deep sleep, the configuration cannot have changed without a reboot
+bool AWSConfig::load_from_rtc( bool _debug_mode )
+{
+	debug_mode = _debug_mode;
+
+	if ( !rtc_config_len || ( crc32_le( 0, rtc_config.data(), rtc_config_len ) != rtc_config_crc ))
+		return false;
+
+	if ( DeserializationError::Ok != deserializeMsgPack( json_config, rtc_config.data(), rtc_config_len )) {
+
+		Serial.printf( "[CONFIGMNGR] [ERROR] Configuration in RTC memory is corrupted.\n" );
+		rtc_config_len = 0;
+		return false;
+	}
+
+	read_hw_info_from_nvs();
+	devices = rtc_config_devices;
+
+	if ( debug_mode )
+		Serial.printf( "[CONFIGMNGR] [DEBUG] Configuration restored from RTC memory (%d bytes).\n", rtc_config_len );
+
+	return true;
+}
+
 bool AWSConfig::read_config( void )
 {
 	read_hw_info_from_nvs();
@@ -329,6 +370,7 @@ bool AWSConfig::rollback()
 	LittleFS.rename( "/aws.conf.bak", "/aws.conf" );
 	Serial.printf( "[CONFIGMNGR] [INFO ] Rollback successful.\n" );
 	_can_rollback = 0;
+	rtc_config_len = 0;
 	return true;
 }
 
@@ -406,12 +448,30 @@ bool AWSConfig::save_runtime_configuration( JsonVariant &_json_config )
 	LittleFS.rename( "/root_ca.txt.try", "/root_ca.txt" );
 
 	_can_rollback = 1;
+	rtc_config_len = 0;
 	if ( debug_mode )
 		list_files();
 
 	return true;
 }
 
+void AWSConfig::save_to_rtc( void )
+{
+	size_t len = measureMsgPack( json_config );
+
+	rtc_config_len = 0;
+	if ( len > rtc_config.size() ) {
+
+		Serial.printf( "[CONFIGMNGR] [ERROR] Configuration is too big to be kept in RTC memory [%d > %d bytes].\n", len, rtc_config.size() );
+		return;
+	}
+
+	serializeMsgPack( json_config, rtc_config.data(), rtc_config.size() );
+	rtc_config_crc = crc32_le( 0, rtc_config.data(), len );
+	rtc_config_devices = devices;
+	rtc_config_len = len;
+}
+
 void AWSConfig::set_missing_network_parameters_to_default_values( void )
 {
 	if ( !json_config["wifi_ap_ssid"].is<JsonVariant>() )
@@ -475,110 +535,39 @@ void AWSConfig::set_missing_network_parameters_to_default_values( void )
 		json_config["wifi_sta_password"] = DEFAULT_WIFI_STA_PASSWORD;
 }
 
-void AWSConfig::set_missing_lookout_safe_parameters_to_default_values( void )
+void AWSConfig::set_missing_lookout_rule_parameters_to_default_values( void )
 {
-	if ( !json_config["safe_cloud_coverage_1_active"].is<JsonVariant>())
-		json_config["safe_cloud_coverage_1_active"] = DEFAULT_SAFE_CLOUD_COVERAGE_1_ACTIVE;
-
-	if ( !json_config["safe_cloud_coverage_2_active"].is<JsonVariant>() )
-		json_config["safe_cloud_coverage_2_active"] = DEFAULT_SAFE_CLOUD_COVERAGE_1_ACTIVE;
-
-	if ( !json_config["safe_cloud_coverage_1_delay"].is<JsonVariant>() )
-		json_config["safe_cloud_coverage_1_delay"] = DEFAULT_SAFE_CLOUD_COVERAGE_1_DELAY;
-
-	if ( !json_config["safe_cloud_coverage_2_delay"].is<JsonVariant>() )
-		json_config["safe_cloud_coverage_2_delay"] = DEFAULT_SAFE_CLOUD_COVERAGE_2_DELAY;
-
-	if ( !json_config["safe_cloud_coverage_1_max"].is<JsonVariant>() )
-		json_config["safe_cloud_coverage_1_max"] = DEFAULT_SAFE_CLOUD_COVERAGE_1_MAX;
-
-	if ( !json_config["safe_cloud_coverage_2_max"].is<JsonVariant>() )
-		json_config["safe_cloud_coverage_2_max"] = DEFAULT_SAFE_CLOUD_COVERAGE_2_MAX;
-
-	if ( !json_config["safe_rain_intensity_active"].is<JsonVariant>() )
-		json_config["safe_rain_intensity_active"] = DEFAULT_SAFE_RAIN_INTENSITY_ACTIVE;
-
-	if ( !json_config["safe_rain_intensity_delay"].is<JsonVariant>() )
-		json_config["safe_rain_intensity_delay"] = DEFAULT_SAFE_RAIN_INTENSITY_DELAY;
-
-	if ( !json_config["safe_rain_intensity_max"].is<JsonVariant>() )
-		json_config["safe_rain_intensity_max"] = DEFAULT_SAFE_RAIN_INTENSITY_MAX;
-
-	if ( !json_config["safe_wind_speed_active"].is<JsonVariant>() )
-		json_config["safe_wind_speed_active"] = DEFAULT_SAFE_WIND_SPEED_ACTIVE;
-
-	if ( !json_config["safe_wind_speed_max"].is<JsonVariant>() )
-		json_config["safe_wind_speed_max"] = DEFAULT_SAFE_WIND_SPEED_MAX;
-
-	if ( !json_config["safe_wind_speed_delay"].is<JsonVariant>() )
-		json_config["safe_wind_speed_delay"] = DEFAULT_SAFE_WIND_SPEED_DELAY;
-}
-
-void AWSConfig::set_missing_lookout_unsafe_parameters_to_default_values( void )
-{
-	if ( !json_config["unsafe_cloud_coverage_1_active"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_1_active"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_1_ACTIVE;
-
-	if ( !json_config["unsafe_cloud_coverage_2_active"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_2_active"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_2_ACTIVE;
-
-	if ( !json_config["unsafe_cloud_coverage_1_delay"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_1_delay"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_1_DELAY;
-
-	if ( !json_config["unsafe_cloud_coverage_2_delay"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_2_delay"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_2_DELAY;
-
-	if ( !json_config["unsafe_cloud_coverage_1_max"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_1_max"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_1_MAX;
-
-	if ( !json_config["unsafe_cloud_coverage_2_max"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_2_max"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_2_MAX;
-
-	if ( !json_config["unsafe_cloud_coverage_1_missing"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_1_missing"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_1_MISSING;
-
-	if ( !json_config["unsafe_cloud_coverage_2_missing"].is<JsonVariant>() )
-		json_config["unsafe_cloud_coverage_2_missing"] = DEFAULT_UNSAFE_CLOUD_COVERAGE_2_MISSING;
-
-	if ( !json_config["unsafe_rain_event_active"].is<JsonVariant>() )
-		json_config["unsafe_rain_event_active"] = DEFAULT_UNSAFE_RAIN_EVENT_ACTIVE;
-
-	if ( !json_config["unsafe_rain_event_missing"].is<JsonVariant>() )
-		json_config["unsafe_rain_event_missing"] = DEFAULT_UNSAFE_RAIN_EVENT_MISSING;
-
-	if ( !json_config["unsafe_rain_intensity_active"].is<JsonVariant>() )
-		json_config["unsafe_rain_intensity_active"] = DEFAULT_UNSAFE_RAIN_INTENSITY_ACTIVE;
-
-	if ( !json_config["unsafe_rain_intensity_max"].is<JsonVariant>() )
-		json_config["unsafe_rain_intensity_max"] = DEFAULT_UNSAFE_RAIN_INTENSITY_MAX;
-
-	if ( !json_config["unsafe_rain_intensity_missing"].is<JsonVariant>() )
-		json_config["unsafe_rain_intensity_missing"] = DEFAULT_UNSAFE_RAIN_INTENSITY_MISSING;
-
-	if ( !json_config["unsafe_wind_speed_1_active"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_1_active"] = DEFAULT_UNSAFE_WIND_SPEED_1_ACTIVE;
-
-	if ( !json_config["unsafe_wind_speed_2_active"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_2_active"] = DEFAULT_UNSAFE_WIND_SPEED_2_ACTIVE;
-
-	if ( !json_config["unsafe_wind_speed_1_max"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_1_max"] = DEFAULT_UNSAFE_WIND_SPEED_1_MAX;
-
-	if ( !json_config["unsafe_wind_speed_2_max"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_2_max"] = DEFAULT_UNSAFE_WIND_SPEED_2_MAX;
-
-	if ( !json_config["unsafe_wind_speed_1_missing"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_1_missing"] = DEFAULT_UNSAFE_WIND_SPEED_1_MISSING;
-
-	if ( !json_config["unsafe_wind_speed_2_missing"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_2_missing"] = DEFAULT_UNSAFE_WIND_SPEED_2_MISSING;
-
-	if ( !json_config["unsafe_wind_speed_1_delay"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_1_delay"] = DEFAULT_UNSAFE_WIND_SPEED_1_DELAY;
-
-	if ( !json_config["unsafe_wind_speed_2_delay"].is<JsonVariant>() )
-		json_config["unsafe_wind_speed_2_delay"] = DEFAULT_UNSAFE_WIND_SPEED_2_DELAY;
-
+	for ( const lookout_rule_definition_t &definition : LOOKOUT_RULE_DEFINITIONS )
+		for ( const lookout_config_key_t &config_key : LOOKOUT_CONFIG_KEYS ) {
+
+			if ( !( definition.keys & config_key.key ))
+				continue;
+
+			etl::string<48> key = LookoutRules::config_key( definition, config_key.suffix );
+			if ( json_config[ key.c_str() ].is<JsonVariant>() )
+				continue;
+
+			switch( config_key.key ) {
+
+				case LOOKOUT_KEY_ACTIVE:
+					json_config[ key.c_str() ] = definition.defaults.active;
+					break;
+				case LOOKOUT_KEY_MAX:
+					json_config[ key.c_str() ] = definition.defaults.max;
+					break;
+				case LOOKOUT_KEY_DELAY:
+					json_config[ key.c_str() ] = definition.defaults.delay;
+					break;
+				case LOOKOUT_KEY_MISSING:
+					json_config[ key.c_str() ] = definition.defaults.satisfied_if_missing;
+					break;
+				case LOOKOUT_KEY_HYSTERESIS:
+					json_config[ key.c_str() ] = definition.defaults.hysteresis;
+					break;
+				default:
+					break;
+			}
+		}
 }
 
 void AWSConfig::set_missing_lookout_parameters_to_default_values( void )
@@ -622,8 +611,7 @@ void AWSConfig::set_missing_lookout_parameters_to_default_values( void )
 	if ( !json_config["cloud_coverage_formula"].is<JsonVariant>() )
 		json_config["cloud_coverage_formula"] = DEFAULT_CC_FORMULA_AWS ? 0 : 1;
 
-	set_missing_lookout_safe_parameters_to_default_values();
-	set_missing_lookout_unsafe_parameters_to_default_values();
+	set_missing_lookout_rule_parameters_to_default_values();
 }
 
 void AWSConfig::set_missing_parameters_to_default_values( void )
@@ -658,6 +646,9 @@ void AWSConfig::set_missing_parameters_to_default_values( void )
 	if ( !json_config["ota_url"].is<JsonVariant>() )
 		json_config["ota_url"] = DEFAULT_OTA_URL;
 
+	if ( !json_config["ota_buffer_size"].is<JsonVariant>() )
+		json_config["ota_buffer_size"] = DEFAULT_OTA_BUFFER_SIZE;
+
 }
 
 void AWSConfig::set_parameter( const char *key, const char *val )
@@ -714,46 +705,14 @@ bool AWSConfig::verify_entries( JsonVariant &proposed_config )
 			case str2int( "k5" ):
 			case str2int( "k6" ):
 			case str2int( "k7" ):
+			case str2int( "ota_buffer_size" ):
 			case str2int( "ota_url" ):
 			case str2int( "pref_iface" ):
 			case str2int( "push_freq" ):
 			case str2int( "rain_event_guard_time" ):
 			case str2int( "remote_server" ):
 			case str2int( "root_ca" ):
-			case str2int( "safe_cloud_coverage_1_active" ):
-			case str2int( "safe_cloud_coverage_2_active" ):
-			case str2int( "safe_cloud_coverage_1_delay" ):
-			case str2int( "safe_cloud_coverage_2_delay" ):
-			case str2int( "safe_cloud_coverage_1_max" ):
-			case str2int( "safe_cloud_coverage_2_max" ):
-			case str2int( "safe_rain_intensity_active" ):
-			case str2int( "safe_rain_intensity_delay" ):
-			case str2int( "safe_rain_intensity_max" ):
-			case str2int( "safe_wind_speed_active" ):
-			case str2int( "safe_wind_speed_delay" ):
-			case str2int( "safe_wind_speed_max" ):
 			case str2int( "tzname" ):
-			case str2int( "unsafe_cloud_coverage_1_active" ):
-			case str2int( "unsafe_cloud_coverage_2_active" ):
-			case str2int( "unsafe_cloud_coverage_1_delay" ):
-			case str2int( "unsafe_cloud_coverage_2_delay" ):
-			case str2int( "unsafe_cloud_coverage_1_max" ):
-			case str2int( "unsafe_cloud_coverage_2_max" ):
-			case str2int( "unsafe_cloud_coverage_1_missing" ):
-			case str2int( "unsafe_cloud_coverage_2_missing" ):
-			case str2int( "unsafe_rain_event_active" ):
-			case str2int( "unsafe_rain_event_missing" ):
-			case str2int( "unsafe_rain_intensity_active" ):
-			case str2int( "unsafe_rain_intensity_max" ):
-			case str2int( "unsafe_rain_intensity_missing" ):
-			case str2int( "unsafe_wind_speed_1_active" ):
-			case str2int( "unsafe_wind_speed_2_active" ):
-			case str2int( "unsafe_wind_speed_1_delay" ):
-			case str2int( "unsafe_wind_speed_2_delay" ):
-			case str2int( "unsafe_wind_speed_1_max" ):
-			case str2int( "unsafe_wind_speed_2_max" ):
-			case str2int( "unsafe_wind_speed_1_missing" ):
-			case str2int( "unsafe_wind_speed_2_missing" ):
 			case str2int( "url_path" ):
 			case str2int( "wifi_ap_dns" ):
 			case str2int( "wifi_ap_gw" ):
@@ -787,6 +746,8 @@ bool AWSConfig::verify_entries( JsonVariant &proposed_config )
 				proposed_config[ item.key().c_str() ] = 1;
 				break;
 			default:
+				if ( LookoutRules::is_config_key( item.key().c_str() ))
+					break;
 				Serial.printf( "[CONFIGMNGR] [ERROR] Unknown configuration key [%s]\n",  item.key().c_str() );
 				return false;
 		}
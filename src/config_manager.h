@@ -24,6 +24,8 @@
 #include <ArduinoJson.h>
 
 #include "device.h"
+#include "lookout_rules.h"
+
 enum struct aws_iface : int {
 
 	wifi_ap,
@@ -85,41 +87,6 @@ const bool				DEFAULT_CC_FORMULA_AWS					= true;
 
 const uint16_t			DEFAULT_RAIN_EVENT_GUARD_TIME			= 60;
 
-const bool				DEFAULT_SAFE_CLOUD_COVERAGE_1_ACTIVE	= false;
-const bool				DEFAULT_SAFE_CLOUD_COVERAGE_2_ACTIVE	= false;
-const uint16_t			DEFAULT_SAFE_CLOUD_COVERAGE_1_DELAY		= 0;
-const uint16_t			DEFAULT_SAFE_CLOUD_COVERAGE_2_DELAY		= 0;
-const uint16_t			DEFAULT_SAFE_CLOUD_COVERAGE_1_MAX		= 0;
-const uint16_t			DEFAULT_SAFE_CLOUD_COVERAGE_2_MAX		= 0;
-const bool				DEFAULT_SAFE_RAIN_INTENSITY_ACTIVE		= false;
-const uint16_t			DEFAULT_SAFE_RAIN_INTENSITY_DELAY		= 0;
-const uint16_t			DEFAULT_SAFE_RAIN_INTENSITY_MAX			= 0;
-const bool				DEFAULT_SAFE_WIND_SPEED_ACTIVE			= false;
-const uint16_t			DEFAULT_SAFE_WIND_SPEED_DELAY			= 0;
-const uint16_t			DEFAULT_SAFE_WIND_SPEED_MAX				= 0;
-
-const bool				DEFAULT_UNSAFE_CLOUD_COVERAGE_1_ACTIVE	= false;
-const bool				DEFAULT_UNSAFE_CLOUD_COVERAGE_2_ACTIVE	= false;
-const uint16_t			DEFAULT_UNSAFE_CLOUD_COVERAGE_1_DELAY	= 0;
-const uint16_t			DEFAULT_UNSAFE_CLOUD_COVERAGE_2_DELAY	= 0;
-const uint16_t			DEFAULT_UNSAFE_CLOUD_COVERAGE_1_MAX		= 0;
-const uint16_t			DEFAULT_UNSAFE_CLOUD_COVERAGE_2_MAX		= 0;
-const bool				DEFAULT_UNSAFE_CLOUD_COVERAGE_1_MISSING	= false;	// if not checked, the key will not be in the submitted json, ditto for other similar parameters
-const bool				DEFAULT_UNSAFE_CLOUD_COVERAGE_2_MISSING	= false;
-const bool				DEFAULT_UNSAFE_RAIN_EVENT_ACTIVE		= true;
-const bool				DEFAULT_UNSAFE_RAIN_EVENT_MISSING		= true;
-const bool				DEFAULT_UNSAFE_RAIN_INTENSITY_ACTIVE	= false;
-const uint16_t			DEFAULT_UNSAFE_RAIN_INTENSITY_MAX		= 0;
-const bool				DEFAULT_UNSAFE_RAIN_INTENSITY_MISSING	= false;
-const bool				DEFAULT_UNSAFE_WIND_SPEED_1_ACTIVE		= false;
-const bool				DEFAULT_UNSAFE_WIND_SPEED_2_ACTIVE		= false;
-const uint16_t			DEFAULT_UNSAFE_WIND_SPEED_1_DELAY		= 0;
-const uint16_t			DEFAULT_UNSAFE_WIND_SPEED_2_DELAY		= 0;
-const uint16_t			DEFAULT_UNSAFE_WIND_SPEED_1_MAX			= 0;
-const uint16_t			DEFAULT_UNSAFE_WIND_SPEED_2_MAX			= 0;
-const bool				DEFAULT_UNSAFE_WIND_SPEED_1_MISSING		= false;
-const bool				DEFAULT_UNSAFE_WIND_SPEED_2_MISSING		= false;
-
 const aws_wifi_mode		DEFAULT_WIFI_MODE						= aws_wifi_mode::both;
 const aws_ip_mode		DEFAULT_WIFI_STA_IP_MODE				= aws_ip_mode::dhcp;
 
@@ -129,7 +96,10 @@ const uint16_t			DEFAULT_PUSH_FREQ						= 300;
 const bool				DEFAULT_DISCORD_ENABLED					= false;
 const char				DEFAULT_DISCORD_WEBHOOK[]				= "";
 
+const size_t			RTC_CONFIG_SIZE							= 2048;		// bytes of MessagePack
+
 const char				DEFAULT_OTA_URL[]						= "https://www.datamancers.net/images/AWS.json";
+const uint16_t			DEFAULT_OTA_BUFFER_SIZE					= 4096;		// bytes per read of the firmware stream
 
 class AWSConfig {
 
@@ -142,9 +112,7 @@ class AWSConfig {
 		std::array<uint8_t,6>	get_eth_mac( void );
 		uint32_t				get_fs_free_space( void );
 		template <typename T>
-		T 						get_lookout_safe_parameter( const char * );
-		template <typename T>
-		T 						get_lookout_unsafe_parameter( const char * );
+		T 						get_lookout_parameter( const char * );
 		template <typename T>
 		T 						get_parameter( const char * );
 		bool					get_has_device( aws_device_t );
@@ -155,6 +123,8 @@ class AWSConfig {
 		etl::string_view		get_root_ca( void );
 		etl::string_view		get_wind_vane_model_str( void );
 		bool 					load( bool );
+		bool					load_from_rtc( bool );
+		void					save_to_rtc( void );
 		void					set_parameter( const char *, const char * );
 		bool					rollback( void );
 		bool					save_runtime_configuration( JsonVariant & );
@@ -183,8 +153,7 @@ class AWSConfig {
 		bool	read_hw_info_from_nvs( void );
 		void	read_root_ca( void );
 		void	set_missing_lookout_parameters_to_default_values( void );
-		void	set_missing_lookout_safe_parameters_to_default_values( void );
-		void	set_missing_lookout_unsafe_parameters_to_default_values( void );
+		void	set_missing_lookout_rule_parameters_to_default_values( void );
 		void	set_missing_network_parameters_to_default_values( void );
 		void	set_missing_parameters_to_default_values( void );
 		void	set_root_ca( JsonVariant & );
@@ -200,59 +169,13 @@ constexpr unsigned int str2int( const char* str, int h = 0 )
     return !str[h] ? 5381 : (str2int(str, h+1) * 33) ^ str[h];
 }
 
+// Rule keys come from LOOKOUT_RULE_DEFINITIONS
 template <typename T>
-T AWSConfig::get_lookout_safe_parameter( const char *key )
+T AWSConfig::get_lookout_parameter( const char *key )
 {
-	switch( str2int( key )) {
-		case str2int( "safe_cloud_coverage_1_active" ):
-		case str2int( "safe_cloud_coverage_2_active" ):
-		case str2int( "safe_cloud_coverage_1_delay" ):
-		case str2int( "safe_cloud_coverage_2_delay" ):
-		case str2int( "safe_cloud_coverage_1_max" ):
-		case str2int( "safe_cloud_coverage_2_max" ):
-		case str2int( "safe_rain_intensity_active" ):
-		case str2int( "safe_rain_intensity_delay" ):
-		case str2int( "safe_rain_intensity_max" ):
-		case str2int( "safe_wind_speed_active" ):
-		case str2int( "safe_wind_speed_delay" ):
-		case str2int( "safe_wind_speed_max" ):
-			return json_config[key].as<T>();
-		default:
-			break;
-	}
-	Serial.printf( "[CONFIGMNGR] [ERROR]: Unknown parameter [%s]\n", key );
-	return 0;
-}
+	if ( LookoutRules::is_config_key( key ))
+		return json_config[key].as<T>();
 
-template <typename T>
-T AWSConfig::get_lookout_unsafe_parameter( const char *key )
-{
-	switch( str2int( key )) {
-		case str2int( "unsafe_cloud_coverage_1_active" ):
-		case str2int( "unsafe_cloud_coverage_2_active" ):
-		case str2int( "unsafe_cloud_coverage_1_delay" ):
-		case str2int( "unsafe_cloud_coverage_2_delay" ):
-		case str2int( "unsafe_cloud_coverage_1_max" ):
-		case str2int( "unsafe_cloud_coverage_2_max" ):
-		case str2int( "unsafe_cloud_coverage_1_missing" ):
-		case str2int( "unsafe_cloud_coverage_2_missing" ):
-		case str2int( "unsafe_rain_event_active" ):
-		case str2int( "unsafe_rain_event_missing" ):
-		case str2int( "unsafe_rain_intensity_active" ):
-		case str2int( "unsafe_rain_intensity_max" ):
-		case str2int( "unsafe_rain_intensity_missing" ):
-		case str2int( "unsafe_wind_speed_1_active" ):
-		case str2int( "unsafe_wind_speed_2_active" ):
-		case str2int( "unsafe_wind_speed_1_delay" ):
-		case str2int( "unsafe_wind_speed_2_delay" ):
-		case str2int( "unsafe_wind_speed_1_max" ):
-		case str2int( "unsafe_wind_speed_2_max" ):
-		case str2int( "unsafe_wind_speed_1_missing" ):
-		case str2int( "unsafe_wind_speed_2_missing" ):
-			return json_config[key].as<T>();
-		default:
-			break;
-	}
 	Serial.printf( "[CONFIGMNGR] [ERROR]: Unknown parameter [%s]\n", key );
 	return 0;
 }
@@ -311,11 +234,8 @@ T AWSConfig::get_network_parameter( const char *key )
 template <typename T>
 T AWSConfig::get_parameter( const char *key )
 {
-	if ( !strncmp( key, "unsafe_", 7 ))
-		return get_lookout_unsafe_parameter<T>( key );
-
-	if ( !strncmp( key, "safe_", 5 ))
-		return get_lookout_safe_parameter<T>( key );
+	if ( !strncmp( key, "unsafe_", 7 ) || !strncmp( key, "safe_", 5 ))
+		return get_lookout_parameter<T>( key );
 
 	if ( !strncmp( key, "wifi_", 5 ) || !strncmp( key, "eth_", 4 ))
 		return get_network_parameter<T>( key );
@@ -339,6 +259,7 @@ T AWSConfig::get_parameter( const char *key )
 		case str2int( "discord_wh" ):
 		case str2int( "lookout_enabled" ):
 		case str2int( "msas_calibration_offset" ):
+		case str2int( "ota_buffer_size" ):
 		case str2int( "ota_url" ):
 		case str2int( "pref_iface" ):
 		case str2int( "push_freq" ):
@@ -20,6 +20,7 @@
 #define DYNAMIC_JSON_DOCUMENT_SIZE  4096	// NOSONAR
 
 #include <Arduino.h>
+#include <memory>
 #include <esp_task_wdt.h>
 #include <AsyncTCP.h>
 #include <Ethernet.h>
@@ -36,11 +37,63 @@
 #include "config_manager.h"
 #include "config_server.h"
 #include "AstroWeatherStation.h"
+#include "history_formatter.h"
 
 extern HardwareSerial Serial1;					// NOSONAR
 extern AstroWeatherStation station;
 extern SemaphoreHandle_t sensors_read_mutex;	// Issue #7
 
+const uint32_t	HISTORY_DEFAULT_SPAN	= 3600;		// s
+const uint8_t	HISTORY_QUERY_SAMPLES	= 8;		// Read from flash at once
+const size_t	HISTORY_QUERY_BUFFER	= 2048;		// Output made ready for the client
+
+enum struct history_query_status_t : uint8_t {
+
+	READING,
+	FINISHED,
+	FAILED
+};
+
+// Everything a /history response needs between two chunks. The history is read and formatted by a scheduler job,
+// the response callback runs in the async_tcp task and only takes what is ready in 'output'.
+struct history_query_t {
+
+	SemaphoreHandle_t										mutex		= xSemaphoreCreateMutex();
+	history_tier_t											tier;
+	uint32_t												from;
+	uint32_t												to;
+	bool													opened		= false;
+	history_cursor_t										cursor;
+	HistoryFormatter										formatter;
+	std::array<history_sample_t,HISTORY_QUERY_SAMPLES>		samples;
+	size_t													count		= 0;
+	size_t													next		= 0;
+	bool													ended		= false;		// No more samples, the formatter is finished
+	std::array<uint8_t,HISTORY_QUERY_BUFFER>				output;
+	size_t													output_size	= 0;
+	history_query_status_t									status		= history_query_status_t::READING;
+
+	~history_query_t( void ) { if ( mutex ) vSemaphoreDelete( mutex ); }
+};
+
+namespace {
+
+// A parameter which is there must be a number and nothing else
+bool get_uint_param( AsyncWebServerRequest *request, const char *name, uint32_t &value )
+{
+	const char	*str;
+	char		*end;
+
+	if ( !request->hasParam( name ))
+		return true;
+
+	str = request->getParam( name )->value().c_str();
+	value = strtoul( str, &end, 10 );
+	return isdigit( *str ) && !*end;
+}
+
+}
+
 void AWSWebServer::attempt_ota_update( AsyncWebServerRequest *request )
 {
 	station.trigger_ota_update();
@@ -66,6 +119,211 @@ void AWSWebServer::get_configuration( AsyncWebServerRequest *request )
 		request->send( 500, "text/plain", "[ERROR] get_configuration() had a problem, please contact support." );
 }
 
+// Streams the history from flash in chunks, with a few kB of heap whatever the time span. One query at a time,
+// flash is read by fill_history_query() and never from the async_tcp task.
+void AWSWebServer::get_history( AsyncWebServerRequest *request )
+{
+	SensorHistory								*history = station.get_history();
+	std::shared_ptr<history_query_t>			query;
+	std::array<uint8_t,HISTORY_CHANNELS>		channels;
+	uint8_t										channel_count = 0;
+	history_format_t							format = history_format_t::CSV;
+	const char									*content_type = "text/csv";
+	AsyncWebServerResponse						*response;
+	uint32_t									from;
+	uint32_t									to = static_cast<uint32_t>( station.get_timestamp() );
+	uint32_t									resolution = 0;
+
+	if ( !history->is_initialised() ) {
+
+		request->send( 503, "text/plain", "No sensor history on this station" );
+		return;
+	}
+
+	if ( !is_history_query_free() ) {
+
+		request->send( 503, "text/plain", "History busy, try again later" );
+		return;
+	}
+
+	if ( !get_uint_param( request, "to", to ) || !get_uint_param( request, "resolution", resolution )) {
+
+		request->send( 400, "text/plain", "Bad time range" );
+		return;
+	}
+	from = to - std::min( to, HISTORY_DEFAULT_SPAN );
+	if ( !get_uint_param( request, "from", from ) || ( from > to )) {
+
+		request->send( 400, "text/plain", "Bad time range" );
+		return;
+	}
+
+	if ( request->hasParam( "format" )) {
+
+		const String &name = request->getParam( "format" )->value();
+
+		if ( name == "ndjson" ) {
+
+			format = history_format_t::NDJSON;
+			content_type = "application/x-ndjson";
+
+		} else if ( name == "bin" ) {
+
+			format = history_format_t::BINARY;
+			content_type = "application/octet-stream";
+
+		} else if ( name != "csv" ) {
+
+			request->send( 400, "text/plain", "Unknown format" );
+			return;
+		}
+	}
+
+	if ( request->hasParam( "channels" )) {
+
+		const String		&value = request->getParam( "channels" )->value();
+		etl::string<512>	list = value.c_str();
+		char				*next;
+
+		for ( char *name = strtok_r( list.data(), ",", &next ); name; name = strtok_r( nullptr, ",", &next )) {
+
+			uint8_t i = std::find_if( HISTORY_CHANNEL_NAMES.begin(), HISTORY_CHANNEL_NAMES.end(), [name]( const char *s ) { return !strcmp( s, name ); } ) - HISTORY_CHANNEL_NAMES.begin();
+
+			if (( i == HISTORY_CHANNELS ) || ( channel_count == HISTORY_CHANNELS )) {
+
+				request->send( 400, "text/plain", "Unknown channel" );
+				return;
+			}
+			channels[ channel_count++ ] = i;
+		}
+
+		if ( !channel_count || ( value.length() > list.capacity() )) {
+
+			request->send( 400, "text/plain", "Bad channel list" );
+			return;
+		}
+
+	} else
+
+		for ( ; channel_count < HISTORY_CHANNELS; channel_count++ )
+			channels[ channel_count ] = channel_count;
+
+	query = std::make_shared<history_query_t>();
+	if ( !query->mutex ) {
+
+		request->send( 500, "text/plain", "Out of memory" );
+		return;
+	}
+	query->tier = history->pick_tier( from );
+	query->from = from;
+	query->to = to;
+	query->formatter.begin( format, HISTORY_CHANNEL_NAMES.data(), channels.data(), channel_count, resolution, static_cast<uint8_t>( query->tier ));
+	xSemaphoreTake( history_query_mutex, portMAX_DELAY );
+	history_query = query;
+	xSemaphoreGive( history_query_mutex );
+	station.trigger_history_query();
+
+	if ( debug_mode )
+		Serial.printf( "[WEBSERVER ] [DEBUG] History from %d to %d, resolution %ds, tier %d.\n", from, to, resolution, static_cast<int>( query->tier ));
+
+	response = request->beginChunkedResponse( content_type, [request,query]( uint8_t *buffer, size_t max_len, size_t ) -> size_t {
+
+		size_t					n;
+		history_query_status_t	status;
+
+		if ( xSemaphoreTake( query->mutex, 0 ) != pdTRUE )
+			return RESPONSE_TRY_AGAIN;
+
+		n = std::min( max_len, query->output_size );
+		memcpy( buffer, query->output.data(), n );
+		memmove( query->output.data(), query->output.data() + n, query->output_size - n );
+		query->output_size -= n;
+		status = query->status;
+		xSemaphoreGive( query->mutex );
+
+		if ( status == history_query_status_t::READING )
+			station.trigger_history_query();
+		if ( n )
+			return n;
+
+		switch ( status ) {
+
+			case history_query_status_t::READING:
+				return RESPONSE_TRY_AGAIN;
+
+			case history_query_status_t::FINISHED:
+				return 0;
+
+			case history_query_status_t::FAILED:
+				break;
+		}
+
+		// Ending the chunked response would pass the truncated history for a complete one
+		Serial.printf( "[WEBSERVER ] [ERROR] Could not read the sensor history, response aborted.\n" );
+		request->client()->abort();
+		return 0;
+	});
+	response->addHeader( "X-History-Tier", HISTORY_TIER_NAMES[ static_cast<uint8_t>( query->tier ) ] );
+	request->send( response );
+}
+
+// Run by the scheduler until the query output is full or the query is over. Output is drained from the formatter
+// before each new sample, so that it only ever holds one line.
+void AWSWebServer::fill_history_query( void )
+{
+	std::shared_ptr<history_query_t>	query;
+	SensorHistory						*history = station.get_history();
+
+	xSemaphoreTake( history_query_mutex, portMAX_DELAY );
+	query = history_query.lock();
+	xSemaphoreGive( history_query_mutex );
+
+	if ( !query || ( xSemaphoreTake( query->mutex, 1000 / portTICK_PERIOD_MS ) != pdTRUE ))
+		return;
+
+	if ( !query->opened ) {
+
+		query->opened = true;
+		if ( !history->open_query( query->cursor, query->tier, query->from, query->to ))
+			query->status = history_query_status_t::FAILED;
+	}
+
+	while ( query->status == history_query_status_t::READING ) {
+
+		query->output_size += query->formatter.read( query->output.data() + query->output_size, query->output.size() - query->output_size );
+		if ( query->output_size == query->output.size() )
+			break;
+
+		if ( query->ended ) {
+
+			query->status = history_query_status_t::FINISHED;
+			break;
+		}
+
+		if ( query->next < query->count ) {
+
+			query->formatter.add( query->samples[ query->next ].timestamp, query->samples[ query->next ].value.data() );
+			query->next++;
+			continue;
+		}
+
+		query->next = 0;
+		if ( !history->read( query->cursor, query->samples.data(), query->samples.size(), query->count )) {
+
+			query->status = history_query_status_t::FAILED;
+			break;
+		}
+
+		// The last bucket goes out with the next pass
+		if ( !query->count ) {
+
+			query->formatter.finish();
+			query->ended = true;
+		}
+	}
+	xSemaphoreGive( query->mutex );
+}
+
 void AWSWebServer::get_lookout_rules_state( AsyncWebServerRequest *request )
 {
 	request->send( 200, "application/json", station.get_lookout_rules_state_json_string().data() );
@@ -132,11 +390,27 @@ void AWSWebServer::index( AsyncWebServerRequest *request )
 	request->send( LittleFS, "/index.html" );
 }
 
+bool AWSWebServer::is_history_query_free( void )
+{
+	bool free;
+
+	xSemaphoreTake( history_query_mutex, portMAX_DELAY );
+	free = history_query.expired();
+	xSemaphoreGive( history_query_mutex );
+	return free;
+}
+
 bool AWSWebServer::initialise( bool _debug_mode )
 {
 	int port = station.get_config_port();
 
 	debug_mode = _debug_mode;
+	if ( !( history_query_mutex = xSemaphoreCreateMutex() )) {
+
+		Serial.printf( "[WEBSERVER ] [ERROR] Could not create the history mutex.\n" );
+		return false;
+	}
+
 	Serial.printf( "[WEBSERVER ] [INFO ] Server on port [%d].\n", port );
 	if (( server = new AsyncWebServer(port))) {
 			if ( debug_mode )
@@ -243,6 +517,7 @@ void AWSWebServer::start( void )
 	server->on( "/open_dome_shutter", HTTP_GET, std::bind( &AWSWebServer::open_dome_shutter, this, std::placeholders::_1 ));
 	server->on( "/favicon.ico", HTTP_GET, std::bind( &AWSWebServer::send_file, this, std::placeholders::_1 ));
 	server->on( "/get_config", HTTP_GET, std::bind( &AWSWebServer::get_configuration, this, std::placeholders::_1 ));
+	server->on( "/history", HTTP_GET, std::bind( &AWSWebServer::get_history, this, std::placeholders::_1 ));
 	server->on( "/get_lookout_state", HTTP_GET, std::bind( &AWSWebServer::get_lookout_rules_state, this, std::placeholders::_1 ));
 	server->on( "/get_station_data", HTTP_GET, std::bind( &AWSWebServer::get_station_data, this, std::placeholders::_1 ));
 	server->on( "/get_root_ca", HTTP_GET, std::bind( &AWSWebServer::get_root_ca, this, std::placeholders::_1 ));
@@ -29,6 +29,9 @@
 #include <SSLClient.h>
 #include <ESPAsyncWebServer.h>
 #include <ArduinoJson.h>
+#include <memory>
+
+struct history_query_t;
 
 class AWSWebServer {
 
@@ -36,7 +39,9 @@ class AWSWebServer {
 
 				AWSWebServer( void ) = default;
 		void attempt_ota_update( AsyncWebServerRequest * );
+		void fill_history_query( void );
 		void get_configuration( AsyncWebServerRequest * );
+		void get_history( AsyncWebServerRequest * );
 		void get_hw_configuration( AsyncWebServerRequest * );
 		void get_station_data( AsyncWebServerRequest * );
 		void get_root_ca( AsyncWebServerRequest * );
@@ -48,6 +53,8 @@ class AWSWebServer {
 
 		AsyncWebServer 	*server		= nullptr;
 		bool			debug_mode	= false;
+		std::weak_ptr<history_query_t>	history_query;		// The one being sent, if any
+		SemaphoreHandle_t	history_query_mutex	= nullptr;	// history_query is set by async_tcp and read by the scheduler
 		bool			initialised	= false;
 		
 		void		close_dome_shutter( AsyncWebServerRequest * );
@@ -55,6 +62,7 @@ class AWSWebServer {
 		void		get_uptime( AsyncWebServerRequest * );
 		void		handle404( AsyncWebServerRequest * );
 		void		index( AsyncWebServerRequest * );
+		bool		is_history_query_free( void );
 		void		open_dome_shutter( AsyncWebServerRequest * );
 		void		reboot( AsyncWebServerRequest * );
 		void		resume_lookout( AsyncWebServerRequest * );
@@ -169,11 +169,17 @@ function fill_lookout_values( values )
 	fill_lookout_value( "unsafe_cloud_coverage_1", true, true, values );
 	fill_lookout_value( "unsafe_cloud_coverage_2", true, true, values );
 	fill_lookout_value( "unsafe_rain_intensity", true, true, values );
+	fill_lookout_value( "unsafe_rh", false, true, values );
+	fill_lookout_value( "unsafe_dew_spread", false, true, values );
+	fill_lookout_value( "unsafe_msas", false, true, values );
 
 	fill_lookout_value( "safe_wind_speed", false, false, values );
 	fill_lookout_value( "safe_cloud_coverage_1", true, false, values );
 	fill_lookout_value( "safe_cloud_coverage_2", true, false, values );
 	fill_lookout_value( "safe_rain_intensity", false, false, values );
+	fill_lookout_value( "safe_rh", false, false, values );
+	fill_lookout_value( "safe_dew_spread", false, false, values );
+	fill_lookout_value( "safe_msas", false, false, values );
 }
 
 function fill_network_values( values )
@@ -357,6 +363,7 @@ function retrieve_data()
 			document.getElementById("push_freq").value = values['push_freq'];
 			document.getElementById("data_push").checked = values['data_push'];
 			document.getElementById("ota_url").value = values['ota_url'];
+			document.getElementById("ota_buffer_size").value = values['ota_buffer_size'];
 			document.getElementById("discord_wh").value = values['discord_wh'];
 			document.getElementById("lookout_dash").style.display = values['lookout_enabled'] ? "flex":"none" ;
 			document.getElementById("dome_dash").style.display = ( values['has_dome'] == 1 ) ? "flex":"none" ;
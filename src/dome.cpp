@@ -19,6 +19,7 @@
 
 #include <Arduino.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
 #include <AsyncUDP_ESP32_W5500.hpp>
 #include <ESPAsyncWebServer.h>
 
@@ -33,8 +34,6 @@ extern void IRAM_ATTR		_handle_dome_shutter_open_change( void );
 extern void IRAM_ATTR		_handle_dome_shutter_closed_change( void );
 
 extern AstroWeatherStation	station;
-extern time_t 				last_ntp_time;		// NOSONAR
-extern uint16_t				ntp_time_misses;	// NOSONAR
 
 //
 // IMPORTANT: Some indications about dome shutter status handling by this driver
@@ -56,6 +55,15 @@ extern uint16_t				ntp_time_misses;	// NOSONAR
 //						if pin level is DOWN, the dome shutter is not expected to be OPEN (could be closing or opening)
 //							==> it requires an active action (pulling HIGH the pin level) to indicate that the shutter is OPEN
 //
+//	==> Both status pins raise an interrupt on each edge, the event task then calls shutter_*_change() which
+//		updates the shutter state right away:
+//
+//				Closed --(closed sensor drops or open command)--> Opening --(open sensor rises)--> Open
+//				Open --(open sensor drops or close command)--> Closing --(closed sensor rises)--> Closed
+//				Opening/Closing --(no end of motion within twice the learned duration)--> Error
+//
+//		Motion durations are learned, a motion slower than the envelope raises an alarm.
+//
 
 Dome::Dome( void )
 {
@@ -64,127 +72,105 @@ Dome::Dome( void )
 	set_driver_version( "1.0" );
 }
 
-bool Dome::get_shutter_closed_status( void )
+bool Dome::close_shutter( void )
 {
 	if ( !is_connected ) {
 
-		Serial.printf( "[DOME      ] [ERROR] Dome is not initialised, cannot get shutter closed status!\n" );
+		Serial.printf( "[DOME      ] [ERROR] Dome is not initialised, cannot close shutter!\n" );
 		return false;
 	}
 
-	bool closed_shutter = ( digitalRead( GPIO_DOME_CLOSED ) == HIGH );
-	bool open_shutter = ( digitalRead( GPIO_DOME_OPEN ) == HIGH );
-
-	if ( closed_shutter ) {
+	dome_data->close_command = true;
 
-		dome_data->shutter_status = dome_shutter_status_t::Closed;
-		dome_data->closed_sensor = true;
+	if ( sc16is750 ) {
 
-	} else {
+		while ( xSemaphoreTake( i2c_mutex, 50 / portTICK_PERIOD_MS ) != pdTRUE );
 
-		if ( open_shutter )
-			dome_data->shutter_status = dome_shutter_status_t::Open;
+		sc16is750->digitalWrite( GPIO_DOME_1, LOW );
 
-		else {
+		xSemaphoreGive( i2c_mutex );
 
-			if ( dome_data->shutter_status == dome_shutter_status_t::Closed )
-				dome_data->shutter_status = dome_shutter_status_t::Opening;
+	} else
 
-		}
-		dome_data->closed_sensor = false;
+		digitalWrite( GPIO_DOME_1_DIRECT, LOW );
 
-	}
+	do_close_shutter = false;
 
-	if ( get_debug_mode() )
-		Serial.printf( "[DOME      ] [DEBUG] Dome shutter closed : %s\n", closed_shutter ? "yes" : "no" );
+	// Repeated commands do not restart the motion timer, and only an end stop clears an error
+	if (( shutter_status == dome_shutter_status_t::Open ) || ( shutter_status == dome_shutter_status_t::Opening ))
+		set_state( dome_shutter_status_t::Closing, static_cast<uint32_t>( esp_timer_get_time() ));
 
-	return closed_shutter;
+	return true;
 }
 
-bool Dome::get_shutter_open_status( void )
+// Scheduled every SUPERVISION_MS and run right away on a command or an alarm. Also catches an edge that would
+// have been missed and supervises motions.
+void Dome::control( void )
 {
-	if ( !is_connected ) {
-
-		Serial.printf( "[DOME      ] [ERROR] Dome is not initialised, cannot get shutter open status!\n" );
-		return false;
+	if ( do_close_shutter )
+		close_shutter();
+	else {
+		if ( do_open_shutter )
+			open_shutter();
 	}
 
-	bool closed_shutter = ( digitalRead( GPIO_DOME_CLOSED ) == HIGH );
-	bool open_shutter = ( digitalRead( GPIO_DOME_OPEN ) == HIGH );
-
-	if ( open_shutter ) {
-
-		dome_data->shutter_status = dome_shutter_status_t::Open;
-		dome_data->open_sensor = true;
+	update_state( static_cast<uint32_t>( esp_timer_get_time() ));
+	supervise_motion( static_cast<uint32_t>( esp_timer_get_time() ));
+	send_pending_alarm();
+}
 
-	} else {
+// Until enough motions have been timed, the envelope is the fixed timeout
+uint32_t Dome::envelope_ms( const dome_motion_stats_t &stats )
+{
+	if ( stats.count < ENVELOPE_SAMPLES )
+		return MOTION_TIMEOUT_MS;
 
-		if ( closed_shutter )
-			dome_data->shutter_status = dome_shutter_status_t::Closed;
+	return static_cast<uint32_t>( stats.mean_ms * ENVELOPE_FACTOR );
+}
 
-		else {
+dome_motion_stats_t Dome::get_closing_stats( void )
+{
+	return closing_stats;
+}
 
-			if ( dome_data->shutter_status == dome_shutter_status_t::Open )
-				dome_data->shutter_status = dome_shutter_status_t::Closing;
+dome_motion_stats_t Dome::get_opening_stats( void )
+{
+	return opening_stats;
+}
 
-		}
-		dome_data->open_sensor = false;
+bool Dome::get_shutter_closed_status( void )
+{
+	if ( !is_connected ) {
 
+		Serial.printf( "[DOME      ] [ERROR] Dome is not initialised, cannot get shutter closed status!\n" );
+		return false;
 	}
 
-	if ( get_debug_mode() )
-		Serial.printf( "[DOME      ] [DEBUG] Dome shutter open : %s\n", open_shutter ? "yes" : "no" );
-
-	return open_shutter;
+	return ( digitalRead( GPIO_DOME_CLOSED ) == HIGH );
 }
 
-bool Dome::close_shutter( void )
+bool Dome::get_shutter_open_status( void )
 {
 	if ( !is_connected ) {
 
-		Serial.printf( "[DOME      ] [ERROR] Dome is not initialised, cannot close shutter!\n" );
+		Serial.printf( "[DOME      ] [ERROR] Dome is not initialised, cannot get shutter open status!\n" );
 		return false;
 	}
 
-	dome_data->close_command = true;
-
-	if ( sc16is750 ) {
-
-		while ( xSemaphoreTake( i2c_mutex, 50 / portTICK_PERIOD_MS ) != pdTRUE );
-
-		sc16is750->digitalWrite( GPIO_DOME_1, LOW );
-
-		xSemaphoreGive( i2c_mutex );
-
-	} else
-
-		digitalWrite( GPIO_DOME_1_DIRECT, LOW );
-
-	do_close_shutter = false;
-	return true;
+	return ( digitalRead( GPIO_DOME_OPEN ) == HIGH );
 }
 
-void Dome::control_task( void *dummy )	// NOSONAR
+dome_shutter_status_t Dome::get_shutter_status( void )
 {
-	while ( true ) {
-
-			if ( do_close_shutter )
-				close_shutter();
-			else {
-				if ( do_open_shutter )
-					open_shutter();
-			}
-
-			delay( 1000 );
-			get_shutter_closed_status();
-			get_shutter_open_status();
-	}
+	return shutter_status;
 }
 
-void Dome::initialise( dome_data_t *_dome_data, bool _debug_mode )
+void Dome::initialise( dome_data_t *_dome_data, Scheduler *_scheduler, bool _debug_mode )
 {
 	set_debug_mode( _debug_mode );
 	dome_data = _dome_data;
+	scheduler = _scheduler;
+	state_mutex = xSemaphoreCreateMutex();
 
 	if ( sc16is750 ) {
 
@@ -200,38 +186,34 @@ void Dome::initialise( dome_data_t *_dome_data, bool _debug_mode )
 	pinMode( GPIO_DOME_OPEN, INPUT );
 	pinMode( GPIO_DOME_CLOSED, INPUT );
 
-	if ( get_shutter_closed_status() )
+	if ( digitalRead( GPIO_DOME_CLOSED ))
 		dome_data->shutter_status = shutter_status = dome_shutter_status_t::Closed;
 	else
-		if ( get_shutter_open_status() )
+		if ( digitalRead( GPIO_DOME_OPEN ))
 			dome_data->shutter_status = shutter_status = dome_shutter_status_t::Open;
 		else
 			dome_data->shutter_status = shutter_status = dome_shutter_status_t::Opening;	// This is a convention
-		
+	motion_start_us = static_cast<uint32_t>( esp_timer_get_time() );
+
 	dome_data->open_sensor = digitalRead( GPIO_DOME_OPEN );
 	dome_data->closed_sensor = digitalRead( GPIO_DOME_CLOSED );
 	dome_data->close_command = false;
 
-	attachInterrupt( GPIO_DOME_CLOSED, _handle_dome_shutter_closed_change, CHANGE );
-	attachInterrupt( GPIO_DOME_OPEN, _handle_dome_shutter_open_change, RISING );
-
-	std::function<void(void *)> _control = std::bind( &Dome::control_task, this, std::placeholders::_1 );
-	if ( xTaskCreatePinnedToCore(
-		[](void *param) {	// NOSONAR
-            std::function<void(void*)>* control_proxy = static_cast<std::function<void(void*)>*>( param );
-            (*control_proxy)( NULL );
-		}, "DomeControl", 2000, &_control, configMAX_PRIORITIES - 2, &dome_task_handle, 1 ) != pdPASS )
-		Serial.printf( "[DOME      ] [ERROR] Could not start task [DomeControlTask]\n" );
-
+	job = scheduler->add_job( "dome", SUPERVISION_MS, SUPERVISION_MS, SUPERVISION_MS, job_priority_t::URGENT, job_pool_t::SHORT, [this]() { control(); } );
+	if ( job == SCHEDULER_NO_JOB )
+		Serial.printf( "[DOME      ] [ERROR] Could not schedule dome control.\n" );
 
 	is_connected = true;
+
+	attachInterrupt( GPIO_DOME_CLOSED, _handle_dome_shutter_closed_change, CHANGE );
+	attachInterrupt( GPIO_DOME_OPEN, _handle_dome_shutter_open_change, CHANGE );
 }
 
-void Dome::initialise( I2C_SC16IS750 *_sc16is750, SemaphoreHandle_t _i2c_mutex, dome_data_t *_dome_data, bool _debug_mode )
+void Dome::initialise( I2C_SC16IS750 *_sc16is750, SemaphoreHandle_t _i2c_mutex, dome_data_t *_dome_data, Scheduler *_scheduler, bool _debug_mode )
 {
 	i2c_mutex =_i2c_mutex;
 	sc16is750 = _sc16is750;
-	initialise( _dome_data, _debug_mode );
+	initialise( _dome_data, _scheduler, _debug_mode );
 }
 
 bool Dome::open_shutter( void )
@@ -257,26 +239,178 @@ bool Dome::open_shutter( void )
 
 		digitalWrite( GPIO_DOME_1_DIRECT, HIGH );
 
+	if (( shutter_status == dome_shutter_status_t::Closed ) || ( shutter_status == dome_shutter_status_t::Closing ))
+		set_state( dome_shutter_status_t::Opening, static_cast<uint32_t>( esp_timer_get_time() ));
+
 	return true;
 }
 
-void Dome::shutter_closed_change( void )
+void Dome::record_motion( dome_motion_stats_t &stats, uint32_t duration_ms, dome_alarm_t slow_alarm )
 {
-	if ( digitalRead( GPIO_DOME_CLOSED ))
-		dome_data->shutter_status = shutter_status = dome_shutter_status_t::Closed;
-	else
-		dome_data->shutter_status = shutter_status = dome_shutter_status_t::Opening;
+	uint32_t envelope = envelope_ms( stats );
+
+	if (( stats.count >= ENVELOPE_SAMPLES ) && ( duration_ms > envelope )) {
+
+		pending_alarm = slow_alarm;
+		pending_alarm_ms = duration_ms;
+	}
+
+	stats.count++;
+	stats.last_ms = duration_ms;
+	stats.max_ms = std::max( stats.max_ms, duration_ms );
+	stats.mean_ms += ( static_cast<float>( duration_ms ) - stats.mean_ms ) / stats.count;
+
+	if ( get_debug_mode() )
+		Serial.printf( "[DOME      ] [DEBUG] Motion took %dms (mean=%.0fms max=%dms envelope=%dms).\n", duration_ms, stats.mean_ms, stats.max_ms, envelope );
+}
+
+// Alarms are raised by whoever changes the state but only sent from the control job, through the blocking worker
+void Dome::send_pending_alarm( void )
+{
+	etl::string<96>	message;
+	dome_alarm_t	alarm = pending_alarm;
+
+	if ( alarm == dome_alarm_t::NONE )
+		return;
+	pending_alarm = dome_alarm_t::NONE;
+
+	switch( alarm ) {
+
+		case dome_alarm_t::SLOW_OPENING:
+			snprintf( message.data(), message.capacity(), "Shutter took %dms to open, expected %dms.", pending_alarm_ms, envelope_ms( opening_stats ));
+			break;
+
+		case dome_alarm_t::SLOW_CLOSING:
+			snprintf( message.data(), message.capacity(), "Shutter took %dms to close, expected %dms.", pending_alarm_ms, envelope_ms( closing_stats ));
+			break;
+
+		case dome_alarm_t::STUCK_OPENING:
+			snprintf( message.data(), message.capacity(), "Shutter still not open after %dms.", pending_alarm_ms );
+			break;
+
+		case dome_alarm_t::STUCK_CLOSING:
+			snprintf( message.data(), message.capacity(), "Shutter still not closed after %dms.", pending_alarm_ms );
+			break;
+
+		default:
+			return;
+	}
+
+	Serial.printf( "[DOME      ] [ERROR] %s\n", message.data() );
+	station.queue_alarm( "[DOME] Shutter motion", message.data() );
+}
+
+void Dome::set_state( dome_shutter_status_t new_status, uint32_t now_us )
+{
+	dome_shutter_status_t	old_status;
+	uint32_t				duration_ms;
+
+	if ( xSemaphoreTake( state_mutex, 100 / portTICK_PERIOD_MS ) != pdTRUE )
+		return;
+
+	old_status = shutter_status;
+	if ( new_status == old_status ) {
+
+		xSemaphoreGive( state_mutex );
+		return;
+	}
+
+	duration_ms = ( now_us - motion_start_us ) / 1000;
+
+	if (( old_status == dome_shutter_status_t::Opening ) && ( new_status == dome_shutter_status_t::Open ))
+		record_motion( opening_stats, duration_ms, dome_alarm_t::SLOW_OPENING );
+	if (( old_status == dome_shutter_status_t::Closing ) && ( new_status == dome_shutter_status_t::Closed ))
+		record_motion( closing_stats, duration_ms, dome_alarm_t::SLOW_CLOSING );
+
+	if (( new_status == dome_shutter_status_t::Opening ) || ( new_status == dome_shutter_status_t::Closing ))
+		motion_start_us = now_us;
+
+	dome_data->shutter_status = shutter_status = new_status;
+	xSemaphoreGive( state_mutex );
+
+	if ( get_debug_mode() )
+		Serial.printf( "[DOME      ] [DEBUG] Shutter state %d -> %d.\n", static_cast<uint8_t>( old_status ), static_cast<uint8_t>( new_status ));
+
+	if ( pending_alarm != dome_alarm_t::NONE )
+		scheduler->run_now( job );
+}
+
+void Dome::shutter_closed_change( uint32_t timestamp_us )
+{
+	update_state( timestamp_us );
+}
+
+void Dome::shutter_open_change( uint32_t timestamp_us )
+{
+	update_state( timestamp_us );
 }
 
-void Dome::shutter_open_change( void )
+// A motion which does not complete within twice its envelope puts the shutter in error
+void Dome::supervise_motion( uint32_t now_us )
 {
-	if ( digitalRead( GPIO_DOME_OPEN ))
-		dome_data->shutter_status = shutter_status = dome_shutter_status_t::Open;
+	uint32_t	elapsed_ms;
+	uint32_t	limit_ms;
+
+	if ( xSemaphoreTake( state_mutex, 100 / portTICK_PERIOD_MS ) != pdTRUE )
+		return;
+
+	elapsed_ms = ( now_us - motion_start_us ) / 1000;
+
+	if ( shutter_status == dome_shutter_status_t::Opening )
+		limit_ms = STUCK_FACTOR * envelope_ms( opening_stats );
+	else if ( shutter_status == dome_shutter_status_t::Closing )
+		limit_ms = STUCK_FACTOR * envelope_ms( closing_stats );
 	else
-		dome_data->shutter_status = shutter_status = dome_shutter_status_t::Closing;
+		limit_ms = UINT32_MAX;
+
+	if ( elapsed_ms <= limit_ms ) {
+
+		xSemaphoreGive( state_mutex );
+		return;
+	}
+
+	pending_alarm = ( shutter_status == dome_shutter_status_t::Opening ) ? dome_alarm_t::STUCK_OPENING : dome_alarm_t::STUCK_CLOSING;
+	pending_alarm_ms = elapsed_ms;
+	dome_data->shutter_status = shutter_status = dome_shutter_status_t::Error;
+	xSemaphoreGive( state_mutex );
 }
 
 void Dome::trigger_close_shutter( void )
 {
 	close_shutter_command = do_close_shutter = true;
+	if ( scheduler )
+		scheduler->run_now( job );
+}
+
+// Derives the shutter state from the sensors, a sensor dropping means the shutter started to move.
+// A motion only ends on the end stop it goes to: if the shutter stays on, or falls back on, the one it
+// started from, supervise_motion() raises the stuck alarm once the motion times out.
+void Dome::update_state( uint32_t now_us )
+{
+	bool closed = ( digitalRead( GPIO_DOME_CLOSED ) == HIGH );
+	bool open = ( digitalRead( GPIO_DOME_OPEN ) == HIGH );
+
+	dome_data->closed_sensor = closed;
+	dome_data->open_sensor = open;
+
+	if ( open && closed )
+		set_state( dome_shutter_status_t::Error, now_us );
+	else if ( shutter_status == dome_shutter_status_t::Closing ) {
+
+		if ( closed )
+			set_state( dome_shutter_status_t::Closed, now_us );
+
+	} else if ( shutter_status == dome_shutter_status_t::Opening ) {
+
+		if ( open )
+			set_state( dome_shutter_status_t::Open, now_us );
+
+	} else if ( closed )
+		set_state( dome_shutter_status_t::Closed, now_us );
+	else if ( open )
+		set_state( dome_shutter_status_t::Open, now_us );
+	else if ( shutter_status == dome_shutter_status_t::Closed )
+		set_state( dome_shutter_status_t::Opening, now_us );
+	else if ( shutter_status == dome_shutter_status_t::Open )
+		set_state( dome_shutter_status_t::Closing, now_us );
 }
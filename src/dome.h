@@ -22,37 +22,76 @@
 #define	_DOME_H
 
 #include "device.h"
+#include "scheduler.h"
+
+struct dome_motion_stats_t {
+
+	uint32_t	count;
+	uint32_t	last_ms;
+	uint32_t	max_ms;
+	float		mean_ms;
+};
+
+enum struct dome_alarm_t : uint8_t {
+
+	NONE,
+	SLOW_OPENING,
+	SLOW_CLOSING,
+	STUCK_OPENING,
+	STUCK_CLOSING
+};
 
 class Dome : public Device {
 
 	private:
 
+		static constexpr uint32_t	MOTION_TIMEOUT_MS		= 120000;	// Until the motion envelope has been learned
+		static constexpr uint8_t	ENVELOPE_SAMPLES		= 3;
+		static constexpr float		ENVELOPE_FACTOR			= 1.5F;		// Slower motions raise an alarm
+		static constexpr float		STUCK_FACTOR			= 2.F;		// Of the envelope, before giving up on a motion
+		static constexpr uint32_t	SUPERVISION_MS			= 1000;
+
 		bool					do_close_shutter				= false;
 		bool					close_shutter_command			= false;
+		dome_motion_stats_t		closing_stats					= {};
 		bool					is_connected					= false;
 		bool					debug_mode						= false;
 		I2C_SC16IS750			*sc16is750						= nullptr;
 		dome_data_t				*dome_data						= nullptr;
 		SemaphoreHandle_t		i2c_mutex;
+		uint32_t				motion_start_us					= 0;
 		bool					do_open_shutter					= false;
-		TaskHandle_t			dome_task_handle;
+		job_id_t				job								= SCHEDULER_NO_JOB;
+		dome_motion_stats_t		opening_stats					= {};
+		volatile dome_alarm_t	pending_alarm					= dome_alarm_t::NONE;
+		uint32_t				pending_alarm_ms				= 0;
 		dome_shutter_status_t	shutter_status					= dome_shutter_status_t::Open;
+		Scheduler				*scheduler						= nullptr;
+		SemaphoreHandle_t		state_mutex						= nullptr;
 
-		bool get_shutter_moving_status( void );
+		void					control( void );
+		uint32_t				envelope_ms( const dome_motion_stats_t & );
+		void					record_motion( dome_motion_stats_t &, uint32_t, dome_alarm_t );
+		void					send_pending_alarm( void );
+		void					set_state( dome_shutter_status_t, uint32_t );
+		void					supervise_motion( uint32_t );
+		void					update_state( uint32_t );
 
 	public:
 
 		explicit Dome( void );
 		bool					close_shutter( void );
-		void					control_task( void * );
+		dome_motion_stats_t		get_closing_stats( void );
 		bool					get_connected( void );
+		dome_motion_stats_t		get_opening_stats( void );
 		bool					get_shutter_closed_status( void );
 		bool					get_shutter_open_status( void );
-		void					initialise( dome_data_t *, bool );
-		void					initialise( I2C_SC16IS750 *, SemaphoreHandle_t, dome_data_t *, bool );
+		dome_shutter_status_t	get_shutter_status( void );
+		void					initialise( dome_data_t *, Scheduler *, bool );
+		void					initialise( I2C_SC16IS750 *, SemaphoreHandle_t, dome_data_t *, Scheduler *, bool );
 		bool					open_shutter( void );
-		void 					shutter_closed_change( void );
-		void 					shutter_open_change( void );
+		void 					shutter_closed_change( uint32_t );
+		void 					shutter_open_change( uint32_t );
 		void					trigger_close_shutter( void );
 };
 
@@ -0,0 +1,56 @@
+/*
+  	event_queue.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "event_queue.h"
+
+uint32_t EventQueue::get_overflows( void )
+{
+	return overflows;
+}
+
+bool EventQueue::pop( aws_event_record_t &record )
+{
+	uint8_t t = tail.load( std::memory_order_relaxed );
+
+	if ( t == head.load( std::memory_order_acquire ))
+		return false;
+
+	record = ring[ t & ( EVENT_QUEUE_SIZE - 1 ) ];
+	tail.store( t + 1, std::memory_order_release );
+	return true;
+}
+
+// Runs in interrupt context: no locks, no logging, nothing outside of IRAM
+bool IRAM_ATTR EventQueue::push( aws_event_t event )
+{
+	uint8_t h = head.load( std::memory_order_relaxed );
+
+	if ( static_cast<uint8_t>( h - tail.load( std::memory_order_acquire )) >= EVENT_QUEUE_SIZE ) {
+
+		overflows++;
+		return false;
+	}
+
+	ring[ h & ( EVENT_QUEUE_SIZE - 1 ) ] = { event, static_cast<uint32_t>( esp_timer_get_time() ) };
+	head.store( h + 1, std::memory_order_release );
+	return true;
+}
@@ -0,0 +1,70 @@
+/*
+  	event_queue.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _event_queue_H
+#define	_event_queue_H
+
+#include <atomic>
+
+enum struct aws_events : uint8_t
+{
+	RAIN,
+	DOME_SHUTTER_CLOSED_CHANGE,
+	DOME_SHUTTER_OPEN_CHANGE,
+	COUNT
+
+};
+using aws_event_t = aws_events;
+
+constexpr uint8_t	EVENT_QUEUE_SIZE	= 16;		// Must be a power of two
+
+struct aws_event_record_t {
+
+	aws_event_t	event;
+	uint32_t	timestamp_us;		// Monotonic time (low 32 bits) at which the interrupt fired
+};
+
+struct event_stats_t {
+
+	uint32_t	count;
+	uint32_t	last_latency_us;	// From the interrupt to the start of its handling
+	uint32_t	max_latency_us;
+};
+
+// Lock-free single producer, single consumer ring. All producers are GPIO interrupt handlers
+// served on the same core, which never preempt each other, so they count as one.
+class EventQueue {
+
+	public:
+
+							EventQueue( void ) = default;
+		uint32_t			get_overflows( void );
+		bool				pop( aws_event_record_t & );
+		bool IRAM_ATTR		push( aws_event_t );
+
+	private:
+
+		std::array<aws_event_record_t,EVENT_QUEUE_SIZE>	ring;
+		std::atomic<uint8_t>	head					= 0;		// Only written by the producer
+		std::atomic<uint8_t>	tail					= 0;		// Only written by the consumer
+		volatile uint32_t		overflows				= 0;
+};
+
+#endif
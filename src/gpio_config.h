@@ -69,6 +69,9 @@ const	uint8_t	GPIO_DOME_1_DIRECT	= 14;
 #define	GPIO_DOME_CLOSED		GPIO_NUM_39
 #define	GPIO_DOME_OPEN			GPIO_NUM_36
 
+// SC16IS750 IRQ output, GPIO_NUM_NC if not wired (polled mode)
+#define	GPIO_SC16IS750_IRQ		GPIO_NUM_NC
+
 // Direct connection between GPS and ESP32 (not through SC16IS750)
 #define	GPS_RX					GPIO_NUM_27
 #define	GPS_TX					GPIO_NUM_26
@@ -0,0 +1,214 @@
+/*
+	history_formatter.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "history_formatter.h"
+
+// Values of all history channels, only the selected ones are output. Must only be called once read() has emptied the output.
+void HistoryFormatter::add( uint32_t timestamp, const float *values )
+{
+	std::array<float,HISTORY_FORMATTER_MAX_CHANNELS>	selected;
+
+	if ( !resolution ) {
+
+		for ( uint8_t i = 0; i < channel_count; i++ )
+			selected[ i ] = values[ channels[ i ] ];
+		emit( timestamp, selected.data() );
+		return;
+	}
+
+	if ( bucket_open && ( timestamp - ( timestamp % resolution ) != bucket_start ))
+		emit_bucket();
+
+	if ( !bucket_open ) {
+
+		bucket_start = timestamp - ( timestamp % resolution );
+		bucket_open = true;
+		for ( uint8_t i = 0; i < channel_count; i++ )
+			buckets[ i ] = { NAN, NAN, 0, 0 };
+	}
+
+	for ( uint8_t i = 0; i < channel_count; i++ ) {
+
+		float		x = values[ channels[ i ] ];
+		bucket_t	&bucket = buckets[ i ];
+
+		if ( std::isnan( x ))
+			continue;
+		bucket.min = bucket.count ? std::fmin( bucket.min, x ) : x;
+		bucket.max = bucket.count ? std::fmax( bucket.max, x ) : x;
+		bucket.sum += x;
+		bucket.count++;
+	}
+}
+
+void HistoryFormatter::begin( history_format_t _format, const char * const *_names, const uint8_t *_channels, uint8_t _channel_count, uint32_t _resolution, uint8_t source )
+{
+	const char *suffix[] = { "_min", "_max", "_mean" };
+
+	format = _format;
+	names = _names;
+	channel_count = ( _channel_count > HISTORY_FORMATTER_MAX_CHANNELS ) ? HISTORY_FORMATTER_MAX_CHANNELS : _channel_count;
+	memcpy( channels.data(), _channels, channel_count );
+	resolution = _resolution;
+	bucket_open = false;
+	output_head = output_size = 0;
+
+	switch( format ) {
+
+		case history_format_t::CSV:
+			print( "timestamp" );
+			for ( uint8_t i = 0; i < channel_count; i++ )
+				if ( resolution )
+					for ( const char *s : suffix )
+						print( ",%s%s", names[ channels[ i ] ], s );
+				else
+					print( ",%s", names[ channels[ i ] ] );
+			print( "\n" );
+			break;
+
+		case history_format_t::NDJSON:
+			break;
+
+		case history_format_t::BINARY: {
+
+			uint8_t header[] = { 'A', 'W', 'S', 'B', 2, channel_count, static_cast<uint8_t>( resolution ? 3 : 1 ), source };
+
+			write( header, sizeof( header ));
+			write( &resolution, sizeof( resolution ));
+			write( channels.data(), channel_count );
+			break;
+		}
+	}
+}
+
+// One line or record, 'values' holds one value per channel or, with a resolution, min, max and mean of each channel in turn
+void HistoryFormatter::emit( uint32_t timestamp, const float *values )
+{
+	const char	*stat[] = { "min", "max", "mean" };
+	uint8_t		per_channel = resolution ? 3 : 1;
+
+	switch( format ) {
+
+		case history_format_t::CSV:
+			print( "%u", static_cast<unsigned int>( timestamp ));
+			for ( uint8_t i = 0; i < channel_count * per_channel; i++ ) {
+
+				print( "," );
+				print_value( values[ i ], false );
+			}
+			print( "\n" );
+			break;
+
+		case history_format_t::NDJSON:
+			print( R"json({"timestamp":%u)json", static_cast<unsigned int>( timestamp ));
+			for ( uint8_t i = 0; i < channel_count; i++ ) {
+
+				print( R"json(,"%s":)json", names[ channels[ i ] ] );
+				if ( !resolution ) {
+
+					print_value( values[ i ], true );
+					continue;
+				}
+				for ( uint8_t j = 0; j < 3; j++ ) {
+
+					print( R"json(%s"%s":)json", j ? "," : "{", stat[ j ] );
+					print_value( values[ 3 * i + j ], true );
+				}
+				print( "}" );
+			}
+			print( "}\n" );
+			break;
+
+		case history_format_t::BINARY:
+			write( &timestamp, sizeof( timestamp ));
+			write( values, channel_count * per_channel * sizeof( float ));
+			break;
+	}
+}
+
+void HistoryFormatter::emit_bucket( void )
+{
+	std::array<float,3 * HISTORY_FORMATTER_MAX_CHANNELS>	stats;
+
+	for ( uint8_t i = 0; i < channel_count; i++ ) {
+
+		stats[ 3 * i ] = buckets[ i ].min;
+		stats[ 3 * i + 1 ] = buckets[ i ].max;
+		stats[ 3 * i + 2 ] = buckets[ i ].count ? buckets[ i ].sum / buckets[ i ].count : NAN;
+	}
+	emit( bucket_start, stats.data() );
+	bucket_open = false;
+}
+
+// The last bucket is only complete once there are no more samples
+void HistoryFormatter::finish( void )
+{
+	if ( bucket_open )
+		emit_bucket();
+}
+
+void HistoryFormatter::print( const char *fmt, ... )
+{
+	va_list	args;
+	int		len;
+
+	va_start( args, fmt );
+	len = vsnprintf( output.data() + output_size, output.size() - output_size, fmt, args );
+	va_end( args );
+
+	if ( len > 0 )
+		output_size = std::min( output_size + len, output.size() - 1 );
+}
+
+void HistoryFormatter::print_value( float x, bool json )
+{
+	if ( std::isnan( x )) {
+
+		if ( json )
+			print( "null" );
+		return;
+	}
+	print( "%.7g", x );
+}
+
+// Pending output, up to the room given. Returns 0 once everything has been read.
+size_t HistoryFormatter::read( uint8_t *buffer, size_t max_len )
+{
+	size_t len = std::min( max_len, output_size - output_head );
+
+	memcpy( buffer, output.data() + output_head, len );
+	output_head += len;
+	if ( output_head == output_size )
+		output_head = output_size = 0;
+	return len;
+}
+
+void HistoryFormatter::write( const void *data, size_t len )
+{
+	len = std::min( len, output.size() - output_size );
+	memcpy( output.data() + output_size, data, len );
+	output_size += len;
+}
@@ -0,0 +1,96 @@
+/*
+  	history_formatter.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _history_formatter_H
+#define	_history_formatter_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint8_t	HISTORY_FORMATTER_MAX_CHANNELS	= 32;
+
+enum struct history_format_t : uint8_t {
+
+	CSV,			// "timestamp" then the channel names, empty cells for missing values
+	NDJSON,			// One object per line, null for missing values
+	BINARY			// See below
+};
+
+// Turns history samples into text or binary output, one sample at a time, so that a response of any length
+// only needs the room of one line. With a resolution, samples are gathered in buckets of that many seconds
+// and each channel gives its min, max and mean over the bucket, missing values ignored. These are taken from
+// the samples given, which are themselves means when they come from a downsampled history tier: the source
+// says which one.
+//
+// Binary output, little endian:
+//	header		char[4]		"AWSB"
+//				uint8		format version, 2
+//				uint8		channel count
+//				uint8		values per channel: 1, or 3 for min, max and mean
+//				uint8		source, as history_tier_t: 0 samples as recorded, 1 and 2 means over a minute and an hour
+//				uint32		resolution in seconds, 0 for samples as they are
+//				uint8[]		history channel of each column
+//	records		uint32		timestamp, start of the bucket with a resolution
+//				float[]		values, NaN when missing
+//
+// No Arduino dependency so that it can be benchmarked on the host, see tools/series_bench.cpp.
+class HistoryFormatter {
+
+	public:
+
+						HistoryFormatter( void ) = default;
+		void			add( uint32_t, const float * );
+		void			begin( history_format_t, const char * const *, const uint8_t *, uint8_t, uint32_t, uint8_t );
+		void			finish( void );
+		size_t			read( uint8_t *, size_t );
+
+	private:
+
+		static constexpr size_t		OUTPUT_SIZE		= 3072;			// One NDJSON line of all channels with their min, max and mean
+
+		struct bucket_t {
+
+			float		min;
+			float		max;
+			float		sum;
+			uint16_t	count;
+		};
+
+		std::array<bucket_t,HISTORY_FORMATTER_MAX_CHANNELS>	buckets;
+		uint32_t				bucket_start	= 0;
+		bool					bucket_open		= false;
+		uint8_t					channel_count	= 0;
+		std::array<uint8_t,HISTORY_FORMATTER_MAX_CHANNELS>	channels;
+		history_format_t		format			= history_format_t::CSV;
+		const char * const		*names			= nullptr;
+		std::array<char,OUTPUT_SIZE>	output;
+		size_t					output_head		= 0;
+		size_t					output_size		= 0;
+		uint32_t				resolution		= 0;
+
+		void			emit( uint32_t, const float * );
+		void			emit_bucket( void );
+		void			print( const char *, ... );
+		void			print_value( float, bool );
+		void			write( const void *, size_t );
+};
+
+#endif
@@ -0,0 +1,221 @@
+/*
+  	lookout_rules.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "lookout_rules.h"
+
+const std::array<lookout_config_key_t,5> LOOKOUT_CONFIG_KEYS = {{
+
+	{ LOOKOUT_KEY_ACTIVE,		"_active" },
+	{ LOOKOUT_KEY_MAX,			"_max" },
+	{ LOOKOUT_KEY_DELAY,		"_delay" },
+	{ LOOKOUT_KEY_MISSING,		"_missing" },
+	{ LOOKOUT_KEY_HYSTERESIS,	"_hysteresis" }
+}};
+
+// New rules only need a line here, their configuration keys and defaults follow from it.
+// A missing input leaves safe rules unsatisfied unless <name>_missing is set.
+const std::array<lookout_rule_definition_t,16> LOOKOUT_RULE_DEFINITIONS = {{
+
+	{ "unsafe_rain_event",				lookout_channel_t::RAIN_EVENT,		lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MISSING,																	{ true, 1.F, 0, true, 0.F }},
+	{ "unsafe_wind_speed_1",			lookout_channel_t::WIND_SPEED,		lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "unsafe_wind_speed_2",			lookout_channel_t::WIND_SPEED,		lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "unsafe_cloud_coverage_1",		lookout_channel_t::CLOUD_COVERAGE,	lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "unsafe_cloud_coverage_2",		lookout_channel_t::CLOUD_COVERAGE,	lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "unsafe_rain_intensity",			lookout_channel_t::RAIN_INTENSITY,	lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,						{ false, 0.F, 0, false, 0.F }},
+	{ "unsafe_rh",						lookout_channel_t::RH,				lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 95.F, 0, false, 0.F }},
+	{ "unsafe_dew_spread",				lookout_channel_t::DEW_SPREAD,		lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_MOST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 1.F, 0, false, 0.F }},
+	{ "unsafe_msas",					lookout_channel_t::MSAS,			lookout_rule_kind_t::UNSAFE,	lookout_rule_test_t::AT_MOST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 16.F, 0, false, 0.F }},
+	{ "safe_wind_speed",				lookout_channel_t::WIND_SPEED,		lookout_rule_kind_t::SAFE,		lookout_rule_test_t::AT_MOST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "safe_cloud_coverage_1",			lookout_channel_t::CLOUD_COVERAGE,	lookout_rule_kind_t::SAFE,		lookout_rule_test_t::AT_MOST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "safe_cloud_coverage_2",			lookout_channel_t::CLOUD_COVERAGE,	lookout_rule_kind_t::SAFE,		lookout_rule_test_t::AT_MOST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "safe_rain_intensity",			lookout_channel_t::RAIN_INTENSITY,	lookout_rule_kind_t::SAFE,		lookout_rule_test_t::AT_MOST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 0.F, 0, false, 0.F }},
+	{ "safe_rh",						lookout_channel_t::RH,				lookout_rule_kind_t::SAFE,		lookout_rule_test_t::AT_MOST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 90.F, 0, false, 0.F }},
+	{ "safe_dew_spread",				lookout_channel_t::DEW_SPREAD,		lookout_rule_kind_t::SAFE,		lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 3.F, 0, false, 0.F }},
+	{ "safe_msas",						lookout_channel_t::MSAS,			lookout_rule_kind_t::SAFE,		lookout_rule_test_t::AT_LEAST,	LOOKOUT_KEY_ACTIVE | LOOKOUT_KEY_MAX | LOOKOUT_KEY_DELAY | LOOKOUT_KEY_MISSING | LOOKOUT_KEY_HYSTERESIS,	{ false, 17.F, 0, false, 0.F }}
+}};
+
+// Settings for the rules are read by the caller, which leaves inactive rules out
+void LookoutRules::compile( const std::function<lookout_rule_settings_t( const lookout_rule_definition_t & )> &get_settings, bool _debug_mode )
+{
+	debug_mode = _debug_mode;
+	rules.clear();
+
+	for ( const lookout_rule_definition_t &definition : LOOKOUT_RULE_DEFINITIONS ) {
+
+		lookout_rule_t rule = {};
+
+		rule.settings = get_settings( definition );
+
+		// Inactive rules are left out: unsafe ones never trigger and safe ones never block
+		if ( !rule.settings.active )
+			continue;
+
+		if ( rules.full() ) {
+
+			Serial.printf( "[LOOKOUT   ] [ERROR] Too many rules, '%s' ignored.\n", definition.name );
+			continue;
+		}
+
+		rule.definition = &definition;
+		rules.push_back( rule );
+
+		if ( debug_mode )
+			Serial.printf( "[LOOKOUT   ] [DEBUG] Rule '%s': %s %.2f, delay=%ds, hysteresis=%.2f, %s if sensor is missing.\n", definition.name, ( definition.test == lookout_rule_test_t::AT_LEAST ) ? ">=" : "<=", rule.settings.max, rule.settings.delay, rule.settings.hysteresis, rule.settings.satisfied_if_missing ? "satisfied" : "not satisfied" );
+	}
+
+	unsafe_satisfied = 0;
+	safe_pending = std::count_if( rules.begin(), rules.end(), []( const lookout_rule_t &r ) { return r.definition->kind == lookout_rule_kind_t::SAFE; } );
+	first_update = true;
+}
+
+// Returns true when the rule's state changed
+bool LookoutRules::evaluate( lookout_rule_t &rule, uint32_t now )
+{
+	const lookout_channel_state_t	&channel = channels[ static_cast<uint8_t>( rule.definition->channel ) ];
+	bool							was_satisfied = rule.satisfied;
+	bool							condition;
+
+	if ( !channel.available ) {
+
+		// Missing inputs count as unsafe unless the rule says otherwise
+		rule.holding = false;
+		rule.satisfied = rule.settings.satisfied_if_missing;
+
+		if ( rule.satisfied != was_satisfied )
+			Serial.printf( "[LOOKOUT   ] [INFO ] Rule '%s' %s: sensor not available.\n", rule.definition->name, rule.satisfied ? "satisfied" : "not satisfied" );
+		return ( rule.satisfied != was_satisfied );
+	}
+
+	// Once satisfied, a rule is only released past its hysteresis band
+	if ( rule.definition->test == lookout_rule_test_t::AT_LEAST )
+		condition = ( channel.value >= ( rule.satisfied ? rule.settings.max - rule.settings.hysteresis : rule.settings.max ));
+	else
+		condition = ( channel.value <= ( rule.satisfied ? rule.settings.max + rule.settings.hysteresis : rule.settings.max ));
+
+	if ( !condition ) {
+
+		rule.holding = false;
+		rule.satisfied = false;
+
+	} else {
+
+		if ( !rule.holding ) {
+
+			rule.holding = true;
+			rule.since = now;
+		}
+		rule.satisfied = (( now - rule.since ) >= rule.settings.delay );
+
+		if ( !rule.satisfied && debug_mode )
+			Serial.printf( "[LOOKOUT   ] [DEBUG] Rule '%s' pending delay: %.2f (%ds < %ds).\n", rule.definition->name, channel.value, now - rule.since, rule.settings.delay );
+	}
+
+	if ( rule.satisfied != was_satisfied )
+		Serial.printf( "[LOOKOUT   ] [INFO ] Rule '%s' %s: %.2f %s %.2f\n", rule.definition->name, rule.satisfied ? "satisfied" : "no longer satisfied", channel.value, ( rule.definition->test == lookout_rule_test_t::AT_LEAST ) ? ">=" : "<=", rule.settings.max );
+
+	return ( rule.satisfied != was_satisfied );
+}
+
+etl::string<48> LookoutRules::config_key( const lookout_rule_definition_t &definition, const char *suffix )
+{
+	etl::string<48> key( definition.name );
+
+	key.append( suffix );
+	return key;
+}
+
+// Whether a key is one of the rules' configuration keys, e.g. "safe_wind_speed_max"
+bool LookoutRules::is_config_key( const char *key )
+{
+	for ( const lookout_rule_definition_t &definition : LOOKOUT_RULE_DEFINITIONS ) {
+
+		size_t l = strlen( definition.name );
+
+		if ( strncmp( key, definition.name, l ))
+			continue;
+
+		for ( const lookout_config_key_t &config_key : LOOKOUT_CONFIG_KEYS )
+			if (( definition.keys & config_key.key ) && !strcmp( key + l, config_key.suffix ))
+				return true;
+	}
+	return false;
+}
+
+bool LookoutRules::is_safe( void )
+{
+	return !safe_pending;
+}
+
+// Rules left out by the configuration read as their kind's neutral state
+bool LookoutRules::is_satisfied( const lookout_rule_definition_t &definition )
+{
+	auto rule = std::find_if( rules.begin(), rules.end(), [&definition]( const lookout_rule_t &r ) { return r.definition == &definition; } );
+
+	if ( rule != rules.end() )
+		return rule->satisfied;
+	return ( definition.kind == lookout_rule_kind_t::SAFE );
+}
+
+bool LookoutRules::is_unsafe( void )
+{
+	return ( unsafe_satisfied != 0 );
+}
+
+// True while a rule's condition holds but its delay has not expired yet
+bool LookoutRules::is_waiting( void )
+{
+	return std::any_of( rules.begin(), rules.end(), []( const lookout_rule_t &r ) { return r.holding && !r.satisfied; } );
+}
+
+// Returns true when the overall state may have changed
+bool LookoutRules::update( const lookout_inputs_t &inputs, uint32_t now )
+{
+	bool changed = false;
+
+	for ( uint8_t i = 0; i < channels.size(); i++ ) {
+
+		channels[ i ].changed = first_update || ( inputs[ i ].value != channels[ i ].value ) || ( inputs[ i ].available != channels[ i ].available );
+		channels[ i ].value = inputs[ i ].value;
+		channels[ i ].available = inputs[ i ].available;
+	}
+
+	for ( lookout_rule_t &rule : rules ) {
+
+		bool waiting = rule.holding && !rule.satisfied;
+
+		if ( !channels[ static_cast<uint8_t>( rule.definition->channel ) ].changed && !waiting )
+			continue;
+
+		if ( !evaluate( rule, now ))
+			continue;
+
+		changed = true;
+		if ( rule.definition->kind == lookout_rule_kind_t::UNSAFE )
+			unsafe_satisfied += rule.satisfied ? 1 : -1;
+		else
+			safe_pending += rule.satisfied ? -1 : 1;
+	}
+
+	changed |= first_update;
+	first_update = false;
+	return changed;
+}
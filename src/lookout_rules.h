@@ -0,0 +1,147 @@
+/*
+  	lookout_rules.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _lookout_rules_H
+#define	_lookout_rules_H
+
+#include <array>
+#include <functional>
+#include <stdint.h>
+
+#include "Embedded_Template_Library.h"
+#include "etl/string.h"
+#include "etl/vector.h"
+
+// No Arduino dependency other than Serial so that the rules can be tested on the host, see tools/lookout_rules_test.cpp
+
+enum struct lookout_channel_t : uint8_t {
+
+	RAIN_EVENT,
+	WIND_SPEED,
+	CLOUD_COVERAGE,
+	RAIN_INTENSITY,
+	RH,
+	DEW_SPREAD,
+	MSAS,
+	COUNT
+};
+
+enum struct lookout_rule_kind_t : uint8_t {
+
+	UNSAFE,			// One satisfied rule makes the conditions unsafe
+	SAFE			// All of them must be satisfied for the conditions to be safe
+};
+
+enum struct lookout_rule_test_t : uint8_t {
+
+	AT_LEAST,		// Satisfied when the value is >= max
+	AT_MOST			// Satisfied when the value is <= max
+};
+
+// Which rule settings come from the configuration, as <name>_active, <name>_max, ...
+constexpr uint8_t	LOOKOUT_KEY_ACTIVE		= 0x01;
+constexpr uint8_t	LOOKOUT_KEY_MAX			= 0x02;
+constexpr uint8_t	LOOKOUT_KEY_DELAY		= 0x04;
+constexpr uint8_t	LOOKOUT_KEY_MISSING		= 0x08;
+constexpr uint8_t	LOOKOUT_KEY_HYSTERESIS	= 0x10;
+
+struct lookout_config_key_t {
+
+	uint8_t		key;
+	const char	*suffix;
+};
+
+struct lookout_rule_settings_t {
+
+	bool		active;
+	float		max;					// Threshold, whichever way the rule tests it
+	uint16_t	delay;
+	bool		satisfied_if_missing;	// <name>_missing: the rule is satisfied while its input is not available
+	float		hysteresis;
+};
+
+struct lookout_rule_definition_t {
+
+	const char				*name;			// Also the prefix of its configuration keys
+	lookout_channel_t		channel;
+	lookout_rule_kind_t		kind;
+	lookout_rule_test_t		test;
+	uint8_t					keys;
+	lookout_rule_settings_t	defaults;		// Configuration defaults, or fixed settings when there is no key
+};
+
+struct lookout_rule_t {
+
+	const lookout_rule_definition_t	*definition;
+	lookout_rule_settings_t			settings;
+	bool							holding;		// Condition true since 'since'
+	uint32_t						since;
+	bool							satisfied;
+};
+
+struct lookout_input_t {
+
+	float	value;
+	bool	available;
+};
+
+struct lookout_channel_state_t {
+
+	float	value;
+	bool	available;
+	bool	changed;
+};
+
+using lookout_inputs_t = std::array<lookout_input_t,static_cast<size_t>( lookout_channel_t::COUNT )>;
+
+constexpr uint8_t	LOOKOUT_MAX_RULES	= 16;
+
+extern const std::array<lookout_config_key_t,5>			LOOKOUT_CONFIG_KEYS;
+extern const std::array<lookout_rule_definition_t,16>	LOOKOUT_RULE_DEFINITIONS;
+
+// Rules are compiled once from the configuration into a table, and only the rules whose input
+// changed, or which wait for their delay to expire, are evaluated again.
+class LookoutRules {
+
+	public:
+
+							LookoutRules( void ) = default;
+		void				compile( const std::function<lookout_rule_settings_t( const lookout_rule_definition_t & )> &, bool );
+		static etl::string<48>	config_key( const lookout_rule_definition_t &, const char * );
+		static bool			is_config_key( const char * );
+		bool				is_safe( void );
+		bool				is_satisfied( const lookout_rule_definition_t & );
+		bool				is_unsafe( void );
+		bool				is_waiting( void );
+		bool				update( const lookout_inputs_t &, uint32_t );
+
+	private:
+
+		std::array<lookout_channel_state_t,static_cast<size_t>( lookout_channel_t::COUNT )>	channels;
+		bool									debug_mode			= false;
+		bool									first_update		= true;
+		etl::vector<lookout_rule_t,LOOKOUT_MAX_RULES>	rules;
+		uint8_t									safe_pending		= 0;
+		uint8_t									unsafe_satisfied	= 0;
+
+		bool				evaluate( lookout_rule_t &, uint32_t );
+};
+
+#endif
@@ -0,0 +1,367 @@
+/*
+  	modbus_master.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <SoftwareSerial.h>
+
+#include "modbus_master.h"
+#include "modbus_simulator.h"
+
+uint32_t ModbusMaster::char_time_us( void )
+{
+	return ( BITS_PER_CHAR * 1000000UL ) / bps;
+}
+
+uint16_t ModbusMaster::crc16( const uint8_t *data, uint8_t len )
+{
+	uint16_t crc = 0xFFFF;
+
+	for ( uint8_t i = 0; i < len; i++ ) {
+
+		crc ^= data[ i ];
+		for ( uint8_t j = 0; j < 8; j++ )
+			crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xA001 : ( crc >> 1 );
+	}
+	return crc;
+}
+
+void ModbusMaster::bus_task( void *dummy )	// NOSONAR
+{
+	while ( true ) {
+
+		ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+		process_queue();
+	}
+}
+
+bool ModbusMaster::execute( uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t speed, uint16_t *registers )
+{
+	std::array<uint8_t,8>	cmd;
+	uint16_t				crc;
+	uint8_t					expected = 5 + 2 * count;
+	uint8_t					n;
+	uint32_t				start_us;
+
+	set_speed( speed );
+
+	cmd[0] = slave;
+	cmd[1] = function;
+	cmd[2] = start >> 8;
+	cmd[3] = start & 0xff;
+	cmd[4] = count >> 8;
+	cmd[5] = count & 0xff;
+	crc = crc16( cmd.data(), 6 );
+	cmd[6] = crc & 0xff;
+	cmd[7] = crc >> 8;
+
+	for ( uint8_t i = 0; i < MODBUS_RETRIES; i++ ) {
+
+		if ( i )
+			stats.retries++;
+
+		wait_for_silence();
+		while ( stream->available() > 0 )		// Drop anything left over from a previous, broken, exchange
+			stream->read();
+
+		start_us = micros();
+		set_direction( SEND );
+		stream->write( cmd.data(), cmd.size() );
+		stream->flush();
+		set_direction( RECV );
+		last_activity_us = micros();
+
+		stats.transactions++;
+		n = read_frame( expected );
+		stats.max_transaction_us = std::max( stats.max_transaction_us, last_activity_us - start_us );
+
+		if ( !n ) {
+
+			stats.timeouts++;
+			if ( debug_mode )
+				Serial.printf( "[MODBUS    ] [DEBUG] Slave %d: timeout.\n", slave );
+			continue;
+		}
+
+		if ( crc16( frame.data(), n - 2 ) != ( frame[ n-2 ] | ( frame[ n-1 ] << 8 ))) {
+
+			stats.crc_errors++;
+			if ( debug_mode )
+				Serial.printf( "[MODBUS    ] [DEBUG] Slave %d: CRC error on %d bytes frame.\n", slave, n );
+			continue;
+		}
+
+		if (( n == 5 ) && ( frame[1] == ( function | 0x80 ))) {
+
+			// Slave is alive but refuses the request, no point in retrying
+			stats.exceptions++;
+			Serial.printf( "[MODBUS    ] [ERROR] Slave %d: exception code %d.\n", slave, frame[2] );
+			return false;
+		}
+
+		if (( n != expected ) || ( frame[0] != slave ) || ( frame[1] != function ) || ( frame[2] != 2 * count )) {
+
+			stats.bad_frames++;
+			if ( debug_mode )
+				Serial.printf( "[MODBUS    ] [DEBUG] Slave %d: unexpected frame.\n", slave );
+			continue;
+		}
+
+		for ( uint8_t j = 0; j < count; j++ )
+			registers[ j ] = ( frame[ 3 + 2*j ] << 8 ) | frame[ 4 + 2*j ];
+
+		return true;
+	}
+	return false;
+}
+
+modbus_stats_t ModbusMaster::get_stats( void )
+{
+	return stats;
+}
+
+bool ModbusMaster::initialise( ModbusSimulator *sim, bool _debug_mode )
+{
+	if ( stream )
+		return true;
+
+	simulator = sim;
+	stream = sim;
+	debug_mode = _debug_mode;
+	Serial.printf( "[MODBUS    ] [INFO ] Using simulated RS485 bus.\n" );
+
+	start_task();
+	return true;
+}
+
+bool ModbusMaster::initialise( SoftwareSerial *bus, uint8_t rx, uint8_t tx, uint8_t ctrl, bool _debug_mode )
+{
+	if ( stream )
+		return true;
+
+	sensor_bus = bus;
+	stream = bus;
+	rx_pin = rx;
+	tx_pin = tx;
+	ctrl_pin = ctrl;
+	debug_mode = _debug_mode;
+
+	pinMode( ctrl_pin, OUTPUT );
+	digitalWrite( ctrl_pin, RECV );
+
+	start_task();
+	return true;
+}
+
+// Wakes up the bus task which will serve all queued requests
+void ModbusMaster::process( void )
+{
+	if ( !stream )
+		return;
+
+	if ( bus_task_handle )
+		xTaskNotifyGive( bus_task_handle );
+	else
+		process_queue();
+}
+
+// Serves queued requests, requests to the same slave at the same speed are merged into a single
+// multi-register read when the resulting span fits.
+void ModbusMaster::process_queue( void )
+{
+	etl::vector<modbus_request_t *,MODBUS_QUEUE_SIZE>	batch;
+	etl::vector<modbus_request_t *,MODBUS_QUEUE_SIZE>	group;
+	std::array<uint16_t,MODBUS_MAX_REGISTERS>			registers;
+
+	if ( xSemaphoreTake( queue_mutex, portMAX_DELAY ) != pdTRUE )
+		return;
+	batch = pending;
+	pending.clear();
+	xSemaphoreGive( queue_mutex );
+
+	xSemaphoreTake( bus_mutex, portMAX_DELAY );
+	uint32_t start_us = micros();
+
+	for ( modbus_request_t *req : batch ) {
+
+		if ( req->status != modbus_request_status_t::QUEUED )
+			continue;
+
+		uint16_t first = req->start;
+		uint16_t last = req->start + req->count;
+
+		group.clear();
+		group.push_back( req );
+
+		for ( modbus_request_t *other : batch ) {
+
+			if (( other == req ) || ( other->status != modbus_request_status_t::QUEUED ) || ( other->slave != req->slave ) || ( other->function != req->function ) || ( other->bps != req->bps ))
+				continue;
+
+			uint16_t f = std::min( first, other->start );
+			uint16_t l = std::max( last, static_cast<uint16_t>( other->start + other->count ));
+			if (( l - f ) > MODBUS_MAX_REGISTERS )
+				continue;
+
+			first = f;
+			last = l;
+			group.push_back( other );
+		}
+
+		bool ok = execute( req->slave, req->function, first, last - first, req->bps, registers.data() );
+		stats.coalesced += group.size() - 1;
+
+		for ( modbus_request_t *member : group ) {
+
+			if ( ok )
+				std::copy_n( registers.begin() + ( member->start - first ), member->count, member->registers.begin() );
+			member->status = ok ? modbus_request_status_t::DONE : modbus_request_status_t::FAILED;
+		}
+	}
+
+	stats.max_batch_us = std::max( stats.max_batch_us, micros() - start_us );
+	xSemaphoreGive( bus_mutex );
+	xSemaphoreGive( queue_processed );
+
+	if ( debug_mode )
+		Serial.printf( "[MODBUS    ] [DEBUG] Transactions=%d coalesced=%d retries=%d timeouts=%d crc_errors=%d bad_frames=%d exceptions=%d max_transaction=%dus max_batch=%dus\n", stats.transactions, stats.coalesced, stats.retries, stats.timeouts, stats.crc_errors, stats.bad_frames, stats.exceptions, stats.max_transaction_us, stats.max_batch_us );
+}
+
+bool ModbusMaster::queue( modbus_request_t *req )
+{
+	bool ok = false;
+
+	if ( !stream || ( xSemaphoreTake( queue_mutex, portMAX_DELAY ) != pdTRUE ))
+		return false;
+
+	if ( !pending.full() ) {
+
+		req->status = modbus_request_status_t::QUEUED;
+		pending.push_back( req );
+		ok = true;
+	}
+
+	xSemaphoreGive( queue_mutex );
+	return ok;
+}
+
+// End of frame is either the expected length or a 3.5 characters silence (e.g. exception frames)
+uint8_t ModbusMaster::read_frame( uint8_t expected )
+{
+	uint8_t		n = 0;
+	uint32_t	last_byte_us = micros();
+	uint32_t	timeout_ms = MODBUS_RESPONSE_TIMEOUT + ( expected * char_time_us() ) / 1000;
+	uint32_t	start = millis();
+
+	while (( n < expected ) && (( millis() - start ) < timeout_ms )) {
+
+		if ( stream->available() > 0 ) {
+
+			frame[ n++ ] = static_cast<uint8_t>( stream->read() );
+			last_byte_us = micros();
+			continue;
+		}
+
+		if ( n && (( micros() - last_byte_us ) > t35_us ))
+			break;
+
+		delay( 1 );
+	}
+
+	last_activity_us = micros();
+	return ( n < 5 ) ? 0 : n;
+}
+
+void ModbusMaster::set_direction( uint8_t direction )
+{
+	if ( !simulator )
+		digitalWrite( ctrl_pin, direction );
+}
+
+void ModbusMaster::set_speed( uint16_t speed )
+{
+	if ( speed == bps )
+		return;
+
+	if ( simulator )
+
+		simulator->set_speed( speed );
+
+	else {
+
+		if ( bps )
+			sensor_bus->end();
+		sensor_bus->begin( speed, EspSoftwareSerial::SWSERIAL_8N1, rx_pin, tx_pin );
+	}
+	bps = speed;
+
+	// Modbus RTU spec: fixed 1750us inter-frame delay above 19200bps
+	t35_us = ( bps > 19200 ) ? 1750 : ( 35 * char_time_us() ) / 10;
+	last_activity_us = micros();
+}
+
+void ModbusMaster::start_task( void )
+{
+	bus_mutex = xSemaphoreCreateMutex();
+	queue_mutex = xSemaphoreCreateMutex();
+	queue_processed = xSemaphoreCreateBinary();
+
+	std::function<void(void *)> _bus_task = std::bind( &ModbusMaster::bus_task, this, std::placeholders::_1 );
+	if ( xTaskCreatePinnedToCore(
+		[](void *param) {	// NOSONAR
+			std::function<void(void*)>* bus_task_proxy = static_cast<std::function<void(void*)>*>( param );	// NOSONAR
+			(*bus_task_proxy)( NULL );
+		}, "ModbusMaster", 3000, &_bus_task, 6, &bus_task_handle, 1 ) != pdPASS ) {
+
+		Serial.printf( "[MODBUS    ] [ERROR] Could not start task [ModbusMaster]\n" );
+		bus_task_handle = nullptr;
+	}
+}
+
+// Synchronous request, used while probing devices
+bool ModbusMaster::transact( modbus_request_t *req )
+{
+	bool ok;
+
+	xSemaphoreTake( bus_mutex, portMAX_DELAY );
+	ok = execute( req->slave, req->function, req->start, req->count, req->bps, req->registers.data() );
+	req->status = ok ? modbus_request_status_t::DONE : modbus_request_status_t::FAILED;
+	xSemaphoreGive( bus_mutex );
+
+	return ok;
+}
+
+bool ModbusMaster::wait( modbus_request_t *req, uint32_t timeout_ms )
+{
+	uint32_t start = millis();
+
+	while ( req->status == modbus_request_status_t::QUEUED ) {
+
+		if (( millis() - start ) > timeout_ms )
+			return false;
+		xSemaphoreTake( queue_processed, 100 / portTICK_PERIOD_MS );
+	}
+	return ( req->status == modbus_request_status_t::DONE );
+}
+
+void ModbusMaster::wait_for_silence( void )
+{
+	uint32_t elapsed = micros() - last_activity_us;
+
+	if ( elapsed < t35_us )
+		delayMicroseconds( t35_us - elapsed );
+}
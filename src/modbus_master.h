@@ -0,0 +1,119 @@
+/*
+  	modbus_master.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _modbus_master_H
+#define	_modbus_master_H
+
+#include <SoftwareSerial.h>
+#include "Embedded_Template_Library.h"
+#include "etl/vector.h"
+
+#define SEND    HIGH
+#define RECV    LOW
+
+constexpr uint8_t	MODBUS_READ_HOLDING_REGISTERS	= 0x03;
+constexpr uint8_t	MODBUS_MAX_REGISTERS			= 8;
+constexpr uint8_t	MODBUS_QUEUE_SIZE				= 8;
+
+enum struct modbus_request_status_t : uint8_t {
+
+	IDLE,
+	QUEUED,
+	DONE,
+	FAILED
+};
+
+struct modbus_request_t {
+
+	uint8_t										slave;
+	uint8_t										function;
+	uint16_t									start;
+	uint16_t									count;
+	uint16_t									bps;
+	std::array<uint16_t,MODBUS_MAX_REGISTERS>	registers;
+	volatile modbus_request_status_t			status;
+};
+
+class ModbusSimulator;
+
+struct modbus_stats_t {
+
+	uint32_t	transactions;
+	uint32_t	coalesced;
+	uint32_t	retries;
+	uint32_t	timeouts;
+	uint32_t	crc_errors;
+	uint32_t	bad_frames;
+	uint32_t	exceptions;
+	uint32_t	max_transaction_us;
+	uint32_t	max_batch_us;
+};
+
+class ModbusMaster {
+
+	public:
+
+								ModbusMaster( void ) = default;
+		modbus_stats_t			get_stats( void );
+		bool					initialise( ModbusSimulator *, bool );
+		bool					initialise( SoftwareSerial *, uint8_t, uint8_t, uint8_t, bool );
+		void					process( void );
+		bool					queue( modbus_request_t * );
+		bool					transact( modbus_request_t * );
+		bool					wait( modbus_request_t *, uint32_t );
+
+		static uint16_t			crc16( const uint8_t *, uint8_t );
+
+	private:
+
+		static constexpr uint8_t	MODBUS_RETRIES				= 3;
+		static constexpr uint16_t	MODBUS_RESPONSE_TIMEOUT		= 200;		// ms, on top of the frame transmission time
+		static constexpr uint8_t	BITS_PER_CHAR				= 10;		// 8N1
+
+		uint16_t					bps						= 0;
+		SemaphoreHandle_t			bus_mutex				= nullptr;
+		TaskHandle_t				bus_task_handle			= nullptr;
+		uint8_t						ctrl_pin;
+		bool						debug_mode				= false;
+		std::array<uint8_t,5+2*MODBUS_MAX_REGISTERS>	frame;
+		uint32_t					last_activity_us		= 0;
+		etl::vector<modbus_request_t *,MODBUS_QUEUE_SIZE>	pending;
+		SemaphoreHandle_t			queue_mutex				= nullptr;
+		SemaphoreHandle_t			queue_processed			= nullptr;
+		uint8_t						rx_pin;
+		SoftwareSerial				*sensor_bus				= nullptr;
+		ModbusSimulator				*simulator				= nullptr;
+		modbus_stats_t				stats					= {};
+		Stream						*stream					= nullptr;
+		uint32_t					t35_us					= 0;
+		uint8_t						tx_pin;
+
+		void					bus_task( void * );
+		uint32_t				char_time_us( void );
+		bool					execute( uint8_t, uint8_t, uint16_t, uint16_t, uint16_t, uint16_t * );
+		void					process_queue( void );
+		uint8_t					read_frame( uint8_t );
+		void					set_direction( uint8_t );
+		void					set_speed( uint16_t );
+		void					start_task( void );
+		void					wait_for_silence( void );
+};
+
+#endif
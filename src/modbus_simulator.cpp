@@ -0,0 +1,246 @@
+/*
+  	modbus_simulator.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+
+#include "device.h"
+#include "anemometer.h"
+#include "wind_vane.h"
+#include "modbus_simulator.h"
+
+bool ModbusSimulator::add_anemometer( byte model )
+{
+	if ( model >= Anemometer::ANEMOMETER_CMD.size() )
+		return false;
+
+	return add_slave( Anemometer::ANEMOMETER_CMD[ model ] >> 56, Anemometer::ANEMOMETER_SPEED[ model ], ( model == 2 ) ? modbus_sim_slave_type_t::ULTRASONIC : modbus_sim_slave_type_t::MECHANICAL_ANEMOMETER, ( model == 2 ) ? 2 : 1 );
+}
+
+bool ModbusSimulator::add_slave( uint8_t address, uint16_t speed, modbus_sim_slave_type_t type, uint8_t register_count )
+{
+	// VMS-3003 answers for both wind speed and direction
+	for ( const modbus_sim_slave_t &slave : slaves )
+		if ( slave.address == address )
+			return ( slave.type == type );
+
+	if ( slaves.full() )
+		return false;
+
+	modbus_sim_slave_t slave = { address, speed, type, {}, register_count };
+	slaves.push_back( slave );
+	return true;
+}
+
+bool ModbusSimulator::add_wind_vane( byte model )
+{
+	if ( model >= Wind_vane::WIND_VANE_CMD.size() )
+		return false;
+
+	return add_slave( Wind_vane::WIND_VANE_CMD[ model ] >> 56, Wind_vane::WIND_VANE_SPEED[ model ], ( model == 2 ) ? modbus_sim_slave_type_t::ULTRASONIC : modbus_sim_slave_type_t::MECHANICAL_WIND_VANE, 2 );
+}
+
+// Bytes of the answer become available at the rate they would arrive on the wire
+int ModbusSimulator::available( void )
+{
+	int32_t elapsed = static_cast<int32_t>( micros() - answer_start_us );
+
+	if ( !answer_len || ( elapsed < 0 ))
+		return 0;
+
+	uint32_t arrived = std::min( static_cast<uint32_t>( answer_len ), static_cast<uint32_t>( elapsed ) / char_time_us() );
+	return arrived - answer_read;
+}
+
+uint32_t ModbusSimulator::char_time_us( void )
+{
+	return ( BITS_PER_CHAR * 1000000UL ) / ( bps ? bps : 9600 );
+}
+
+void ModbusSimulator::corrupt_answer( void )
+{
+	bool corrupted = false;
+
+	for ( uint8_t i = 0; i < answer_len; i++ )
+		for ( uint8_t bit = 0; bit < 8; bit++ )
+			if ( roll( bit_error_rate )) {
+
+				answer[ i ] ^= ( 1 << bit );
+				corrupted = true;
+			}
+
+	if ( corrupted )
+		stats.corrupted_frames++;
+}
+
+void ModbusSimulator::flush( void )
+{
+	// Nothing to do, frames are handled as soon as they are complete
+}
+
+modbus_sim_stats_t ModbusSimulator::get_stats( void )
+{
+	return stats;
+}
+
+void ModbusSimulator::handle_request( void )
+{
+	uint16_t	crc;
+	uint16_t	start;
+	uint16_t	count;
+
+	stats.requests++;
+	answer_len = 0;
+	answer_read = 0;
+
+	if ( ModbusMaster::crc16( request.data(), 6 ) != ( request[6] | ( request[7] << 8 )))
+		return;
+
+	auto slave = std::find_if( slaves.begin(), slaves.end(), [this]( const modbus_sim_slave_t &s ) { return s.address == request[0]; } );
+	if ( slave == slaves.end() )
+		return;
+
+	if ( slave->bps != bps ) {
+
+		stats.wrong_speed++;
+		return;
+	}
+
+	if ( roll( dropout_rate )) {
+
+		stats.dropouts++;
+		return;
+	}
+
+	start = ( request[2] << 8 ) | request[3];
+	count = ( request[4] << 8 ) | request[5];
+
+	answer[0] = slave->address;
+	if ( request[1] != MODBUS_READ_HOLDING_REGISTERS ) {
+
+		answer[1] = request[1] | 0x80;
+		answer[2] = 0x01;					// Illegal function
+		answer_len = 3;
+
+	} else if ( !count || (( start + count ) > slave->register_count )) {
+
+		answer[1] = request[1] | 0x80;
+		answer[2] = 0x02;					// Illegal data address
+		answer_len = 3;
+
+	} else {
+
+		answer[1] = request[1];
+		answer[2] = 2 * count;
+		for ( uint8_t i = 0; i < count; i++ ) {
+
+			answer[ 3 + 2*i ] = slave->registers[ start + i ] >> 8;
+			answer[ 4 + 2*i ] = slave->registers[ start + i ] & 0xff;
+		}
+		answer_len = 3 + 2 * count;
+	}
+
+	crc = ModbusMaster::crc16( answer.data(), answer_len );
+	answer[ answer_len++ ] = crc & 0xff;
+	answer[ answer_len++ ] = crc >> 8;
+
+	corrupt_answer();
+	stats.answers++;
+
+	// The request was written at once, account for its time on the wire before the slave's own latency
+	answer_start_us = micros() + ( request.size() * char_time_us() ) + ( latency_ms * 1000 );
+}
+
+int ModbusSimulator::peek( void )
+{
+	return available() ? answer[ answer_read ] : -1;
+}
+
+int ModbusSimulator::read( void )
+{
+	return available() ? answer[ answer_read++ ] : -1;
+}
+
+bool ModbusSimulator::roll( float probability )
+{
+	if ( probability <= 0.F )
+		return false;
+
+	return ( static_cast<float>( random( 1000000 )) / 1000000.F ) < probability;
+}
+
+void ModbusSimulator::set_bit_error_rate( float rate )
+{
+	bit_error_rate = rate;
+}
+
+void ModbusSimulator::set_dropout_rate( float rate )
+{
+	dropout_rate = rate;
+}
+
+void ModbusSimulator::set_latency( uint16_t ms )
+{
+	latency_ms = ms;
+}
+
+void ModbusSimulator::set_speed( uint16_t speed )
+{
+	bps = speed;
+	request_len = 0;
+	answer_len = 0;
+}
+
+void ModbusSimulator::set_wind( float speed, uint16_t direction )
+{
+	direction %= 360;
+
+	for ( modbus_sim_slave_t &slave : slaves ) {
+
+		switch( slave.type ) {
+
+			case modbus_sim_slave_type_t::MECHANICAL_ANEMOMETER:
+				slave.registers[0] = static_cast<uint16_t>( speed * 10.F );
+				break;
+
+			case modbus_sim_slave_type_t::MECHANICAL_WIND_VANE:
+				slave.registers[0] = (( direction + 22 ) / 45 ) % 8;
+				slave.registers[1] = direction;
+				break;
+
+			case modbus_sim_slave_type_t::ULTRASONIC:
+				slave.registers[0] = static_cast<uint16_t>( speed * 100.F );
+				slave.registers[1] = direction;
+				break;
+		}
+	}
+}
+
+size_t ModbusSimulator::write( uint8_t c )
+{
+	// A new request cancels any answer still in flight, as on a half duplex bus
+	answer_len = 0;
+	request[ request_len++ ] = c;
+
+	if ( request_len == request.size() ) {
+
+		handle_request();
+		request_len = 0;
+	}
+	return 1;
+}
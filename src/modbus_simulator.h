@@ -0,0 +1,99 @@
+/*
+  	modbus_simulator.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _modbus_simulator_H
+#define	_modbus_simulator_H
+
+#include <Stream.h>
+#include "modbus_master.h"
+
+enum struct modbus_sim_slave_type_t : uint8_t {
+
+	MECHANICAL_ANEMOMETER,		// reg0 = speed x10
+	MECHANICAL_WIND_VANE,		// reg0 = direction index (0-7), reg1 = direction in degrees
+	ULTRASONIC					// reg0 = speed x100, reg1 = direction in degrees
+};
+
+struct modbus_sim_slave_t {
+
+	uint8_t										address;
+	uint16_t									bps;
+	modbus_sim_slave_type_t						type;
+	std::array<uint16_t,MODBUS_MAX_REGISTERS>	registers;
+	uint8_t										register_count;
+};
+
+struct modbus_sim_stats_t {
+
+	uint32_t	requests;
+	uint32_t	answers;
+	uint32_t	dropouts;
+	uint32_t	corrupted_frames;
+	uint32_t	wrong_speed;
+};
+
+// Stands in for the RS485 bus and answers like the supported wind sensors would, with configurable
+// latency, bit errors and dropouts. Only depends on Stream, micros() and random().
+class ModbusSimulator : public Stream {
+
+	public:
+
+							ModbusSimulator( void ) = default;
+		bool				add_anemometer( byte );
+		bool				add_wind_vane( byte );
+		modbus_sim_stats_t	get_stats( void );
+		void				set_bit_error_rate( float );
+		void				set_dropout_rate( float );
+		void				set_latency( uint16_t );
+		void				set_speed( uint16_t );
+		void				set_wind( float, uint16_t );
+
+		int					available( void ) override;
+		void				flush( void ) override;
+		int					peek( void ) override;
+		int					read( void ) override;
+		size_t				write( uint8_t ) override;
+
+	private:
+
+		static constexpr uint8_t	MAX_SLAVES		= 2;
+		static constexpr uint8_t	BITS_PER_CHAR	= 10;
+
+		float											bit_error_rate	= 0.F;
+		uint16_t										bps				= 0;
+		float											dropout_rate	= 0.F;
+		uint16_t										latency_ms		= 20;
+		std::array<uint8_t,8>							request;
+		uint8_t											request_len		= 0;
+		etl::vector<modbus_sim_slave_t,MAX_SLAVES>		slaves;
+		modbus_sim_stats_t								stats			= {};
+		std::array<uint8_t,5+2*MODBUS_MAX_REGISTERS>	answer;
+		uint8_t											answer_len		= 0;
+		uint8_t											answer_read		= 0;
+		uint32_t										answer_start_us	= 0;
+
+		bool				add_slave( uint8_t, uint16_t, modbus_sim_slave_type_t, uint8_t );
+		uint32_t			char_time_us( void );
+		void				corrupt_answer( void );
+		void				handle_request( void );
+		bool				roll( float );
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*
+  	reading_buffer.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <Arduino.h>
+
+#include "reading_buffer.h"
+
+// Only the count is reset on power up, the records are not worth a copy from flash at each boot
+RTC_NOINIT_ATTR std::array<rtc_reading_t,READING_BUFFER_SIZE>	rtc_readings;	// NOSONAR
+RTC_DATA_ATTR uint8_t	rtc_readings_head = 0;		// NOSONAR
+RTC_DATA_ATTR uint8_t	rtc_readings_count = 0;		// NOSONAR
+
+uint8_t ReadingBuffer::count( void )
+{
+	return rtc_readings_count;
+}
+
+// Oldest reading
+const rtc_reading_t &ReadingBuffer::front( void )
+{
+	return rtc_readings[ ( rtc_readings_head + READING_BUFFER_SIZE - rtc_readings_count ) % READING_BUFFER_SIZE ];
+}
+
+void ReadingBuffer::pop( void )
+{
+	if ( rtc_readings_count )
+		rtc_readings_count--;
+}
+
+// When full, the oldest reading makes room and is handed back in 'evicted'
+bool ReadingBuffer::push( const sensor_data_t &sensor_data, float battery_level, rtc_reading_t &evicted )
+{
+	bool full = ( rtc_readings_count == READING_BUFFER_SIZE );
+
+	if ( full )
+		evicted = front();
+	else
+		rtc_readings_count++;
+
+	rtc_readings[ rtc_readings_head ] = { sensor_data, battery_level };
+	rtc_readings_head = ( rtc_readings_head + 1 ) % READING_BUFFER_SIZE;
+	return full;
+}
@@ -0,0 +1,50 @@
+/*
+  	reading_buffer.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _reading_buffer_H
+#define	_reading_buffer_H
+
+#include "common.h"
+
+constexpr uint8_t	READING_BUFFER_SIZE	= 24;		// Two hours of 5 minutes wake ups
+
+// Fixed layout, kept as is in RTC slow memory
+struct rtc_reading_t {
+
+	sensor_data_t	sensor_data;
+	float			battery_level;
+};
+
+static_assert( sizeof( rtc_reading_t ) * READING_BUFFER_SIZE <= 3072, "Reading buffer does not fit in its share of RTC slow memory" );
+
+// Sensor readings of a solar station, kept through deep sleep until the next network push. The storage
+// lives in RTC memory, so there is only one buffer whatever the number of instances.
+class ReadingBuffer {
+
+	public:
+
+						ReadingBuffer( void ) = default;
+		uint8_t			count( void );
+		const rtc_reading_t	&front( void );
+		void			pop( void );
+		bool			push( const sensor_data_t &, float, rtc_reading_t & );
+};
+
+#endif
@@ -0,0 +1,113 @@
+/*
+	rg9_parser.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstring>
+
+#include "rg9_parser.h"
+
+// Returns the kind of line that this byte completed, NONE while a line is still being received
+rg9_answer_t RG9Parser::feed( uint8_t c )
+{
+	bool eol = ( c == '\r' ) || ( c == '\n' );
+
+	switch( state ) {
+
+		case rg9_parser_state_t::IDLE:
+			if ( eol )
+				break;
+			line[ 0 ] = static_cast<char>( c );
+			line_size = 1;
+			state = rg9_parser_state_t::LINE;
+			break;
+
+		case rg9_parser_state_t::LINE:
+			if ( eol ) {
+
+				state = rg9_parser_state_t::IDLE;
+				return parse_line();
+			}
+			if ( line_size == line.size() - 1 )
+				state = rg9_parser_state_t::DISCARD;
+			else
+				line[ line_size++ ] = static_cast<char>( c );
+			break;
+
+		case rg9_parser_state_t::DISCARD:
+			if ( eol )
+				state = rg9_parser_state_t::IDLE;
+			break;
+	}
+	return rg9_answer_t::NONE;
+}
+
+uint8_t RG9Parser::get_intensity( void )
+{
+	return intensity;
+}
+
+// Last complete line
+const char *RG9Parser::get_line( void )
+{
+	return line.data();
+}
+
+char RG9Parser::get_status( void )
+{
+	return status;
+}
+
+rg9_answer_t RG9Parser::parse_line( void )
+{
+	line[ line_size ] = 0;
+
+	if (( line_size >= 3 ) && ( line[ 0 ] == 'R' ) && ( line[ 1 ] == ' ' )) {
+
+		uint8_t i = static_cast<uint8_t>( line[ 2 ] - '0' );
+		intensity = ( i > 7 ) ? 0 : i;	// Most probably during initialisation phase
+		return rg9_answer_t::RAIN;
+	}
+
+	if ( !strncmp( line.data(), "Baud ", 5 ))
+		return rg9_answer_t::BAUD;
+
+	if (( line_size > 6 ) && !strncmp( line.data(), "Reset ", 6 )) {
+
+		status = line[ 6 ];
+		return rg9_answer_t::RESET;
+	}
+
+	return rg9_answer_t::OTHER;
+}
+
+// As described in RG-9 protocol
+const char *RG9Parser::reset_cause( char status )
+{
+	switch ( status ) {
+
+		case 'N': return "Normal power up";
+		case 'M': return "MCLR";
+		case 'W': return "Watchdog timer reset";
+		case 'O': return "Start overflow";
+		case 'U': return "Start underflow";
+		case 'B': return "Low voltage";
+		case 'D': return "Other";
+		default: return "Unknown";
+	}
+}
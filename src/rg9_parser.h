@@ -0,0 +1,73 @@
+/*
+  	rg9_parser.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _rg9_parser_H
+#define	_rg9_parser_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum struct rg9_answer_t : uint8_t {
+
+	NONE,			// No complete line yet
+	BAUD,			// "Baud x"
+	RAIN,			// "R x"
+	RESET,			// "Reset x", the sensor is back in polling mode
+	OTHER
+};
+
+enum struct rg9_parser_state_t : uint8_t {
+
+	IDLE,
+	LINE,
+	DISCARD
+};
+
+// Byte level parser of the Hydreon RG-9 serial protocol. Lines end with CR, LF or both, lines longer
+// than the buffer are dropped whole. No Arduino dependency so that it can be tested on the host,
+// see tools/rg9_parser_test.cpp.
+class RG9Parser {
+
+	public:
+
+		static constexpr char	NO_STATUS	= 0;
+
+							RG9Parser( void ) = default;
+		rg9_answer_t		feed( uint8_t );
+		uint8_t				get_intensity( void );
+		const char			*get_line( void );
+		char				get_status( void );
+		static const char	*reset_cause( char );
+
+	private:
+
+		static constexpr size_t	LINE_SIZE	= 128;
+
+		uint8_t					intensity		= 0;
+		std::array<char,LINE_SIZE>	line		= {};
+		size_t					line_size		= 0;
+		rg9_parser_state_t		state			= rg9_parser_state_t::IDLE;
+		char					status			= NO_STATUS;
+
+		rg9_answer_t		parse_line( void );
+};
+
+#endif
@@ -20,92 +20,58 @@
 
 #include "rs485_device.h"
 
-std::array<uint8_t,7> RS485Device::get_answer( void )
+uint16_t RS485Device::get_register( uint8_t i )
 {
-	return answer;
+	return request.registers[ i ];
 }
 
-bool RS485Device::initialise( etl::string_view devtype, SoftwareSerial *bus, uint8_t rx, uint8_t tx, uint8_t ctrl, uint64_t command, uint16_t spd )
+bool RS485Device::initialise( etl::string_view devtype, ModbusMaster *modbus, uint64_t command, uint16_t spd )
 {
-	sensor_bus = bus;
-	device_type = devtype;
-	rx_pin = rx;
-	tx_pin = tx;
-	ctrl_pin = ctrl;
+	std::array<uint8_t,8>	cmd;
 
-	pinMode( ctrl, OUTPUT );
+	bus = modbus;
+	device_type = devtype;
 
 	uint64_t_to_uint8_t_array( command, cmd );
 
-	if ( !bps )
-
-		bps = spd;
-
-	else {
-
-		if ( bps != spd ) {
-
-			bps = spd;
-			sensor_bus->end();
+	request.slave = cmd[0];
+	request.function = cmd[1];
+	request.start = ( cmd[2] << 8 ) | cmd[3];
+	request.count = std::min( static_cast<uint8_t>(( cmd[4] << 8 ) | cmd[5] ), MODBUS_MAX_REGISTERS );
+	request.bps = spd;
+	request.registers.fill( 0 );
+	request.status = modbus_request_status_t::IDLE;
 
-		} else
+	if ( ModbusMaster::crc16( cmd.data(), 6 ) != ( cmd[6] | ( cmd[7] << 8 )))
+		Serial.printf( "[%s] [BUG  ] Command CRC mismatch.\n", device_type.data() );
 
-			return set_initialised ( interrogate( true ) );
-	}
-
-	sensor_bus->begin( bps, EspSoftwareSerial::SWSERIAL_8N1, rx_pin, tx_pin );
-	return set_initialised ( interrogate( true ) );
+	return set_initialised( interrogate( true ) );
 }
 
+// Picks up the answer of a queued request, or interrogates the device synchronously if none was queued
 bool RS485Device::interrogate( bool verbose )
 {
-	byte	i = 0;
-	byte	j;
-
-	answer.fill( 0 );
-
-	if ( get_debug_mode() ) {
-
-		if ( verbose ) {
-
-			etl::string<8> str( cmd.begin(), cmd.end() );
-			Serial.printf( "[%s] [DEBUG] Sending command: %s\n", device_type.data(), str.data() );
+	bool ok;
 
-		} else
+	if ( get_debug_mode() && verbose )
+		Serial.printf( "[%s] [DEBUG] Reading %d register(s) @%d from slave %d.\n", device_type.data(), request.count, request.start, request.slave );
 
-			Serial.printf( "[%s] [DEBUG] Probing.\n", device_type.data() );
-	}
+	if ( request.status == modbus_request_status_t::QUEUED )
+		ok = bus->wait( &request, RS485_ANSWER_TIMEOUT );
+	else if ( request.status == modbus_request_status_t::IDLE )
+		ok = bus->transact( &request );
+	else
+		ok = ( request.status == modbus_request_status_t::DONE );
 
-	while ( answer[1] != 0x03 ) {
+	request.status = modbus_request_status_t::IDLE;
 
-		digitalWrite( ctrl_pin, SEND );
-		sensor_bus->write( cmd.data(), cmd.max_size() );
-		sensor_bus->flush();
+	if ( get_debug_mode() && verbose && !ok )
+		Serial.printf( "[%s] [DEBUG] No valid answer.\n", device_type.data() );
 
-		digitalWrite( ctrl_pin, RECV );
-		sensor_bus->readBytes( answer.data(), answer.max_size() );
-
-		if ( get_debug_mode() && verbose ) {
-
-			etl::string<7> str( answer.begin(), answer.end() );
-			Serial.printf( "[%s] [DEBUG] Answer: %s", device_type.data(), str.data() );
-
-		}
-
-		if ( answer[1] == 0x03 ) {
-
-			return true;
-
-		} else {
-
-			if ( get_debug_mode() && verbose )
-				Serial.printf( "(Error).\n" );
-			delay( 500 );
-		}
-
-		if ( ++i == 3 ) {
+	return ok;
+}
 
-			return false;
-		}
-	}
+bool RS485Device::queue_request( void )
+{
+	return bus->queue( &request );
 }
@@ -21,31 +21,26 @@
 #ifndef _rs485_device_H
 #define	_rs485_device_H
 
-#include <SoftwareSerial.h>
 #include "device.h"
-
-#define SEND    HIGH
-#define RECV    LOW
+#include "modbus_master.h"
 
 class RS485Device : public Device {
 
 	public:
 
 								RS485Device( void ) = default;
-		std::array<uint8_t,7> 	get_answer( void );
-		bool					initialise( etl::string_view, SoftwareSerial *, uint8_t, uint8_t, uint8_t, uint64_t, uint16_t );
+		uint16_t			 	get_register( uint8_t );
+		bool					initialise( etl::string_view, ModbusMaster *, uint64_t, uint16_t );
 		bool					interrogate( bool );
+		bool					queue_request( void );
 
 	private:
 
-		std::array<uint8_t,7>	answer;
-   		uint16_t				bps					= 0;
-		std::array<uint8_t,8>	cmd;
-		uint8_t					ctrl_pin;
+		static constexpr uint32_t	RS485_ANSWER_TIMEOUT	= 2000;	// ms
+
+		ModbusMaster			*bus				= nullptr;
 		etl::string_view		device_type;
-		uint8_t					rx_pin;
-		SoftwareSerial			*sensor_bus			= nullptr;
-		uint8_t					tx_pin;
+		modbus_request_t		request;
 
 };
 
@@ -0,0 +1,514 @@
+/*
+  	scheduler.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "scheduler.h"
+
+namespace {
+
+	// One worker per pool. Short jobs never wait on the network, the lookout and the dome leave their alarms to
+	// the blocking pool. A sensor read can still send one, like the blocking jobs it needs room for TLS.
+	// print_stats() reports the stack each worker never used.
+	const std::array<uint32_t,static_cast<uint8_t>( job_pool_t::COUNT )>	WORKER_STACK = { 5120, 8192, 8192 };
+}
+
+// first_ms is the delay before the first run, the deadline is counted from each due time
+job_id_t Scheduler::add_job( const char *name, uint32_t period_ms, uint32_t first_ms, uint32_t deadline_ms, job_priority_t priority, job_pool_t pool, std::function<void(void)> callback )
+{
+	scheduler_job_t	job = {};
+	job_id_t		id;
+	bool			due_now;
+
+	if ( !pools[ 0 ].ready_count )
+		return SCHEDULER_NO_JOB;
+
+	job.name = name;
+	job.callback = std::move( callback );
+	job.period_ticks = std::max<uint32_t>( 1, ( period_ms + TICK_MS - 1 ) / TICK_MS );
+	job.deadline_us = deadline_ms * 1000;
+	job.priority = priority;
+	job.pool = pool;
+	job.next = SCHEDULER_NO_JOB;
+	job.enabled = true;
+
+	taskENTER_CRITICAL( &mux );
+
+	if ( jobs.full() ) {
+
+		taskEXIT_CRITICAL( &mux );
+		Serial.printf( "[SCHEDULER ] [ERROR] No room left for job [%s]\n", name );
+		return SCHEDULER_NO_JOB;
+	}
+
+	id = jobs.size();
+	job.due_tick = current_tick() + ( first_ms + TICK_MS - 1 ) / TICK_MS;
+	jobs.push_back( std::move( job ));
+
+	due_now = ( first_ms == 0 );
+	if ( due_now )
+		queue( id );
+	else
+		arm( id );
+
+	taskEXIT_CRITICAL( &mux );
+
+	if ( due_now )
+		signal( id );
+	else
+		set_timer( false );
+
+	if ( debug_mode )
+		Serial.printf( "[SCHEDULER ] [DEBUG] Job [%s] every %dms, deadline %dms.\n", name, period_ms, deadline_ms );
+
+	return id;
+}
+
+// Must be called with the mux held, the due tick must be after now_tick
+void Scheduler::arm( job_id_t id )
+{
+	scheduler_job_t	&job = jobs[ id ];
+	uint32_t		delta = job.due_tick - now_tick;
+	uint32_t		target = job.due_tick;
+
+	if ( delta < WHEEL_SLOTS )
+
+		job.level = 0;
+
+	else if ( delta < ( WHEEL_SLOTS << WHEEL_BITS ))
+
+		job.level = 1;
+
+	else {
+
+		// Beyond the wheel, parked in the furthest slot and cascaded down again from there
+		job.level = 2;
+		if ( delta >= WHEEL_SPAN )
+			target = now_tick + WHEEL_SPAN - 1;
+	}
+
+	job.slot = ( target >> ( WHEEL_BITS * job.level )) & WHEEL_MASK;
+	job.next = wheel[ job.level ][ job.slot ];
+	job.armed = true;
+	wheel[ job.level ][ job.slot ] = id;
+}
+
+// Jobs of a higher level slot which just came within reach are spread over the lower levels
+void Scheduler::cascade( uint8_t level, uint32_t slot )
+{
+	job_id_t id = wheel[ level ][ slot ];
+	job_id_t next;
+
+	wheel[ level ][ slot ] = SCHEDULER_NO_JOB;
+
+	while ( id != SCHEDULER_NO_JOB ) {
+
+		next = jobs[ id ].next;
+		arm( id );
+		id = next;
+	}
+}
+
+// Tick the wheel would be at if the timer fired on every one
+uint32_t Scheduler::current_tick( void )
+{
+	return static_cast<uint32_t>(( esp_timer_get_time() - origin_us ) / ( TICK_MS * 1000 ));
+}
+
+// Must be called with the mux held
+void Scheduler::disarm( job_id_t id )
+{
+	scheduler_job_t	&job = jobs[ id ];
+	job_id_t		*link = &wheel[ job.level ][ job.slot ];
+
+	while ( *link != SCHEDULER_NO_JOB ) {
+
+		if ( *link == id ) {
+
+			*link = job.next;
+			break;
+		}
+		link = &jobs[ *link ].next;
+	}
+	job.armed = false;
+}
+
+job_stats_t Scheduler::get_stats( job_id_t id )
+{
+	job_stats_t s = {};
+
+	taskENTER_CRITICAL( &mux );
+	if ( id < jobs.size() )
+		s = jobs[ id ].stats;
+	taskEXIT_CRITICAL( &mux );
+	return s;
+}
+
+bool Scheduler::initialise( bool _debug_mode )
+{
+	std::array<char,16>						name;
+	std::array<std::function<void(void *)>,POOLS>	_worker;
+	esp_timer_create_args_t					timer_args = {};
+
+	if ( pools[ 0 ].ready_count )
+		return true;
+
+	debug_mode = _debug_mode;
+	for ( auto &level : wheel )
+		level.fill( SCHEDULER_NO_JOB );
+
+	for ( pool_t &pool : pools )
+		pool.ready_count = xSemaphoreCreateCounting( SCHEDULER_MAX_JOBS, 0 );
+	timer_mutex = xSemaphoreCreateMutex();
+
+	for ( uint8_t i = 0; i < POOLS; i++ ) {
+
+		_worker[ i ] = std::bind( &Scheduler::worker, this, static_cast<job_pool_t>( i ));
+		snprintf( name.data(), name.size(), "SchedWorker%d", i );
+		if ( xTaskCreatePinnedToCore(
+			[](void *param) {	// NOSONAR
+				std::function<void(void*)>* worker_proxy = static_cast<std::function<void(void*)>*>( param );	// NOSONAR
+				(*worker_proxy)( NULL );
+			}, name.data(), WORKER_STACK[ i ], &_worker[ i ], 5, &workers[ i ], 1 ) != pdPASS ) {
+
+			Serial.printf( "[SCHEDULER ] [ERROR] Could not start task [%s]\n", name.data() );
+			workers[ i ] = nullptr;
+		}
+	}
+
+	timer_args.callback = &Scheduler::tick_callback;
+	timer_args.arg = this;
+	timer_args.dispatch_method = ESP_TIMER_TASK;
+	timer_args.name = "scheduler";
+
+	if ( esp_timer_create( &timer_args, &tick_timer ) != ESP_OK ) {
+
+		Serial.printf( "[SCHEDULER ] [ERROR] Could not create tick timer.\n" );
+		return false;
+	}
+
+	origin_us = esp_timer_get_time();
+	return true;
+}
+
+// First tick after now_tick with a job due in its level 0 slot, or with a higher level slot to cascade down.
+// Must be called with the mux held.
+uint32_t Scheduler::next_wake( void )
+{
+	uint32_t t;
+
+	auto must_cascade = [this]( uint32_t at ) {
+
+		if ( at & WHEEL_MASK )
+			return false;
+		if ( wheel[ 1 ][ ( at >> WHEEL_BITS ) & WHEEL_MASK ] != SCHEDULER_NO_JOB )
+			return true;
+		return !( at & (( WHEEL_SLOTS << WHEEL_BITS ) - 1 )) && ( wheel[ 2 ][ ( at >> ( 2 * WHEEL_BITS )) & WHEEL_MASK ] != SCHEDULER_NO_JOB );
+	};
+
+	// Level 0 holds the jobs due within a turn of the wheel
+	for ( t = now_tick + 1; t != now_tick + WHEEL_SLOTS; t++ )
+		if (( wheel[ 0 ][ t & WHEEL_MASK ] != SCHEDULER_NO_JOB ) || must_cascade( t ))
+			return t;
+
+	// Past it, jobs only come down from the higher levels
+	for ( t = ( t + WHEEL_MASK ) & ~WHEEL_MASK; ( t - now_tick ) < WHEEL_SPAN; t += WHEEL_SLOTS )
+		if ( must_cascade( t ))
+			return t;
+
+	return t;
+}
+
+// Highest priority first, then the job which has been waiting for the longest. Must be called with the mux held.
+job_id_t Scheduler::next_ready( pool_t &pool )
+{
+	auto &ready = pool.ready;
+	auto best = ready.end();
+
+	for ( auto it = ready.begin(); it != ready.end(); ++it ) {
+
+		if (( best == ready.end() ) || ( jobs[ *it ].priority < jobs[ *best ].priority ) ||
+			(( jobs[ *it ].priority == jobs[ *best ].priority ) && ( static_cast<int32_t>( jobs[ *it ].due_tick - jobs[ *best ].due_tick ) < 0 )))
+			best = it;
+	}
+
+	if ( best == ready.end() )
+		return SCHEDULER_NO_JOB;
+
+	job_id_t id = *best;
+	ready.erase( best );
+	jobs[ id ].queued = false;
+	jobs[ id ].running = true;
+	return id;
+}
+
+void Scheduler::print_stats( void )
+{
+	job_stats_t	s;
+
+	for ( job_id_t id = 0; id < jobs.size(); id++ ) {
+
+		s = get_stats( id );
+		Serial.printf( "[SCHEDULER ] [INFO ] Job [%s]: runs=%d overruns=%d skipped=%d runtime=%dus (max %dus) max_jitter=%dus\n",
+			jobs[ id ].name, s.runs, s.overruns, s.skipped, s.last_runtime_us, s.max_runtime_us, s.max_jitter_us );
+	}
+
+	for ( TaskHandle_t w : workers )
+		if ( w )
+			Serial.printf( "[SCHEDULER ] [INFO ] Worker [%s]: %d bytes of stack never used.\n", pcTaskGetName( w ), uxTaskGetStackHighWaterMark( w ));
+}
+
+// Must be called with the mux held
+void Scheduler::queue( job_id_t id )
+{
+	jobs[ id ].queued = true;
+	pools[ static_cast<uint8_t>( jobs[ id ].pool ) ].ready.push_back( id );
+}
+
+// Next period after a run, periods which already went by are dropped rather than run back to back.
+// Must be called with the mux held, returns true when the job is due right away.
+bool Scheduler::reschedule( job_id_t id )
+{
+	scheduler_job_t	&job = jobs[ id ];
+	int32_t			late;
+
+	job.running = false;
+	if ( job.run_again ) {
+
+		job.run_again = false;
+		job.due_tick = current_tick();
+		queue( id );
+		return true;
+	}
+
+	if ( !job.enabled )
+		return false;
+
+	job.due_tick += job.period_ticks;
+	late = static_cast<int32_t>( current_tick() - job.due_tick );
+
+	if ( late < 0 ) {
+
+		arm( id );
+		return false;
+	}
+
+	job.stats.skipped += late / job.period_ticks;
+	job.due_tick += ( late / job.period_ticks ) * job.period_ticks;
+	queue( id );
+	return true;
+}
+
+// Runs the job as soon as a worker is free, even when disabled, and restarts its period from there.
+// A job already waiting for a worker just runs once.
+void Scheduler::run_now( job_id_t id )
+{
+	bool queued = false;
+
+	if ( id >= jobs.size() )
+		return;
+
+	taskENTER_CRITICAL( &mux );
+
+	scheduler_job_t &job = jobs[ id ];
+
+	if ( job.running )
+
+		job.run_again = true;
+
+	else if ( !job.queued ) {
+
+		if ( job.armed )
+			disarm( id );
+		job.due_tick = current_tick();
+		queue( id );
+		queued = true;
+	}
+
+	taskEXIT_CRITICAL( &mux );
+
+	if ( queued )
+		signal( id );
+}
+
+// Disabled jobs leave the wheel so that they do not wake it up, enabled again they are due a period later
+void Scheduler::set_enabled( job_id_t id, bool enabled )
+{
+	if ( id >= jobs.size() )
+		return;
+
+	taskENTER_CRITICAL( &mux );
+
+	scheduler_job_t &job = jobs[ id ];
+
+	job.enabled = enabled;
+	if ( !enabled && job.armed )
+
+		disarm( id );
+
+	else if ( enabled && !job.armed && !job.queued && !job.running ) {
+
+		job.due_tick = current_tick() + job.period_ticks;
+		arm( id );
+	}
+
+	taskEXIT_CRITICAL( &mux );
+
+	if ( enabled )
+		set_timer( false );
+}
+
+// Takes effect when the job is next rescheduled, for instance from the job itself
+void Scheduler::set_period( job_id_t id, uint32_t period_ms )
+{
+	if ( id >= jobs.size() )
+		return;
+
+	taskENTER_CRITICAL( &mux );
+	jobs[ id ].period_ticks = std::max<uint32_t>( 1, ( period_ms + TICK_MS - 1 ) / TICK_MS );
+	taskEXIT_CRITICAL( &mux );
+}
+
+// Sets the timer for the next tick the wheel has something to do at, unless it already is. Once it fired, it
+// must be set again whatever that tick is.
+void Scheduler::set_timer( bool fired )
+{
+	uint32_t	wake;
+	int64_t		delay_us;
+
+	xSemaphoreTake( timer_mutex, portMAX_DELAY );
+
+	taskENTER_CRITICAL( &mux );
+	wake = next_wake();
+	taskEXIT_CRITICAL( &mux );
+
+	if ( fired || ( wake != wake_tick )) {
+
+		wake_tick = wake;
+		delay_us = static_cast<int64_t>( origin_us + static_cast<uint64_t>( wake ) * TICK_MS * 1000 ) - esp_timer_get_time();
+		esp_timer_stop( tick_timer );
+		esp_timer_start_once( tick_timer, std::max<int64_t>( delay_us, 0 ));
+	}
+
+	xSemaphoreGive( timer_mutex );
+}
+
+// Wakes up a worker of the job's pool
+void Scheduler::signal( job_id_t id )
+{
+	xSemaphoreGive( pools[ static_cast<uint8_t>( jobs[ id ].pool ) ].ready_count );
+}
+
+// Catches the wheel up with the time, the ticks slept through had nothing due but may have to cascade
+void Scheduler::tick( void )
+{
+	job_id_t					id;
+	job_id_t					next;
+	uint32_t					target = current_tick();
+	std::array<uint8_t,POOLS>	due = {};
+
+	taskENTER_CRITICAL( &mux );
+
+	while ( static_cast<int32_t>( target - now_tick ) > 0 ) {
+
+		now_tick++;
+		if ( !( now_tick & WHEEL_MASK )) {
+
+			if ( !( now_tick & (( WHEEL_SLOTS << WHEEL_BITS ) - 1 )))
+				cascade( 2, ( now_tick >> ( 2 * WHEEL_BITS )) & WHEEL_MASK );
+			cascade( 1, ( now_tick >> WHEEL_BITS ) & WHEEL_MASK );
+		}
+
+		id = wheel[ 0 ][ now_tick & WHEEL_MASK ];
+		wheel[ 0 ][ now_tick & WHEEL_MASK ] = SCHEDULER_NO_JOB;
+
+		while ( id != SCHEDULER_NO_JOB ) {
+
+			next = jobs[ id ].next;
+			jobs[ id ].armed = false;
+			queue( id );
+			due[ static_cast<uint8_t>( jobs[ id ].pool ) ]++;
+			id = next;
+		}
+	}
+
+	taskEXIT_CRITICAL( &mux );
+
+	for ( uint8_t i = 0; i < POOLS; i++ )
+		while ( due[ i ]-- )
+			xSemaphoreGive( pools[ i ].ready_count );
+
+	set_timer( true );
+}
+
+void Scheduler::tick_callback( void *arg )
+{
+	static_cast<Scheduler *>( arg )->tick();
+}
+
+void Scheduler::worker( job_pool_t pool_id )
+{
+	pool_t		&pool = pools[ static_cast<uint8_t>( pool_id ) ];
+	job_id_t	id;
+	uint64_t	due_us;
+	uint64_t	start_us;
+	uint64_t	end_us;
+	bool		due_again;
+
+	while ( true ) {
+
+		xSemaphoreTake( pool.ready_count, portMAX_DELAY );
+
+		taskENTER_CRITICAL( &mux );
+		id = next_ready( pool );
+		taskEXIT_CRITICAL( &mux );
+
+		if ( id == SCHEDULER_NO_JOB )
+			continue;
+
+		scheduler_job_t &job = jobs[ id ];
+
+		due_us = origin_us + static_cast<uint64_t>( job.due_tick ) * TICK_MS * 1000;
+		start_us = esp_timer_get_time();
+		job.callback();
+		end_us = esp_timer_get_time();
+
+		taskENTER_CRITICAL( &mux );
+
+		job.stats.runs++;
+		job.stats.last_runtime_us = end_us - start_us;
+		job.stats.max_runtime_us = std::max( job.stats.max_runtime_us, job.stats.last_runtime_us );
+		if ( start_us > due_us )
+			job.stats.max_jitter_us = std::max( job.stats.max_jitter_us, static_cast<uint32_t>( start_us - due_us ));
+		if ( end_us > due_us + job.deadline_us )
+			job.stats.overruns++;
+		due_again = reschedule( id );
+
+		taskEXIT_CRITICAL( &mux );
+
+		if ( due_again )
+			signal( id );
+		else
+			set_timer( false );
+
+		if ( debug_mode && ( end_us > due_us + job.deadline_us ))
+			Serial.printf( "[SCHEDULER ] [DEBUG] Job [%s] missed its deadline by %lldus.\n", job.name, end_us - due_us - job.deadline_us );
+	}
+}
@@ -0,0 +1,142 @@
+/*
+  	scheduler.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _scheduler_H
+#define	_scheduler_H
+
+#include <array>
+#include <functional>
+#include <esp_timer.h>
+#include "Embedded_Template_Library.h"
+#include "etl/vector.h"
+
+enum struct job_priority_t : uint8_t {
+
+	URGENT,			// Served first when several jobs are due at once, not HIGH which Arduino.h defines
+	NORMAL,
+	BACKGROUND
+};
+
+// Each pool has a single worker. The sensor reads and the jobs which wait on the network run on workers
+// of their own, so that they never hold up the lookout, the dome or the rain guard, nor each other.
+enum struct job_pool_t : uint8_t {
+
+	SHORT,
+	SENSORS,
+	BLOCKING,
+	COUNT
+};
+
+using job_id_t = uint8_t;
+
+constexpr uint8_t	SCHEDULER_MAX_JOBS	= 16;
+constexpr job_id_t	SCHEDULER_NO_JOB	= 0xFF;
+
+struct job_stats_t {
+
+	uint32_t	runs;
+	uint32_t	overruns;			// Finished after their deadline
+	uint32_t	skipped;			// Periods dropped because the job was still late
+	uint32_t	last_runtime_us;
+	uint32_t	max_runtime_us;
+	uint32_t	max_jitter_us;		// Due time to actual start
+};
+
+struct scheduler_job_t {
+
+	const char					*name;
+	std::function<void(void)>	callback;
+	uint32_t					period_ticks;
+	uint32_t					deadline_us;	// From the due time
+	job_priority_t				priority;
+	job_pool_t					pool;
+	uint32_t					due_tick;
+	job_id_t					next;			// In the same wheel slot
+	uint8_t						level;
+	uint8_t						slot;
+	bool						armed;			// In the wheel
+	bool						queued;			// Waiting for a worker
+	bool						running;
+	bool						enabled;		// Disabled jobs are neither, until run_now()
+	bool						run_again;		// run_now() while running
+	job_stats_t					stats;
+};
+
+// All periodic work of the station goes through here: a hierarchical timer wheel hands the jobs which are due
+// to the worker of their pool, highest priority first. A one-shot esp_timer advances the wheel, it is set for
+// the next slot holding a job rather than ticking when nothing is due.
+class Scheduler {
+
+	public:
+
+							Scheduler( void ) = default;
+		job_id_t			add_job( const char *, uint32_t, uint32_t, uint32_t, job_priority_t, job_pool_t, std::function<void(void)> );
+		job_stats_t			get_stats( job_id_t );
+		bool				initialise( bool );
+		void				print_stats( void );
+		void				run_now( job_id_t );
+		void				set_enabled( job_id_t, bool );
+		void				set_period( job_id_t, uint32_t );
+
+	private:
+
+		static constexpr uint32_t	TICK_MS			= 100;
+		static constexpr uint8_t	WHEEL_BITS		= 6;
+		static constexpr uint32_t	WHEEL_SLOTS		= 1 << WHEEL_BITS;
+		static constexpr uint32_t	WHEEL_MASK		= WHEEL_SLOTS - 1;
+		static constexpr uint8_t	WHEEL_LEVELS	= 3;			// 0.1s, 6.4s and 6.8min slots, 7.3h ahead at most
+		static constexpr uint32_t	WHEEL_SPAN		= 1 << ( WHEEL_BITS * WHEEL_LEVELS );
+		static constexpr uint8_t	POOLS			= static_cast<uint8_t>( job_pool_t::COUNT );
+
+		struct pool_t {
+
+			etl::vector<job_id_t,SCHEDULER_MAX_JOBS>	ready;
+			SemaphoreHandle_t							ready_count	= nullptr;
+		};
+
+		bool					debug_mode		= false;
+		etl::vector<scheduler_job_t,SCHEDULER_MAX_JOBS>		jobs;
+		portMUX_TYPE			mux				= portMUX_INITIALIZER_UNLOCKED;
+		uint32_t				now_tick		= 0;		// Where the wheel is, can lag behind the time until the timer fires
+		uint64_t				origin_us		= 0;		// Monotonic time of tick 0
+		std::array<pool_t,POOLS>	pools;
+		esp_timer_handle_t		tick_timer		= nullptr;
+		SemaphoreHandle_t		timer_mutex		= nullptr;
+		uint32_t				wake_tick		= 0;		// The timer is set for this one
+		std::array<std::array<job_id_t,WHEEL_SLOTS>,WHEEL_LEVELS>	wheel;
+		std::array<TaskHandle_t,POOLS>				workers		= {};
+
+		void				arm( job_id_t );
+		void				cascade( uint8_t, uint32_t );
+		uint32_t			current_tick( void );
+		void				disarm( job_id_t );
+		uint32_t			next_wake( void );
+		job_id_t			next_ready( pool_t & );
+		void				queue( job_id_t );
+		bool				reschedule( job_id_t );
+		void				set_timer( bool );
+		void				signal( job_id_t );
+		void				tick( void );
+		void				worker( job_pool_t );
+
+		static void			tick_callback( void * );
+};
+
+#endif
@@ -0,0 +1,520 @@
+/*
+	sensor_history.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <Arduino.h>
+#include <esp_system.h>
+#include <LittleFS.h>
+
+#include "sensor_history.h"
+
+const std::array<const char *,HISTORY_CHANNELS>	HISTORY_CHANNEL_NAMES = {
+
+	"temperature", "pressure", "sl_pressure", "rh", "dew_point", "wind_speed", "wind_gust", "wind_direction",
+	"rain_event", "rain_intensity", "ambient_temperature", "raw_sky_temperature", "sky_temperature", "cloud_cover",
+	"cloud_coverage", "lux", "irradiance", "msas", "nelm", "gain", "integration_time", "ir_luminosity",
+	"vis_luminosity", "full_luminosity"
+};
+
+const std::array<uint8_t,HISTORY_CHANNELS>		HISTORY_CHANNEL_BITS = { 0, 0, 0, 0, 0, 0, 0, 0, 2, 4, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+constexpr std::array<uint16_t,HISTORY_TIERS>		TIER_MAX_SEGMENTS	= { 36, 72, 100 };	// Some 12 hours at 15s, 4 days and 1 year, depending on compression
+constexpr std::array<const char *,HISTORY_TIERS>	TIER_DIR			= { "/history/raw", "/history/1m", "/history/1h" };
+
+// What the writer needs to go on appending to a tier
+struct history_tier_state_t {
+
+	uint32_t	first_segment;		// 0 when the tier is empty
+	uint32_t	last_segment;
+	uint16_t	segments;
+	uint16_t	size;				// Of the last segment
+	uint32_t	last_timestamp;
+	SeriesCodec	writer;				// State after the last record
+};
+
+struct history_bucket_t {
+
+	uint32_t								start;
+	std::array<float,HISTORY_CHANNELS>		sum;
+	std::array<uint16_t,HISTORY_CHANNELS>	count;
+};
+
+// Solar stations only add their readings at push time, the buckets must survive the deep sleeps in between
+RTC_DATA_ATTR std::array<history_bucket_t,HISTORY_TIERS - 1>	rtc_history_buckets = {};	// NOSONAR
+// Likewise for the tiers, so that a wake up from deep sleep neither lists nor replays them
+RTC_DATA_ATTR std::array<history_tier_state_t,HISTORY_TIERS>	rtc_history_tiers = {};		// NOSONAR
+RTC_DATA_ATTR bool	rtc_history_scanned = false;	// NOSONAR
+
+// Stores one sample in a tier, the timestamps of a tier only go forward
+bool SensorHistory::add( const sensor_data_t &sensor_data )
+{
+	history_sample_t	sample;
+	bool				ok;
+
+	if ( !initialised )
+		return false;
+
+	to_sample( sensor_data, sample );
+	if ( sample.timestamp < MIN_TIMESTAMP )
+		return false;
+
+	if ( xSemaphoreTake( mutex, 1000 / portTICK_PERIOD_MS ) != pdTRUE )
+		return false;
+
+	if (( ok = append( history_tier_t::RAW, sample ))) {
+
+		downsample( history_tier_t::MINUTE, sample );
+		downsample( history_tier_t::HOUR, sample );
+	}
+	xSemaphoreGive( mutex );
+	return ok;
+}
+
+bool SensorHistory::append( history_tier_t tier, const history_sample_t &sample )
+{
+	history_tier_state_t	&state = rtc_history_tiers[ static_cast<uint8_t>( tier ) ];
+	segment_index_t			&tier_index = index[ static_cast<uint8_t>( tier ) ];
+	etl::string<32>			filename;
+	File					segment;
+	std::array<uint8_t,MAX_RECORD_SIZE>	record;
+	size_t					len;
+
+	static_assert(( TIER_MAX_SEGMENTS[ 0 ] <= MAX_SEGMENTS ) && ( TIER_MAX_SEGMENTS[ 1 ] <= MAX_SEGMENTS ) && ( TIER_MAX_SEGMENTS[ 2 ] <= MAX_SEGMENTS ), "Segment index too small" );
+
+	if ( sample.timestamp <= state.last_timestamp )
+		return false;
+
+	if ( !state.segments || ( state.size + MAX_RECORD_SIZE > SEGMENT_SIZE )) {
+
+		make_room();
+		while ( state.segments >= TIER_MAX_SEGMENTS[ static_cast<uint8_t>( tier ) ] )
+			remove_oldest_segment( tier );
+
+		segment_header_t header = { MAGIC, FORMAT, static_cast<uint8_t>( tier ), HISTORY_CHANNELS, 0, sample.timestamp, HISTORY_TIER_INTERVAL[ static_cast<uint8_t>( tier ) ] };
+
+		segment_name( filename, tier, sample.timestamp );
+		if ( !( segment = LittleFS.open( filename.data(), FILE_WRITE )) || ( segment.write( reinterpret_cast<uint8_t *>( &header ), sizeof( header )) != sizeof( header ))) {
+
+			Serial.printf( "[HISTORY   ] [ERROR] Cannot create segment [%s].\n", filename.data() );
+			return false;
+		}
+		if ( !state.segments )
+			state.first_segment = sample.timestamp;
+		state.last_segment = sample.timestamp;
+		state.segments++;
+		if ( tier_index.listed && !tier_index.segments.full() )
+			tier_index.segments.push_back( sample.timestamp );
+		state.size = sizeof( header );
+		state.writer.reset( HISTORY_CHANNEL_BITS.data(), HISTORY_CHANNELS, sample.timestamp );
+
+		if ( debug_mode )
+			Serial.printf( "[HISTORY   ] [DEBUG] New segment [%s], %d in this tier.\n", filename.data(), state.segments );
+
+	} else {
+
+		segment_name( filename, tier, state.last_segment );
+		segment = LittleFS.open( filename.data(), FILE_APPEND );
+	}
+
+	len = state.writer.encode( sample.timestamp, sample.value.data(), record.data(), record.size() );
+
+	// The stream cannot go on after a partial write, the next record opens a new segment
+	if ( !segment || ( segment.write( record.data(), len ) != len )) {
+
+		Serial.printf( "[HISTORY   ] [ERROR] Cannot write to segment [%s].\n", filename.data() );
+		state.size = SEGMENT_SIZE;
+		return false;
+	}
+	segment.close();
+	state.size += len;
+	state.last_timestamp = sample.timestamp;
+	return true;
+}
+
+// Buckets are written as soon as a sample falls in the next one. Floats get the mean of the bucket and integers
+// its largest value, so that a short rain event still shows. Missing values are ignored.
+void SensorHistory::downsample( history_tier_t tier, const history_sample_t &sample )
+{
+	history_bucket_t	&bucket = rtc_history_buckets[ static_cast<uint8_t>( tier ) - 1 ];
+	uint32_t			start = sample.timestamp - ( sample.timestamp % HISTORY_TIER_INTERVAL[ static_cast<uint8_t>( tier ) ] );
+	history_sample_t	mean;
+
+	if ( bucket.start && ( bucket.start != start )) {
+
+		mean.timestamp = bucket.start;
+		for ( uint8_t i = 0; i < HISTORY_CHANNELS; i++ )
+			mean.value[ i ] = bucket.count[ i ] ? ( HISTORY_CHANNEL_BITS[ i ] ? bucket.sum[ i ] : bucket.sum[ i ] / bucket.count[ i ] ) : NAN;
+		append( tier, mean );
+	}
+
+	if ( bucket.start != start ) {
+
+		bucket.start = start;
+		bucket.sum.fill( 0 );
+		bucket.count.fill( 0 );
+	}
+
+	for ( uint8_t i = 0; i < HISTORY_CHANNELS; i++ )
+		if ( !isnan( sample.value[ i ] )) {
+
+			bucket.sum[ i ] = HISTORY_CHANNEL_BITS[ i ] ? std::max( bucket.sum[ i ], sample.value[ i ] ) : bucket.sum[ i ] + sample.value[ i ];
+			bucket.count[ i ]++;
+		}
+}
+
+// Latest segment starting at or before the timestamp, or with 'after', first segment starting after it. 0 when there is none.
+uint32_t SensorHistory::find_segment( history_tier_t tier, uint32_t timestamp, bool after )
+{
+	const etl::ivector<uint32_t>	&segments = get_index( tier ).segments;
+	auto							next = std::upper_bound( segments.begin(), segments.end(), timestamp );
+
+	if ( after )
+		return ( next == segments.end() ) ? 0 : *next;
+	return ( next == segments.begin() ) ? 0 : *( next - 1 );
+}
+
+uint32_t SensorHistory::fs_free_space( void )
+{
+	return LittleFS.totalBytes() - LittleFS.usedBytes();
+}
+
+uint32_t SensorHistory::get_first_timestamp( history_tier_t tier )
+{
+	return rtc_history_tiers[ static_cast<uint8_t>( tier ) ].first_segment;
+}
+
+// Listed from the directory on first use only, solar stations seldom need it
+SensorHistory::segment_index_t &SensorHistory::get_index( history_tier_t tier )
+{
+	segment_index_t	&tier_index = index[ static_cast<uint8_t>( tier ) ];
+	File			dir;
+	File			file;
+	uint32_t		start;
+
+	if ( tier_index.listed )
+		return tier_index;
+
+	tier_index.listed = true;
+	tier_index.segments.clear();
+	if ( !( dir = LittleFS.open( TIER_DIR[ static_cast<uint8_t>( tier ) ] )))
+		return tier_index;
+
+	while (( file = dir.openNextFile() )) {
+
+		start = strtoul( file.name(), nullptr, 16 );
+		file.close();
+
+		// Only when the limits were lowered by an update, the newest segments are kept
+		if ( tier_index.segments.full() ) {
+
+			auto oldest = std::min_element( tier_index.segments.begin(), tier_index.segments.end() );
+			if ( start > *oldest )
+				*oldest = start;
+			continue;
+		}
+		tier_index.segments.push_back( start );
+	}
+	dir.close();
+
+	std::sort( tier_index.segments.begin(), tier_index.segments.end() );
+	return tier_index;
+}
+
+// After a deep sleep the tiers are as they were left, only a reset or a new firmware has them scanned again
+bool SensorHistory::initialise( bool _debug_mode )
+{
+	bool	resume = rtc_history_scanned && ( esp_reset_reason() == ESP_RST_DEEPSLEEP );
+
+	debug_mode = _debug_mode;
+
+	if ( initialised )
+		return true;
+
+	if ( !LittleFS.begin( true )) {
+
+		Serial.printf( "[HISTORY   ] [ERROR] Could not access flash filesystem, no sensor history.\n" );
+		return false;
+	}
+
+	if ( !LittleFS.exists( "/history" ))
+		LittleFS.mkdir( "/history" );
+
+	for ( uint8_t i = 0; i < HISTORY_TIERS; i++ ) {
+
+		if ( !LittleFS.exists( TIER_DIR[ i ] ))
+			LittleFS.mkdir( TIER_DIR[ i ] );
+		if ( !resume )
+			scan_tier( static_cast<history_tier_t>( i ));
+
+		if ( debug_mode )
+			Serial.printf( "[HISTORY   ] [DEBUG] Tier [%s]: %d segments, last record at %d.\n", TIER_DIR[ i ], rtc_history_tiers[ i ].segments, rtc_history_tiers[ i ].last_timestamp );
+	}
+	rtc_history_scanned = true;
+
+	mutex = xSemaphoreCreateMutex();
+	initialised = true;
+	return true;
+}
+
+bool SensorHistory::is_initialised( void )
+{
+	return initialised;
+}
+
+// The finest tier gives way first, so that the coarse history lasts longest
+bool SensorHistory::make_room( void )
+{
+	while ( fs_free_space() < MIN_FREE_SPACE ) {
+
+		uint8_t i = 0;
+
+		while (( i < HISTORY_TIERS ) && ( rtc_history_tiers[ i ].segments < 2 ))
+			i++;
+
+		if ( i == HISTORY_TIERS ) {
+
+			Serial.printf( "[HISTORY   ] [WARN ] Flash filesystem is almost full (%d bytes left).\n", fs_free_space() );
+			return false;
+		}
+		remove_oldest_segment( static_cast<history_tier_t>( i ));
+	}
+	return true;
+}
+
+// Returns false when the history cannot be read, an empty query is done from the start
+bool SensorHistory::open_query( history_cursor_t &cursor, history_tier_t tier, uint32_t from, uint32_t to )
+{
+	cursor.tier = tier;
+	cursor.from = from;
+	cursor.to = to;
+	cursor.offset = 0;
+	cursor.done = true;
+
+	if ( !initialised || ( xSemaphoreTake( mutex, 1000 / portTICK_PERIOD_MS ) != pdTRUE ))
+		return false;
+
+	if ( !( cursor.segment = find_segment( tier, from, false )))
+		cursor.segment = rtc_history_tiers[ static_cast<uint8_t>( tier ) ].first_segment;
+	cursor.done = ( !cursor.segment || ( cursor.segment > to ));
+
+	xSemaphoreGive( mutex );
+	return true;
+}
+
+// Finest tier which still goes back to 'from', or else the one going back furthest. Coarser tiers only hold means,
+// so the finest one gives the true minimum and maximum over any resolution.
+history_tier_t SensorHistory::pick_tier( uint32_t from )
+{
+	uint8_t	oldest = 0;
+
+	for ( uint8_t i = 0; i < HISTORY_TIERS; i++ ) {
+
+		if ( rtc_history_tiers[ i ].segments && ( !rtc_history_tiers[ oldest ].segments || ( rtc_history_tiers[ i ].first_segment < rtc_history_tiers[ oldest ].first_segment )))
+			oldest = i;
+
+		if ( rtc_history_tiers[ i ].segments && ( rtc_history_tiers[ i ].first_segment <= from ))
+			return static_cast<history_tier_t>( i );
+	}
+	return static_cast<history_tier_t>( oldest );
+}
+
+// Reads the next samples of a query, up to the size of the buffer, 'count' is 0 once the query is over.
+// Returns false when the history could not be read, which must not be taken for the end of the query.
+bool SensorHistory::read( history_cursor_t &cursor, history_sample_t *samples, size_t max_samples, size_t &count )
+{
+	size_t	n = 0;
+	bool	end;
+
+	count = 0;
+	if ( cursor.done )
+		return true;
+
+	if ( !initialised || ( xSemaphoreTake( mutex, 1000 / portTICK_PERIOD_MS ) != pdTRUE ))
+		return false;
+
+	while (( n < max_samples ) && !cursor.done ) {
+
+		n += read_segment( cursor, samples + n, max_samples - n, end );
+		if ( !end || cursor.done )
+			break;
+
+		if ( !( cursor.segment = find_segment( cursor.tier, cursor.segment, true )) || ( cursor.segment > cursor.to ))
+			cursor.done = true;
+		cursor.offset = 0;
+	}
+
+	xSemaphoreGive( mutex );
+	count = n;
+	return true;
+}
+
+// Samples of the current segment only, 'end' is set once it has no more to give. The segment may have been
+// removed since the last call, or have a record cut short by a reset: both end it.
+size_t SensorHistory::read_segment( history_cursor_t &cursor, history_sample_t *samples, size_t max_samples, bool &end )
+{
+	std::array<uint8_t,READ_CHUNK>	buffer;
+	etl::string<32>					filename;
+	segment_header_t				header;
+	File							segment;
+	size_t							n = 0;
+	size_t							len;
+	size_t							used;
+	size_t							k;
+
+	end = true;
+	segment_name( filename, cursor.tier, cursor.segment );
+	if ( !( segment = LittleFS.open( filename.data(), FILE_READ )))
+		return 0;
+
+	if ( !cursor.offset ) {
+
+		if (( segment.read( reinterpret_cast<uint8_t *>( &header ), sizeof( header )) != sizeof( header )) || ( header.magic != MAGIC ) || ( header.format != FORMAT ) || ( header.channels != HISTORY_CHANNELS )) {
+
+			segment.close();
+			return 0;
+		}
+		cursor.reader.reset( HISTORY_CHANNEL_BITS.data(), HISTORY_CHANNELS, header.first_timestamp );
+		cursor.offset = sizeof( header );
+	}
+
+	while (( n < max_samples ) && !cursor.done && segment.seek( cursor.offset ) && ( len = segment.read( buffer.data(), buffer.size() ))) {
+
+		used = 0;
+		while (( n < max_samples ) && ( k = cursor.reader.decode( buffer.data() + used, len - used, samples[ n ].timestamp, samples[ n ].value.data() ))) {
+
+			used += k;
+			if ( samples[ n ].timestamp > cursor.to ) {
+
+				cursor.done = true;
+				break;
+			}
+			if ( samples[ n ].timestamp >= cursor.from )
+				n++;
+		}
+		cursor.offset += used;
+		if ( !used )
+			break;
+	}
+	segment.close();
+
+	end = ( n < max_samples );
+	return n;
+}
+
+void SensorHistory::remove_oldest_segment( history_tier_t tier )
+{
+	history_tier_state_t	&state = rtc_history_tiers[ static_cast<uint8_t>( tier ) ];
+	segment_index_t			&tier_index = get_index( tier );
+	etl::string<32>			filename;
+
+	segment_name( filename, tier, state.first_segment );
+	LittleFS.remove( filename.data() );
+
+	if ( debug_mode )
+		Serial.printf( "[HISTORY   ] [DEBUG] Removed segment [%s].\n", filename.data() );
+
+	if ( !tier_index.segments.empty() && ( tier_index.segments.front() == state.first_segment ))
+		tier_index.segments.erase( tier_index.segments.begin() );
+
+	if ( --state.segments && !tier_index.segments.empty() )
+		state.first_segment = tier_index.segments.front();
+	else
+		state = {};
+}
+
+void SensorHistory::scan_tier( history_tier_t tier )
+{
+	history_tier_state_t	&state = rtc_history_tiers[ static_cast<uint8_t>( tier ) ];
+	File					file;
+	etl::string<32>			filename;
+	history_cursor_t		cursor;
+	history_sample_t		sample;
+	bool					end;
+
+	state = {};
+	index[ static_cast<uint8_t>( tier ) ].listed = false;
+
+	const etl::ivector<uint32_t> &segments = get_index( tier ).segments;
+	if ( segments.empty() )
+		return;
+
+	state.first_segment = segments.front();
+	state.last_segment = segments.back();
+	state.segments = segments.size();
+
+	// Replays the last segment to get the state of the encoder back
+	cursor.tier = tier;
+	cursor.from = 0;
+	cursor.to = UINT32_MAX;
+	cursor.segment = state.last_segment;
+	cursor.offset = 0;
+	cursor.done = false;
+	state.last_timestamp = state.last_segment;
+	while ( read_segment( cursor, &sample, 1, end ))
+		state.last_timestamp = sample.timestamp;
+	state.writer = cursor.reader;
+	state.size = cursor.offset;
+
+	// Older format, or a record cut short by a reset: nothing can follow, the next record opens a new segment
+	segment_name( filename, tier, state.last_segment );
+	file = LittleFS.open( filename.data(), FILE_READ );
+	if ( !cursor.offset || !file || ( file.size() != cursor.offset ))
+		state.size = SEGMENT_SIZE;
+	file.close();
+}
+
+void SensorHistory::segment_name( etl::string<32> &filename, history_tier_t tier, uint32_t first_timestamp )
+{
+	snprintf( filename.data(), filename.capacity(), "%s/%08x", TIER_DIR[ static_cast<uint8_t>( tier ) ], static_cast<unsigned int>( first_timestamp ));
+}
+
+void SensorHistory::to_sample( const sensor_data_t &sensor_data, history_sample_t &sample )
+{
+	auto set = [&]( history_channel_t channel, aws_device_t device, float value ) {
+
+		sample.value[ static_cast<uint8_t>( channel ) ] = (( sensor_data.available_sensors & device ) == device ) ? value : NAN;
+	};
+
+	sample.timestamp = static_cast<uint32_t>( sensor_data.timestamp );
+
+	set( history_channel_t::TEMPERATURE, aws_device_t::BME_SENSOR, sensor_data.weather.temperature );
+	set( history_channel_t::PRESSURE, aws_device_t::BME_SENSOR, sensor_data.weather.pressure );
+	set( history_channel_t::SL_PRESSURE, aws_device_t::BME_SENSOR, sensor_data.weather.sl_pressure );
+	set( history_channel_t::RH, aws_device_t::BME_SENSOR, sensor_data.weather.rh );
+	set( history_channel_t::DEW_POINT, aws_device_t::BME_SENSOR, sensor_data.weather.dew_point );
+	set( history_channel_t::WIND_SPEED, aws_device_t::ANEMOMETER_SENSOR, sensor_data.weather.wind_speed );
+	set( history_channel_t::WIND_GUST, aws_device_t::ANEMOMETER_SENSOR, sensor_data.weather.wind_gust );
+	set( history_channel_t::WIND_DIRECTION, aws_device_t::WIND_VANE_SENSOR, sensor_data.weather.wind_direction );
+	set( history_channel_t::RAIN_EVENT, aws_device_t::RAIN_SENSOR, sensor_data.weather.rain_event ? 1 : 0 );
+	set( history_channel_t::RAIN_INTENSITY, aws_device_t::RAIN_SENSOR, sensor_data.weather.rain_intensity );
+	set( history_channel_t::AMBIENT_TEMPERATURE, aws_device_t::MLX_SENSOR, sensor_data.weather.ambient_temperature );
+	set( history_channel_t::RAW_SKY_TEMPERATURE, aws_device_t::MLX_SENSOR, sensor_data.weather.raw_sky_temperature );
+	set( history_channel_t::SKY_TEMPERATURE, aws_device_t::MLX_SENSOR, sensor_data.weather.sky_temperature );
+	set( history_channel_t::CLOUD_COVER, aws_device_t::MLX_SENSOR, sensor_data.weather.cloud_cover );
+	set( history_channel_t::CLOUD_COVERAGE, aws_device_t::MLX_SENSOR, sensor_data.weather.cloud_coverage );
+	set( history_channel_t::LUX, aws_device_t::TSL_SENSOR, sensor_data.sun.lux );
+	set( history_channel_t::IRRADIANCE, aws_device_t::TSL_SENSOR, sensor_data.sun.irradiance );
+	set( history_channel_t::MSAS, aws_device_t::TSL_SENSOR, sensor_data.sqm.msas );
+	set( history_channel_t::NELM, aws_device_t::TSL_SENSOR, sensor_data.sqm.nelm );
+	set( history_channel_t::GAIN, aws_device_t::TSL_SENSOR, sensor_data.sqm.gain );
+	set( history_channel_t::INTEGRATION_TIME, aws_device_t::TSL_SENSOR, sensor_data.sqm.integration_time );
+	set( history_channel_t::IR_LUMINOSITY, aws_device_t::TSL_SENSOR, sensor_data.sqm.ir_luminosity );
+	set( history_channel_t::VIS_LUMINOSITY, aws_device_t::TSL_SENSOR, sensor_data.sqm.vis_luminosity );
+	set( history_channel_t::FULL_LUMINOSITY, aws_device_t::TSL_SENSOR, sensor_data.sqm.full_luminosity );
+}
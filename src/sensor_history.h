@@ -0,0 +1,163 @@
+/*
+  	sensor_history.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _sensor_history_H
+#define	_sensor_history_H
+
+#include "Embedded_Template_Library.h"
+#include "etl/vector.h"
+
+#include "common.h"
+#include "series_codec.h"
+
+enum struct history_channel_t : uint8_t {
+
+	TEMPERATURE,
+	PRESSURE,
+	SL_PRESSURE,
+	RH,
+	DEW_POINT,
+	WIND_SPEED,
+	WIND_GUST,
+	WIND_DIRECTION,
+	RAIN_EVENT,
+	RAIN_INTENSITY,
+	AMBIENT_TEMPERATURE,
+	RAW_SKY_TEMPERATURE,
+	SKY_TEMPERATURE,
+	CLOUD_COVER,
+	CLOUD_COVERAGE,
+	LUX,
+	IRRADIANCE,
+	MSAS,
+	NELM,
+	GAIN,
+	INTEGRATION_TIME,
+	IR_LUMINOSITY,
+	VIS_LUMINOSITY,
+	FULL_LUMINOSITY,
+	COUNT
+};
+
+constexpr uint8_t	HISTORY_CHANNELS	= static_cast<uint8_t>( history_channel_t::COUNT );
+
+// Same names as in the JSON sensor data
+extern const std::array<const char *,HISTORY_CHANNELS>	HISTORY_CHANNEL_NAMES;
+// Width of the channels stored as small integers, 0 for floats
+extern const std::array<uint8_t,HISTORY_CHANNELS>		HISTORY_CHANNEL_BITS;
+
+enum struct history_tier_t : uint8_t {
+
+	RAW,			// Every sensor poll
+	MINUTE,			// Means over one minute
+	HOUR,			// Means over one hour
+	COUNT
+};
+
+constexpr uint8_t	HISTORY_TIERS	= static_cast<uint8_t>( history_tier_t::COUNT );
+
+constexpr std::array<uint32_t,HISTORY_TIERS>	HISTORY_TIER_INTERVAL	= { 0, 60, 3600 };		// In seconds
+constexpr std::array<const char *,HISTORY_TIERS>	HISTORY_TIER_NAMES		= { "raw", "1m", "1h" };
+
+// Channels of unavailable sensors are NaN
+struct history_sample_t {
+
+	uint32_t								timestamp;
+	std::array<float,HISTORY_CHANNELS>		value;
+};
+
+// Position of a query, the files are only open while reading so that the writer is never blocked for long
+struct history_cursor_t {
+
+	history_tier_t	tier;
+	uint32_t		from;
+	uint32_t		to;
+	uint32_t		segment;		// First timestamp of the current segment, 0 before the query starts
+	uint16_t		offset;			// Of the next record in that segment, 0 before its header is read
+	SeriesCodec		reader;
+	bool			done;
+};
+
+// Sensor history kept on LittleFS, one directory per tier. Each directory holds segments of at most
+// SEGMENT_SIZE bytes, named after the timestamp of their first record so that a directory listing
+// is the time index, kept in RAM once listed. Records are compressed with SeriesCodec, each segment
+// starting afresh from its header. Segments are append only and the oldest ones go first, when a tier
+// holds too many of them or when the filesystem runs short of space.
+class SensorHistory {
+
+	public:
+
+						SensorHistory( void ) = default;
+		bool			add( const sensor_data_t & );
+		uint32_t		get_first_timestamp( history_tier_t );
+		bool			initialise( bool );
+		bool			is_initialised( void );
+		bool			open_query( history_cursor_t &, history_tier_t, uint32_t, uint32_t );
+		history_tier_t	pick_tier( uint32_t );
+		bool			read( history_cursor_t &, history_sample_t *, size_t, size_t & );
+
+	private:
+
+		static constexpr uint32_t	MAGIC				= 0x48535741;		// "AWSH"
+		static constexpr uint8_t	FORMAT				= 2;				// 1 was uncompressed
+		static constexpr uint16_t	SEGMENT_SIZE		= 4096;				// One flash block
+		static constexpr uint16_t	MAX_SEGMENTS		= 100;				// In any tier
+		static constexpr size_t		MAX_RECORD_SIZE		= series_max_record_size( HISTORY_CHANNELS );
+		static constexpr size_t		READ_CHUNK			= 512;
+		static constexpr uint32_t	MIN_FREE_SPACE		= 128 * 1024;		// Left for the configuration, the backlog and file updates
+		static constexpr uint32_t	MIN_TIMESTAMP		= 1704067200;		// 2024-01-01, anything earlier means the clock is not set
+
+		struct segment_header_t {
+
+			uint32_t	magic;
+			uint8_t		format;
+			uint8_t		tier;
+			uint8_t		channels;
+			uint8_t		reserved;
+			uint32_t	first_timestamp;
+			uint32_t	interval;
+		};
+
+		// First timestamps of the segments, oldest first
+		struct segment_index_t {
+
+			bool									listed;
+			etl::vector<uint32_t,MAX_SEGMENTS>		segments;
+		};
+
+		bool							debug_mode		= false;
+		bool							initialised		= false;
+		SemaphoreHandle_t				mutex			= nullptr;
+		std::array<segment_index_t,HISTORY_TIERS>	index	= {};
+
+		bool			append( history_tier_t, const history_sample_t & );
+		void			downsample( history_tier_t, const history_sample_t & );
+		uint32_t		find_segment( history_tier_t, uint32_t, bool );
+		uint32_t		fs_free_space( void );
+		segment_index_t	&get_index( history_tier_t );
+		bool			make_room( void );
+		size_t			read_segment( history_cursor_t &, history_sample_t *, size_t, bool & );
+		void			remove_oldest_segment( history_tier_t );
+		void			scan_tier( history_tier_t );
+		void			segment_name( etl::string<32> &, history_tier_t, uint32_t );
+		void			to_sample( const sensor_data_t &, history_sample_t & );
+};
+
+#endif
@@ -39,6 +39,8 @@
 
 RTC_DATA_ATTR long	prev_available_sensors = 0;	// NOSONAR
 RTC_DATA_ATTR long	available_sensors = 0;		// NOSONAR
+// Sensors found at the last full boot, only those are probed again after a fast wake
+RTC_DATA_ATTR long	boot_available_sensors = 0;	// NOSONAR
 
 SemaphoreHandle_t sensors_read_mutex = NULL;	// Issue #7
 const aws_device_t ALL_SENSORS	= ( aws_device_t::MLX_SENSOR | aws_device_t::TSL_SENSOR | aws_device_t::BME_SENSOR | aws_device_t::WIND_VANE_SENSOR | aws_device_t::ANEMOMETER_SENSOR | aws_device_t::RAIN_SENSOR | aws_device_t::GPS_SENSOR );
@@ -115,24 +117,40 @@ sensor_data_t *AWSSensorManager::get_sensor_data( void )
 	return &sensor_data;
 }
 
-bool AWSSensorManager::initialise( I2C_SC16IS750 *sc16is750, AWSConfig *_config, bool _rain_event )
+// Monotonic time (low 32 bits) at which the sensors of the current snapshot started to be read
+uint32_t AWSSensorManager::get_snapshot_us( void )
+{
+	return snapshot_us;
+}
+
+bool AWSSensorManager::initialise( I2C_SC16IS750 *sc16is750, AWSConfig *_config, Scheduler *_scheduler, bool _rain_event )
 {
 	config = _config;
+	scheduler = _scheduler;
 	rain_event = _rain_event;
 	initialise_sensors( sc16is750 );
 
 	if ( !solar_panel ) {
 
 		sensors_read_mutex = xSemaphoreCreateMutex();
-		std::function<void(void *)> _poll_sensors_task = std::bind( &AWSSensorManager::poll_sensors_task, this, std::placeholders::_1 );
-		if ( xTaskCreatePinnedToCore(
-			[](void *param) {	// NOSONAR
-        	    std::function<void(void*)>* poll_proxy = static_cast<std::function<void(void*)>*>( param );
-        	    (*poll_proxy)( NULL );
-			}, "PollSensorsTask", 10000, &_poll_sensors_task, 5, &sensors_task_handle, 1 ) != pdPASS )
-			Serial.printf( "[SENSORMNGR] [ERROR] Could not start task [SensorManagerTask]\n" );
+		// A snapshot can take most of the polling interval (SQM ranging, RS485 timeouts), it has a worker of its own
+		poll_job = scheduler->add_job( "sensors", polling_ms_interval, 0, polling_ms_interval, job_priority_t::URGENT, job_pool_t::SENSORS, [this]() { refresh_snapshot(); } );
+		if ( poll_job == SCHEDULER_NO_JOB )
+			Serial.printf( "[SENSORMNGR] [ERROR] Could not schedule sensor polling.\n" );
 	}
 
+	initialise_cloud_model();
+
+	initialised = true;
+	return true;
+}
+
+void AWSSensorManager::initialise_cloud_model( void )
+{
+	std::array<int,7> k;
+
+	aws_cloud_model.set_thresholds( config->get_parameter<int>( "cc_aws_cloudy" ), config->get_parameter<int>( "cc_aws_overcast" ));
+
 	k[0] = config->get_parameter<int>( "k1" );
 	k[1] = config->get_parameter<int>( "k2" );
 	k[2] = config->get_parameter<int>( "k3" );
@@ -140,9 +158,13 @@ bool AWSSensorManager::initialise( I2C_SC16IS750 *sc16is750, AWSConfig *_config,
 	k[4] = config->get_parameter<int>( "k5" );
 	k[5] = config->get_parameter<int>( "k6" );
 	k[6] = config->get_parameter<int>( "k7" );
+	aag_cloud_model.set_coefficients( k );
+	aag_cloud_model.set_thresholds( config->get_parameter<int>( "cc_aag_cloudy" ), config->get_parameter<int>( "cc_aag_overcast" ));
 
-	initialised = true;
-	return true;
+	if ( config->get_parameter<int>( "cloud_coverage_formula" ) == 0 )
+		cloud_model = &aws_cloud_model;
+	else
+		cloud_model = &aag_cloud_model;
 }
 
 void AWSSensorManager::initialise_BME( void )
@@ -187,21 +209,37 @@ void AWSSensorManager::initialise_sensors( I2C_SC16IS750 *_sc16is750 )
 		delay( 500 );		// MLX96014 seems to take some time to properly initialise
 	}
 
-	if ( !rain_event && config->get_has_device( aws_device_t::BME_SENSOR ) )
+	// A full boot probes every sensor again
+	if ( !fast_wake && !rain_event )
+		available_sensors = aws_device_t::NO_SENSOR;
+
+	if ( !rain_event && must_initialise( aws_device_t::BME_SENSOR ) )
 		initialise_BME();
 
-	if ( !rain_event && config->get_has_device( aws_device_t::MLX_SENSOR ) )
+	if ( !rain_event && must_initialise( aws_device_t::MLX_SENSOR ) )
 		initialise_MLX();
 
-	if ( !rain_event && config->get_has_device( aws_device_t::TSL_SENSOR ) ) {
+	if ( !rain_event && must_initialise( aws_device_t::TSL_SENSOR ) ) {
 
 		initialise_TSL();
 		sqm.initialise( tsl, &sensor_data.sqm, config->get_parameter<float>( "msas_calibration_offset" ), debug_mode );
 	}
 
-	if ( !rain_event &&  config->get_has_device( aws_device_t::ANEMOMETER_SENSOR ) ) {
+	if ( !rain_event && ( must_initialise( aws_device_t::ANEMOMETER_SENSOR ) || must_initialise( aws_device_t::WIND_VANE_SENSOR ))) {
 
-		if ( !anemometer.initialise( &rs485_bus, polling_ms_interval, config->get_parameter<int>( "anemometer_model" ), debug_mode ))
+#ifdef AWS_MODBUS_SIMULATOR
+		modbus_simulator.add_anemometer( config->get_parameter<int>( "anemometer_model" ));
+		modbus_simulator.add_wind_vane( config->get_parameter<int>( "wind_vane_model" ));
+		modbus_simulator.set_wind( 3.5F, 270 );
+		modbus.initialise( &modbus_simulator, debug_mode );
+#else
+		modbus.initialise( &rs485_bus, GPIO_WIND_SENSOR_RX, GPIO_WIND_SENSOR_TX, GPIO_WIND_SENSOR_CTRL, debug_mode );
+#endif
+	}
+
+	if ( !rain_event &&  must_initialise( aws_device_t::ANEMOMETER_SENSOR ) ) {
+
+		if ( !anemometer.initialise( &modbus, polling_ms_interval, config->get_parameter<int>( "anemometer_model" ), debug_mode ))
 
 			available_sensors &= ~aws_device_t::ANEMOMETER_SENSOR;
 
@@ -212,9 +250,9 @@ void AWSSensorManager::initialise_sensors( I2C_SC16IS750 *_sc16is750 )
 		}
 	}
 
-	if ( !rain_event && config->get_has_device( aws_device_t::WIND_VANE_SENSOR ) ) {
+	if ( !rain_event && must_initialise( aws_device_t::WIND_VANE_SENSOR ) ) {
 
-		if ( !wind_vane.initialise( &rs485_bus, config->get_parameter<int>( "wind_vane_model" ), debug_mode ))
+		if ( !wind_vane.initialise( &modbus, config->get_parameter<int>( "wind_vane_model" ), debug_mode ))
 
 			available_sensors &= ~aws_device_t::WIND_VANE_SENSOR;
 
@@ -225,9 +263,11 @@ void AWSSensorManager::initialise_sensors( I2C_SC16IS750 *_sc16is750 )
 		}
 	}
 
-	if ( config->get_has_device( aws_device_t::RAIN_SENSOR ) && initialise_rain_sensor())
+	if ( must_initialise( aws_device_t::RAIN_SENSOR ) && initialise_rain_sensor())
 		available_sensors |= aws_device_t::RAIN_SENSOR;
 
+	if ( !fast_wake && !rain_event )
+		boot_available_sensors = static_cast<unsigned long>( available_sensors );
 }
 
 bool AWSSensorManager::initialise_rain_sensor( void )
@@ -253,6 +293,13 @@ void AWSSensorManager::initialise_TSL( void )
 	}
 }
 
+// After a fast wake, sensors which were missing at the last full boot are not probed again. Not from
+// prev_available_sensors, which follows every read and would drop a sensor for good after one failure.
+bool AWSSensorManager::must_initialise( aws_device_t sensor )
+{
+	return config->get_has_device( sensor ) && ( !fast_wake || (( boot_available_sensors & sensor ) == sensor ));
+}
+
 bool AWSSensorManager::poll_sensors( void )
 {
 	if ( xSemaphoreTake( sensors_read_mutex, 2000 / portTICK_PERIOD_MS ) == pdTRUE ) {
@@ -265,28 +312,6 @@ bool AWSSensorManager::poll_sensors( void )
 	return false;
 }
 
-void AWSSensorManager::poll_sensors_task( void *dummy )	// NOSONAR
-{
-	while( true ) {
-
-		if ( xSemaphoreTake( sensors_read_mutex, 5000 / portTICK_PERIOD_MS ) == pdTRUE ) {
-
-			retrieve_sensor_data();
-			xSemaphoreGive( sensors_read_mutex );
-			if ( config->get_has_device( aws_device_t::ANEMOMETER_SENSOR ) )
-				sensor_data.weather.wind_gust = anemometer.get_wind_gust();
-			else
-				sensor_data.weather.wind_gust = 0.F;
-			sensor_data.available_sensors = available_sensors;
-		}
-
-		if ( sensor_data.weather.rain_event )
-			station.send_alarm( "[Station] RAIN EVENT", "Rain event!" );
-
-		delay( polling_ms_interval );
-	}
-}
-
 const char *AWSSensorManager::rain_intensity_str( void )
 {
 	return rain_sensor.get_rain_intensity_str();
@@ -341,40 +366,12 @@ void AWSSensorManager::read_MLX( void )
 	if ( ( available_sensors & aws_device_t::MLX_SENSOR ) == aws_device_t::MLX_SENSOR ) {
 
 		sensor_data.weather.ambient_temperature = mlx->readAmbientTempC();
-		sensor_data.weather.sky_temperature = mlx->readObjectTempC();
 		sensor_data.weather.raw_sky_temperature = mlx->readObjectTempC();
 
-		if ( config->get_parameter<int>( "cloud_coverage_formula" ) == 0 ) {
-
-			sensor_data.weather.sky_temperature -= sensor_data.weather.ambient_temperature;
-			sensor_data.weather.cloud_coverage = ( sensor_data.weather.sky_temperature <= -15 ) ? 0 : 2;
-			if ( sensor_data.weather.sky_temperature < config->get_parameter<int>( "cc_aws_cloudy" ) )
-				sensor_data.weather.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLEAR );
-			else if ( sensor_data.weather.sky_temperature < config->get_parameter<int>( "cc_aws_overcast" ) )
-				sensor_data.weather.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLOUDY );
-			else
-				sensor_data.weather.cloud_coverage = static_cast<uint8_t>( cloud_coverage::OVERCAST );
+		cloud_model_result_t result = cloud_model->evaluate( sensor_data.weather.ambient_temperature, sensor_data.weather.raw_sky_temperature );
+		sensor_data.weather.sky_temperature = result.sky_temperature;
+		sensor_data.weather.cloud_coverage = result.cloud_coverage;
 
-		}
-		else {
-
-			float t = ( k[0] / 100 ) * ( sensor_data.weather.ambient_temperature - k[1] / 10 ) * ( k[2] / 100 ) * pow( exp( k[3] / 1000 * sensor_data.weather.ambient_temperature ), k[4]/100 );
-			float t67;
-			if ( abs( k[1] / 10 - sensor_data.weather.ambient_temperature ) < 1 )
-				t67 = sign<int>( k[5] ) * sign<float>( sensor_data.weather.ambient_temperature - k[1]/10) * ( k[1] / 10 - sensor_data.weather.ambient_temperature );
-			else
-				t67 = k[5] / 10 * sign( sensor_data.weather.ambient_temperature - k[1]/10 ) * ( log( abs( k[1]/10 - sensor_data.weather.ambient_temperature ))/log(10) + k[6] / 100 );
-			t += t67;
-			sensor_data.weather.sky_temperature -= t;
-
-			if ( sensor_data.weather.sky_temperature < config->get_parameter<int>( "cc_aag_cloudy" ) )
-				sensor_data.weather.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLEAR );
-			else if ( sensor_data.weather.sky_temperature < config->get_parameter<int>( "cc_aag_overcast" ) )
-				sensor_data.weather.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLOUDY );
-			else
-				sensor_data.weather.cloud_coverage = static_cast<uint8_t>( cloud_coverage::OVERCAST );
-
-		}
 		if ( debug_mode )
 			Serial.printf( "[SENSORMNGR] [DEBUG] Ambient temperature = %2.2f °C / Raw sky temperature = %2.2f °C / Corrected sky temperature = %2.2f °C / Cloud coverage = %s (%d)\n", sensor_data.weather.ambient_temperature, sensor_data.weather.raw_sky_temperature, sensor_data.weather.sky_temperature, CLOUD_COVERAGE_STR[sensor_data.weather.cloud_coverage].data(), sensor_data.weather.cloud_coverage );
 		return;
@@ -436,6 +433,29 @@ void AWSSensorManager::read_wind_vane( void )
 	sensor_data.weather.wind_direction = x;
 }
 
+// Takes a new snapshot of all sensors, scheduled every polling_ms_interval
+void AWSSensorManager::refresh_snapshot( void )
+{
+	if ( xSemaphoreTake( sensors_read_mutex, 5000 / portTICK_PERIOD_MS ) == pdTRUE ) {
+
+		retrieve_sensor_data();
+		xSemaphoreGive( sensors_read_mutex );
+		if ( config->get_has_device( aws_device_t::ANEMOMETER_SENSOR ) )
+			sensor_data.weather.wind_gust = anemometer.get_wind_gust();
+		else
+			sensor_data.weather.wind_gust = 0.F;
+		sensor_data.available_sensors = available_sensors;
+
+		if ( snapshot_listener )
+			snapshot_listener();
+		if ( snapshot_job != SCHEDULER_NO_JOB )
+			scheduler->run_now( snapshot_job );
+	}
+
+	if ( sensor_data.weather.rain_event )
+		station.send_alarm( "[Station] RAIN EVENT", "Rain event!" );
+}
+
 void AWSSensorManager::reset_rain_event( void )
 {
 	rain_event = false;
@@ -447,6 +467,14 @@ void AWSSensorManager::retrieve_sensor_data( void )
 
 		sensor_data.weather.rain_event = rain_event;
 		sensor_data.timestamp = station.get_timestamp();
+		snapshot_us = static_cast<uint32_t>( AWSClock::monotonic_us() );
+
+		// RS485 bus is served in the background while we read the I2C sensors
+		if ( config->get_has_device( aws_device_t::ANEMOMETER_SENSOR ) && anemometer.get_initialised() )
+			anemometer.queue_request();
+		if ( config->get_has_device( aws_device_t::WIND_VANE_SENSOR ) && wind_vane.get_initialised() )
+			wind_vane.queue_request();
+		modbus.process();
 
 		if ( config->get_has_device( aws_device_t:: BME_SENSOR ) )
 			read_BME();
@@ -490,11 +518,28 @@ void AWSSensorManager::set_debug_mode( bool b )
 	debug_mode = b;
 }
 
+void AWSSensorManager::set_fast_wake( bool b )
+{
+	fast_wake = b;
+}
+
 void AWSSensorManager::set_rain_event( void )
 {
 	rain_event = true;
 }
 
+// Job run once after each new snapshot, whatever its own period
+void AWSSensorManager::set_snapshot_job( job_id_t job )
+{
+	snapshot_job = job;
+}
+
+// The listener is called each time a new snapshot is published by the polling job
+void AWSSensorManager::set_snapshot_listener( std::function<void(void)> listener )
+{
+	snapshot_listener = std::move( listener );
+}
+
 void AWSSensorManager::set_solar_panel( bool b )
 {
 	solar_panel = b;
@@ -510,7 +555,7 @@ void AWSSensorManager::set_solar_panel( bool b )
 void AWSSensorManager::resume( void )
 {
 	if ( initialised )
-		vTaskResume( sensors_task_handle );
+		scheduler->set_enabled( poll_job, true );
 }
 
 bool AWSSensorManager::sensor_is_available( aws_device_t sensor )
@@ -521,5 +566,5 @@ bool AWSSensorManager::sensor_is_available( aws_device_t sensor )
 void AWSSensorManager::suspend( void )
 {
 	if ( initialised )
-		vTaskSuspend( sensors_task_handle );
+		scheduler->set_enabled( poll_job, false );
 }
@@ -33,17 +33,18 @@
 #include "Hydreon.h"
 #include "anemometer.h"
 #include "wind_vane.h"
+#include "modbus_simulator.h"
+#include "cloud_model.h"
+#include "scheduler.h"
+
+// Uncomment to replace the RS485 bus with a simulator answering like the configured wind sensors
+// #define AWS_MODBUS_SIMULATOR
 
 const float			LUX_TO_IRRADIANCE_FACTOR	= 0.88;
 const unsigned int	TSL_MAX_LUX					= 88000;
 
-enum struct cloud_coverage : uint8_t {
-
-	CLEAR,
-	CLOUDY,
-	OVERCAST
-
-};
+// Event bit the lookout gets from the snapshot listener when new sensor data is published
+const uint32_t		SENSOR_SNAPSHOT_NOTIFICATION	= 0x01;
 
 class AWSSensorManager {
 
@@ -56,17 +57,28 @@ class AWSSensorManager {
     SQM					sqm;
 	Anemometer			anemometer;
 	Wind_vane			wind_vane;
-	std::array<int,7>	k;
+	AWSCloudModel		aws_cloud_model;
+	AAGCloudModel		aag_cloud_model;
+	CloudModel			*cloud_model		= &aws_cloud_model;
 	AWSConfig 			*config				= nullptr;
 	SoftwareSerial		rs485_bus;
+	ModbusMaster		modbus;
+#ifdef AWS_MODBUS_SIMULATOR
+	ModbusSimulator		modbus_simulator;
+#endif
 
     aws_device_t		available_sensors	= aws_device_t::NO_SENSOR;
     sensor_data_t		sensor_data;
     bool				debug_mode			= false;
+	bool				fast_wake			= false;
     bool				initialised			= false;
 	bool				rain_event			= false;
 	bool				solar_panel			= false;
-    TaskHandle_t		sensors_task_handle;
+    job_id_t			poll_job			= SCHEDULER_NO_JOB;
+	Scheduler			*scheduler			= nullptr;
+	std::function<void(void)>	snapshot_listener;
+	job_id_t			snapshot_job		= SCHEDULER_NO_JOB;
+	uint32_t			snapshot_us			= 0;
     SemaphoreHandle_t	i2c_mutex			= nullptr;
    	uint32_t			polling_ms_interval	= DEFAULT_SENSOR_POLLING_MS_INTERVAL;
 
@@ -77,7 +89,8 @@ class AWSSensorManager {
     bool				get_debug_mode( void );
     SemaphoreHandle_t	get_i2c_mutex( void );
     sensor_data_t		*get_sensor_data( void );
-    bool				initialise( I2C_SC16IS750 *, AWSConfig *, bool );
+	uint32_t			get_snapshot_us( void );
+    bool				initialise( I2C_SC16IS750 *, AWSConfig *, Scheduler *, bool );
     bool				initialise_rain_sensor( void );
     void				initialise_sensors( I2C_SC16IS750 * );
     bool				poll_sensors( void );
@@ -89,7 +102,10 @@ class AWSSensorManager {
 	void				resume( void );
 	bool				sensor_is_available( aws_device_t );
     void				set_debug_mode( bool );
+	void				set_fast_wake( bool );
     void				set_rain_event( void );
+	void				set_snapshot_job( job_id_t );
+	void				set_snapshot_listener( std::function<void(void)> );
 	void				set_solar_panel( bool );
 	void				suspend( void );
 
@@ -98,14 +114,16 @@ class AWSSensorManager {
 bool sync_time( void );
 
     void initialise_BME( void );
+    void initialise_cloud_model( void );
     void initialise_MLX( void );
     void initialise_TSL( void );
-    void poll_sensors_task( void * );
+    bool must_initialise( aws_device_t );
     void read_anemometer();
     void read_BME( void );
     void read_MLX( void );
     void read_TSL( void );
     void read_wind_vane( void );
+    void refresh_snapshot( void );
     void retrieve_sensor_data( void );
 };
 
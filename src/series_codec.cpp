@@ -0,0 +1,246 @@
+/*
+	series_codec.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "series_codec.h"
+
+// MSB first bit streams over a caller's buffer
+struct bit_writer_t {
+
+	uint8_t		*buffer;
+	size_t		pos;
+
+	void put( uint32_t bits, uint8_t n )
+	{
+		while ( n ) {
+
+			uint8_t	room = 8 - ( pos & 7 );
+			uint8_t	k = ( n < room ) ? n : room;
+
+			if ( room == 8 )
+				buffer[ pos >> 3 ] = 0;
+			buffer[ pos >> 3 ] |= (( bits >> ( n - k )) & (( 1U << k ) - 1 )) << ( room - k );
+			pos += k;
+			n -= k;
+		}
+	}
+};
+
+struct bit_reader_t {
+
+	const uint8_t	*buffer;
+	size_t			size;			// In bits
+	size_t			pos;
+
+	bool get( uint32_t &bits, uint8_t n )
+	{
+		if ( pos + n > size )
+			return false;
+
+		bits = 0;
+		while ( n ) {
+
+			uint8_t	room = 8 - ( pos & 7 );
+			uint8_t	k = ( n < room ) ? n : room;
+
+			bits = ( bits << k ) | (( buffer[ pos >> 3 ] >> ( room - k )) & (( 1U << k ) - 1 ));
+			pos += k;
+			n -= k;
+		}
+		return true;
+	}
+};
+
+// Timestamp classes: prefix, prefix length, value length, offset
+constexpr std::array<std::array<int32_t,4>,4>	DOD_CLASSES = {{ { 0b10, 2, 7, 63 }, { 0b110, 3, 9, 255 }, { 0b1110, 4, 12, 2047 }, { 0b1111, 4, 32, 0 } }};
+
+// Returns the size of the record, 0 when the input ends before it does. The state only moves on success.
+size_t SeriesCodec::decode( const uint8_t *input, size_t input_size, uint32_t &_timestamp, float *values )
+{
+	bit_reader_t	reader = { input, 8 * input_size, 0 };
+	SeriesCodec		previous = *this;
+	uint32_t		bits;
+	uint32_t		x;
+	uint8_t			i;
+	int32_t			dod = 0;
+
+	auto fail = [&]() {
+
+		*this = previous;
+		return 0;
+	};
+
+	if ( !reader.get( bits, 1 ))
+		return fail();
+
+	if ( bits ) {
+
+		for ( i = 0; i < 3; i++ ) {
+
+			if ( !reader.get( bits, 1 ))
+				return fail();
+			if ( !bits )
+				break;
+		}
+		if ( !reader.get( bits, DOD_CLASSES[ i ][ 2 ] ))
+			return fail();
+		dod = static_cast<int32_t>( bits ) - DOD_CLASSES[ i ][ 3 ];
+	}
+	delta += dod;
+	timestamp += delta;
+	_timestamp = timestamp;
+
+	for ( i = 0; i < channels; i++ ) {
+
+		if ( !reader.get( bits, 1 ))
+			return fail();
+
+		if ( channel_bits[ i ] ) {
+
+			if ( bits && !reader.get( value[ i ], channel_bits[ i ] ))
+				return fail();
+			values[ i ] = ( value[ i ] == ( 1U << channel_bits[ i ] ) - 1 ) ? NAN : static_cast<float>( value[ i ] );
+			continue;
+		}
+
+		if ( bits ) {
+
+			if ( !reader.get( bits, 1 ))
+				return fail();
+
+			if ( bits ) {
+
+				if ( !reader.get( bits, 5 ))
+					return fail();
+				leading[ i ] = bits;
+				if ( !reader.get( bits, 5 ))
+					return fail();
+				meaningful[ i ] = bits + 1;
+				if ( leading[ i ] + meaningful[ i ] > 32 )
+					return fail();
+
+			} else if ( leading[ i ] == NO_WINDOW )
+				return fail();
+
+			if ( !reader.get( x, meaningful[ i ] ))
+				return fail();
+			value[ i ] ^= x << ( 32 - leading[ i ] - meaningful[ i ] );
+		}
+		memcpy( values + i, &value[ i ], sizeof( float ));
+	}
+	return ( reader.pos + 7 ) / 8;
+}
+
+// Returns the size of the record, 0 when the output could not hold the largest possible one
+size_t SeriesCodec::encode( uint32_t _timestamp, const float *values, uint8_t *output, size_t output_size )
+{
+	bit_writer_t	writer = { output, 0 };
+	int32_t			dod;
+	uint32_t		bits;
+	uint32_t		x;
+	uint8_t			lz;
+	uint8_t			tz;
+	uint8_t			i;
+
+	if ( output_size < series_max_record_size( channels ))
+		return 0;
+
+	dod = static_cast<int32_t>( _timestamp - timestamp ) - delta;
+	delta += dod;
+	timestamp = _timestamp;
+
+	if ( !dod )
+		writer.put( 0, 1 );
+	else {
+
+		for ( i = 0; i < 3; i++ )
+			if (( dod >= -DOD_CLASSES[ i ][ 3 ] ) && ( dod <= DOD_CLASSES[ i ][ 3 ] + 1 ))
+				break;
+		writer.put( DOD_CLASSES[ i ][ 0 ], DOD_CLASSES[ i ][ 1 ] );
+		writer.put( static_cast<uint32_t>( dod + DOD_CLASSES[ i ][ 3 ] ), DOD_CLASSES[ i ][ 2 ] );
+	}
+
+	for ( i = 0; i < channels; i++ ) {
+
+		if ( channel_bits[ i ] ) {
+
+			uint32_t nan_code = ( 1U << channel_bits[ i ] ) - 1;
+
+			bits = std::isnan( values[ i ] ) ? nan_code : std::min<uint32_t>( std::lround( std::fmax( values[ i ], 0.0F )), nan_code - 1 );
+			if ( bits == value[ i ] )
+				writer.put( 0, 1 );
+			else {
+
+				writer.put( 1, 1 );
+				writer.put( bits, channel_bits[ i ] );
+				value[ i ] = bits;
+			}
+			continue;
+		}
+
+		memcpy( &bits, values + i, sizeof( float ));
+		if ( !( x = bits ^ value[ i ] )) {
+
+			writer.put( 0, 1 );
+			continue;
+		}
+		value[ i ] = bits;
+		lz = __builtin_clz( x );
+		tz = __builtin_ctz( x );
+
+		// Same window as the previous value when it fits, its position is not worth repeating
+		if (( leading[ i ] != NO_WINDOW ) && ( lz >= leading[ i ] ) && ( tz >= 32 - leading[ i ] - meaningful[ i ] )) {
+
+			writer.put( 0b10, 2 );
+			writer.put( x >> ( 32 - leading[ i ] - meaningful[ i ] ), meaningful[ i ] );
+			continue;
+		}
+
+		leading[ i ] = ( lz > 31 ) ? 31 : lz;
+		meaningful[ i ] = 32 - leading[ i ] - tz;
+		writer.put( 0b11, 2 );
+		writer.put( leading[ i ], 5 );
+		writer.put( meaningful[ i ] - 1, 5 );
+		writer.put( x >> tz, meaningful[ i ] );
+	}
+	return ( writer.pos + 7 ) / 8;
+}
+
+uint32_t SeriesCodec::get_timestamp( void )
+{
+	return timestamp;
+}
+
+// Channels start at 0, or at NaN for integer channels, so that the first record of a stream holds everything
+void SeriesCodec::reset( const uint8_t *_channel_bits, uint8_t _channels, uint32_t first_timestamp )
+{
+	channel_bits = _channel_bits;
+	channels = ( _channels > SERIES_MAX_CHANNELS ) ? SERIES_MAX_CHANNELS : _channels;
+	timestamp = first_timestamp;
+	delta = 0;
+	leading.fill( NO_WINDOW );
+	meaningful.fill( 0 );
+
+	for ( uint8_t i = 0; i < channels; i++ )
+		value[ i ] = channel_bits[ i ] ? ( 1U << channel_bits[ i ] ) - 1 : 0;
+}
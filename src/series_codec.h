@@ -0,0 +1,66 @@
+/*
+  	series_codec.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _series_codec_H
+#define	_series_codec_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint8_t	SERIES_MAX_CHANNELS	= 32;
+
+// Worst case of one record: timestamp escape, then a full XOR window for each channel
+constexpr size_t series_max_record_size( uint8_t channels )
+{
+	return ( 4 + 32 + ( channels * ( 2 + 5 + 5 + 32 )) + 7 ) / 8;
+}
+
+// Gorilla style compression of multi-channel series, as in Facebook's time series database: delta of delta
+// timestamps and, per channel, the XOR of each float with the previous one. Channels given a width in bits
+// hold small unsigned integers (enums, booleans) and only cost that width when they change, their largest
+// value standing for NaN. Records are byte aligned so that they can be appended to a file one at a time.
+//
+// Encoder and decoder share the same state, which only depends on the records already seen since reset().
+// The pure C++ keeps it buildable on the host, see tools/series_bench.cpp.
+class SeriesCodec {
+
+	public:
+
+						SeriesCodec( void ) = default;
+		size_t			decode( const uint8_t *, size_t, uint32_t &, float * );
+		size_t			encode( uint32_t, const float *, uint8_t *, size_t );
+		uint32_t		get_timestamp( void );
+		void			reset( const uint8_t *, uint8_t, uint32_t );
+
+	private:
+
+		static constexpr uint8_t	NO_WINDOW	= 0xFF;
+
+		const uint8_t								*channel_bits	= nullptr;		// 0 for floats
+		uint8_t										channels		= 0;
+		int32_t										delta			= 0;
+		std::array<uint8_t,SERIES_MAX_CHANNELS>		leading			= {};
+		std::array<uint8_t,SERIES_MAX_CHANNELS>		meaningful		= {};
+		uint32_t									timestamp		= 0;
+		std::array<uint32_t,SERIES_MAX_CHANNELS>	value			= {};			// Float bits or integer codes
+};
+
+#endif
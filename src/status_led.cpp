@@ -0,0 +1,115 @@
+/*
+  	status_led.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include <driver/ledc.h>
+#include <esp_timer.h>
+
+#include "status_led.h"
+
+bool StatusLED::initialise( uint8_t pin, ledc_channel_t _channel )
+{
+	ledc_timer_config_t		timer_config = {};
+	ledc_channel_config_t	channel_config = {};
+	esp_timer_create_args_t	timer_args = {};
+
+	channel = _channel;
+
+	// Both LEDs share the same timer, configuring it twice is harmless
+	timer_config.speed_mode = LEDC_LOW_SPEED_MODE;
+	timer_config.duty_resolution = LEDC_TIMER_8_BIT;
+	timer_config.timer_num = PWM_TIMER;
+	timer_config.freq_hz = PWM_FREQUENCY;
+	timer_config.clk_cfg = LEDC_AUTO_CLK;
+
+	channel_config.gpio_num = pin;
+	channel_config.speed_mode = LEDC_LOW_SPEED_MODE;
+	channel_config.channel = channel;
+	channel_config.timer_sel = PWM_TIMER;
+	channel_config.duty = 0;
+
+	if (( ledc_timer_config( &timer_config ) != ESP_OK ) || ( ledc_channel_config( &channel_config ) != ESP_OK )) {
+
+		Serial.printf( "[STATUSLED ] [ERROR] Could not configure LEDC for pin %d.\n", pin );
+		return false;
+	}
+
+	// Already installed when the second LED is initialised
+	ledc_fade_func_install( 0 );
+
+	timer_args.callback = &StatusLED::step_callback;
+	timer_args.arg = this;
+	timer_args.dispatch_method = ESP_TIMER_TASK;
+	timer_args.name = "StatusLED";
+
+	if ( esp_timer_create( &timer_args, &step_timer ) != ESP_OK ) {
+
+		Serial.printf( "[STATUSLED ] [ERROR] Could not create step timer for pin %d.\n", pin );
+		step_timer = nullptr;
+		return false;
+	}
+
+	return true;
+}
+
+// Steps are always applied from the esp_timer task, so LEDC calls never race each other
+void StatusLED::play( const led_pattern_t *_pattern )
+{
+	if ( !step_timer )
+		return;
+
+	taskENTER_CRITICAL( &pattern_mux );
+	pattern = _pattern;
+	index = 0;
+	taskEXIT_CRITICAL( &pattern_mux );
+
+	esp_timer_stop( step_timer );
+	esp_timer_start_once( step_timer, 0 );
+}
+
+void StatusLED::step( void )
+{
+	led_step_t	current;
+	bool		last;
+
+	taskENTER_CRITICAL( &pattern_mux );
+	if ( !pattern || !pattern->count ) {
+
+		taskEXIT_CRITICAL( &pattern_mux );
+		return;
+	}
+	current = pattern->steps[ index ];
+	last = ( pattern->count == 1 );
+	index = ( index + 1 ) % pattern->count;
+	taskEXIT_CRITICAL( &pattern_mux );
+
+	// These two also take over from a fade which would still be running
+	if ( current.fade_ms )
+		ledc_set_fade_time_and_start( LEDC_LOW_SPEED_MODE, channel, current.duty, current.fade_ms, LEDC_FADE_NO_WAIT );
+	else
+		ledc_set_duty_and_update( LEDC_LOW_SPEED_MODE, channel, current.duty, 0 );
+
+	if ( !last )
+		esp_timer_start_once( step_timer, 1000ULL * ( current.fade_ms + current.hold_ms ));
+}
+
+void StatusLED::step_callback( void *arg )
+{
+	static_cast<StatusLED *>( arg )->step();
+}
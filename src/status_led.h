@@ -0,0 +1,70 @@
+/*
+  	status_led.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _status_led_H
+#define	_status_led_H
+
+#include <array>
+#include <driver/ledc.h>
+#include <esp_timer.h>
+
+constexpr uint8_t	LED_PATTERN_MAX_STEPS	= 4;
+
+struct led_step_t {
+
+	uint8_t		duty;			// 0-255
+	uint16_t	fade_ms;		// Hardware fade to duty, 0 to switch at once
+	uint16_t	hold_ms;		// Once the fade is over
+};
+
+// Steps loop forever, a single step pattern is a steady level
+struct led_pattern_t {
+
+	uint8_t											count;
+	std::array<led_step_t,LED_PATTERN_MAX_STEPS>	steps;
+};
+
+// Plays patterns on one LED: the LEDC peripheral does the PWM and the fades, an esp_timer
+// moves to the next step. No task and no CPU time between steps.
+class StatusLED {
+
+	public:
+
+							StatusLED( void ) = default;
+		bool				initialise( uint8_t, ledc_channel_t );
+		void				play( const led_pattern_t * );
+
+	private:
+
+		static constexpr uint32_t	PWM_FREQUENCY	= 5000;
+		static constexpr ledc_timer_t	PWM_TIMER	= LEDC_TIMER_0;
+
+		ledc_channel_t			channel;
+		uint8_t					index			= 0;
+		portMUX_TYPE			pattern_mux		= portMUX_INITIALIZER_UNLOCKED;
+		const led_pattern_t		*pattern		= nullptr;
+		esp_timer_handle_t		step_timer		= nullptr;
+
+		void					step( void );
+
+		static void				step_callback( void * );
+};
+
+#endif
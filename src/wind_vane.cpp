@@ -17,8 +17,6 @@
 	with this program. If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include <SoftwareSerial.h>
-
 #include "defaults.h"
 #include "gpio_config.h"
 #include "device.h"
@@ -29,21 +27,21 @@ const std::array<std::string, 3>	Wind_vane::WIND_VANE_DESCRIPTION	= { "Mechanica
 const std::array<uint64_t,3>		Wind_vane::WIND_VANE_CMD			= { 0x020300000002c438, 0x020300000002c438, 0x010300000002c40b };
 const std::array<uint16_t,3>		Wind_vane::WIND_VANE_SPEED			= { 4800, 9600, 4800 };
 
-bool Wind_vane::initialise( SoftwareSerial *bus, byte model, bool _debug_mode )
+bool Wind_vane::initialise( ModbusMaster *bus, byte model, bool _debug_mode )
 {
 	set_debug_mode( _debug_mode );
 	set_name( WIND_VANE_MODEL[ model ].c_str() );
 	set_description( WIND_VANE_DESCRIPTION[ model ].c_str() );
-	set_driver_version( "1.0");
+	set_driver_version( "1.1" );
 
-	return RS485Device::initialise( "WINDVANE  ", bus, GPIO_WIND_SENSOR_RX, GPIO_WIND_SENSOR_TX, GPIO_WIND_SENSOR_CTRL, WIND_VANE_CMD[ model ], WIND_VANE_SPEED[ model ] );
+	return RS485Device::initialise( "WINDVANE  ", bus, WIND_VANE_CMD[ model ], WIND_VANE_SPEED[ model ] );
 }
 
 int16_t Wind_vane::get_wind_direction( bool verbose )
 {
 	if ( interrogate( verbose ) ) {
 
-		wind_direction = ( get_answer()[5] << 8 ) + get_answer()[6];
+		wind_direction = get_register( 1 );
 		if ( get_debug_mode() && verbose )
 			Serial.printf( "\n[WINDVANE  ] [DEBUG] Wind direction: %d°\n", wind_direction );
 
@@ -21,12 +21,8 @@
 #ifndef _wind_vane_H
 #define	_wind_vane_H
 
-#include <SoftwareSerial.h>
 #include "rs485_device.h"
 
-#define SEND	HIGH
-#define RECV	LOW
-
 class Wind_vane : public RS485Device {
 
 	public:
@@ -37,7 +33,7 @@ class Wind_vane : public RS485Device {
 		static const std::array<uint16_t,3>		WIND_VANE_SPEED;
 
 						Wind_vane( void ) = default;
-		bool			initialise( SoftwareSerial *, byte, bool );
+		bool			initialise( ModbusMaster *, byte, bool );
 		int16_t			get_wind_direction( bool );
 
 	private:
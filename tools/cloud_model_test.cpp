@@ -0,0 +1,174 @@
+/*
+	cloud_model_test.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+
+	Host test and benchmark of the cloud models (src/cloud_model.cpp) against the inline formulas of
+	AWSSensorManager::read_MLX() that they replaced, kept below as they were.
+
+		g++ -O2 -std=c++17 -I../src -o cloud_model_test cloud_model_test.cpp ../src/cloud_model.cpp
+		./cloud_model_test
+
+	Sky temperatures and cloud coverage classes are compared over ambient temperatures from -30 to 40°C and
+	raw sky temperatures from -60 to 30°C, for the default AAG coefficients and a few others. Exits with 1
+	if any sky temperature differs by more than MAX_ERROR (relative to the value, or to 1°C below it) or any class
+	differs other than by rounding at a threshold.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cloud_model.h"
+
+constexpr float	MAX_ERROR	= 1e-5F;		// Relative, float rounding between pow(exp()) and a single expf()
+
+template <typename T>
+int sign( T val )
+{
+	return static_cast<int>( T( 0 ) < val ) - static_cast<int>( val < T( 0 ));
+}
+
+struct thresholds_t {
+
+	int		cloudy;
+	int		overcast;
+};
+
+// AWSSensorManager::read_MLX() before the cloud models, only renamed
+cloud_model_result_t legacy( int formula, const std::array<int,7> &k, thresholds_t aws, thresholds_t aag, float ambient_temperature, float raw_sky_temperature )
+{
+	cloud_model_result_t	result;
+	float					sky_temperature = raw_sky_temperature;
+
+	if ( formula == 0 ) {
+
+		sky_temperature -= ambient_temperature;
+		if ( sky_temperature < aws.cloudy )
+			result.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLEAR );
+		else if ( sky_temperature < aws.overcast )
+			result.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLOUDY );
+		else
+			result.cloud_coverage = static_cast<uint8_t>( cloud_coverage::OVERCAST );
+
+	} else {
+
+		float t = ( k[0] / 100 ) * ( ambient_temperature - k[1] / 10 ) * ( k[2] / 100 ) * pow( exp( k[3] / 1000 * ambient_temperature ), k[4]/100 );
+		float t67;
+		if ( std::abs( k[1] / 10 - ambient_temperature ) < 1 )
+			t67 = sign<int>( k[5] ) * sign<float>( ambient_temperature - k[1]/10) * ( k[1] / 10 - ambient_temperature );
+		else
+			t67 = k[5] / 10 * sign( ambient_temperature - k[1]/10 ) * ( log( std::abs( k[1]/10 - ambient_temperature ))/log(10) + k[6] / 100 );
+		t += t67;
+		sky_temperature -= t;
+
+		if ( sky_temperature < aag.cloudy )
+			result.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLEAR );
+		else if ( sky_temperature < aag.overcast )
+			result.cloud_coverage = static_cast<uint8_t>( cloud_coverage::CLOUDY );
+		else
+			result.cloud_coverage = static_cast<uint8_t>( cloud_coverage::OVERCAST );
+	}
+	result.sky_temperature = sky_temperature;
+	return result;
+}
+
+int main( void )
+{
+	// Defaults from config_manager.h first
+	const std::vector<std::array<int,7>>	coefficients = {
+		{ 33, 0, 8, 100, 100, 0, 0 },
+		{ 250, 150, 300, 1000, 100, -30, 150 },
+		{ 150, -50, 200, 2000, 200, 25, -120 },
+		{ 100, 100, 100, 1000, 100, 10, 100 }
+	};
+	const thresholds_t						aws = { -20, -10 };
+	const thresholds_t						aag = { -15, -5 };
+	std::vector<cloud_model_sample_t>		samples;
+	int										failures = 0;
+
+	for ( float ambient = -30.F; ambient <= 40.F; ambient += 0.25F )
+		for ( float raw_sky = -60.F; raw_sky <= 30.F; raw_sky += 0.5F )
+			samples.push_back( { ambient, raw_sky } );
+
+	std::vector<cloud_model_result_t>	results( samples.size() );
+
+	for ( int formula = 0; formula < 2; formula++ )
+		for ( const auto &k : coefficients ) {
+
+			AWSCloudModel	aws_model;
+			AAGCloudModel	aag_model;
+			CloudModel		*model = formula ? static_cast<CloudModel *>( &aag_model ) : static_cast<CloudModel *>( &aws_model );
+			float			max_error = 0.F;
+			size_t			class_mismatches = 0;
+
+			aws_model.set_thresholds( aws.cloudy, aws.overcast );
+			aag_model.set_coefficients( k );
+			aag_model.set_thresholds( aag.cloudy, aag.overcast );
+			model->evaluate( samples.data(), results.data(), samples.size() );
+
+			for ( size_t i = 0; i < samples.size(); i++ ) {
+
+				cloud_model_result_t expected = legacy( formula, k, aws, aag, samples[ i ].ambient_temperature, samples[ i ].raw_sky_temperature );
+				float error = std::fabs( results[ i ].sky_temperature - expected.sky_temperature ) / std::fmax( 1.F, std::fabs( expected.sky_temperature ));
+
+				max_error = std::fmax( max_error, error );
+				// A class can only flip for a sky temperature within rounding of a threshold
+				const thresholds_t &t = formula ? aag : aws;
+				float tolerance = MAX_ERROR * std::fmax( 1.F, std::fabs( expected.sky_temperature ));
+				bool at_threshold = ( std::fabs( expected.sky_temperature - t.cloudy ) <= tolerance ) || ( std::fabs( expected.sky_temperature - t.overcast ) <= tolerance );
+				if (( results[ i ].cloud_coverage != expected.cloud_coverage ) && !at_threshold )
+					class_mismatches++;
+			}
+
+			bool ok = ( max_error <= MAX_ERROR ) && !class_mismatches;
+			printf( "%s k={%d,%d,%d,%d,%d,%d,%d}: max relative error %.1e, %zu class mismatches %s\n", formula ? "AAG" : "AWS", k[0], k[1], k[2], k[3], k[4], k[5], k[6],
+				max_error, class_mismatches, ok ? "ok" : "FAILED" );
+			if ( !ok )
+				failures++;
+			if ( !formula )
+				break;
+		}
+
+	{
+		using clock = std::chrono::steady_clock;
+		AAGCloudModel	model;
+		volatile float	sink = 0;
+		const int		runs = 50;
+
+		model.set_coefficients( coefficients[ 1 ] );
+		model.set_thresholds( aag.cloudy, aag.overcast );
+
+		auto start = clock::now();
+		for ( int run = 0; run < runs; run++ )
+			for ( const auto &sample : samples )
+				sink = sink + legacy( 1, coefficients[ 1 ], aws, aag, sample.ambient_temperature, sample.raw_sky_temperature ).sky_temperature;
+		double legacy_ns = std::chrono::duration<double,std::nano>( clock::now() - start ).count() / ( runs * samples.size() );
+
+		start = clock::now();
+		for ( int run = 0; run < runs; run++ )
+			for ( const auto &sample : samples )
+				sink = sink + model.evaluate( sample.ambient_temperature, sample.raw_sky_temperature ).sky_temperature;
+		double model_ns = std::chrono::duration<double,std::nano>( clock::now() - start ).count() / ( runs * samples.size() );
+
+		printf( "AAG evaluation: inline formula %.1fns, model %.1fns per sample\n", legacy_ns, model_ns );
+	}
+
+	printf( "%s\n", failures ? "FAILED" : "All checks passed" );
+	return failures ? 1 : 0;
+}
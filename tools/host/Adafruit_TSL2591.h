@@ -0,0 +1,34 @@
+#pragma once
+#include "Arduino.h"
+
+// Same values as the Adafruit driver
+enum tsl2591Gain_t {
+
+	TSL2591_GAIN_LOW	= 0x00,
+	TSL2591_GAIN_MED	= 0x10,
+	TSL2591_GAIN_HIGH	= 0x20,
+	TSL2591_GAIN_MAX	= 0x30
+};
+
+enum tsl2591IntegrationTime_t {
+
+	TSL2591_INTEGRATIONTIME_100MS	= 0x00,
+	TSL2591_INTEGRATIONTIME_200MS	= 0x01,
+	TSL2591_INTEGRATIONTIME_300MS	= 0x02,
+	TSL2591_INTEGRATIONTIME_400MS	= 0x03,
+	TSL2591_INTEGRATIONTIME_500MS	= 0x04,
+	TSL2591_INTEGRATIONTIME_600MS	= 0x05
+};
+
+// Simulated sensor, getFullLuminosity() is implemented by the tool that uses it, see tools/sqm_bench.cpp
+class Adafruit_TSL2591 {
+
+	public:
+
+		uint32_t	getFullLuminosity( void );
+		void		setGain( tsl2591Gain_t g ) { gain = g; }
+		void		setTiming( tsl2591IntegrationTime_t t ) { timing = t; }
+
+		tsl2591Gain_t				gain	= TSL2591_GAIN_LOW;
+		tsl2591IntegrationTime_t	timing	= TSL2591_INTEGRATIONTIME_100MS;
+};
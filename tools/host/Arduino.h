@@ -0,0 +1,142 @@
+/*
+  	Arduino.h
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+
+	Just enough of the Arduino core and FreeRTOS to build the station's hardware independent code on the host,
+	for the tests in tools/. Time is the host's, GPIOs do nothing and no task is ever started: code falling
+	back to synchronous processing when it cannot start its task runs in the caller.
+*/
+
+#pragma once
+#ifndef _host_Arduino_H
+#define	_host_Arduino_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+
+typedef uint8_t	byte;
+
+#define HIGH	1
+#define LOW		0
+#define INPUT	0
+#define OUTPUT	1
+
+inline uint32_t micros( void )
+{
+	return static_cast<uint32_t>( std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+inline uint32_t millis( void )
+{
+	return micros() / 1000;
+}
+
+inline void delay( uint32_t ms )
+{
+	std::this_thread::sleep_for( std::chrono::milliseconds( ms ));
+}
+
+inline void delayMicroseconds( uint32_t us )
+{
+	std::this_thread::sleep_for( std::chrono::microseconds( us ));
+}
+
+// Deterministic unless reseeded, so that test runs can be replayed
+inline std::mt19937 &host_rng( void )
+{
+	static std::mt19937 rng( 1 );
+	return rng;
+}
+
+inline long random( long max )
+{
+	return static_cast<long>( host_rng()() % static_cast<uint32_t>( max ));
+}
+
+inline void randomSeed( unsigned long seed )
+{
+	host_rng().seed( seed );
+}
+
+inline void pinMode( uint8_t, uint8_t ) {}
+inline void digitalWrite( uint8_t, uint8_t ) {}
+inline int digitalRead( uint8_t ) { return LOW; }
+
+struct host_serial_t {
+
+	bool quiet = false;
+
+	template<typename... A>
+	void printf( const char *fmt, A... args )
+	{
+		if ( !quiet )
+			::printf( fmt, args... );
+	}
+};
+
+inline host_serial_t Serial;
+
+class Stream {
+
+	public:
+
+		virtual			~Stream( void ) = default;
+		virtual int		available( void ) = 0;
+		virtual void	flush( void ) = 0;
+		virtual int		peek( void ) = 0;
+		virtual int		read( void ) = 0;
+		virtual size_t	write( uint8_t ) = 0;
+
+		size_t write( const uint8_t *buffer, size_t len )
+		{
+			for ( size_t i = 0; i < len; i++ )
+				write( buffer[ i ] );
+			return len;
+		}
+};
+
+typedef void	*SemaphoreHandle_t;
+typedef void	*TaskHandle_t;
+
+#define portMAX_DELAY		0xFFFFFFFF
+#define portTICK_PERIOD_MS	1
+#define pdFALSE				0
+#define pdTRUE				1
+#define pdPASS				1
+
+// Single threaded: every semaphore is free
+inline SemaphoreHandle_t xSemaphoreCreateBinary( void ) { static int handle; return &handle; }
+inline SemaphoreHandle_t xSemaphoreCreateMutex( void ) { static int handle; return &handle; }
+inline int xSemaphoreGive( SemaphoreHandle_t ) { return pdTRUE; }
+inline int xSemaphoreTake( SemaphoreHandle_t, uint32_t ) { return pdTRUE; }
+
+// Reports success without a handle, see above
+inline int xTaskCreatePinnedToCore( void (*)( void * ), const char *, uint32_t, void *, int, TaskHandle_t *handle, int ) { *handle = nullptr; return pdPASS; }
+inline void xTaskNotifyGive( TaskHandle_t ) {}
+inline uint32_t ulTaskNotifyTake( int, uint32_t ) { return 0; }
+
+#endif
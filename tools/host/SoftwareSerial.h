@@ -0,0 +1,19 @@
+#pragma once
+#include "Arduino.h"
+
+// Never opened on the host, the tests put a ModbusSimulator on the bus instead
+namespace EspSoftwareSerial { enum config_t { SWSERIAL_8N1 }; }
+
+class SoftwareSerial : public Stream {
+
+	public:
+
+		void	begin( uint32_t, EspSoftwareSerial::config_t, int8_t, int8_t ) {}
+		void	end( void ) {}
+		int		available( void ) override { return 0; }
+		void	flush( void ) override {}
+		int		peek( void ) override { return -1; }
+		int		read( void ) override { return -1; }
+		size_t	write( uint8_t ) override { return 1; }
+		using Stream::write;
+};
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// The part of etl::string that the station uses, truncating like it does
+namespace etl {
+
+	template<size_t N>
+	struct string : std::string {
+
+				string( void ) = default;
+				string( const char *s ) : std::string( s ) { resize( std::min( size(), N )); }
+		void	assign( const char *s ) { std::string::assign( s ); resize( std::min( size(), N )); }
+		size_t	capacity( void ) const { return N; }
+		bool	full( void ) const { return size() >= N; }
+	};
+
+	using string_view = std::string_view;
+}
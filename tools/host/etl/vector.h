@@ -0,0 +1,13 @@
+#pragma once
+#include <vector>
+
+// The part of etl::vector that the station uses, without the fixed storage
+namespace etl {
+
+	template<typename T, size_t N>
+	struct vector : std::vector<T> {
+
+		bool	full( void ) const { return this->size() >= N; }
+		size_t	capacity( void ) const { return N; }
+	};
+}
@@ -0,0 +1,188 @@
+/*
+	lookout_rules_test.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+
+	Host test of the lookout rules (src/lookout_rules.cpp).
+
+		g++ -O2 -std=c++17 -Ihost -I../src -o lookout_rules_test lookout_rules_test.cpp ../src/lookout_rules.cpp
+		./lookout_rules_test
+
+	Rules are compiled from settings given here instead of the configuration, then fed with inputs the way
+	AWSLookout does after each sensor snapshot. Exits with 1 if any check fails.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "lookout_rules.h"
+
+int	failures = 0;
+
+void check( bool ok, const char *what )
+{
+	printf( "%-72s %s\n", what, ok ? "ok" : "FAILED" );
+	if ( !ok )
+		failures++;
+}
+
+const lookout_rule_definition_t &definition( const char *name )
+{
+	for ( const lookout_rule_definition_t &d : LOOKOUT_RULE_DEFINITIONS )
+		if ( !strcmp( d.name, name ))
+			return d;
+	printf( "No rule named %s\n", name );
+	exit( 1 );
+}
+
+// Only the given rules are active, the rain event one included when listed
+void compile( LookoutRules &rules, const std::map<std::string,lookout_rule_settings_t> &active )
+{
+	rules.compile( [&active]( const lookout_rule_definition_t &d ) {
+
+		auto settings = active.find( d.name );
+		if ( settings == active.end() ) {
+
+			lookout_rule_settings_t inactive = d.defaults;
+			inactive.active = false;
+			return inactive;
+		}
+		return settings->second;
+
+	}, false );
+}
+
+lookout_inputs_t inputs( float wind_speed, bool wind_available, float cloud_coverage, bool mlx_available )
+{
+	lookout_inputs_t i = {};
+
+	i[ static_cast<uint8_t>( lookout_channel_t::RAIN_EVENT ) ] = { 0.F, true };
+	i[ static_cast<uint8_t>( lookout_channel_t::WIND_SPEED ) ] = { wind_speed, wind_available };
+	i[ static_cast<uint8_t>( lookout_channel_t::CLOUD_COVERAGE ) ] = { cloud_coverage, mlx_available };
+	return i;
+}
+
+lookout_inputs_t humidity( float rh, float dew_spread, float msas )
+{
+	lookout_inputs_t i = inputs( 0.F, true, 0.F, true );
+
+	i[ static_cast<uint8_t>( lookout_channel_t::RH ) ] = { rh, true };
+	i[ static_cast<uint8_t>( lookout_channel_t::DEW_SPREAD ) ] = { dew_spread, true };
+	i[ static_cast<uint8_t>( lookout_channel_t::MSAS ) ] = { msas, true };
+	return i;
+}
+
+int main( void )
+{
+	Serial.quiet = true;
+
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "safe_wind_speed", { true, 5.F, 0, false, 0.F }}} );
+		rules.update( inputs( 2.F, true, 0.F, true ), 0 );
+		check( rules.is_safe() && !rules.is_unsafe(), "safe rule, calm wind: safe" );
+		rules.update( inputs( 2.F, false, 0.F, true ), 1 );
+		check( !rules.is_safe(), "safe rule, anemometer lost: no longer safe" );
+		rules.update( inputs( 2.F, true, 0.F, true ), 2 );
+		check( rules.is_safe(), "safe rule, anemometer back: safe again" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "safe_cloud_coverage_1", { true, 1.F, 0, false, 0.F }}} );
+		rules.update( inputs( 0.F, true, 0.F, false ), 0 );
+		check( !rules.is_safe(), "safe rule, sensor missing from the start: not safe" );
+		check( !rules.is_satisfied( definition( "safe_cloud_coverage_1" )), "safe rule, sensor missing: reported as not satisfied" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "safe_wind_speed", { true, 5.F, 0, true, 0.F }}} );
+		rules.update( inputs( 0.F, false, 0.F, true ), 0 );
+		check( rules.is_safe(), "safe rule allowed to ignore a missing sensor: safe" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "unsafe_wind_speed_1", { true, 10.F, 0, true, 0.F }}, { "safe_wind_speed", { true, 5.F, 0, false, 0.F }}} );
+		rules.update( inputs( 0.F, false, 0.F, true ), 0 );
+		check( rules.is_unsafe() && !rules.is_safe(), "unsafe rule triggering on a missing sensor: unsafe" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "unsafe_wind_speed_1", { true, 10.F, 0, false, 0.F }}} );
+		rules.update( inputs( 0.F, false, 0.F, true ), 0 );
+		check( !rules.is_unsafe(), "unsafe rule ignoring a missing sensor: not triggered" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "unsafe_wind_speed_1", { true, 10.F, 30, false, 2.F }}} );
+		rules.update( inputs( 12.F, true, 0.F, true ), 100 );
+		check( !rules.is_unsafe() && rules.is_waiting(), "unsafe rule, gust: waits for its delay" );
+		rules.update( inputs( 12.F, true, 0.F, true ), 130 );
+		check( rules.is_unsafe() && !rules.is_waiting(), "unsafe rule, wind held for the delay: unsafe" );
+		rules.update( inputs( 9.F, true, 0.F, true ), 131 );
+		check( rules.is_unsafe(), "unsafe rule, within hysteresis: still unsafe" );
+		rules.update( inputs( 7.F, true, 0.F, true ), 132 );
+		check( !rules.is_unsafe(), "unsafe rule, below hysteresis: released" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "unsafe_dew_spread", { true, 1.F, 0, false, 1.F }}, { "safe_dew_spread", { true, 3.F, 0, false, 0.F }}} );
+		rules.update( humidity( 80.F, 5.F, 20.F ), 0 );
+		check( rules.is_safe() && !rules.is_unsafe(), "dew spread rules, dry air: safe" );
+		rules.update( humidity( 80.F, 0.5F, 20.F ), 1 );
+		check( rules.is_unsafe() && !rules.is_safe(), "dew spread rules, close to dew point: unsafe" );
+		rules.update( humidity( 80.F, 1.5F, 20.F ), 2 );
+		check( rules.is_unsafe(), "dew spread rules, within hysteresis: still unsafe" );
+		rules.update( humidity( 80.F, 2.5F, 20.F ), 3 );
+		check( !rules.is_unsafe() && !rules.is_safe(), "dew spread rules, released but not dry enough to be safe" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {{ "unsafe_rh", { true, 95.F, 0, false, 0.F }}, { "safe_msas", { true, 17.F, 0, false, 0.F }}} );
+		rules.update( humidity( 96.F, 5.F, 20.F ), 0 );
+		check( rules.is_unsafe(), "humidity rule, saturated air: unsafe" );
+		rules.update( humidity( 80.F, 5.F, 15.F ), 1 );
+		check( !rules.is_unsafe() && !rules.is_safe(), "sky brightness rule, twilight: not safe" );
+		rules.update( humidity( 80.F, 5.F, 18.F ), 2 );
+		check( rules.is_safe(), "sky brightness rule, dark sky: safe" );
+	}
+	{
+		LookoutRules rules;
+
+		compile( rules, {} );
+		rules.update( inputs( 0.F, false, 0.F, false ), 0 );
+		check( rules.is_safe() && !rules.is_unsafe(), "no rule: safe" );
+		check( rules.is_satisfied( definition( "safe_wind_speed" )) && !rules.is_satisfied( definition( "unsafe_wind_speed_1" )), "inactive rules reported in their neutral state" );
+	}
+
+	check( LookoutRules::is_config_key( "safe_wind_speed_missing" ), "key derived from the table: safe_wind_speed_missing" );
+	check( LookoutRules::is_config_key( "unsafe_cloud_coverage_2_hysteresis" ), "key derived from the table: unsafe_cloud_coverage_2_hysteresis" );
+	check( LookoutRules::is_config_key( "unsafe_rh_max" ) && LookoutRules::is_config_key( "safe_dew_spread_delay" ) && LookoutRules::is_config_key( "unsafe_msas_hysteresis" ), "keys of the humidity, dew spread and sky brightness rules" );
+	check( !LookoutRules::is_config_key( "unsafe_rain_intensity_delay" ), "no key for a setting the rule does not have" );
+	check( !LookoutRules::is_config_key( "safe_wind_speed" ) && !LookoutRules::is_config_key( "safe_wind_speed_maximum" ), "rule name alone or with a wrong suffix is not a key" );
+
+	printf( "%s\n", failures ? "FAILED" : "All checks passed" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+/*
+	modbus_sim_test.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+
+	Host test of the RS485 path: the wind sensor drivers and the Modbus RTU master (src/modbus_master.cpp)
+	talking to the slave simulator (src/modbus_simulator.cpp), on a clean bus then with latency, bit errors
+	and dropouts.
+
+		g++ -O2 -std=c++17 -Ihost -I../src -o modbus_sim_test modbus_sim_test.cpp ../src/modbus_master.cpp \
+			../src/modbus_simulator.cpp ../src/rs485_device.cpp ../src/device.cpp ../src/anemometer.cpp ../src/wind_vane.cpp
+		./modbus_sim_test
+
+	The host/ directory stands in for the Arduino core and FreeRTOS, see host/Arduino.h. Random faults are
+	drawn from a fixed seed so that runs can be compared. Exits with 1 if any check fails.
+*/
+
+#include <cmath>
+#include <cstdio>
+
+#include "anemometer.h"
+#include "modbus_master.h"
+#include "modbus_simulator.h"
+#include "wind_vane.h"
+
+constexpr uint32_t	POLLING_MS_INTERVAL	= 5000;
+constexpr float		WIND_SPEED			= 3.5F;
+constexpr uint16_t	WIND_DIRECTION		= 270;
+
+int	failures = 0;
+
+void check( bool ok, const char *what )
+{
+	printf( "%-72s %s\n", what, ok ? "ok" : "FAILED" );
+	if ( !ok )
+		failures++;
+}
+
+struct bus_t {
+
+	ModbusSimulator	simulator;
+	ModbusMaster	master;
+	Anemometer		anemometer;
+	Wind_vane		wind_vane;
+	bool			initialised;
+};
+
+// Sets the bus up for one model of anemometer and wind vane, faults only apply once the sensors are found
+void setup( bus_t &bus, byte model )
+{
+	bus.simulator.add_anemometer( model );
+	bus.simulator.add_wind_vane( model );
+	bus.simulator.set_wind( WIND_SPEED, WIND_DIRECTION );
+	bus.simulator.set_latency( 5 );
+	bus.master.initialise( &bus.simulator, false );
+	bus.initialised = bus.anemometer.initialise( &bus.master, POLLING_MS_INTERVAL, model, false ) && bus.wind_vane.initialise( &bus.master, model, false );
+}
+
+struct poll_result_t {
+
+	uint32_t	polls;
+	uint32_t	speeds;			// Valid readings
+	uint32_t	directions;
+	uint32_t	wrong;			// Valid looking readings with the wrong value
+};
+
+// Same as one sensor poll of the station: both requests queued, served in one batch, then picked up
+poll_result_t poll( bus_t &bus, uint32_t polls )
+{
+	poll_result_t result = {};
+
+	for ( uint32_t i = 0; i < polls; i++ ) {
+
+		bus.anemometer.queue_request();
+		bus.wind_vane.queue_request();
+		bus.master.process();
+
+		float	speed = bus.anemometer.get_wind_speed( false );
+		int16_t	direction = bus.wind_vane.get_wind_direction( false );
+
+		result.polls++;
+		if ( speed >= 0 ) {
+
+			result.speeds++;
+			if ( std::fabs( speed - WIND_SPEED ) > 0.01F )
+				result.wrong++;
+		}
+		if ( direction >= 0 ) {
+
+			result.directions++;
+			if ( direction != WIND_DIRECTION )
+				result.wrong++;
+		}
+	}
+	return result;
+}
+
+int main( void )
+{
+	Serial.quiet = true;
+
+	for ( byte model = 0; model < 3; model++ ) {
+
+		bus_t	bus;
+		char	what[ 80 ];
+
+		setup( bus, model );
+		snprintf( what, sizeof( what ), "model %d: sensors found", model );
+		check( bus.initialised, what );
+
+		poll_result_t		result = poll( bus, 10 );
+		modbus_stats_t		stats = bus.master.get_stats();
+
+		snprintf( what, sizeof( what ), "model %d: clean bus, every reading valid and right", model );
+		check(( result.speeds == 10 ) && ( result.directions == 10 ) && !result.wrong, what );
+		snprintf( what, sizeof( what ), "model %d: clean bus, no retry", model );
+		check( !stats.retries && !stats.timeouts && !stats.crc_errors, what );
+
+		// VMS-3003 answers speed and direction from the same registers
+		if ( model == 2 ) {
+
+			check( stats.coalesced == 10, "model 2: speed and direction requests coalesced" );
+			check( stats.transactions == 2 + 10, "model 2: one transaction per poll" );
+		}
+	}
+
+	{
+		bus_t bus;
+
+		setup( bus, 0 );
+		bus.simulator.set_dropout_rate( 1.F );
+		poll_result_t		result = poll( bus, 5 );
+		modbus_stats_t		stats = bus.master.get_stats();
+		modbus_sim_stats_t	sim = bus.simulator.get_stats();
+
+		check( !result.speeds && !result.directions, "dead bus: no reading" );
+		check(( stats.timeouts == sim.dropouts ) && ( stats.retries == 2 * 2 * 5 ), "dead bus: every attempt times out, two retries per request" );
+	}
+
+	{
+		bus_t bus;
+
+		setup( bus, 0 );
+		bus.simulator.set_dropout_rate( 0.3F );
+		poll_result_t		result = poll( bus, 50 );
+		modbus_stats_t		stats = bus.master.get_stats();
+		modbus_sim_stats_t	sim = bus.simulator.get_stats();
+
+		printf( "\t30%% dropouts: %u/%u speeds, %u/%u directions, %u dropouts, %u retries\n", result.speeds, result.polls, result.directions, result.polls, sim.dropouts, stats.retries );
+		check(( sim.dropouts > 0 ) && ( stats.timeouts == sim.dropouts ), "30% dropouts: every dropout seen as a timeout" );
+		check(( result.speeds + result.directions ) >= 95, "30% dropouts: retries recover at least 95% of the readings" );
+		check( !result.wrong, "30% dropouts: no wrong reading" );
+	}
+
+	{
+		bus_t bus;
+
+		setup( bus, 0 );
+		bus.simulator.set_bit_error_rate( 0.005F );
+		poll_result_t		result = poll( bus, 50 );
+		modbus_stats_t		stats = bus.master.get_stats();
+		modbus_sim_stats_t	sim = bus.simulator.get_stats();
+
+		printf( "\tBER 5e-3: %u corrupted frames, %u CRC errors, %u bad frames, %u timeouts, %u/%u readings\n", sim.corrupted_frames, stats.crc_errors, stats.bad_frames, stats.timeouts, result.speeds + result.directions, 2 * result.polls );
+		check(( sim.corrupted_frames > 0 ) && ( stats.crc_errors + stats.bad_frames + stats.timeouts >= sim.corrupted_frames ), "BER 5e-3: every corrupted frame rejected" );
+		check( !result.wrong, "BER 5e-3: no wrong reading" );
+		check(( result.speeds + result.directions ) >= 95, "BER 5e-3: retries recover at least 95% of the readings" );
+	}
+
+	{
+		bus_t bus;
+
+		setup( bus, 1 );
+		bus.simulator.set_latency( 60 );
+		poll_result_t		result = poll( bus, 3 );
+		modbus_stats_t		stats = bus.master.get_stats();
+
+		check(( result.speeds == 3 ) && ( result.directions == 3 ) && !stats.timeouts, "60ms latency: within the answer timeout" );
+		check( stats.max_transaction_us >= 60000, "60ms latency: seen in the transaction time" );
+	}
+
+	{
+		bus_t bus;
+
+		setup( bus, 1 );
+		bus.simulator.set_latency( 400 );
+		poll_result_t		result = poll( bus, 1 );
+		modbus_stats_t		stats = bus.master.get_stats();
+
+		check( !result.speeds && !result.directions && ( stats.timeouts == 2 * 3 ), "400ms latency: answers come too late" );
+	}
+
+	{
+		bus_t				bus;
+		modbus_request_t	request = {};
+
+		setup( bus, 0 );
+		request.slave = 1;
+		request.function = MODBUS_READ_HOLDING_REGISTERS;
+		request.start = 0;
+		request.count = 4;
+		request.bps = Anemometer::ANEMOMETER_SPEED[ 0 ];
+		bool ok = bus.master.transact( &request );
+		modbus_stats_t stats = bus.master.get_stats();
+
+		check( !ok && ( stats.exceptions == 1 ) && !stats.retries, "illegal address: exception, not retried" );
+	}
+
+	printf( "%s\n", failures ? "FAILED" : "All checks passed" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+#
+#	ota_delta.py
+#
+#	(c) 2024 F.Lesage
+#
+#	This program is free software: you can redistribute it and/or modify it
+#	under the terms of the GNU General Public License as published by the
+#	Free Software Foundation, either version 3 of the License, or (at your option)
+#	any later version.
+#
+#	This program is distributed in the hope that it will be useful, but
+#	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+#	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+#	more details.
+#
+#	You should have received a copy of the GNU General Public License along
+#	with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+# Makes and verifies the firmware patches applied by AWSOTA::patch_image.
+#
+#	ota_delta.py make old.bin new.bin patch.bin [--gzip] [--base-id BUILD_ID --url URL]
+#	ota_delta.py verify old.bin new.bin patch.bin
+#
+# Patch format, all integers little endian:
+#
+#	header		char[8]		"AWSDELTA"
+#				uint32		size of the base image
+#				uint32		size of the new image
+#				uint8[32]	SHA256 esptool appended to the base image, which esp_partition_get_sha256()
+#							returns for an app partition
+#	records		uint32		diff length
+#				uint32		extra length
+#				int32		seek
+#				diff bytes, added modulo 256 to the base bytes read from the current base position
+#				extra bytes, copied as they are
+#				the base position moves by the diff length, then by seek
+#
+# Records follow each other until the new image is complete. As with bsdiff, a diff block only
+# holds the few bytes which moved addresses changed, so the patch compresses very well: it is
+# meant to be published with --gzip and "Encoding": "gzip" in the manifest.
+
+import argparse
+import gzip
+import json
+import struct
+import sys
+
+MAGIC = b'AWSDELTA'
+IMAGE_MAGIC = 0xE9
+HASH_APPENDED = 23		# Offset of the flag in the esptool image header
+SEED = 8				# Length of the exact match which starts a diff block
+STRIDE = 4				# Base positions indexed, any match of SEED + STRIDE - 1 bytes is found
+MAX_CANDIDATES = 8		# Base positions tried per seed
+MIN_MATCH = 24			# Shorter diff blocks cost more than they save
+GIVE_UP = 64			# Mismatch balance after which a diff block stops
+
+def index_base( base ):
+	index = {}
+	for pos in range( 0, len( base ) - SEED + 1, STRIDE ):
+		positions = index.setdefault( base[ pos:pos + SEED ], [] )
+		if len( positions ) < MAX_CANDIDATES:
+			positions.append( pos )
+	return index
+
+# Approximate match, bsdiff style: goes on as long as matching bytes outweigh the others
+def extend( new, base, i, j ):
+	score = best_score = best_len = n = 0
+	limit = min( len( new ) - i, len( base ) - j )
+	while n < limit:
+		score += 1 if new[ i + n ] == base[ j + n ] else -1
+		n += 1
+		if score > best_score:
+			best_score, best_len = score, n
+		elif score < best_score - GIVE_UP:
+			break
+	return best_len
+
+def find_match( new, base, index, i, offset ):
+	candidates = []
+	if 0 <= i + offset and base[ i + offset:i + offset + SEED ] == new[ i:i + SEED ]:
+		candidates.append( i + offset )
+	for shift in range( STRIDE ):
+		if i + shift + SEED > len( new ):
+			break
+		for pos in index.get( new[ i + shift:i + shift + SEED ], [] ):
+			if pos >= shift:
+				candidates.append( pos - shift )
+	best = None
+	for j in candidates:
+		length = extend( new, base, i, j )
+		if length >= MIN_MATCH and ( best is None or length > best[ 1 ] ):
+			best = ( j, length )
+	return best
+
+# Not a digest of the file: the last 32 bytes of an esptool image are the SHA256 of what comes before them
+def image_sha256( image ):
+	if len( image ) < HASH_APPENDED + 33 or image[ 0 ] != IMAGE_MAGIC or not image[ HASH_APPENDED ]:
+		raise ValueError( 'not an esptool image with an appended SHA256' )
+	return bytes( image[ -32: ] )
+
+def make_patch( base, new ):
+	index = index_base( base )
+	blocks = []				# ( new position, base position, length )
+	i = 0
+	offset = 0
+	last_end = 0
+	while i < len( new ):
+		match = find_match( new, base, index, i, offset )
+		if not match:
+			i += 1
+			continue
+		j, length = match
+		while i > last_end and j > 0 and new[ i - 1 ] == base[ j - 1 ]:
+			i, j, length = i - 1, j - 1, length + 1
+		blocks.append(( i, j, length ))
+		offset = j - i
+		i += length
+		last_end = i
+
+	if not blocks or blocks[ 0 ][ 0 ]:
+		blocks.insert( 0, ( 0, 0, 0 ))
+	blocks.append(( len( new ), None, 0 ))
+
+	patch = bytearray( MAGIC )
+	patch += struct.pack( '<II', len( base ), len( new ))
+	patch += image_sha256( base )
+	for ( start, pos, length ), ( next_start, next_pos, _ ) in zip( blocks, blocks[ 1: ] ):
+		extra = new[ start + length:next_start ]
+		seek = ( next_pos - ( pos + length )) if next_pos is not None else 0
+		patch += struct.pack( '<IIi', length, len( extra ), seek )
+		patch += bytes(( new[ start + k ] - base[ pos + k ] ) & 0xFF for k in range( length ))
+		patch += extra
+	return bytes( patch )
+
+# Same steps as the station
+def apply_patch( base, patch ):
+	if patch[ :8 ] != MAGIC:
+		raise ValueError( 'not a firmware patch' )
+	base_size, new_size = struct.unpack_from( '<II', patch, 8 )
+	if base_size != len( base ) or patch[ 16:48 ] != image_sha256( base ):
+		raise ValueError( 'patch does not apply to this base image' )
+	out = bytearray()
+	p = 48
+	base_pos = 0
+	while len( out ) < new_size:
+		diff_len, extra_len, seek = struct.unpack_from( '<IIi', patch, p )
+		p += 12
+		if base_pos < 0 or base_pos + diff_len > base_size:
+			raise ValueError( 'patch reads outside of the base image' )
+		out += bytes(( base[ base_pos + k ] + patch[ p + k ] ) & 0xFF for k in range( diff_len ))
+		p += diff_len
+		out += patch[ p:p + extra_len ]
+		p += extra_len
+		base_pos += diff_len + seek
+	return bytes( out )
+
+def read( filename ):
+	with open( filename, 'rb' ) as f:
+		return f.read()
+
+def main():
+	parser = argparse.ArgumentParser( description = 'AstroWeatherStation firmware patches' )
+	parser.add_argument( 'action', choices = [ 'make', 'verify' ] )
+	parser.add_argument( 'base', help = 'firmware currently running on the stations' )
+	parser.add_argument( 'new', help = 'firmware to update to' )
+	parser.add_argument( 'patch' )
+	parser.add_argument( '--gzip', action = 'store_true', help = 'compress the patch' )
+	parser.add_argument( '--base-id', help = 'unique build id of the base firmware, prints the manifest entry' )
+	parser.add_argument( '--url', help = 'where the patch will be published' )
+	args = parser.parse_args()
+
+	base = read( args.base )
+	new = read( args.new )
+
+	if args.action == 'make':
+		patch = make_patch( base, new )
+		if args.gzip:
+			patch = gzip.compress( patch, 9 )
+		with open( args.patch, 'wb' ) as f:
+			f.write( patch )
+	else:
+		patch = read( args.patch )
+
+	if patch[ :2 ] == b'\x1f\x8b':
+		compressed = len( patch )
+		patch = gzip.decompress( patch )
+	else:
+		compressed = None
+
+	if apply_patch( base, patch ) != new:
+		print( 'Patch does NOT rebuild the new firmware', file = sys.stderr )
+		return 1
+
+	print( 'Patch OK: new image %d bytes, patch %d bytes%s, %.1fx smaller' % ( len( new ), len( patch ),
+		( ', %d bytes compressed' % compressed ) if compressed else '', len( new ) / ( compressed or len( patch ))))
+
+	if args.action == 'make' and args.base_id:
+		entry = { 'Base': args.base_id, 'URL': args.url or args.patch }
+		if args.gzip:
+			entry[ 'Encoding' ] = 'gzip'
+		print( json.dumps( entry ))
+	return 0
+
+if __name__ == '__main__':
+	sys.exit( main() )
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+#	ota_delta_test.py
+#
+#	(c) 2024 F.Lesage
+#
+#	This program is free software: you can redistribute it and/or modify it
+#	under the terms of the GNU General Public License as published by the
+#	Free Software Foundation, either version 3 of the License, or (at your option)
+#	any later version.
+#
+#	This program is distributed in the hope that it will be useful, but
+#	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+#	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+#	more details.
+#
+#	You should have received a copy of the GNU General Public License along
+#	with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+# Host test of the firmware patches (tools/ota_delta.py).
+#
+#	python3 ota_delta_test.py [old.bin new.bin]
+#
+# Without arguments, two images are laid out the way esptool elf2image writes them: header, segments, checksum
+# padded to 16 bytes, then the SHA256 of all that appended. The new one has code inserted in the middle of the
+# text segment, every address pointing past it moved and a longer rodata segment, which is what a small source
+# change does to a build. Given two real builds (.pio/build/<env>/firmware.bin), they are used instead.
+#
+# The patch must carry the digest esp_partition_get_sha256() returns for the running partition, rebuild the new
+# image, and be refused by an image it was not made against. Exits with 1 if any check fails.
+
+import gzip
+import hashlib
+import random
+import struct
+import sys
+
+import ota_delta
+
+FLASH_TEXT = 0x400D0020
+CHECKSUM_SEED = 0xEF
+
+failures = 0
+
+def check( ok, what ):
+	global failures
+	print( '%-72s %s' % ( what, 'ok' if ok else 'FAILED' ))
+	if not ok:
+		failures += 1
+
+# Same layout as esptool's ESP32FirmwareImage.save()
+def esp_image( entry, segments ):
+	image = bytearray( struct.pack( '<BBBBI', ota_delta.IMAGE_MAGIC, len( segments ), 2, 0x20, entry ))
+	image += struct.pack( '<BBBBHBHH4sB', 0xEE, 0, 0, 0, 0, 0, 0, 0xFFFF, b'\0' * 4, 1 )
+	checksum = CHECKSUM_SEED
+	for address, data in segments:
+		image += struct.pack( '<II', address, len( data )) + data
+		for b in data:
+			checksum ^= b
+	image += b'\0' * ( 15 - len( image ) % 16 ) + bytes(( checksum, ))
+	return bytes( image + hashlib.sha256( image ).digest() )
+
+# Words are either plain data or addresses within the text segment, as literal pools are
+def code( rng, size, text_base ):
+	words = []
+	for _ in range( size // 4 ):
+		if rng.random() < 0.25:
+			words.append( text_base + rng.randrange( size ) & ~3 )
+		else:
+			words.append( rng.choice(( rng.getrandbits( 32 ), rng.getrandbits( 8 ), 0x0C0C0C0C & rng.getrandbits( 32 ))))
+	return words
+
+def pack( words ):
+	return struct.pack( '<%dI' % len( words ), *words )
+
+def synthetic_images():
+	rng = random.Random( 1 )
+	words = code( rng, 600 * 1024, FLASH_TEXT )
+	rodata = bytes( rng.getrandbits( 7 ) for _ in range( 40 * 1024 ))
+	base = esp_image( FLASH_TEXT + 0x100, [ ( 0x3F400020, rodata ), ( FLASH_TEXT, pack( words )) ] )
+
+	inserted = 200
+	at = len( words ) // 2
+	moved = [ w + inserted if FLASH_TEXT + at * 4 <= w < FLASH_TEXT + len( words ) * 4 else w for w in words ]
+	new_words = moved[ :at ] + [ rng.getrandbits( 32 ) for _ in range( inserted // 4 ) ] + moved[ at: ]
+	new_rodata = rodata[ :1000 ] + b'New message\0' + rodata[ 1000: ]
+	new = esp_image( FLASH_TEXT + 0x100, [ ( 0x3F400020, new_rodata ), ( FLASH_TEXT, pack( new_words )) ] )
+	return base, new
+
+def main():
+	if len( sys.argv ) == 3:
+		base, new = ota_delta.read( sys.argv[ 1 ] ), ota_delta.read( sys.argv[ 2 ] )
+	else:
+		base, new = synthetic_images()
+
+	check( hashlib.sha256( base[ :-32 ] ).digest() == base[ -32: ], 'base image ends with the SHA256 of its content' )
+
+	patch = ota_delta.make_patch( base, new )
+	check( patch[ 16:48 ] == base[ -32: ], 'patch header holds the digest esp_partition_get_sha256() returns' )
+	check( patch[ 16:48 ] != hashlib.sha256( base ).digest(), 'which is not the SHA256 of the whole file' )
+	check( ota_delta.apply_patch( base, patch ) == new, 'patch rebuilds the new image' )
+
+	try:
+		ota_delta.apply_patch( new, patch )
+		check( False, 'patch refused by another image' )
+	except ValueError:
+		check( True, 'patch refused by another image' )
+
+	try:
+		ota_delta.make_patch( base[ :ota_delta.HASH_APPENDED ] + b'\0' + base[ ota_delta.HASH_APPENDED + 1:-32 ], new )
+		check( False, 'image without appended SHA256 refused' )
+	except ValueError:
+		check( True, 'image without appended SHA256 refused' )
+
+	compressed = len( gzip.compress( patch, 9 ))
+	print( 'New image %d bytes, patch %d bytes, %d bytes compressed, %.1fx smaller' % ( len( new ), len( patch ), compressed, len( new ) / compressed ))
+
+	print( 'FAILED' if failures else 'All checks passed' )
+	return 1 if failures else 0
+
+if __name__ == '__main__':
+	sys.exit( main() )
@@ -0,0 +1,130 @@
+/*
+	rg9_parser_test.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+
+	Host test of the Hydreon RG-9 protocol parser (src/rg9_parser.cpp).
+
+		g++ -O2 -std=c++17 -I../src -o rg9_parser_test rg9_parser_test.cpp ../src/rg9_parser.cpp
+		./rg9_parser_test
+
+	Feeds the parser with what the sensor sends, byte after byte, the way the UART receive callback does.
+	Exits with 1 if any check fails.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "rg9_parser.h"
+
+int	failures = 0;
+
+void check( bool ok, const char *what )
+{
+	printf( "%-64s %s\n", what, ok ? "ok" : "FAILED" );
+	if ( !ok )
+		failures++;
+}
+
+// Answers completed while feeding the whole input
+std::vector<rg9_answer_t> feed( RG9Parser &parser, const std::string &input )
+{
+	std::vector<rg9_answer_t> answers;
+
+	for ( char c : input ) {
+
+		rg9_answer_t answer = parser.feed( static_cast<uint8_t>( c ));
+		if ( answer != rg9_answer_t::NONE )
+			answers.push_back( answer );
+	}
+	return answers;
+}
+
+int main( void )
+{
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, "R 3\r\n" );
+
+		check(( answers.size() == 1 ) && ( answers[ 0 ] == rg9_answer_t::RAIN ) && ( parser.get_intensity() == 3 ), "rain report" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, "R 5\rR 2\nR 7\n\r" );
+
+		check(( answers.size() == 3 ) && ( parser.get_intensity() == 7 ), "CR, LF and CRLF line ends" );
+	}
+	{
+		RG9Parser	parser;
+
+		feed( parser, "R 4\r\n" );
+		auto answers = feed( parser, "R 9\r\n" );
+		check(( answers.size() == 1 ) && ( answers[ 0 ] == rg9_answer_t::RAIN ) && !parser.get_intensity(), "out of range intensity reads as no rain" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, "R 1" );
+
+		check( answers.empty() && !parser.get_intensity(), "no answer before the end of the line" );
+		answers = feed( parser, "\n" );
+		check(( answers.size() == 1 ) && ( parser.get_intensity() == 1 ), "line split across receive callbacks" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, "Baud 9600\r\n" );
+
+		check(( answers.size() == 1 ) && ( answers[ 0 ] == rg9_answer_t::BAUD ) && !strcmp( parser.get_line(), "Baud 9600" ), "baud rate answer" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, "R 2\r\nReset W\r\n" );
+
+		check(( answers.size() == 2 ) && ( answers[ 1 ] == rg9_answer_t::RESET ) && ( parser.get_status() == 'W' ), "reset after a report" );
+		check( !strcmp( RG9Parser::reset_cause( parser.get_status() ), "Watchdog timer reset" ), "reset cause" );
+		check( !strcmp( RG9Parser::reset_cause( 'x' ), "Unknown" ), "unknown reset cause" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, "Reset\r\n" );
+
+		check(( answers.size() == 1 ) && ( answers[ 0 ] == rg9_answer_t::OTHER ) && ( parser.get_status() == RG9Parser::NO_STATUS ), "reset without a cause is not a reset" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, "PwrDays 12\r\nSW 1.2\r\n" );
+
+		check(( answers.size() == 2 ) && ( answers[ 0 ] == rg9_answer_t::OTHER ) && !strcmp( parser.get_line(), "SW 1.2" ), "other lines" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, std::string( 300, 'x' ) + "\r\nR 6\r\n" );
+
+		check(( answers.size() == 1 ) && ( answers[ 0 ] == rg9_answer_t::RAIN ) && ( parser.get_intensity() == 6 ), "overlong line dropped, next one parsed" );
+	}
+	{
+		RG9Parser	parser;
+		auto		answers = feed( parser, std::string( "\0\xff" "R 3\n", 6 ));
+
+		check(( answers.size() == 1 ) && ( answers[ 0 ] == rg9_answer_t::OTHER ) && !parser.get_intensity(), "noise before a report spoils that line only" );
+		answers = feed( parser, "R 3\n" );
+		check(( answers.size() == 1 ) && ( parser.get_intensity() == 3 ), "report after noise" );
+	}
+
+	printf( "%s\n", failures ? "FAILED" : "All checks passed" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,348 @@
+/*
+	series_bench.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+
+	Host benchmark of the sensor history compression (src/series_codec.cpp) and of the /history
+	output (src/history_formatter.cpp).
+
+		g++ -O2 -std=c++17 -I../src -o series_bench series_bench.cpp ../src/series_codec.cpp ../src/history_formatter.cpp
+		./series_bench [night.csv ...]
+
+	Each CSV file is a recorded night, as returned by /history?format=csv: a header line with "timestamp"
+	then the channel names, one sample per line, empty or "nan" for missing values. Without any file, a
+	synthetic clear then cloudy night is used. Segments are filled the way the station fills them, the
+	ratio is against the 4 bytes per channel and timestamp records of the uncompressed format.
+
+	The query table decodes the segments and formats every sample the way /history does, in chunks of one
+	TCP segment, and gives the throughput in samples and output bytes per second, flash reads excluded.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "history_formatter.h"
+#include "series_codec.h"
+
+constexpr size_t	SEGMENT_SIZE	= 4096;		// As in SensorHistory
+constexpr size_t	HEADER_SIZE		= 16;
+constexpr size_t	CHUNK_SIZE		= 1436;		// One TCP segment of the chunked response
+
+struct series_t {
+
+	std::string				name;
+	std::vector<std::string>	channel_names;
+	std::vector<uint8_t>		channel_bits;
+	std::vector<uint32_t>		timestamps;
+	std::vector<float>			values;			// Row after row
+};
+
+// Same widths as HISTORY_CHANNEL_BITS
+uint8_t channel_bits( const std::string &name )
+{
+	if ( name == "rain_event" )
+		return 2;
+	if ( name == "rain_intensity" )
+		return 4;
+	if ( name == "cloud_coverage" )
+		return 2;
+	return 0;
+}
+
+bool load_csv( const char *filename, series_t &series )
+{
+	std::ifstream		file( filename );
+	std::string			line;
+	std::string			cell;
+
+	if ( !file || !std::getline( file, line ))
+		return false;
+
+	series.name = filename;
+	std::stringstream header( line );
+	std::getline( header, cell, ',' );
+	while ( std::getline( header, cell, ',' )) {
+
+		series.channel_names.push_back( cell );
+		series.channel_bits.push_back( channel_bits( cell ));
+	}
+
+	while ( std::getline( file, line )) {
+
+		std::stringstream row( line );
+
+		if ( !std::getline( row, cell, ',' ) || cell.empty() )
+			continue;
+		series.timestamps.push_back( std::stoul( cell ));
+		for ( size_t i = 0; i < series.channel_names.size(); i++ )
+			series.values.push_back(( std::getline( row, cell, ',' ) && !cell.empty() && ( cell != "nan" )) ? std::stof( cell ) : NAN );
+	}
+	return !series.timestamps.empty();
+}
+
+// 12 hours at 15s: slow drifts with sensor noise, a few gusts, clouds and a short shower after 3am
+void make_night( series_t &series )
+{
+	std::mt19937					rng( 42 );
+	std::normal_distribution<float>	noise( 0, 1 );
+	const char						*names[] = { "temperature", "pressure", "sl_pressure", "rh", "dew_point", "wind_speed", "wind_gust", "wind_direction",
+												 "rain_event", "rain_intensity", "ambient_temperature", "raw_sky_temperature", "sky_temperature", "cloud_cover",
+												 "cloud_coverage", "lux", "irradiance", "msas", "nelm", "gain", "integration_time", "ir_luminosity",
+												 "vis_luminosity", "full_luminosity" };
+	uint32_t						t0 = 1718488800;
+
+	series.name = "synthetic night";
+	for ( const char *name : names ) {
+
+		series.channel_names.push_back( name );
+		series.channel_bits.push_back( channel_bits( name ));
+	}
+
+	for ( uint32_t n = 0; n < 12 * 240; n++ ) {
+
+		float	h = n / 240.0F;
+		bool	cloudy = h > 6;
+		bool	rain = ( h > 9 ) && ( h < 9.5F );
+		float	temperature = 14 - 0.6F * h + 0.02F * noise( rng );
+		float	rh = std::fmin( 100, 60 + 3 * h + 0.05F * noise( rng ));
+		float	pressure = 1013.2F - 0.1F * h + 0.01F * noise( rng );
+		float	sky = cloudy ? -8 + noise( rng ) : -22 + 0.2F * noise( rng );
+		float	wind = std::fmax( 0, 2 + noise( rng ));
+		float	msas = cloudy ? 18.5F + 0.05F * noise( rng ) : 21.2F + 0.02F * noise( rng );
+		uint16_t	lum = static_cast<uint16_t>( std::fmax( 0, 5 + noise( rng )));
+
+		series.timestamps.push_back( t0 + 15 * n + (( n % 17 ) ? 0 : 1 ));
+		series.values.insert( series.values.end(), {
+			roundf( temperature * 100 ) / 100, pressure, pressure + 29.4F, roundf( rh * 100 ) / 100,
+			temperature - ( 100 - rh ) / 5, roundf( wind * 10 ) / 10, roundf(( wind + std::fabs( noise( rng ))) * 10 ) / 10,
+			static_cast<float>( 45 * (( n / 60 ) % 8 )), rain ? 1.0F : 0.0F, rain ? 3.0F : 0.0F,
+			temperature + 0.02F * noise( rng ), sky - 1.5F, sky, cloudy ? 85.0F : 5.0F, cloudy ? 2.0F : 0.0F,
+			0, 0, msas, msas - 14.5F, 428, 600, static_cast<float>( lum ), static_cast<float>( lum * 2 ), static_cast<float>( lum * 3 ) });
+	}
+}
+
+// Encodes into station sized segments, returns the bytes used on flash
+size_t encode( const series_t &series, std::vector<uint8_t> &output, std::vector<size_t> &segment_starts )
+{
+	SeriesCodec	codec;
+	size_t		channels = series.channel_names.size();
+	size_t		max_record = series_max_record_size( channels );
+	size_t		segment_size = SEGMENT_SIZE;
+	size_t		flash = 0;
+
+	output.assign( series.timestamps.size() * max_record, 0 );
+	segment_starts.clear();
+
+	size_t pos = 0;
+	for ( size_t n = 0; n < series.timestamps.size(); n++ ) {
+
+		if ( segment_size + max_record > SEGMENT_SIZE ) {
+
+			codec.reset( series.channel_bits.data(), channels, series.timestamps[ n ] );
+			segment_starts.push_back( pos );
+			flash += HEADER_SIZE;
+			segment_size = HEADER_SIZE;
+		}
+		size_t k = codec.encode( series.timestamps[ n ], &series.values[ n * channels ], &output[ pos ], max_record );
+		pos += k;
+		segment_size += k;
+		flash += k;
+	}
+	output.resize( pos );
+	return flash;
+}
+
+// Decodes and checks every bit against the original, NaNs included
+bool decode( const series_t &series, const std::vector<uint8_t> &input, const std::vector<size_t> &segment_starts, bool check )
+{
+	SeriesCodec				codec;
+	size_t					channels = series.channel_names.size();
+	std::vector<float>		values( channels );
+	uint32_t				timestamp;
+	size_t					pos = 0;
+	size_t					segment = 0;
+
+	for ( size_t n = 0; n < series.timestamps.size(); n++ ) {
+
+		if (( segment < segment_starts.size() ) && ( pos == segment_starts[ segment ] )) {
+
+			codec.reset( series.channel_bits.data(), channels, series.timestamps[ n ] );
+			segment++;
+		}
+		size_t k = codec.decode( &input[ pos ], input.size() - pos, timestamp, values.data() );
+		if ( !k )
+			return false;
+		pos += k;
+
+		if ( !check )
+			continue;
+		if ( timestamp != series.timestamps[ n ] )
+			return false;
+		for ( size_t i = 0; i < channels; i++ ) {
+
+			float expected = series.values[ n * channels + i ];
+
+			if ( series.channel_bits[ i ] ) {
+
+				if ( std::isnan( expected ) ? !std::isnan( values[ i ] ) : ( values[ i ] != std::fmin( std::round( std::fmax( expected, 0 )), ( 1 << series.channel_bits[ i ] ) - 2 )))
+					return false;
+
+			} else if ( memcmp( &expected, &values[ i ], sizeof( float )))
+				return false;
+		}
+	}
+	return true;
+}
+
+template<typename F>
+double mb_per_s( size_t bytes, F f )
+{
+	using clock = std::chrono::steady_clock;
+	auto		start = clock::now();
+	double		elapsed;
+	size_t		runs = 0;
+
+	do {
+
+		f();
+		runs++;
+		elapsed = std::chrono::duration<double>( clock::now() - start ).count();
+
+	} while ( elapsed < 0.5 );
+	return runs * bytes / elapsed / 1e6;
+}
+
+// Same loop as the /history chunk filler, returns the size of the response
+size_t query( const series_t &series, const std::vector<uint8_t> &input, const std::vector<size_t> &segment_starts, history_format_t format, uint32_t resolution )
+{
+	static HistoryFormatter		formatter;
+	SeriesCodec					codec;
+	size_t						channels = series.channel_names.size();
+	std::vector<const char *>	names;
+	std::vector<uint8_t>		all( channels );
+	std::vector<float>			values( channels );
+	std::array<uint8_t,CHUNK_SIZE>	chunk;
+	uint32_t					timestamp;
+	size_t						pos = 0;
+	size_t						segment = 0;
+	size_t						total = 0;
+	size_t						n = 0;
+
+	for ( size_t i = 0; i < channels; i++ ) {
+
+		names.push_back( series.channel_names[ i ].c_str() );
+		all[ i ] = i;
+	}
+	formatter.begin( format, names.data(), all.data(), channels, resolution, 0 );
+
+	for ( size_t k = 0; k <= series.timestamps.size(); k++ ) {
+
+		size_t len;
+
+		while (( len = formatter.read( chunk.data() + n, chunk.size() - n ))) {
+
+			n += len;
+			if ( n == chunk.size() ) {
+
+				total += n;
+				n = 0;
+			}
+		}
+		if ( k == series.timestamps.size() ) {
+
+			formatter.finish();
+			while (( len = formatter.read( chunk.data(), chunk.size() )))
+				total += len;
+			break;
+		}
+
+		if (( segment < segment_starts.size() ) && ( pos == segment_starts[ segment ] )) {
+
+			codec.reset( series.channel_bits.data(), channels, series.timestamps[ k ] );
+			segment++;
+		}
+		pos += codec.decode( &input[ pos ], input.size() - pos, timestamp, values.data() );
+		formatter.add( timestamp, values.data() );
+	}
+	return total + n;
+}
+
+int main( int argc, char **argv )
+{
+	std::vector<series_t>	nights;
+	int						status = 0;
+
+	for ( int i = 1; i < argc; i++ ) {
+
+		series_t series;
+
+		if ( !load_csv( argv[ i ], series )) {
+
+			fprintf( stderr, "Cannot read [%s]\n", argv[ i ] );
+			return 1;
+		}
+		nights.push_back( series );
+	}
+	if ( nights.empty() ) {
+
+		nights.emplace_back();
+		make_night( nights.back() );
+	}
+
+	printf( "%-24s %8s %4s %10s %10s %7s %6s %11s %11s\n", "series", "samples", "ch", "raw", "flash", "ratio", "B/rec", "enc MB/s", "dec MB/s" );
+	for ( const auto &series : nights ) {
+
+		std::vector<uint8_t>	encoded;
+		std::vector<size_t>		segment_starts;
+		size_t					raw = series.timestamps.size() * ( 4 + 4 * series.channel_names.size() );
+		size_t					flash = encode( series, encoded, segment_starts );
+		bool					ok = decode( series, encoded, segment_starts, true );
+		double					enc = mb_per_s( raw, [&]() { encode( series, encoded, segment_starts ); } );
+		double					dec = mb_per_s( raw, [&]() { decode( series, encoded, segment_starts, false ); } );
+
+		printf( "%-24.24s %8zu %4zu %10zu %10zu %6.1fx %6.1f %11.1f %11.1f %s\n", series.name.c_str(), series.timestamps.size(), series.channel_names.size(),
+			raw, flash, static_cast<double>( raw ) / flash, static_cast<double>( encoded.size() ) / series.timestamps.size(), enc, dec, ok ? "" : "ROUND TRIP FAILED" );
+		if ( !ok )
+			status = 1;
+	}
+
+	printf( "\n%-24s %8s %10s %10s %12s %11s\n", "query", "format", "resolution", "response", "samples/s", "MB/s" );
+	for ( const auto &series : nights ) {
+
+		std::vector<uint8_t>	encoded;
+		std::vector<size_t>		segment_starts;
+		const char				*format_names[] = { "csv", "ndjson", "bin" };
+
+		encode( series, encoded, segment_starts );
+		for ( uint32_t resolution : { 0, 300 } )
+			for ( uint8_t format = 0; format < 3; format++ ) {
+
+				size_t	response = query( series, encoded, segment_starts, static_cast<history_format_t>( format ), resolution );
+				double	mb = mb_per_s( response, [&]() { query( series, encoded, segment_starts, static_cast<history_format_t>( format ), resolution ); } );
+
+				printf( "%-24.24s %8s %10u %10zu %12.0f %11.1f\n", series.name.c_str(), format_names[ format ], resolution, response,
+					mb * 1e6 / response * series.timestamps.size(), mb );
+			}
+	}
+	return status;
+}
@@ -0,0 +1,126 @@
+/*
+	sqm_bench.cpp
+
+	(c) 2024 F.Lesage
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <https://www.gnu.org/licenses/>.
+
+	Host benchmark of the SQM auto-ranging (src/SQM.cpp) against a simulated TSL2591.
+
+		g++ -O2 -std=c++17 -Ihost -I../src -o sqm_bench sqm_bench.cpp ../src/SQM.cpp
+		./sqm_bench [ir_fraction]
+
+	The simulated sensor counts photons with Poisson noise at the gain and integration time it is set to, and
+	saturates like the real one. The sky brightness is turned into count rates with the same lux formula as
+	the driver, ir_fraction (0.3 by default) of the full channel being infrared. The temperature is kept below
+	0°C so that the channel compensation is neutral.
+
+	For each sky brightness, the driver starts from its power-on range, then takes READINGS readings in a row,
+	as the station does. The table gives the range it settled on, the integrations and sensor time per reading
+	once settled, and the bias and spread of the readings. Exits with 1 when a reading is off by more than
+	0.15 mag on average, from mag 6 to 21.
+
+	At mag 20, 21 and 22, a settled reading takes 5.9, 13.1 and 29.2 integrations (3.5s, 7.9s and 17.6s). The
+	fixed stepping the auto-ranging replaced takes 12.4, 21.2 and 39.2 on the same simulated sensor (6.5s,
+	11.9s and 22.7s), and reads 2 to 3.8 mag too bright there as its sums overflow.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "SQM.h"
+
+constexpr uint8_t	READINGS		= 20;
+constexpr float		AMBIENT_TEMP	= -5.F;
+
+const std::array<uint16_t,4>	GAIN_FACTOR			= { 1, 25, 428, 9876 };
+
+std::mt19937	rng( 1 );
+float			full_rate;			// Counts per ms at gain 1
+float			ir_rate;
+uint32_t		integrations;
+uint32_t		sensor_ms;
+
+uint32_t Adafruit_TSL2591::getFullLuminosity( void )
+{
+	uint32_t	ms = 100 * ( timing + 1 );
+	uint16_t	max = ( timing == TSL2591_INTEGRATIONTIME_100MS ) ? 36863 : 65535;
+	double		scale = static_cast<double>( GAIN_FACTOR[ gain >> 4 ] ) * ms;
+	uint32_t	full = std::poisson_distribution<uint32_t>( full_rate * scale )( rng );
+	uint32_t	ir = std::poisson_distribution<uint32_t>( ir_rate * scale )( rng );
+
+	integrations++;
+	sensor_ms += ms;
+	return ( std::min<uint32_t>( ir, max ) << 16 ) | std::min<uint32_t>( full, max );
+}
+
+// Inverse of SQM::compute_msas_nelm() without calibration offset
+void set_sky( float msas, float ir_fraction )
+{
+	float lux = 108000.F * powf( 10.F, -0.4F * msas );
+	float visible_ratio = 1.F - ir_fraction;
+
+	full_rate = lux / 408.F / ( visible_ratio * visible_ratio );
+	ir_rate = full_rate * ir_fraction;
+}
+
+int main( int argc, char **argv )
+{
+	float	ir_fraction = ( argc > 1 ) ? strtof( argv[ 1 ], nullptr ) : 0.3F;
+	int		status = 0;
+
+	Serial.quiet = true;
+
+	printf( "%6s %8s %7s %9s %8s %9s %8s %8s %8s\n", "mag", "gain", "time", "ranging", "integr.", "ms/read", "bias", "sigma", "nelm" );
+	for ( float msas = 4.F; msas <= 22.01F; msas += 1.F ) {
+
+		Adafruit_TSL2591	tsl;
+		SQM					sqm;
+		sqm_data_t			data = {};
+		uint32_t			first_integrations;
+		uint32_t			settled_integrations = 0;
+		uint32_t			settled_ms = 0;
+		double				sum = 0;
+		double				sum2 = 0;
+
+		set_sky( msas, ir_fraction );
+		sqm.initialise( &tsl, &data, 0.F, false );
+
+		integrations = sensor_ms = 0;
+		sqm.read( AMBIENT_TEMP );
+		first_integrations = integrations;
+
+		for ( uint8_t i = 0; i < READINGS; i++ ) {
+
+			integrations = sensor_ms = 0;
+			sqm.read( AMBIENT_TEMP );
+			settled_integrations += integrations;
+			settled_ms += sensor_ms;
+			sum += data.msas - msas;
+			sum2 += ( data.msas - msas ) * ( data.msas - msas );
+		}
+
+		double bias = sum / READINGS;
+		double sigma = sqrt( std::max( 0.0, sum2 / READINGS - bias * bias ));
+
+		printf( "%6.1f %7ux %5ums %9u %8.1f %9.0f %+8.3f %8.3f %8.2f\n", msas, data.gain, data.integration_time, first_integrations,
+			static_cast<double>( settled_integrations ) / READINGS, static_cast<double>( settled_ms ) / READINGS, bias, sigma, data.nelm );
+
+		if (( msas >= 6.F ) && ( msas <= 21.F ) && ( fabs( bias ) > 0.15 ))
+			status = 1;
+	}
+	return status;
+}